@@ -0,0 +1,81 @@
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+#include "chat_template/chat_template.h"
+#include "chat_template/jinja_chat_template.h"
+
+using namespace llm;
+
+namespace {
+
+// clang-format off
+const std::string kChatMLTemplate =
+    "{% for message in messages %}"
+      "{{'<|im_start|>' + message['role'] + '\n' + message['content'] + '<|im_end|>' + '\n'}}"
+    "{% endfor %}"
+    "{% if add_generation_prompt %}{{ '<|im_start|>assistant\n' }}{% endif %}";
+
+const std::string kGemmaTemplate =
+    "{{ bos_token }}"
+    "{% if messages[0]['role'] == 'system' %}{{ raise_exception('System role not supported') }}{% endif %}"
+    "{% for message in messages %}"
+      "{% if (message['role'] == 'user') != (loop.index0 % 2 == 0) %}"
+        "{{ raise_exception('Conversation roles must alternate user/assistant/user/assistant/...') }}"
+      "{% endif %}"
+      "{% if (message['role'] == 'assistant') %}{% set role = 'model' %}{% else %}{% set role = message['role'] %}{% endif %}"
+      "{{ '<start_of_turn>' + role + '\n' + message['content'] | trim + '<end_of_turn>\n' }}"
+    "{% endfor %}"
+    "{% if add_generation_prompt %}{{'<start_of_turn>model\n'}}{% endif %}";
+// clang-format on
+
+// a chat of alternating user and assistant messages
+ChatMessages create_chat(size_t num_messages) {
+  ChatMessages messages;
+  for (size_t i = 0; i < num_messages; ++i) {
+    auto* message = messages.Add();
+    message->set_role(i % 2 == 0 ? "user" : "assistant");
+    message->set_content("It was the best of times, it was the worst of times, "
+                         "it was the age of wisdom. " +
+                         std::to_string(i));
+  }
+  return messages;
+}
+
+void render(benchmark::State& state,
+            const std::string& template_str,
+            bool enable_compile) {
+  const JinjaChatTemplate chat_template(
+      template_str, /*add_generation_prompt=*/true, enable_compile);
+  const auto messages = create_chat(state.range(0));
+  for (auto _ : state) {
+    auto prompt = chat_template.apply(messages);
+    benchmark::DoNotOptimize(prompt);
+  }
+  state.SetItemsProcessed(state.iterations() * messages.size());
+}
+
+}  // namespace
+
+// render multi-turn chats with the jinja interpreter
+static void BM_chat_template_chatml_interpret(benchmark::State& state) {
+  render(state, kChatMLTemplate, /*enable_compile=*/false);
+}
+
+// render multi-turn chats with the compiled template
+static void BM_chat_template_chatml_compiled(benchmark::State& state) {
+  render(state, kChatMLTemplate, /*enable_compile=*/true);
+}
+
+static void BM_chat_template_gemma_interpret(benchmark::State& state) {
+  render(state, kGemmaTemplate, /*enable_compile=*/false);
+}
+
+static void BM_chat_template_gemma_compiled(benchmark::State& state) {
+  render(state, kGemmaTemplate, /*enable_compile=*/true);
+}
+
+BENCHMARK(BM_chat_template_chatml_interpret)->Arg(2)->Arg(16);
+BENCHMARK(BM_chat_template_chatml_compiled)->Arg(2)->Arg(16);
+BENCHMARK(BM_chat_template_gemma_interpret)->Arg(2)->Arg(16);
+BENCHMARK(BM_chat_template_gemma_compiled)->Arg(2)->Arg(16);
@@ -0,0 +1,135 @@
+#include <benchmark/benchmark.h>
+#include <torch/torch.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "engine/model_runner.h"
+#include "memory/kv_cache.h"
+#include "model_loader/state_dict.h"
+#include "models/causal_lm.h"
+#include "quantization/quant_args.h"
+
+using namespace llm;
+
+namespace {
+
+// a small llama model
+constexpr int64_t kVocabSize = 1024;
+constexpr int64_t kHiddenSize = 512;
+constexpr int64_t kIntermediateSize = 1376;
+constexpr int64_t kNumLayers = 4;
+constexpr int64_t kNumHeads = 8;
+constexpr int64_t kBlockSize = 16;
+// number of tokens of each sequence in the kv cache
+constexpr int64_t kSeqLen = 128;
+// max bytes cached by the cpu memory pool
+constexpr int64_t kMaxCachedBytes = int64_t(1) << 30;
+
+ModelArgs small_llama_args() {
+  ModelArgs args;
+  args.model_type("llama")
+      .vocab_size(kVocabSize)
+      .hidden_size(kHiddenSize)
+      .intermediate_size(kIntermediateSize)
+      .n_layers(kNumLayers)
+      .n_heads(kNumHeads)
+      .n_kv_heads(kNumHeads)
+      .head_dim(kHiddenSize / kNumHeads)
+      .hidden_act("silu")
+      .rms_norm_eps(1e-5)
+      .rope_theta(10000.0f)
+      .max_position_embeddings(2048);
+  return args;
+}
+
+// random weights of the small llama model
+StateDict small_llama_weights() {
+  std::unordered_map<std::string, torch::Tensor> dict;
+  auto add = [&dict](const std::string& name, int64_t rows, int64_t cols) {
+    dict.emplace(name, torch::randn({rows, cols}) * 0.02);
+  };
+  add("model.embed_tokens.weight", kVocabSize, kHiddenSize);
+  for (int64_t i = 0; i < kNumLayers; ++i) {
+    const std::string prefix = "model.layers." + std::to_string(i) + ".";
+    for (const char* proj : {"q_proj", "k_proj", "v_proj", "o_proj"}) {
+      add(prefix + "self_attn." + proj + ".weight", kHiddenSize, kHiddenSize);
+    }
+    add(prefix + "mlp.gate_proj.weight", kIntermediateSize, kHiddenSize);
+    add(prefix + "mlp.up_proj.weight", kIntermediateSize, kHiddenSize);
+    add(prefix + "mlp.down_proj.weight", kHiddenSize, kIntermediateSize);
+    dict.emplace(prefix + "input_layernorm.weight", torch::ones({kHiddenSize}));
+    dict.emplace(prefix + "post_attention_layernorm.weight",
+                 torch::ones({kHiddenSize}));
+  }
+  dict.emplace("model.norm.weight", torch::ones({kHiddenSize}));
+  add("lm_head.weight", kVocabSize, kHiddenSize);
+  return StateDict(dict, 0, 1);
+}
+
+}  // namespace
+
+// each iteration runs a decoding step of a small llama model on cpu, with
+// kSeqLen tokens of each sequence in the kv cache.
+// pool 0: intermediate tensors from the system allocator
+// pool 1: intermediate tensors from the cpu memory pool
+static void BM_cpu_decode(benchmark::State& state) {
+  const bool pool = state.range(0) != 0;
+  const int64_t batch_size = state.range(1);
+
+  torch::manual_seed(0);
+  const auto options = torch::dtype(torch::kFloat).device(torch::kCPU);
+  auto model = CausalLM::create(
+      small_llama_args(), QuantArgs(), ParallelArgs(0, 1, nullptr), options);
+  model->load_state_dict(small_llama_weights());
+
+  // one block table per sequence
+  const int64_t blocks_per_seq = (kSeqLen + 1 + kBlockSize - 1) / kBlockSize;
+  const int64_t num_blocks = batch_size * blocks_per_seq + 1;
+  const int64_t head_dim = kHiddenSize / kNumHeads;
+  std::vector<KVCache> kv_caches;
+  for (int64_t i = 0; i < kNumLayers; ++i) {
+    kv_caches.emplace_back(
+        torch::zeros({num_blocks, kBlockSize, kNumHeads, head_dim}, options),
+        torch::zeros({num_blocks, kBlockSize, kNumHeads, head_dim}, options));
+  }
+
+  ModelRunner::Options runner_options;
+  runner_options.block_size(kBlockSize)
+      .cpu_memory_pool_bytes(pool ? kMaxCachedBytes : 0);
+  ModelRunner runner(model.get(), torch::kCPU, runner_options);
+
+  // a decoding step with one token per sequence
+  const auto int_options = torch::dtype(torch::kInt);
+  InputParameters params;
+  params.empty_kv_cache = false;
+  params.num_sequences = static_cast<int32_t>(batch_size);
+  params.q_max_seq_len = 1;
+  params.kv_max_seq_len = kSeqLen + 1;
+  params.q_cu_seq_lens = torch::arange(0, batch_size + 1, int_options);
+  params.kv_cu_seq_lens = params.q_cu_seq_lens * (kSeqLen + 1);
+  // skip block 0, blocks of sequences are consecutive
+  params.block_tables =
+      (torch::arange(batch_size * blocks_per_seq, int_options) + 1)
+          .view({batch_size, blocks_per_seq});
+  // slots of new tokens at position kSeqLen
+  const auto new_blocks =
+      params.block_tables.select(/*dim=*/1, kSeqLen / kBlockSize);
+  params.new_cache_slots = new_blocks * kBlockSize + kSeqLen % kBlockSize;
+  const auto tokens = torch::randint(kVocabSize, {batch_size}, int_options);
+  const auto positions = torch::full({batch_size}, kSeqLen, int_options);
+
+  for (auto _ : state) {
+    auto hidden_states = runner.forward(tokens, positions, kv_caches, params);
+    benchmark::DoNotOptimize(hidden_states);
+  }
+  state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+BENCHMARK(BM_cpu_decode)
+    ->ArgNames({"pool", "batch_size"})
+    ->ArgsProduct({{0, 1}, {1, 8}})
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,83 @@
+#include <benchmark/benchmark.h>
+#include <torch/torch.h>
+
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#include "common/cpu_affinity.h"
+#include "common/threadpool.h"
+
+using namespace llm;
+
+namespace {
+
+constexpr int64_t kHiddenSize = 2048;
+constexpr int64_t kIntermediateSize = 5632;
+constexpr int64_t kNumLayers = 4;
+
+// run func in the thread of the threadpool and wait for it
+template <typename Func>
+void run_in_thread(ThreadPool& threadpool, Func&& func) {
+  std::promise<void> promise;
+  threadpool.schedule([&]() {
+    func();
+    promise.set_value();
+  });
+  promise.get_future().wait();
+}
+
+}  // namespace
+
+// each iteration runs a decoding step of mlp layers on a cpu worker thread,
+// which is bandwidth bound by reading the weights.
+// pinned 0: default threads without pinning
+// pinned 1: worker pinned to the cpus of numa node 0, with intra-op threads
+// of the node and memory bound to the node
+static void BM_cpu_worker_layout(benchmark::State& state) {
+  const bool pinned = state.range(0) != 0;
+  const int64_t batch_size = state.range(1);
+
+  ThreadPool worker;
+  if (pinned) {
+    const auto cpus = numa_node_cpus(/*node=*/0);
+    if (cpus.empty()) {
+      state.SkipWithError("numa node 0 is not available");
+      return;
+    }
+    run_in_thread(worker, [&]() {
+      set_thread_affinity(cpus);
+      bind_memory_to_numa_node(/*node=*/0);
+      torch::set_num_threads(static_cast<int>(cpus.size()));
+    });
+  }
+
+  // weights are allocated and first touched in the worker thread
+  std::vector<torch::Tensor> weights;
+  run_in_thread(worker, [&]() {
+    for (int64_t i = 0; i < kNumLayers; ++i) {
+      weights.push_back(torch::randn({kIntermediateSize, kHiddenSize}));
+      weights.push_back(torch::randn({kHiddenSize, kIntermediateSize}));
+    }
+  });
+  const auto input = torch::randn({batch_size, kHiddenSize});
+
+  for (auto _ : state) {
+    torch::Tensor output;
+    run_in_thread(worker, [&]() {
+      auto h = input;
+      for (int64_t i = 0; i < kNumLayers; ++i) {
+        h = torch::silu(torch::matmul(h, weights[2 * i].t()));
+        h = torch::matmul(h, weights[2 * i + 1].t());
+      }
+      output = h;
+    });
+    benchmark::DoNotOptimize(output);
+  }
+  state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+BENCHMARK(BM_cpu_worker_layout)
+    ->ArgNames({"pinned", "batch_size"})
+    ->ArgsProduct({{0, 1}, {1, 16}})
+    ->UseRealTime();
@@ -0,0 +1,110 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "grammar/dfa.h"
+#include "grammar/json_schema.h"
+#include "grammar/token_grammar.h"
+
+using namespace llm;
+
+namespace {
+
+const std::string kJsonSchema = R"({
+  "type": "object",
+  "properties": {
+    "name": {"type": "string", "maxLength": 32},
+    "age": {"type": "integer"},
+    "score": {"type": "number"},
+    "tags": {"type": "array", "items": {"type": "string"}, "maxItems": 4},
+    "active": {"type": "boolean"}
+  },
+  "required": ["name", "age"]
+})";
+
+// random tokens of 1 to 8 bytes drawn from json-like characters
+std::shared_ptr<const TokenVocab> create_vocab(size_t vocab_size) {
+  static const std::string kChars =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+      " \"{}[],:.-_\n";
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<size_t> len_dist(1, 8);
+  std::uniform_int_distribution<size_t> char_dist(0, kChars.size() - 1);
+  std::vector<std::string> tokens(vocab_size);
+  for (auto& token : tokens) {
+    const size_t len = len_dist(gen);
+    for (size_t i = 0; i < len; ++i) {
+      token.push_back(kChars[char_dist(gen)]);
+    }
+  }
+  return std::make_shared<TokenVocab>(std::move(tokens));
+}
+
+std::unique_ptr<TokenGrammar> create_grammar(size_t vocab_size) {
+  std::string regex;
+  std::string error;
+  json_schema_to_regex(kJsonSchema, &regex, &error);
+  return std::make_unique<TokenGrammar>(Dfa::compile(regex, &error),
+                                        create_vocab(vocab_size));
+}
+
+}  // namespace
+
+// cost of computing the mask of one state on cache miss
+static void BM_grammar_compute_mask(benchmark::State& state) {
+  const auto grammar = create_grammar(state.range(0));
+  const auto num_states = static_cast<int32_t>(grammar->num_states());
+  int32_t grammar_state = 0;
+  for (auto _ : state) {
+    auto bitmask = grammar->compute_allowed_tokens(grammar_state);
+    benchmark::DoNotOptimize(bitmask);
+    grammar_state = (grammar_state + 1) % num_states;
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetLabel(std::to_string(num_states) + " states");
+}
+
+// cost of computing the mask by walking every token from the state
+static void BM_grammar_compute_mask_naive(benchmark::State& state) {
+  const auto grammar = create_grammar(state.range(0));
+  const auto num_states = static_cast<int32_t>(grammar->num_states());
+  const size_t vocab_size = grammar->vocab_size();
+  int32_t grammar_state = 0;
+  for (auto _ : state) {
+    std::vector<uint32_t> bitmask(grammar->num_bitmask_words(), 0);
+    for (size_t i = 0; i < vocab_size; ++i) {
+      const auto token_id = static_cast<int32_t>(i);
+      if (grammar->next_state(grammar_state, token_id) != Dfa::kDeadState) {
+        bitmask[i / 32] |= (1u << (i % 32));
+      }
+    }
+    benchmark::DoNotOptimize(bitmask);
+    grammar_state = (grammar_state + 1) % num_states;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// cost of filling the mask of one token from the cache
+static void BM_grammar_cached_mask(benchmark::State& state) {
+  const auto grammar = create_grammar(state.range(0));
+  grammar->precompute();
+  const auto num_states = static_cast<int32_t>(grammar->num_states());
+  std::vector<uint32_t> bitmask(grammar->num_bitmask_words());
+  int32_t grammar_state = 0;
+  for (auto _ : state) {
+    const auto& cached = grammar->allowed_tokens(grammar_state);
+    std::copy(cached.begin(), cached.end(), bitmask.begin());
+    benchmark::DoNotOptimize(bitmask.data());
+    grammar_state = (grammar_state + 1) % num_states;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_grammar_compute_mask)->Arg(32000)->Arg(128000);
+BENCHMARK(BM_grammar_compute_mask_naive)->Arg(32000)->Arg(128000);
+BENCHMARK(BM_grammar_cached_mask)->Arg(32000)->Arg(128000);
@@ -0,0 +1,147 @@
+#include <benchmark/benchmark.h>
+#include <torch/cuda.h>
+#include <torch/torch.h>
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "engine/batch.h"
+#include "engine/model_input_builder.h"
+#include "memory/block_allocator.h"
+#include "request/sequence.h"
+
+using namespace llm;
+
+namespace {
+
+constexpr uint32_t kNumSequences = 256;
+constexpr uint32_t kNumPromptTokens = 512;
+constexpr uint32_t kNumGeneratedTokens = 64;
+constexpr uint32_t kBlockSize = 16;
+constexpr int32_t kVocabSize = 32000;
+constexpr uint32_t kCapacity = kNumPromptTokens + kNumGeneratedTokens * 2;
+constexpr uint32_t kNumBlocks = (kCapacity + kBlockSize - 1) / kBlockSize;
+
+// sequences in decode phase, with the last generated token to process
+std::vector<std::unique_ptr<Sequence>> create_sequences(
+    BlockAllocator& allocator,
+    uint32_t num_sequences,
+    bool with_penalties) {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int32_t> token_dist(0, kVocabSize - 1);
+
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = kCapacity;
+  if (with_penalties) {
+    options.sampling_param.frequency_penalty = 0.1;
+    options.sampling_param.repetition_penalty = 1.1;
+  }
+
+  std::vector<std::unique_ptr<Sequence>> sequences;
+  for (uint32_t i = 0; i < num_sequences; ++i) {
+    std::vector<int32_t> token_ids;
+    for (uint32_t j = 0; j < kNumPromptTokens; ++j) {
+      token_ids.push_back(token_dist(gen));
+    }
+    auto seq = std::make_unique<Sequence>(
+        /*prompt=*/"", token_ids, kCapacity, options);
+    seq->append_blocks(allocator.allocate(kNumBlocks));
+    seq->commit_kv_cache(kNumPromptTokens);
+    for (uint32_t j = 0; j < kNumGeneratedTokens; ++j) {
+      seq->append_token(token_dist(gen));
+      seq->commit_kv_cache(/*size=*/1);
+    }
+    seq->append_token(token_dist(gen));
+    sequences.push_back(std::move(seq));
+  }
+  return sequences;
+}
+
+// each iteration prepares the inputs of one decoding step for all sequences
+void run_prepare(benchmark::State& state, ModelInputBuilder* builder) {
+  const bool with_penalties = state.range(0) != 0;
+  BlockAllocator allocator(kNumSequences * kNumBlocks, kBlockSize);
+  auto sequences = create_sequences(allocator, kNumSequences, with_penalties);
+  std::vector<Sequence*> seqs;
+  for (auto& seq : sequences) {
+    seqs.push_back(seq.get());
+  }
+
+  Batch batch;
+  for (auto _ : state) {
+    batch.reset(seqs);
+    auto model_input = batch.prepare_model_input(
+        /*num_decoding_tokens=*/1, /*min_decoding_bach_size=*/0,
+        /*threadpool=*/nullptr, builder);
+    benchmark::DoNotOptimize(model_input);
+    // undo the step to prepare the same inputs again
+    for (auto* seq : seqs) {
+      seq->rollback_kv_cache(/*size=*/1);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kNumSequences);
+}
+
+// each iteration moves the inputs of one decoding step to the device
+void run_to_device(benchmark::State& state, bool packed) {
+  if (!torch::cuda::is_available()) {
+    state.SkipWithError("CUDA is not available");
+    return;
+  }
+  const uint32_t num_sequences = state.range(0);
+  BlockAllocator allocator(num_sequences * kNumBlocks, kBlockSize);
+  auto sequences = create_sequences(
+      allocator, num_sequences, /*with_penalties=*/true);
+  std::vector<Sequence*> seqs;
+  for (auto& seq : sequences) {
+    seqs.push_back(seq.get());
+  }
+
+  ModelInputBuilder builder(/*pin_memory=*/true);
+  Batch batch(seqs);
+  auto model_input = batch.prepare_model_input(
+      /*num_decoding_tokens=*/1, /*min_decoding_bach_size=*/0,
+      /*threadpool=*/nullptr, &builder);
+  if (!packed) {
+    model_input.packed = {};
+  }
+
+  const torch::Device device(torch::kCUDA);
+  for (auto _ : state) {
+    auto device_input = model_input.to(device, torch::kHalf);
+    torch::cuda::synchronize();
+    benchmark::DoNotOptimize(device_input);
+  }
+  state.SetItemsProcessed(state.iterations() * num_sequences);
+}
+
+}  // namespace
+
+// build inputs with temporary buffers for each step
+static void BM_prepare_model_input(benchmark::State& state) {
+  run_prepare(state, /*builder=*/nullptr);
+}
+
+// build inputs with buffers reused across steps
+static void BM_prepare_model_input_reuse(benchmark::State& state) {
+  ModelInputBuilder builder;
+  run_prepare(state, &builder);
+}
+
+BENCHMARK(BM_prepare_model_input)->ArgName("penalties")->Arg(0)->Arg(1);
+BENCHMARK(BM_prepare_model_input_reuse)->ArgName("penalties")->Arg(0)->Arg(1);
+
+// move inputs to the device tensor by tensor
+static void BM_model_input_to_device(benchmark::State& state) {
+  run_to_device(state, /*packed=*/false);
+}
+
+// move inputs to the device with a single transfer
+static void BM_model_input_to_device_packed(benchmark::State& state) {
+  run_to_device(state, /*packed=*/true);
+}
+
+BENCHMARK(BM_model_input_to_device)->Arg(1)->Arg(8)->Arg(32);
+BENCHMARK(BM_model_input_to_device_packed)->Arg(1)->Arg(8)->Arg(32);
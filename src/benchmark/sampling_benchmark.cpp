@@ -0,0 +1,88 @@
+#include <benchmark/benchmark.h>
+#include <torch/cuda.h>
+#include <torch/torch.h>
+
+#include <cstdint>
+
+#include "sampling/logits_processor.h"
+#include "sampling/parameters.h"
+#include "sampling/sampler.h"
+#include "sampling/sampling_pipeline.h"
+
+using namespace llm;
+
+namespace {
+
+constexpr int64_t kVocabSize = 32000;
+
+// sampling parameters of a decoding step with random sampling, temperature
+// and top_p enabled, but no penalties
+SamplingParameters create_params(int64_t num_seqs,
+                                 const torch::Device& device) {
+  const auto options = torch::dtype(torch::kFloat32).device(device);
+  SamplingParameters params;
+  params.selected_token_idxes =
+      torch::arange(num_seqs, torch::dtype(torch::kInt).device(device));
+  params.sample_idxes = params.selected_token_idxes;
+  params.temperatures = torch::full({num_seqs}, 0.7, options);
+  params.top_p = torch::full({num_seqs}, 0.9, options);
+  params.do_sample =
+      torch::ones({num_seqs}, torch::dtype(torch::kBool).device(device));
+  params.all_random_sample = true;
+  return params;
+}
+
+torch::Device benchmark_device() {
+  return torch::cuda::is_available() ? torch::Device(torch::kCUDA)
+                                     : torch::Device(torch::kCPU);
+}
+
+void synchronize(const torch::Device& device) {
+  if (device.is_cuda()) {
+    torch::cuda::synchronize();
+  }
+}
+
+}  // namespace
+
+// build processors and the sampler for each step, checking do_sample on device
+static void BM_sampling_per_step(benchmark::State& state) {
+  const auto device = benchmark_device();
+  const int64_t num_seqs = state.range(0);
+  const auto params = create_params(num_seqs, device);
+  const auto logits = torch::randn({num_seqs, kVocabSize}, device);
+
+  for (auto _ : state) {
+    auto processor = LogitsProcessor::create(params);
+    auto output = processor->forward(logits.clone(),
+                                     params.unique_token_ids,
+                                     params.unique_token_counts,
+                                     params.unique_token_ids_lens);
+    output = output.index_select(/*dim=*/0, params.sample_idxes);
+    const Sampler sampler(params.do_sample);
+    auto sample_output = sampler.forward(output);
+    synchronize(device);
+    benchmark::DoNotOptimize(sample_output);
+  }
+  state.SetItemsProcessed(state.iterations() * num_seqs);
+}
+
+// reuse the pipeline across steps with flags computed on host
+static void BM_sampling_pipeline(benchmark::State& state) {
+  const auto device = benchmark_device();
+  const int64_t num_seqs = state.range(0);
+  const auto params = create_params(num_seqs, device);
+  const auto logits = torch::randn({num_seqs, kVocabSize}, device);
+
+  SamplingPipeline pipeline;
+  for (auto _ : state) {
+    const auto output = pipeline.process(logits.clone(), params);
+    auto sample_output = pipeline.sample(output, params);
+    synchronize(device);
+    benchmark::DoNotOptimize(sample_output);
+  }
+  state.SetItemsProcessed(state.iterations() * num_seqs);
+}
+
+BENCHMARK(BM_sampling_per_step)->Arg(1)->Arg(8)->Arg(64);
+BENCHMARK(BM_sampling_pipeline)->Arg(1)->Arg(8)->Arg(64);
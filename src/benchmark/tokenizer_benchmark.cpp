@@ -0,0 +1,602 @@
+#include <absl/strings/escaping.h>
+#include <absl/strings/str_join.h>
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+#include <re2/re2.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "common/threadpool.h"
+#include "request/incremental_decoder.h"
+#include "tokenizer/bpe_vocab.h"
+#include "tokenizer/hf_tokenizer.h"
+#include "tokenizer/pre_tokenizer.h"
+#include "tokenizer/prefix_token_cache.h"
+#include "tokenizer/sentencepiece_tokenizer.h"
+#include "tokenizer/special_token_matcher.h"
+#include "tokenizer/tiktoken_tokenizer.h"
+#include "tokenizer/tokenizer.h"
+
+// the directory of the tokenizer test data, set by cmake
+#ifndef TOKENIZER_DATA_DIR
+#define TOKENIZER_DATA_DIR "src/tokenizer/data"
+#endif
+
+using namespace llm;
+
+namespace {
+
+enum class Backend { kSentencePiece, kTiktoken, kHuggingFace };
+
+// the vocab size of the generated tiktoken vocab
+constexpr size_t kVocabSize = 32000;
+
+// the pre-tokenization pattern of cl100k_base
+// clang-format off
+constexpr char kPattern[] =
+    R"((?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+[^\S]|\s+)";
+// clang-format on
+
+// a mix of prose, code and cjk characters
+const std::string kText =
+    "The quick brown fox jumps over the lazy dog. It was the best of times, "
+    "it was the worst of times, it was the age of wisdom.\n"
+    "for (size_t i = 0; i < tokens.size(); ++i) {\n"
+    "    ids->push_back(encoder.at(tokens[i]));\n"
+    "}\n"
+    "\xE4\xBD\xA0\xE5\xA5\xBD\xEF\xBC\x8C\xE4\xB8\x96\xE7\x95\x8C"
+    "\xEF\xBC\x81 \xE3\x81\x93\xE3\x82\x93\xE3\x81\xAB\xE3\x81\xA1"
+    "\xE3\x81\xAF 2024\xE5\xB9\xB4\n";
+
+std::string repeat(const std::string& text, size_t size) {
+  std::string result;
+  while (result.size() < size) {
+    result += text;
+  }
+  return result;
+}
+
+// random lowercase letters without spaces, split into long pieces
+std::string random_letters(size_t size) {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> dist('a', 'z');
+  std::string text(size, ' ');
+  for (auto& c : text) {
+    c = static_cast<char>(dist(gen));
+  }
+  return text;
+}
+
+// write a tiktoken vocab of 256 bytes and tokens merged from pairs of
+// existing tokens of lowercase letters and spaces, like a trained bpe vocab.
+// the vocab in the test data is too small to measure loading.
+std::string write_vocab_file() {
+  std::mt19937 gen(42);
+  std::vector<std::string> tokens;
+  std::unordered_map<std::string, int32_t> ranks;
+  for (int32_t i = 0; i < 256; ++i) {
+    const std::string token(1, static_cast<char>(i));
+    ranks[token] = i;
+    if (i == ' ' || (i >= 'a' && i <= 'z')) {
+      tokens.push_back(token);
+    }
+  }
+  while (ranks.size() < kVocabSize) {
+    std::uniform_int_distribution<size_t> dist(0, tokens.size() - 1);
+    std::string token = tokens[dist(gen)] + tokens[dist(gen)];
+    if (token.size() <= 16 && ranks.count(token) == 0) {
+      ranks[token] = static_cast<int32_t>(ranks.size());
+      tokens.push_back(std::move(token));
+    }
+  }
+
+  const auto path =
+      std::filesystem::temp_directory_path() / "tokenizer_benchmark.tiktoken";
+  std::ofstream fs(path);
+  for (const auto& [token, rank] : ranks) {
+    fs << absl::Base64Escape(token) << " " << rank << "\n";
+  }
+  fs.close();
+  return path.string();
+}
+
+// the bytes to unicode mapping of the byte level bpe in gpt2
+std::vector<std::string> bytes_to_unicode() {
+  std::vector<std::string> chars(256);
+  uint32_t n = 0;
+  for (uint32_t b = 0; b < 256; ++b) {
+    const bool printable = (b >= '!' && b <= '~') ||
+                           (b >= 0xA1 && b <= 0xAC) ||
+                           (b >= 0xAE && b <= 0xFF);
+    const uint32_t cp = printable ? b : 256 + n++;
+    // encode the code point, which is below 0x800, in utf-8
+    if (cp < 0x80) {
+      chars[b] = std::string(1, static_cast<char>(cp));
+    } else {
+      chars[b] = {static_cast<char>(0xC0 | (cp >> 6)),
+                  static_cast<char>(0x80 | (cp & 0x3F))};
+    }
+  }
+  return chars;
+}
+
+// convert the tiktoken vocab to a byte level bpe tokenizer.json, since there
+// is no hf tokenizer in the test data. the merge of each token is the split
+// into two tokens with the lowest ranks, as tiktoken merges them.
+std::string write_hf_tokenizer_file(const std::string& vocab_file) {
+  std::map<std::string, int32_t> ranks;
+  std::ifstream ifs(vocab_file);
+  std::string token;
+  int32_t rank = 0;
+  while (ifs >> token >> rank) {
+    std::string bytes;
+    CHECK(absl::Base64Unescape(token, &bytes));
+    ranks[bytes] = rank;
+  }
+
+  const auto chars = bytes_to_unicode();
+  auto to_json = [&chars](const std::string& bytes) {
+    std::string result = "\"";
+    for (const char c : bytes) {
+      const auto& ch = chars[static_cast<uint8_t>(c)];
+      if (ch == "\"" || ch == "\\") {
+        result += "\\";
+      }
+      result += ch;
+    }
+    return result + "\"";
+  };
+
+  std::vector<std::pair<int32_t, std::string>> merges;
+  std::string vocab;
+  for (const auto& [bytes, rank] : ranks) {
+    if (!vocab.empty()) {
+      vocab += ",";
+    }
+    vocab += to_json(bytes) + ":" + std::to_string(rank);
+
+    std::pair<int32_t, int32_t> best = {rank, rank};
+    std::string merge;
+    for (size_t i = 1; i < bytes.size(); ++i) {
+      const auto left = ranks.find(bytes.substr(0, i));
+      const auto right = ranks.find(bytes.substr(i));
+      if (left == ranks.end() || right == ranks.end()) {
+        continue;
+      }
+      const std::pair<int32_t, int32_t> split = {
+          std::max(left->second, right->second),
+          std::min(left->second, right->second)};
+      if (split < best) {
+        best = split;
+        // the pair of tokens separated by a space in a json string
+        const auto left_json = to_json(left->first);
+        merge = left_json.substr(0, left_json.size() - 1) + " " +
+                to_json(right->first).substr(1);
+      }
+    }
+    if (!merge.empty()) {
+      merges.emplace_back(rank, std::move(merge));
+    }
+  }
+  std::sort(merges.begin(), merges.end());
+  std::string merges_json;
+  for (const auto& [rank, merge] : merges) {
+    if (!merges_json.empty()) {
+      merges_json += ",";
+    }
+    merges_json += merge;
+  }
+
+  // clang-format off
+  const std::string byte_level =
+      R"({"type":"ByteLevel","add_prefix_space":false,"trim_offsets":true,"use_regex":true})";
+  // clang-format on
+  const auto path = std::filesystem::temp_directory_path() /
+                    "tokenizer_benchmark.json";
+  std::ofstream ofs(path);
+  ofs << R"({"version":"1.0","truncation":null,"padding":null,)"
+      << R"("added_tokens":[],"normalizer":null,)"
+      << R"("pre_tokenizer":)" << byte_level << R"(,"post_processor":null,)"
+      << R"("decoder":)" << byte_level << R"(,"model":{"type":"BPE",)"
+      << R"("dropout":null,"unk_token":null,"continuing_subword_prefix":null,)"
+      << R"("end_of_word_suffix":null,"fuse_unk":false,"byte_fallback":false,)"
+      << R"("vocab":{)" << vocab << R"(},"merges":[)" << merges_json << "]}}";
+  ofs.close();
+  return path.string();
+}
+
+std::unique_ptr<Tokenizer> create_tokenizer(Backend backend) {
+  TokenizerArgs args;
+  switch (backend) {
+    case Backend::kSentencePiece:
+      args.vocab_file() = "tokenizer.model";
+      args.prefix_tokens() = {"<s>"};
+      return std::make_unique<SentencePieceTokenizer>(TOKENIZER_DATA_DIR,
+                                                      args);
+    case Backend::kTiktoken:
+      args.vocab_file() = "test.tiktoken";
+      args.pattern() = kPattern;
+      return std::make_unique<TiktokenTokenizer>(TOKENIZER_DATA_DIR, args);
+    case Backend::kHuggingFace: {
+      const auto path = write_hf_tokenizer_file(
+          std::string(TOKENIZER_DATA_DIR) + "/test.tiktoken");
+      auto tokenizer = HFTokenizer::from_file(path);
+      std::filesystem::remove(path);
+      return tokenizer;
+    }
+  }
+  return nullptr;
+}
+
+// the tokenizer of the backend, loaded once and shared by benchmarks
+const Tokenizer& get_tokenizer(Backend backend) {
+  static const auto* tokenizers = [] {
+    auto* tokenizers = new std::map<Backend, std::unique_ptr<Tokenizer>>();
+    for (const auto backend : {Backend::kSentencePiece,
+                               Backend::kTiktoken,
+                               Backend::kHuggingFace}) {
+      (*tokenizers)[backend] = create_tokenizer(backend);
+    }
+    return tokenizers;
+  }();
+  return *tokenizers->at(backend);
+}
+
+void run_encode(benchmark::State& state,
+                const Tokenizer& tokenizer,
+                const std::string& text) {
+  size_t num_tokens = 0;
+  for (auto _ : state) {
+    std::vector<int32_t> ids;
+    CHECK(tokenizer.encode(text, &ids));
+    num_tokens += ids.size();
+    benchmark::DoNotOptimize(ids.data());
+  }
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * text.size()));
+  state.counters["tokens"] = benchmark::Counter(
+      static_cast<double>(num_tokens), benchmark::Counter::kIsRate);
+}
+
+}  // namespace
+
+static void BM_encode(benchmark::State& state, Backend backend) {
+  const auto tokenizer = get_tokenizer(backend).clone();
+  run_encode(state, *tokenizer, repeat(kText, state.range(0)));
+}
+
+// adversarial inputs with a single long piece
+static void BM_encode_spaces(benchmark::State& state, Backend backend) {
+  const auto tokenizer = get_tokenizer(backend).clone();
+  run_encode(state, *tokenizer, std::string(state.range(0), ' '));
+}
+
+static void BM_encode_letters(benchmark::State& state, Backend backend) {
+  const auto tokenizer = get_tokenizer(backend).clone();
+  run_encode(state, *tokenizer, random_letters(state.range(0)));
+}
+
+static void BM_decode(benchmark::State& state, Backend backend) {
+  const auto tokenizer = get_tokenizer(backend).clone();
+  std::vector<int32_t> ids;
+  CHECK(tokenizer->encode(repeat(kText, state.range(0)), &ids));
+  size_t num_bytes = 0;
+  for (auto _ : state) {
+    const auto text = tokenizer->decode(ids, /*skip_special_tokens=*/true);
+    num_bytes += text.size();
+    benchmark::DoNotOptimize(text.data());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(num_bytes));
+  state.counters["tokens"] = benchmark::Counter(
+      static_cast<double>(state.iterations() * ids.size()),
+      benchmark::Counter::kIsRate);
+}
+
+// decode the output tokens one by one as in streaming, with the window of
+// tokens for tokenizers without decode_token(), like hf tokenizers
+static void BM_incremental_decode(benchmark::State& state, Backend backend) {
+  const auto tokenizer = get_tokenizer(backend).clone();
+  std::vector<int32_t> ids;
+  CHECK(tokenizer->encode(repeat(kText, state.range(0)), &ids));
+  for (auto _ : state) {
+    IncrementalDecoder decoder(/*prompt=*/"",
+                               /*num_prompt_tokens=*/0,
+                               /*echo=*/false,
+                               /*skip_special_tokens=*/true);
+    for (size_t i = 1; i <= ids.size(); ++i) {
+      const auto delta = decoder.decode(Slice<int32_t>(ids, i), *tokenizer);
+      benchmark::DoNotOptimize(delta.data());
+    }
+  }
+  // time per token
+  state.counters["per_token"] = benchmark::Counter(
+      static_cast<double>(state.iterations() * ids.size()),
+      benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// cost of cloning the tokenizer for handlers
+static void BM_clone(benchmark::State& state, Backend backend) {
+  const auto& tokenizer = get_tokenizer(backend);
+  for (auto _ : state) {
+    auto clone = tokenizer.clone();
+    benchmark::DoNotOptimize(clone.get());
+  }
+}
+
+// a burst of prompts encoded on a threadpool of the given size, 0 for serial.
+// the throughput should scale with the number of threads.
+static void BM_encode_batch(benchmark::State& state, Backend backend) {
+  const auto tokenizer = get_tokenizer(backend).clone();
+  const size_t num_threads = state.range(0);
+  std::unique_ptr<ThreadPool> threadpool;
+  if (num_threads > 0) {
+    threadpool = std::make_unique<ThreadPool>(num_threads);
+  }
+  // prompts of different lengths
+  std::vector<std::string> prompts;
+  for (size_t i = 0; i < 1000; ++i) {
+    prompts.push_back(repeat(kText, 256 + (i % 8) * 256));
+  }
+  for (auto _ : state) {
+    std::vector<std::vector<int32_t>> ids;
+    CHECK(tokenizer->encode_batch(prompts, &ids, threadpool.get()));
+    benchmark::DoNotOptimize(ids.data());
+  }
+  // prompts per second
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * prompts.size()));
+}
+
+// encode with the same tokenizer in all threads, which share the handle of
+// hf tokenizers.
+static void BM_encode_threads_shared(benchmark::State& state,
+                                     Backend backend) {
+  run_encode(state, get_tokenizer(backend), repeat(kText, 4096));
+}
+
+// multi-turn chats in chatml format with a shared system prompt, encoded
+// with the prefix token cache if enabled
+static void BM_tiktoken_encode_chat(benchmark::State& state) {
+  const auto path = write_vocab_file();
+  TokenizerArgs args;
+  args.vocab_file() = path;
+  args.pattern() = kPattern;
+  args.special_tokens() = {{"<|im_start|>", kVocabSize},
+                           {"<|im_end|>", kVocabSize + 1}};
+  const TiktokenTokenizer tokenizer("", args);
+  std::filesystem::remove(path);
+  const bool use_cache = state.range(0) != 0;
+  const std::string system_prompt = repeat(kText, 2048);
+
+  // render the prompt of each turn, and the end of each message
+  std::vector<std::string> prompts;
+  std::vector<std::vector<size_t>> boundaries;
+  const size_t kNumChats = 8;
+  const size_t kNumTurns = 16;
+  for (size_t chat = 0; chat < kNumChats; ++chat) {
+    std::string history = "<|im_start|>system\n" + system_prompt;
+    std::vector<size_t> history_boundaries = {history.size()};
+    history += "<|im_end|>\n";
+    for (size_t turn = 0; turn < kNumTurns; ++turn) {
+      history += "<|im_start|>user\n" + std::to_string(chat) + kText;
+      history_boundaries.push_back(history.size());
+      history += "<|im_end|>\n";
+      prompts.push_back(history + "<|im_start|>assistant\n");
+      boundaries.push_back(history_boundaries);
+      history += "<|im_start|>assistant\n" + kText;
+      history_boundaries.push_back(history.size());
+      history += "<|im_end|>\n";
+    }
+  }
+
+  PrefixTokenCache::Stats stats;
+  for (auto _ : state) {
+    PrefixTokenCache cache(/*max_entries=*/1024, /*verify=*/false);
+    for (size_t i = 0; i < prompts.size(); ++i) {
+      std::vector<int32_t> ids;
+      if (use_cache) {
+        cache.encode(tokenizer, prompts[i], boundaries[i], &ids);
+      } else {
+        tokenizer.encode(prompts[i], &ids);
+      }
+      benchmark::DoNotOptimize(ids.data());
+    }
+    stats = cache.stats();
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * prompts.size()));
+  state.counters["hit_rate"] = stats.hit_rate();
+  state.counters["saved_ms"] = stats.saved_seconds() * 1000;
+}
+
+// startup cost of loading the tokenizer from the vocab file
+static void BM_tiktoken_load(benchmark::State& state) {
+  const auto path = write_vocab_file();
+  TokenizerArgs args;
+  args.vocab_file() = path;
+  args.pattern() = kPattern;
+  for (auto _ : state) {
+    auto tokenizer = std::make_unique<TiktokenTokenizer>("", args);
+    benchmark::DoNotOptimize(tokenizer.get());
+  }
+  std::filesystem::remove(path);
+}
+
+// startup cost of loading the tokenizer from the compiled binary vocab file
+static void BM_tiktoken_load_binary(benchmark::State& state) {
+  const auto path = write_vocab_file();
+  const auto binary_path = path + ".bin";
+  CHECK(BpeVocab::from_file(path)->save(binary_path));
+  TokenizerArgs args;
+  args.vocab_file() = binary_path;
+  args.pattern() = kPattern;
+  for (auto _ : state) {
+    auto tokenizer = std::make_unique<TiktokenTokenizer>("", args);
+    benchmark::DoNotOptimize(tokenizer.get());
+  }
+  std::filesystem::remove(path);
+  std::filesystem::remove(binary_path);
+}
+
+// split text into pieces with the regex (0) or the pre-tokenizer (1)
+static void BM_pre_tokenize(benchmark::State& state) {
+  const std::string text = repeat(kText, 65536);
+  const re2::RE2 regex(std::string("(") + kPattern + ")");
+  const auto pre_tokenizer = PreTokenizer::create(kPattern);
+  CHECK(pre_tokenizer != nullptr);
+  const bool use_pre_tokenizer = state.range(0) != 0;
+  size_t num_pieces = 0;
+  for (auto _ : state) {
+    std::string_view input = text;
+    std::string_view piece;
+    if (use_pre_tokenizer) {
+      while (pre_tokenizer->next(&input, &piece)) {
+        ++num_pieces;
+      }
+    } else {
+      while (re2::RE2::FindAndConsume(&input, regex, &piece)) {
+        ++num_pieces;
+      }
+    }
+    benchmark::DoNotOptimize(piece.data());
+  }
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * text.size()));
+  state.counters["pieces"] = benchmark::Counter(
+      static_cast<double>(num_pieces), benchmark::Counter::kIsRate);
+}
+
+// find special tokens with the regex (0) or the aho-corasick matcher (1)
+static void BM_find_special_tokens(benchmark::State& state) {
+  std::vector<std::string> tokens = {"<|endoftext|>", "<|im_start|>",
+                                     "<|im_end|>"};
+  for (int i = 0; i < 205; ++i) {
+    tokens.push_back("<|extra_" + std::to_string(i) + "|>");
+  }
+  const std::string text =
+      repeat("<|im_start|>user\n" + kText + "<|im_end|>\n", 65536);
+  std::vector<std::string> escaped_tokens;
+  for (const auto& token : tokens) {
+    escaped_tokens.push_back(re2::RE2::QuoteMeta(token));
+  }
+  const re2::RE2 regex("(" + absl::StrJoin(escaped_tokens, "|") + ")");
+  const SpecialTokenMatcher matcher(tokens);
+  const bool use_matcher = state.range(0) != 0;
+  for (auto _ : state) {
+    std::string_view input = text;
+    std::string_view special;
+    size_t len = 0;
+    if (use_matcher) {
+      size_t start = 0;
+      while ((start = matcher.find(input, &len)) != std::string_view::npos) {
+        input.remove_prefix(start + len);
+      }
+    } else {
+      while (re2::RE2::FindAndConsume(&input, regex, &special)) {
+      }
+    }
+    benchmark::DoNotOptimize(input.data());
+  }
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * text.size()));
+}
+
+BENCHMARK_CAPTURE(BM_encode, sentencepiece, Backend::kSentencePiece)
+    ->Arg(256)
+    ->Arg(65536);
+BENCHMARK_CAPTURE(BM_encode, tiktoken, Backend::kTiktoken)
+    ->Arg(256)
+    ->Arg(65536);
+BENCHMARK_CAPTURE(BM_encode, huggingface, Backend::kHuggingFace)
+    ->Arg(256)
+    ->Arg(65536);
+BENCHMARK_CAPTURE(BM_encode_spaces, sentencepiece, Backend::kSentencePiece)
+    ->Arg(1024)
+    ->Arg(16384);
+BENCHMARK_CAPTURE(BM_encode_spaces, tiktoken, Backend::kTiktoken)
+    ->Arg(1024)
+    ->Arg(16384);
+BENCHMARK_CAPTURE(BM_encode_spaces, huggingface, Backend::kHuggingFace)
+    ->Arg(1024)
+    ->Arg(16384);
+BENCHMARK_CAPTURE(BM_encode_letters, sentencepiece, Backend::kSentencePiece)
+    ->Arg(1024)
+    ->Arg(16384);
+BENCHMARK_CAPTURE(BM_encode_letters, tiktoken, Backend::kTiktoken)
+    ->Arg(1024)
+    ->Arg(16384);
+BENCHMARK_CAPTURE(BM_encode_letters, huggingface, Backend::kHuggingFace)
+    ->Arg(1024)
+    ->Arg(16384);
+BENCHMARK_CAPTURE(BM_decode, sentencepiece, Backend::kSentencePiece)
+    ->Arg(256)
+    ->Arg(65536);
+BENCHMARK_CAPTURE(BM_decode, tiktoken, Backend::kTiktoken)
+    ->Arg(256)
+    ->Arg(65536);
+BENCHMARK_CAPTURE(BM_decode, huggingface, Backend::kHuggingFace)
+    ->Arg(256)
+    ->Arg(65536);
+BENCHMARK_CAPTURE(BM_incremental_decode,
+                  sentencepiece,
+                  Backend::kSentencePiece)
+    ->Arg(4096);
+BENCHMARK_CAPTURE(BM_incremental_decode, tiktoken, Backend::kTiktoken)
+    ->Arg(4096);
+BENCHMARK_CAPTURE(BM_incremental_decode, huggingface, Backend::kHuggingFace)
+    ->Arg(4096);
+BENCHMARK_CAPTURE(BM_clone, sentencepiece, Backend::kSentencePiece);
+BENCHMARK_CAPTURE(BM_clone, tiktoken, Backend::kTiktoken);
+BENCHMARK_CAPTURE(BM_clone, huggingface, Backend::kHuggingFace);
+BENCHMARK_CAPTURE(BM_encode_batch, sentencepiece, Backend::kSentencePiece)
+    ->Arg(0)
+    ->Arg(1)
+    ->Arg(4)
+    ->Arg(16)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_encode_batch, tiktoken, Backend::kTiktoken)
+    ->Arg(0)
+    ->Arg(1)
+    ->Arg(4)
+    ->Arg(16)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_encode_batch, huggingface, Backend::kHuggingFace)
+    ->Arg(0)
+    ->Arg(1)
+    ->Arg(4)
+    ->Arg(16)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_encode_threads_shared, tiktoken, Backend::kTiktoken)
+    ->Threads(1)
+    ->Threads(4)
+    ->Threads(16)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_encode_threads_shared,
+                  huggingface,
+                  Backend::kHuggingFace)
+    ->Threads(1)
+    ->Threads(4)
+    ->Threads(16)
+    ->UseRealTime();
+BENCHMARK(BM_tiktoken_encode_chat)
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_tiktoken_load)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_tiktoken_load_binary)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_pre_tokenize)->Arg(0)->Arg(1);
+BENCHMARK(BM_find_special_tokens)->Arg(0)->Arg(1);
@@ -0,0 +1,305 @@
+#include "compiled_chat_template.h"
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "chat_template.h"
+
+namespace llm {
+
+namespace {
+
+// max number of messages of the conversations to probe and verify
+constexpr size_t kMaxProbedMessages = 3;
+constexpr size_t kMaxVerifiedMessages = 4;
+
+constexpr const char* kRoleNames[] = {"system", "user", "assistant"};
+
+// a marker content to locate the content in the rendered prompt
+std::string marker(size_t index) {
+  return "[[message" + std::to_string(index) + "]]";
+}
+
+// a content with whitespaces and characters changed by some templates
+std::string padded_marker(size_t index) {
+  return " \n " + marker(index) + "  a\t\tb\n\n'\"<&>{{ }} 你好 \n";
+}
+
+// split the prompt by the markers of n messages, returns false if any marker
+// is missing, duplicated or out of order.
+bool split_by_markers(const std::string& prompt,
+                      size_t n,
+                      std::vector<std::string>* pieces) {
+  size_t pos = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const std::string m = marker(i);
+    const size_t found = prompt.find(m, pos);
+    if (found == std::string::npos ||
+        prompt.find(m, found + m.size()) != std::string::npos) {
+      return false;
+    }
+    pieces->push_back(prompt.substr(pos, found - pos));
+    pos = found + m.size();
+  }
+  pieces->push_back(prompt.substr(pos));
+  return true;
+}
+
+bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+         c == '\r';
+}
+
+// append the content with leading and trailing whitespaces removed, and each
+// run of inner whitespaces replaced with its first character, which matches
+// boost::algorithm::trim_all used by the jinja filter 'trim'.
+void append_trim_all(std::string_view content, std::string* prompt) {
+  size_t begin = 0;
+  size_t end = content.size();
+  while (begin < end && is_space(content[begin])) {
+    ++begin;
+  }
+  while (end > begin && is_space(content[end - 1])) {
+    --end;
+  }
+  // write into the prompt directly
+  const size_t offset = prompt->size();
+  prompt->resize(offset + end - begin);
+  char* out = prompt->data() + offset;
+  for (size_t i = begin; i < end; ++i) {
+    if (!is_space(content[i]) || !is_space(content[i - 1])) {
+      *out++ = content[i];
+    }
+  }
+  prompt->resize(out - prompt->data());
+}
+
+// set the text if not set, returns false if it conflicts with the set one
+bool learn_text(std::optional<std::string>* text, const std::string& piece) {
+  if (!text->has_value()) {
+    *text = piece;
+    return true;
+  }
+  return text->value() == piece;
+}
+
+}  // namespace
+
+std::unique_ptr<CompiledChatTemplate> CompiledChatTemplate::compile(
+    const Renderer& renderer) {
+  // the constructor is private
+  std::unique_ptr<CompiledChatTemplate> compiled(new CompiledChatTemplate());
+  if (!compiled->learn(renderer)) {
+    return nullptr;
+  }
+  compiled->learn_content_modes(renderer);
+
+  // at least a single message is covered
+  bool covered = false;
+  for (int r = 0; r < kNumRoles; ++r) {
+    covered = covered || (compiled->leads_[r].has_value() &&
+                          compiled->tails_[r].has_value() &&
+                          compiled->modes_[kStart][r] != ContentMode::kUnknown);
+  }
+  if (!covered || !compiled->verify(renderer)) {
+    return nullptr;
+  }
+  return compiled;
+}
+
+bool CompiledChatTemplate::render(const ChatMessages& messages,
+                                  std::string* prompt) const {
+  if (messages.empty()) {
+    return false;
+  }
+  std::vector<Role> roles;
+  std::vector<std::string_view> contents;
+  roles.reserve(messages.size());
+  contents.reserve(messages.size());
+  for (const auto& message : messages) {
+    int r = 0;
+    while (r < kNumRoles && message.role() != kRoleNames[r]) {
+      ++r;
+    }
+    if (r == kNumRoles) {
+      // unknown role
+      return false;
+    }
+    roles.push_back(static_cast<Role>(r));
+    contents.push_back(message.content());
+  }
+  return build(roles, contents, /*modes=*/{}, prompt);
+}
+
+bool CompiledChatTemplate::build(const std::vector<Role>& roles,
+                                 const std::vector<std::string_view>& contents,
+                                 const std::vector<ContentMode>& modes,
+                                 std::string* prompt) const {
+  size_t size = 0;
+  for (const auto& content : contents) {
+    size += content.size();
+  }
+  prompt->clear();
+  prompt->reserve(size + roles.size() * 32);
+
+  Role prev = kStart;
+  for (size_t i = 0; i < roles.size(); ++i) {
+    const Role role = roles[i];
+    const auto& text = i == 0 ? leads_[role] : separators_[prev][role];
+    if (!text.has_value()) {
+      return false;
+    }
+    prompt->append(text.value());
+
+    const ContentMode mode = modes.empty() ? modes_[prev][role] : modes[i];
+    switch (mode) {
+      case ContentMode::kVerbatim:
+        prompt->append(contents[i]);
+        break;
+      case ContentMode::kTrimAll:
+        append_trim_all(contents[i], prompt);
+        break;
+      default:
+        return false;
+    }
+    prev = role;
+  }
+
+  const auto& tail = tails_[prev];
+  if (!tail.has_value()) {
+    return false;
+  }
+  prompt->append(tail.value());
+  return true;
+}
+
+std::vector<std::vector<CompiledChatTemplate::Role>>
+CompiledChatTemplate::role_sequences(size_t max_messages) {
+  std::vector<std::vector<Role>> sequences;
+  std::vector<std::vector<Role>> last = {{}};
+  for (size_t n = 1; n <= max_messages; ++n) {
+    std::vector<std::vector<Role>> next;
+    for (const auto& roles : last) {
+      for (int r = 0; r < kNumRoles; ++r) {
+        next.push_back(roles);
+        next.back().push_back(static_cast<Role>(r));
+      }
+    }
+    sequences.insert(sequences.end(), next.begin(), next.end());
+    last = std::move(next);
+  }
+  return sequences;
+}
+
+bool CompiledChatTemplate::learn(const Renderer& renderer) {
+  // probe conversations up to kMaxProbedMessages messages, so that the
+  // separators are also learned after the first message, e.g. for templates
+  // only accepting alternating user and assistant messages.
+  for (const auto& roles : role_sequences(kMaxProbedMessages)) {
+    ChatMessages messages;
+    for (size_t i = 0; i < roles.size(); ++i) {
+      auto* message = messages.Add();
+      message->set_role(kRoleNames[roles[i]]);
+      message->set_content(marker(i));
+    }
+    const auto prompt = renderer(messages);
+    std::vector<std::string> pieces;
+    if (!prompt.has_value() ||
+        !split_by_markers(prompt.value(), roles.size(), &pieces)) {
+      // not supported by the template
+      continue;
+    }
+    // the text depends on more than the adjacent roles, e.g. loop.last
+    if (!learn_text(&leads_[roles.front()], pieces.front()) ||
+        !learn_text(&tails_[roles.back()], pieces.back())) {
+      return false;
+    }
+    for (size_t i = 1; i < roles.size(); ++i) {
+      if (!learn_text(&separators_[roles[i - 1]][roles[i]], pieces[i])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void CompiledChatTemplate::learn_content_modes(const Renderer& renderer) {
+  for (const auto& roles : role_sequences(kMaxProbedMessages)) {
+    const Role prev = roles.size() > 1 ? roles[roles.size() - 2] : kStart;
+    const Role role = roles.back();
+    if (modes_[prev][role] != ContentMode::kUnknown) {
+      continue;
+    }
+
+    // a padded content after marker contents
+    std::vector<std::string> contents;
+    ChatMessages messages;
+    for (size_t i = 0; i < roles.size(); ++i) {
+      contents.push_back(i + 1 == roles.size() ? padded_marker(i) : marker(i));
+      auto* message = messages.Add();
+      message->set_role(kRoleNames[roles[i]]);
+      message->set_content(contents.back());
+    }
+    const auto prompt = renderer(messages);
+    if (!prompt.has_value()) {
+      continue;
+    }
+
+    const std::vector<std::string_view> views(contents.begin(), contents.end());
+    for (const auto mode : {ContentMode::kVerbatim, ContentMode::kTrimAll}) {
+      std::vector<ContentMode> modes(roles.size(), ContentMode::kVerbatim);
+      modes.back() = mode;
+      std::string expected;
+      if (build(roles, views, modes, &expected) &&
+          expected == prompt.value()) {
+        modes_[prev][role] = mode;
+        break;
+      }
+    }
+  }
+}
+
+bool CompiledChatTemplate::verify(const Renderer& renderer) const {
+  // all sequences of roles up to kMaxVerifiedMessages messages, and long
+  // conversations of alternating roles.
+  auto sequences = role_sequences(kMaxVerifiedMessages);
+  for (const Role first : {kSystem, kUser}) {
+    std::vector<Role> roles = {first};
+    for (size_t i = 1; i < 2 * kMaxVerifiedMessages + 1; ++i) {
+      roles.push_back(roles.back() == kUser ? kAssistant : kUser);
+    }
+    sequences.push_back(roles);
+  }
+
+  for (const auto& roles : sequences) {
+    // marker contents, padded contents, and padded contents mixed with empty
+    for (int style = 0; style < 3; ++style) {
+      ChatMessages messages;
+      for (size_t i = 0; i < roles.size(); ++i) {
+        auto* message = messages.Add();
+        message->set_role(kRoleNames[roles[i]]);
+        if (style == 0) {
+          message->set_content(marker(i));
+        } else if (style == 1 || i % 2 == 1) {
+          message->set_content(padded_marker(i));
+        }
+      }
+      std::string prompt;
+      if (!render(messages, &prompt)) {
+        // not covered
+        continue;
+      }
+      const auto expected = renderer(messages);
+      if (!expected.has_value() || expected.value() != prompt) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace llm
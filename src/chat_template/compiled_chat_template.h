@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chat_template.h"
+
+namespace llm {
+
+// A chat template compiled from another chat template, e.g. a jinja template,
+// by rendering probe conversations with marker contents. Common chat templates
+// (chatml, qwen, gemma, mistral, ...) wrap each message with fixed text that
+// only depends on the roles of the message and the previous one, so the prompt
+// can be built by concatenating the learned text and the contents directly.
+// The compiled template is verified against the original one on conversations
+// up to a few messages, and conversations not covered by the probes are not
+// rendered, for which the caller should fall back to the original template.
+// immutable and thread safe.
+class CompiledChatTemplate final {
+ public:
+  using Renderer =
+      std::function<std::optional<std::string>(const ChatMessages&)>;
+
+  // compile the template with the renderer of the original template.
+  // returns nullptr if the template can't be compiled.
+  static std::unique_ptr<CompiledChatTemplate> compile(
+      const Renderer& renderer);
+
+  // render the messages into the prompt, returns false if the messages are
+  // not covered by the compiled template.
+  bool render(const ChatMessages& messages, std::string* prompt) const;
+
+ private:
+  // roles of messages, kStart is used as the previous role of the first one
+  enum Role : int8_t {
+    kSystem = 0,
+    kUser = 1,
+    kAssistant = 2,
+    kNumRoles = 3,
+    kStart = 3,
+  };
+
+  // how the content of a message is rendered
+  enum class ContentMode : int8_t {
+    // not learned, or changed in an unknown way
+    kUnknown = 0,
+    kVerbatim = 1,
+    // strip whitespaces and compress inner whitespaces, as the jinja filter
+    // 'trim' of jinja2cpp
+    kTrimAll = 2,
+  };
+
+  CompiledChatTemplate() = default;
+
+  // all sequences of roles with up to max_messages messages
+  static std::vector<std::vector<Role>> role_sequences(size_t max_messages);
+
+  // build the prompt from the learned text, returns false if any text is not
+  // learned. modes are used for the contents instead of the learned ones if
+  // not empty.
+  bool build(const std::vector<Role>& roles,
+             const std::vector<std::string_view>& contents,
+             const std::vector<ContentMode>& modes,
+             std::string* prompt) const;
+
+  // learn the text from the probes, returns false on conflicts
+  bool learn(const Renderer& renderer);
+
+  // learn how the contents are rendered
+  void learn_content_modes(const Renderer& renderer);
+
+  // compare with the original template, returns false on mismatches
+  bool verify(const Renderer& renderer) const;
+
+  // text before the first message with the role
+  std::optional<std::string> leads_[kNumRoles];
+
+  // text between two messages, indexed by their roles
+  std::optional<std::string> separators_[kNumRoles][kNumRoles];
+
+  // text after the last message with the role
+  std::optional<std::string> tails_[kNumRoles];
+
+  // content modes indexed by the previous role and the role of the message
+  ContentMode modes_[kNumRoles + 1][kNumRoles] = {};
+};
+
+}  // namespace llm
@@ -0,0 +1,160 @@
+#include "compiled_chat_template.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "jinja_chat_template.h"
+
+namespace llm {
+
+namespace {
+
+// clang-format off
+const std::string kChatMLTemplate =
+    "{% for message in messages %}"
+      "{{'<|im_start|>' + message['role'] + '\n' + message['content'] + '<|im_end|>' + '\n'}}"
+    "{% endfor %}"
+    "{% if add_generation_prompt %}{{ '<|im_start|>assistant\n' }}{% endif %}";
+
+const std::string kQwenTemplate =
+    "{% for message in messages %}"
+      "{% if loop.first and messages[0]['role'] != 'system' %}"
+        "{{ '<|im_start|>system\nYou are a helpful assistant<|im_end|>\n' }}"
+      "{% endif %}"
+      "{{'<|im_start|>' + message['role'] + '\n' + message['content'] + '<|im_end|>' + '\n'}}"
+    "{% endfor %}"
+    "{% if add_generation_prompt %}{{ '<|im_start|>assistant\n' }}{% endif %}";
+
+const std::string kGemmaTemplate =
+    "{{ bos_token }}"
+    "{% if messages[0]['role'] == 'system' %}{{ raise_exception('System role not supported') }}{% endif %}"
+    "{% for message in messages %}"
+      "{% if (message['role'] == 'user') != (loop.index0 % 2 == 0) %}"
+        "{{ raise_exception('Conversation roles must alternate user/assistant/user/assistant/...') }}"
+      "{% endif %}"
+      "{% if (message['role'] == 'assistant') %}{% set role = 'model' %}{% else %}{% set role = message['role'] %}{% endif %}"
+      "{{ '<start_of_turn>' + role + '\n' + message['content'] | trim + '<end_of_turn>\n' }}"
+    "{% endfor %}"
+    "{% if add_generation_prompt %}{{'<start_of_turn>model\n'}}{% endif %}";
+
+const std::string kMistralTemplate =
+    "{{ bos_token }}"
+    "{% for message in messages %}"
+      "{% if (message['role'] == 'user') != (loop.index0 % 2 == 0) %}"
+        "{{ raise_exception('Conversation roles must alternate user/assistant/user/assistant/...') }}"
+      "{% endif %}"
+      "{% if message['role'] == 'user' %}{{ '[INST] ' + message['content'] + ' [/INST]' }}"
+      "{% elif message['role'] == 'assistant' %}{{ message['content'] + eos_token + ' ' }}"
+      "{% else %}{{ raise_exception('Only user and assistant roles are supported!') }}"
+      "{% endif %}"
+    "{% endfor %}";
+
+const std::string kOpenChatTemplate =
+    "<s>"
+    "{% for message in messages %}"
+      "{{ 'GPT4 Correct ' + message['role'] + ': ' + message['content'] + '<|end_of_turn|>'}}"
+    "{% endfor %}"
+    "{% if add_generation_prompt %}{{ 'GPT4 Correct Assistant:' }}{% endif %}";
+
+// the output depends on the index of messages
+const std::string kIndexedTemplate =
+    "{% for message in messages %}"
+      "{{ loop.index ~ '. ' + message['role'] + ': ' + message['content'] + '\n' }}"
+    "{% endfor %}";
+// clang-format on
+
+ChatMessages make_messages(
+    const std::vector<std::pair<std::string, std::string>>& messages) {
+  ChatMessages result;
+  for (const auto& [role, content] : messages) {
+    auto* message = result.Add();
+    message->set_role(role);
+    message->set_content(content);
+  }
+  return result;
+}
+
+std::vector<ChatMessages> conversations() {
+  return {
+      make_messages({{"user", "hi"}}),
+      make_messages({{"system", "you are a helpful assistant."},
+                     {"user", "hi"},
+                     {"assistant", "what i can do for you?"},
+                     {"user", "how are you?"}}),
+      make_messages({{"user", "  hello \n\n world  "},
+                     {"assistant", "\tI'm fine,  thanks.\n"},
+                     {"user", "你好 {{ name }} <br/>"},
+                     {"assistant", ""},
+                     {"user", "bye"}}),
+      make_messages({{"user", "a"}, {"user", "b"}}),
+      make_messages({{"tool", "unknown role"}, {"user", "hi"}}),
+  };
+}
+
+}  // namespace
+
+TEST(CompiledChatTemplateTest, CompileCommonTemplates) {
+  for (const auto& template_str : {kChatMLTemplate,
+                                   kQwenTemplate,
+                                   kGemmaTemplate,
+                                   kMistralTemplate,
+                                   kOpenChatTemplate}) {
+    JinjaChatTemplate compiled(template_str, /*add_generation_prompt=*/true);
+    JinjaChatTemplate interpreted(template_str,
+                                  /*add_generation_prompt=*/true,
+                                  /*enable_compile=*/false);
+    EXPECT_TRUE(compiled.compiled()) << template_str;
+    EXPECT_FALSE(interpreted.compiled());
+
+    // same output as the interpreter, including fall backs
+    for (const auto& messages : conversations()) {
+      EXPECT_EQ(compiled.apply(messages), interpreted.apply(messages))
+          << template_str;
+    }
+  }
+}
+
+TEST(CompiledChatTemplateTest, FallBackToInterpreter) {
+  JinjaChatTemplate template_(kIndexedTemplate,
+                              /*add_generation_prompt=*/true);
+  EXPECT_FALSE(template_.compiled());
+
+  const auto prompt =
+      template_.apply(make_messages({{"user", "hi"}, {"assistant", "hello"}}));
+  ASSERT_TRUE(prompt.has_value());
+  EXPECT_EQ(prompt.value(), "1. user: hi\n2. assistant: hello\n");
+}
+
+TEST(CompiledChatTemplateTest, Render) {
+  // a template supporting alternating user and assistant messages only
+  auto renderer = [](const ChatMessages& messages)
+      -> std::optional<std::string> {
+    std::string prompt = "<s>";
+    for (int i = 0; i < messages.size(); ++i) {
+      const auto& message = messages[i];
+      if ((message.role() == "user") != (i % 2 == 0)) {
+        return std::nullopt;
+      }
+      prompt += message.role() == "user"
+                    ? "[INST] " + message.content() + " [/INST]"
+                    : " " + message.content() + "</s>";
+    }
+    return prompt;
+  };
+  const auto compiled = CompiledChatTemplate::compile(renderer);
+  ASSERT_NE(compiled, nullptr);
+
+  std::string prompt;
+  const auto messages = make_messages(
+      {{"user", "hi"}, {"assistant", "hello"}, {"user", "how are you?"}});
+  ASSERT_TRUE(compiled->render(messages, &prompt));
+  EXPECT_EQ(prompt, renderer(messages).value());
+
+  // not covered by the compiled template
+  EXPECT_FALSE(compiled->render(make_messages({{"system", "hi"}}), &prompt));
+  EXPECT_FALSE(compiled->render(make_messages({}), &prompt));
+}
+
+}  // namespace llm
@@ -4,21 +4,44 @@
 #include <jinja2cpp/binding/nlohmann_json.h>
 #include <jinja2cpp/value.h>
 
+#include <mutex>
 #include <optional>
 #include <string>
+#include <utility>
 
 namespace llm {
 
 JinjaChatTemplate::JinjaChatTemplate(const std::string& template_str,
-                                     bool add_generation_prompt)
+                                     bool add_generation_prompt,
+                                     bool enable_compile)
     : add_generation_prompt_(add_generation_prompt) {
   if (!template_.Load(template_str)) {
     LOG(FATAL) << "Failed to load template: " << template_str;
   }
+  if (enable_compile) {
+    compiled_ = CompiledChatTemplate::compile(
+        [this](const ChatMessages& messages) {
+          return interpret(messages, /*quiet=*/true);
+        });
+    LOG(INFO) << (compiled_ != nullptr
+                      ? "Compiled the jinja chat template"
+                      : "Failed to compile the jinja chat template, fall back "
+                        "to the interpreter");
+  }
 }
 
 std::optional<std::string> JinjaChatTemplate::apply(
     const ChatMessages& messages) const {
+  std::string prompt;
+  if (compiled_ != nullptr && compiled_->render(messages, &prompt)) {
+    return prompt;
+  }
+  return interpret(messages);
+}
+
+std::optional<std::string> JinjaChatTemplate::interpret(
+    const ChatMessages& messages,
+    bool quiet) const {
   // convert the messages to json object
   nlohmann::json messages_json = nlohmann::json::array();
   for (const auto& message : messages) {
@@ -28,18 +51,34 @@ std::optional<std::string> JinjaChatTemplate::apply(
     messages_json.push_back(message_json);
   }
   // apply the template
-  return apply(messages_json);
+  return render(messages_json, quiet);
 }
 
 std::optional<std::string> JinjaChatTemplate::apply(
     nlohmann::json& messages) const {
+  return render(messages, /*quiet=*/false);
+}
+
+std::optional<std::string> JinjaChatTemplate::render(nlohmann::json& messages,
+                                                     bool quiet) const {
   jinja2::ValuesMap values;
   // add the messages to the values
   values["messages"] = jinja2::Reflect(messages);
   // add the generation prompt
   values["add_generation_prompt"] = add_generation_prompt_;
   // render the template
-  return template_.RenderAsString(values).value();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto result = template_.RenderAsString(values);
+  if (!result.has_value()) {
+    if (quiet) {
+      VLOG(1) << "Failed to render template: " << result.error().ToString();
+    } else {
+      LOG(ERROR) << "Failed to render template: "
+                 << result.error().ToString();
+    }
+    return std::nullopt;
+  }
+  return std::move(result.value());
 }
 
 }  // namespace llm
\ No newline at end of file
@@ -2,19 +2,26 @@
 
 #include <jinja2cpp/template.h>
 
+#include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <optional>
 #include <string>
 
 #include "chat_template.h"
+#include "compiled_chat_template.h"
 
 namespace llm {
 
 // A chat template implementation that uses jinja2 as the template engine.
+// The template is compiled into a CompiledChatTemplate if possible, which
+// renders prompts without the interpreter, and falls back to the interpreter
+// otherwise. thread safe.
 class JinjaChatTemplate : public ChatTemplate {
  public:
   JinjaChatTemplate(const std::string& template_str,
-                    bool add_generation_prompt);
+                    bool add_generation_prompt,
+                    bool enable_compile = true);
 
   std::optional<std::string> apply(const ChatMessages& messages) const override;
 
@@ -22,9 +29,27 @@ class JinjaChatTemplate : public ChatTemplate {
   // apply the template to the values in the json object
   std::optional<std::string> apply(nlohmann::json& messages) const;
 
+  // whether the template is compiled
+  bool compiled() const { return compiled_ != nullptr; }
+
  private:
+  // render the messages with the interpreter. failures are only logged
+  // verbosely when quiet, e.g. for probe renders while compiling.
+  std::optional<std::string> interpret(const ChatMessages& messages,
+                                       bool quiet = false) const;
+
+  // render the template with the values in the json object
+  std::optional<std::string> render(nlohmann::json& messages,
+                                    bool quiet) const;
+
   mutable jinja2::Template template_;
   bool add_generation_prompt_;
+
+  // mutex to protect the template, which is not thread safe
+  mutable std::mutex mutex_;
+
+  // the compiled template, nullptr if the template can't be compiled
+  std::unique_ptr<CompiledChatTemplate> compiled_;
 };
 
 }  // namespace llm
\ No newline at end of file
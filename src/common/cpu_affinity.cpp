@@ -0,0 +1,167 @@
+#include "cpu_affinity.h"
+
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_split.h>
+#include <absl/strings/strip.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace llm {
+namespace {
+
+constexpr char kNumaNodeDir[] = "/sys/devices/system/node";
+
+// max number of numa nodes in the node mask
+constexpr int32_t kMaxNumaNodes = 1024;
+
+}  // namespace
+
+std::vector<int32_t> parse_cpu_list(const std::string& cpu_list) {
+  std::vector<int32_t> cpus;
+  for (absl::string_view part :
+       absl::StrSplit(cpu_list, ',', absl::SkipWhitespace())) {
+    part = absl::StripAsciiWhitespace(part);
+    const std::vector<absl::string_view> range = absl::StrSplit(part, '-');
+    int32_t first = -1;
+    int32_t last = -1;
+    if (range.size() > 2 || !absl::SimpleAtoi(range.front(), &first) ||
+        !absl::SimpleAtoi(range.back(), &last) || first < 0 || first > last) {
+      LOG(ERROR) << "Failed to parse cpus: " << part;
+      continue;
+    }
+    for (int32_t cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
+bool set_thread_affinity(const std::vector<int32_t>& cpus) {
+#ifdef __linux__
+  if (cpus.empty()) {
+    return false;
+  }
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (const int32_t cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      LOG(ERROR) << "Invalid cpu: " << cpu;
+      return false;
+    }
+    CPU_SET(cpu, &cpu_set);
+  }
+  const int ret =
+      pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (ret != 0) {
+    LOG(ERROR) << "Failed to set thread affinity, error: " << ret;
+    return false;
+  }
+  return true;
+#else
+  LOG(WARNING) << "Thread affinity is not supported on this platform.";
+  return false;
+#endif
+}
+
+std::vector<int32_t> get_thread_affinity() {
+  std::vector<int32_t> cpus;
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+    return cpus;
+  }
+  for (int32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &cpu_set)) {
+      cpus.push_back(cpu);
+    }
+  }
+#endif
+  return cpus;
+}
+
+ScopedThreadAffinity::ScopedThreadAffinity(const std::vector<int32_t>& cpus) {
+  if (cpus.empty()) {
+    return;
+  }
+  auto prev_cpus = get_thread_affinity();
+  if (set_thread_affinity(cpus)) {
+    prev_cpus_ = std::move(prev_cpus);
+  }
+}
+
+ScopedThreadAffinity::~ScopedThreadAffinity() {
+  if (!prev_cpus_.empty()) {
+    set_thread_affinity(prev_cpus_);
+  }
+}
+
+std::vector<int32_t> numa_node_cpus(int32_t node) {
+  const auto path = std::filesystem::path(kNumaNodeDir) /
+                    ("node" + std::to_string(node)) / "cpulist";
+  std::ifstream file(path);
+  std::string cpu_list;
+  if (!file || !std::getline(file, cpu_list)) {
+    return {};
+  }
+  return parse_cpu_list(cpu_list);
+}
+
+int32_t numa_node_of_cpu(int32_t cpu) {
+  std::error_code ec;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(kNumaNodeDir, ec)) {
+    absl::string_view name = entry.path().filename().native();
+    int32_t node = -1;
+    if (!absl::ConsumePrefix(&name, "node") || !absl::SimpleAtoi(name, &node)) {
+      continue;
+    }
+    const auto cpus = numa_node_cpus(node);
+    if (std::binary_search(cpus.begin(), cpus.end(), cpu)) {
+      return node;
+    }
+  }
+  return -1;
+}
+
+bool bind_memory_to_numa_node(int32_t node) {
+#ifdef __linux__
+  if (node < 0 || node >= kMaxNumaNodes) {
+    LOG(ERROR) << "Invalid numa node: " << node;
+    return false;
+  }
+  constexpr int32_t kBitsPerLong = sizeof(unsigned long) * 8;
+  unsigned long node_mask[kMaxNumaNodes / kBitsPerLong] = {};
+  node_mask[node / kBitsPerLong] |= 1UL << (node % kBitsPerLong);
+  // the kernel takes one more than the number of bits in the mask
+  const long ret = syscall(
+      SYS_set_mempolicy, MPOL_BIND, node_mask, kMaxNumaNodes + 1);
+  if (ret != 0) {
+    PLOG(ERROR) << "Failed to bind memory to numa node " << node;
+    return false;
+  }
+  return true;
+#else
+  LOG(WARNING) << "Numa binding is not supported on this platform.";
+  return false;
+#endif
+}
+
+}  // namespace llm
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace llm {
+
+// parse a cpu list, e.g. "0-3,8,10-11", into sorted unique cpu ids.
+// invalid parts are logged and skipped.
+std::vector<int32_t> parse_cpu_list(const std::string& cpu_list);
+
+// pin the calling thread to the cpus, threads created by it afterwards
+// inherit the affinity. returns false if not supported or failed.
+bool set_thread_affinity(const std::vector<int32_t>& cpus);
+
+// get the cpus that the calling thread is allowed to run on
+std::vector<int32_t> get_thread_affinity();
+
+// pin the calling thread to the cpus within the scope, so that only threads
+// created in the scope inherit them, and restore its affinity on exit.
+// no-op if cpus is empty.
+class ScopedThreadAffinity final {
+ public:
+  explicit ScopedThreadAffinity(const std::vector<int32_t>& cpus);
+
+  ~ScopedThreadAffinity();
+
+  // not copyable
+  ScopedThreadAffinity(const ScopedThreadAffinity&) = delete;
+  ScopedThreadAffinity& operator=(const ScopedThreadAffinity&) = delete;
+
+ private:
+  // cpus to restore on exit, empty if not pinned
+  std::vector<int32_t> prev_cpus_;
+};
+
+// get the cpus of the numa node, empty if the node is unknown
+std::vector<int32_t> numa_node_cpus(int32_t node);
+
+// get the numa node of the cpu, -1 if unknown
+int32_t numa_node_of_cpu(int32_t cpu);
+
+// bind memory allocated by the calling thread, and threads created by it
+// afterwards, to the numa node. pages are placed when first touched.
+// returns false if not supported or failed.
+bool bind_memory_to_numa_node(int32_t node);
+
+}  // namespace llm
@@ -0,0 +1,76 @@
+#include "cpu_affinity.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+namespace llm {
+
+TEST(CpuAffinityTest, ParseCpuList) {
+  EXPECT_EQ(parse_cpu_list("0-3,8,10-11"),
+            std::vector<int32_t>({0, 1, 2, 3, 8, 10, 11}));
+  // sorted and deduplicated
+  EXPECT_EQ(parse_cpu_list(" 4, 2-4 ,1"), std::vector<int32_t>({1, 2, 3, 4}));
+  EXPECT_TRUE(parse_cpu_list("").empty());
+  // invalid parts are skipped
+  EXPECT_EQ(parse_cpu_list("3-1,a,2,1-2-3,-1"), std::vector<int32_t>({2}));
+}
+
+TEST(CpuAffinityTest, SetThreadAffinity) {
+  const auto cpus = get_thread_affinity();
+  ASSERT_FALSE(cpus.empty());
+
+  // pin a new thread to avoid changing the affinity of the test thread
+  std::vector<int32_t> pinned_cpus;
+  std::vector<int32_t> child_cpus;
+  std::thread thread([&]() {
+    ASSERT_TRUE(set_thread_affinity({cpus.front()}));
+    pinned_cpus = get_thread_affinity();
+    // threads created afterwards inherit the affinity
+    std::thread child([&]() { child_cpus = get_thread_affinity(); });
+    child.join();
+  });
+  thread.join();
+  EXPECT_EQ(pinned_cpus, std::vector<int32_t>({cpus.front()}));
+  EXPECT_EQ(child_cpus, std::vector<int32_t>({cpus.front()}));
+  EXPECT_EQ(get_thread_affinity(), cpus);
+}
+
+TEST(CpuAffinityTest, ScopedThreadAffinity) {
+  const auto cpus = get_thread_affinity();
+  ASSERT_FALSE(cpus.empty());
+  const std::vector<int32_t> io_cpus = {cpus.back()};
+
+  // io threads are created in the scope, workers after it
+  std::vector<int32_t> io_thread_cpus;
+  std::vector<int32_t> worker_cpus;
+  std::thread thread([&]() {
+    {
+      ScopedThreadAffinity affinity(io_cpus);
+      std::thread io_thread([&]() { io_thread_cpus = get_thread_affinity(); });
+      io_thread.join();
+    }
+    std::thread worker([&]() { worker_cpus = get_thread_affinity(); });
+    worker.join();
+  });
+  thread.join();
+  EXPECT_EQ(io_thread_cpus, io_cpus);
+  // workers never inherit the io cpus
+  EXPECT_EQ(worker_cpus, cpus);
+  if (cpus.size() > 1) {
+    EXPECT_NE(worker_cpus, io_cpus);
+  }
+}
+
+TEST(CpuAffinityTest, NumaNodeOfCpu) {
+  const int32_t node = numa_node_of_cpu(get_thread_affinity().front());
+  if (node < 0) {
+    GTEST_SKIP() << "numa nodes are not available";
+  }
+  const auto cpus = numa_node_cpus(node);
+  EXPECT_FALSE(cpus.empty());
+  EXPECT_EQ(numa_node_of_cpu(cpus.front()), node);
+}
+
+}  // namespace llm
@@ -1,6 +1,11 @@
 #include "threadpool.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
 
 #include "concurrent_queue.h"
@@ -31,6 +36,55 @@ void ThreadPool::schedule(Runnable runnable) {
   queue_.push(std::move(runnable));
 }
 
+void ThreadPool::parallel_for(size_t n,
+                              const std::function<void(size_t)>& func) {
+  if (n == 0) {
+    return;
+  }
+
+  // shared with the helper tasks, which may start after all calls are done
+  struct State {
+    std::atomic<size_t> next{0};
+    size_t n = 0;
+    const std::function<void(size_t)>* func = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t num_done = 0;
+  };
+  auto state = std::make_shared<State>();
+  state->n = n;
+  state->func = &func;
+
+  // claim indices one by one until all are claimed. func is only accessed
+  // for claimed indices, so it is alive while the caller waits for them.
+  auto run = [](State* state) {
+    size_t num_done = 0;
+    for (size_t i = state->next.fetch_add(1); i < state->n;
+         i = state->next.fetch_add(1)) {
+      (*state->func)(i);
+      ++num_done;
+    }
+    if (num_done > 0) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->num_done += num_done;
+      if (state->num_done == state->n) {
+        state->cv.notify_all();
+      }
+    }
+  };
+
+  const size_t num_helpers = std::min(threads_.size(), n - 1);
+  for (size_t i = 0; i < num_helpers; ++i) {
+    schedule([state, run]() { run(state.get()); });
+  }
+  run(state.get());
+
+  // wait for the calls claimed by helpers
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->cv.wait(lock, [&state]() { return state->num_done == state->n; });
+}
+
 void ThreadPool::internal_loop() {
   while (true) {
     Runnable runnable = queue_.pop();
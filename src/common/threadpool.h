@@ -1,5 +1,7 @@
 #pragma once
 #include <folly/Function.h>
+
+#include <functional>
 #include <thread>
 
 #include "concurrent_queue.h"
@@ -29,6 +31,14 @@ class ThreadPool final {
   // schedule a runnable to be executed
   void schedule(Runnable runnable);
 
+  // run func(i) for i in [0, n) on the threads of the threadpool and the
+  // calling thread, returns after all calls are done. the calling thread
+  // also runs the calls, so it is safe to call from a thread of the pool.
+  void parallel_for(size_t n, const std::function<void(size_t)>& func);
+
+  // get the number of threads
+  size_t size() const { return threads_.size(); }
+
  private:
   void internal_loop();
 
@@ -72,4 +72,27 @@ TEST(ThreadPoolTest, MultipleThreads) {
   EXPECT_EQ(counter, 10);
 }
 
+TEST(ThreadPoolTest, ParallelFor) {
+  ThreadPool threadpool(4);
+  std::vector<int> results(1000, 0);
+  threadpool.parallel_for(results.size(),
+                          [&results](size_t i) { results[i] += i; });
+  for (size_t i = 0; i < results.size(); ++i) {
+    EXPECT_EQ(results[i], i);
+  }
+
+  // no calls for empty range
+  threadpool.parallel_for(0, [](size_t /*i*/) { FAIL(); });
+}
+
+TEST(ThreadPoolTest, NestedParallelFor) {
+  // all threads of the pool call parallel_for, which should not deadlock
+  ThreadPool threadpool(2);
+  std::atomic_uint32_t counter = 0;
+  threadpool.parallel_for(4, [&threadpool, &counter](size_t /*i*/) {
+    threadpool.parallel_for(10, [&counter](size_t /*j*/) { counter++; });
+  });
+  EXPECT_EQ(counter, 40);
+}
+
 }  // namespace llm
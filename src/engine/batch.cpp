@@ -1,33 +1,25 @@
 #include "batch.h"
 
+#include <absl/container/flat_hash_map.h>
 #include <torch/torch.h>
 
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <memory>
 #include <vector>
 
 #include "common/slice.h"
 #include "common/tensor_helper.h"
+#include "common/threadpool.h"
+#include "model_input_builder.h"
 #include "models/parameters.h"
+#include "request/beam_group.h"
 #include "request/sequence.h"
 #include "sampling/parameters.h"
 
 namespace llm {
 
-namespace {
-
-template <typename T>
-void pad_2d_vector(std::vector<std::vector<T>>& vec, T pad_value) {
-  size_t max_col_size = 0;
-  for (const auto& row : vec) {
-    max_col_size = std::max(max_col_size, row.size());
-  }
-
-  for (auto& row : vec) {
-    row.resize(max_col_size, pad_value);
-  }
-}
-
-}  // namespace
-
 Batch::Batch(Sequence* sequence) { add(sequence); }
 Batch::Batch(const std::vector<Sequence*>& sequences) { add(sequences); }
 
@@ -44,6 +36,15 @@ void Batch::add(Sequence* sequence, uint32_t token_budget) {
   sequences_.push_back(sequence);
   token_budgets_.push_back(token_budget);
   budget_used_.push_back(0);
+
+  // take over pending block copies of the sequence
+  auto block_copies = sequence->take_block_copies();
+  if (!block_copies.empty()) {
+    block_copies_.insert(block_copies_.end(),
+                         std::make_move_iterator(block_copies.begin()),
+                         std::make_move_iterator(block_copies.end()));
+    block_copies_pending_ = true;
+  }
 }
 
 void Batch::add(const std::vector<Sequence*>& sequences) {
@@ -59,47 +60,65 @@ void Batch::set_engine_type(EngineType engine_type) {
   }
   // reset the budget used
   std::fill(budget_used_.begin(), budget_used_.end(), 0);
+  // block copies need to be applied to the kv cache of each engine
+  block_copies_pending_ = !block_copies_.empty();
 }
 
 void Batch::clear() {
   sequences_.clear();
   token_budgets_.clear();
   budget_used_.clear();
+  block_copies_.clear();
+  block_copies_pending_ = false;
+}
+
+std::vector<Batch> Batch::split(size_t max_batches) const {
+  std::vector<Batch> batches;
+  if (sequences_.empty()) {
+    return batches;
+  }
+  const size_t num_batches =
+      std::clamp<size_t>(max_batches, 1, sequences_.size());
+  const size_t max_batch_size =
+      (sequences_.size() + num_batches - 1) / num_batches;
+  for (size_t i = 0; i < sequences_.size(); ++i) {
+    auto* sequence = sequences_[i];
+    const bool same_beam_group = i > 0 && sequence->beam_group() != nullptr &&
+                                 sequence->beam_group() ==
+                                     sequences_[i - 1]->beam_group();
+    if (batches.empty() ||
+        (batches.back().size() >= max_batch_size && !same_beam_group)) {
+      batches.emplace_back();
+    }
+    auto& batch = batches.back();
+    batch.sequences_.push_back(sequence);
+    batch.token_budgets_.push_back(token_budgets_[i]);
+    batch.budget_used_.push_back(budget_used_[i]);
+  }
+  batches.front().block_copies_ = block_copies_;
+  batches.front().block_copies_pending_ = block_copies_pending_;
+  return batches;
 }
 
 // prepare inputs for the batch
 // NOLINTNEXTLINE
 ModelInput Batch::prepare_model_input(uint32_t num_decoding_tokens,
-                                      uint32_t min_decoding_bach_size) {
-  // flatten the token ids and positions
-  std::vector<int32_t> flatten_tokens_vec;
-  std::vector<int32_t> flatten_positions_vec;
-
-  // sleceted tokens to return logits, including generated tokens and last
-  // prompt token
-  std::vector<const SamplingParameter*> sampling_params;
-  std::vector<int32_t> selected_token_idxes;
-  // track the last token of selected tokens for sampling
-  std::vector<int32_t> sample_idxes;
-
-  // track the unique token ids and counts in the batch
-  std::vector<std::vector<int64_t>> unique_token_ids_vec;
-  std::vector<std::vector<int32_t>> unique_token_counts_vec;
-  std::vector<int32_t> unique_token_lens_vec;
+                                      uint32_t min_decoding_bach_size,
+                                      ThreadPool* threadpool,
+                                      ModelInputBuilder* builder) {
+  // build the input with temporary buffers if no builder is given
+  std::unique_ptr<ModelInputBuilder> local_builder;
+  if (builder == nullptr) {
+    local_builder = std::make_unique<ModelInputBuilder>();
+    builder = local_builder.get();
+  }
+  builder->reset();
 
   bool empty_kv_cache = true;
-  uint32_t max_seq_len = 0;
-  uint32_t q_max_seq_len = 0;
-  std::vector<int32_t> cu_seq_lens = {0};
-  std::vector<int32_t> q_cu_seq_lens = {0};
-  // slot ids for new token
-  std::vector<int32_t> new_token_slot_ids;
-  std::vector<std::vector<int32_t>> block_tables_vec;
   const int32_t num_sequences = static_cast<int32_t>(sequences_.size());
   for (int32_t i = 0; i < num_sequences; ++i) {
     auto* sequence = sequences_[i];
-    const auto token_ids = sequence->token_ids();
-    const uint32_t n_tokens = token_ids.size();
+    const uint32_t n_tokens = sequence->num_tokens();
     const uint32_t n_kv_cache_tokens = sequence->num_kv_cache_tokens();
 
     empty_kv_cache = empty_kv_cache && (n_kv_cache_tokens == 0);
@@ -130,86 +149,15 @@ ModelInput Batch::prepare_model_input(uint32_t num_decoding_tokens,
     // update budget used
     budget_used_[i] += q_seq_len;
 
-    // update sequence length
-    max_seq_len = std::max(max_seq_len, seq_len);
-    q_max_seq_len = std::max(q_max_seq_len, q_seq_len);
-    cu_seq_lens.push_back(cu_seq_lens.back() + seq_len);
-    q_cu_seq_lens.push_back(q_cu_seq_lens.back() + q_seq_len);
-
-    // pack the token ids and positions into one-dimensional tensors
-    // and select tokens for sampling the next token
-    const uint32_t n_prompt_tokens = sequence->num_prompt_tokens();
-    std::unordered_map<int32_t, int32_t> adjusted_token_to_count_map;
-    for (uint32_t j = n_kv_cache_tokens; j < seq_len; ++j) {
-      // skip prompt tokens except the last one
-      if (j + 1 < n_prompt_tokens) {
-        continue;
-      }
-      ++adjusted_token_to_count_map[token_ids[j]];
-    }
-
-    bool has_selected_token = false;
-    for (uint32_t j = n_kv_cache_tokens; j < seq_len; ++j) {
-      flatten_tokens_vec.push_back(token_ids[j]);
-      flatten_positions_vec.push_back(static_cast<int32_t>(j));
-
-      // skip prompt tokens except the last one
-      if (j + 1 < n_prompt_tokens) {
-        continue;
-      }
-
-      // adjust token count for current token
-      --adjusted_token_to_count_map[token_ids[j]];
-
-      // select tokens for sampling the next token
-      selected_token_idxes.push_back(flatten_tokens_vec.size() - 1);
-      sampling_params.push_back(sequence->sampling_param());
-
-      // add token id and count for sampling
-      const auto& seq_token_counts = sequence->token_to_count_map();
-      const auto unique_tokens = seq_token_counts.size();
-
-      auto& ids = unique_token_ids_vec.emplace_back();
-      auto& counts = unique_token_counts_vec.emplace_back();
-      ids.reserve(unique_tokens);
-      counts.reserve(unique_tokens);
-      for (const auto& [token_id, count] : seq_token_counts) {
-        const auto it = adjusted_token_to_count_map.find(token_id);
-        const auto adjust_count =
-            it != adjusted_token_to_count_map.end() ? it->second : 0;
-        if (count > adjust_count) {
-          ids.push_back(token_id);
-          counts.push_back(count - adjust_count);
-        }
-      }
-      unique_token_lens_vec.push_back(static_cast<int32_t>(ids.size()));
-
-      // sample last token in the sequence
-      if (j == seq_len - 1) {
-        sample_idxes.push_back(
-            static_cast<int32_t>(selected_token_idxes.size() - 1));
-      }
-    }
+    // pack the token ids, positions, slots and blocks of the sequence, and
+    // select tokens for sampling the next token
+    builder->add_sequence(*sequence, n_kv_cache_tokens, seq_len);
 
     // commit kv cache to advance kv_cache pos in sequence
     sequence->commit_kv_cache(/*size=*/q_seq_len);
-
-    // assign slot ids for new tokens [n_tokens_in_kvcache, total_tokens)
-    const auto blocks = sequence->blocks();
-    const auto slot_ids = sequence->kv_cache_slots(n_kv_cache_tokens, seq_len);
-    new_token_slot_ids.insert(
-        new_token_slot_ids.end(), slot_ids.begin(), slot_ids.end());
-
-    // construct block ids for each sequence
-    std::vector<int32_t> block_ids;
-    block_ids.reserve(blocks.size());
-    for (const auto& block : blocks) {
-      block_ids.push_back(block.id());
-    }
-    block_tables_vec.push_back(block_ids);
   }
 
-  if (flatten_tokens_vec.empty()) {
+  if (builder->num_tokens() == 0) {
     // no tokens to process
     return {};
   }
@@ -217,63 +165,122 @@ ModelInput Batch::prepare_model_input(uint32_t num_decoding_tokens,
   // padding the batch to the minimum decoding batch size for cuda graph
   // TODO: move the logic to a better place
   if (num_sequences < min_decoding_bach_size) {
-    const uint32_t n_tokens = flatten_tokens_vec.size();
+    const uint32_t n_tokens = builder->num_tokens();
     // kv_cache is not empty in decoding phase
     const bool in_decoding_phase = !empty_kv_cache;
     const bool same_num_decoding_tokens =
-        q_max_seq_len == num_decoding_tokens &&
+        builder->q_max_seq_len() == num_decoding_tokens &&
         n_tokens == num_sequences * num_decoding_tokens;
     if (in_decoding_phase && same_num_decoding_tokens) {
-      // add padding tokens to the batch
-      for (int32_t i = num_sequences; i < min_decoding_bach_size; ++i) {
-        for (int32_t k = 0; k < num_decoding_tokens; ++k) {
-          flatten_tokens_vec.push_back(0);
-          flatten_positions_vec.push_back(0);
-          new_token_slot_ids.push_back(0);
-        }
-        cu_seq_lens.push_back(cu_seq_lens.back() + num_decoding_tokens);
-        q_cu_seq_lens.push_back(q_cu_seq_lens.back() + num_decoding_tokens);
-        block_tables_vec.emplace_back();
-      }
+      builder->add_padding_sequences(min_decoding_bach_size - num_sequences,
+                                     num_decoding_tokens);
     }
   }
 
-  ModelInput model_inputs;
-  model_inputs.token_ids = torch::tensor(flatten_tokens_vec, torch::kInt);
-  model_inputs.positions = torch::tensor(flatten_positions_vec, torch::kInt);
-
-  auto& input_params = model_inputs.input_params;
-  input_params.empty_kv_cache = empty_kv_cache;
-  input_params.num_sequences = num_sequences;
-  input_params.kv_max_seq_len = max_seq_len;
-  input_params.q_max_seq_len = q_max_seq_len;
-  input_params.kv_cu_seq_lens = torch::tensor(cu_seq_lens, torch::kInt);
-  input_params.q_cu_seq_lens = torch::tensor(q_cu_seq_lens, torch::kInt);
-  input_params.new_cache_slots = torch::tensor(new_token_slot_ids, torch::kInt);
-
-  pad_2d_vector(block_tables_vec, /*pad_value=*/0);
-  input_params.block_tables = create_2d_tensor(block_tables_vec, torch::kInt);
-
-  CHECK_EQ(sampling_params.size(), selected_token_idxes.size());
-  if (!selected_token_idxes.empty()) {
-    pad_2d_vector<int64_t>(unique_token_ids_vec, /*pad_value=*/0);
-    pad_2d_vector(unique_token_counts_vec, /*pad_value=*/0);
-    model_inputs.sampling_params.init(sampling_params,
-                                      selected_token_idxes,
-                                      sample_idxes,
-                                      unique_token_ids_vec,
-                                      unique_token_counts_vec,
-                                      unique_token_lens_vec);
+  if (block_copies_pending_) {
+    for (const auto& [src_block, dst_block_id] : block_copies_) {
+      builder->add_block_copy(src_block.id(), dst_block_id);
+    }
+    block_copies_pending_ = false;
+  }
+
+  ModelInput model_inputs = builder->build();
+  model_inputs.input_params.empty_kv_cache = empty_kv_cache;
+  model_inputs.input_params.num_sequences = num_sequences;
+
+  if (!builder->constrained_sequences().empty()) {
+    auto& sampling_params = model_inputs.sampling_params;
+    auto compute_bitmasks =
+        [sequences = builder->constrained_sequences()]() -> torch::Tensor {
+      size_t num_words = 0;
+      for (const auto* sequence : sequences) {
+        num_words =
+            std::max(num_words, sequence->grammar()->num_bitmask_words());
+      }
+      auto bitmasks = torch::empty(
+          {static_cast<int64_t>(sequences.size()),
+           static_cast<int64_t>(num_words)},
+          torch::kInt);
+      auto* data = reinterpret_cast<uint32_t*>(bitmasks.data_ptr<int32_t>());
+      for (size_t i = 0; i < sequences.size(); ++i) {
+        sequences[i]->fill_allowed_tokens(data + i * num_words, num_words);
+      }
+      return bitmasks;
+    };
+
+    if (threadpool != nullptr) {
+      // sequences are not updated until the sample output is processed
+      std::promise<torch::Tensor> promise;
+      sampling_params.allowed_token_bitmasks_future =
+          promise.get_future().share();
+      threadpool->schedule(
+          [compute_bitmasks = std::move(compute_bitmasks),
+           promise = std::move(promise)]() mutable {
+            promise.set_value(compute_bitmasks());
+          });
+    } else {
+      sampling_params.allowed_token_bitmasks = compute_bitmasks();
+    }
   }
 
   return model_inputs;
 }
 
+uint32_t Batch::num_decoding_steps(uint32_t max_steps) const {
+  size_t num_steps = max_steps;
+  for (size_t i = 0; i < sequences_.size() && num_steps > 1; ++i) {
+    const auto* sequence = sequences_[i];
+    const size_t n_tokens = sequence->num_tokens();
+    const size_t n_kv_cache_tokens = sequence->num_kv_cache_tokens();
+    // one token to decode in each step
+    if (sequence->is_prefill_stage() || n_tokens != n_kv_cache_tokens + 1 ||
+        budget_used_[i] >= token_budgets_[i]) {
+      return 1;
+    }
+
+    const auto* param = sequence->sampling_param();
+    const bool need_token_stats = param->frequency_penalty != 0.0 ||
+                                  param->presence_penalty != 0.0 ||
+                                  param->repetition_penalty != 1.0;
+    if (sequence->beam_group() != nullptr || sequence->grammar() != nullptr ||
+        need_token_stats) {
+      return 1;
+    }
+
+    // kv cache slots and token capacity for tokens of all steps
+    num_steps = std::min({num_steps,
+                          sequence->kv_cache_capacity() - n_kv_cache_tokens,
+                          sequence->capacity() - n_tokens});
+    // no need to decode beyond the max tokens
+    const size_t max_tokens = sequence->stopping_criteria()->max_tokens;
+    const size_t n_generated_tokens = sequence->num_generated_tokens();
+    if (max_tokens > n_generated_tokens) {
+      num_steps = std::min(num_steps, max_tokens - n_generated_tokens);
+    }
+  }
+  return static_cast<uint32_t>(std::max<size_t>(num_steps, 1));
+}
+
 void Batch::process_sample_output(const SampleOutput& sample_output) {
   // it is possible that the model output is empty for prefill sequences
   if (sample_output.next_tokens.defined()) {
+    // [num_seqs] or [num_seqs, num_steps] for multiple decoding steps
     const auto& next_tokens = sample_output.next_tokens.cpu();
-    const int64_t num_seqs = next_tokens.numel();
+    const int64_t num_seqs = next_tokens.size(/*dim=*/0);
+    const int64_t num_steps =
+        next_tokens.dim() == 2 ? next_tokens.size(/*dim=*/1) : 1;
+    const auto step_tokens = next_tokens.view({num_seqs, num_steps});
+    torch::Tensor step_logprobs;
+    if (sample_output.next_logprobs.defined()) {
+      step_logprobs =
+          sample_output.next_logprobs.cpu().view({num_seqs, num_steps});
+    }
+
+    // beams and their output indices for each beam group
+    absl::flat_hash_map<BeamGroup*,
+                        std::pair<std::vector<Sequence*>, std::vector<int64_t>>>
+        beam_groups;
+
     int64_t output_idx = 0;
     for (auto* seq : sequences_) {
       if (seq->is_prefill_stage()) {
@@ -281,14 +288,95 @@ void Batch::process_sample_output(const SampleOutput& sample_output) {
         continue;
       }
       CHECK_LT(output_idx, num_seqs);
+      const int64_t idx = output_idx++;
+
+      // beams are advanced together with other beams in the same group
+      if (auto* beam_group = seq->beam_group(); beam_group != nullptr) {
+        auto& [beams, output_idxes] = beam_groups[beam_group];
+        beams.push_back(seq);
+        output_idxes.push_back(idx);
+        continue;
+      }
 
-      // add the next token to sequence
-      const int32_t next_token_id =
-          static_cast<int32_t>(next_tokens[output_idx++].item<int64_t>());
-      seq->append_token(next_token_id);
+      // add the next tokens to sequence until it finishes
+      for (int64_t step = 0; step < num_steps; ++step) {
+        if (step > 0) {
+          if (seq->is_finished()) {
+            break;
+          }
+          // the previous token has been written into the kv cache
+          seq->commit_kv_cache(/*size=*/1);
+        }
+        const int32_t next_token_id =
+            static_cast<int32_t>(step_tokens[idx][step].item<int64_t>());
+        const float next_logprob = step_logprobs.defined()
+                                       ? step_logprobs[idx][step].item<float>()
+                                       : 0.0f;
+        seq->append_token(next_token_id, next_logprob);
+      }
     }
     CHECK_EQ(output_idx, num_seqs);
+
+    for (auto& [beam_group, beams_data] : beam_groups) {
+      const auto& [beams, output_idxes] = beams_data;
+      process_beam_search_output(
+          beam_group, beams, output_idxes, sample_output.logprobs);
+    }
+  }
+}
+
+void Batch::process_beam_search_output(BeamGroup* beam_group,
+                                       const std::vector<Sequence*>& beams,
+                                       const std::vector<int64_t>& output_idxes,
+                                       const torch::Tensor& logprobs) {
+  CHECK(logprobs.defined());
+  // all live beams should be processed in the same step, otherwise recompute
+  // the last token for the beams to wait for the others.
+  if (beams.size() != beam_group->num_live_beams()) {
+    for (auto* beam : beams) {
+      beam->rollback_kv_cache(/*size=*/1);
+    }
+    return;
+  }
+
+  const auto device = logprobs.device();
+  std::vector<float> cumulative_logprobs;
+  cumulative_logprobs.reserve(beams.size());
+  for (const auto* beam : beams) {
+    cumulative_logprobs.push_back(beam->cumulative_logprob());
+  }
+  const auto idxes = torch::tensor(output_idxes, torch::kLong).to(device);
+  const auto cum_logprobs =
+      torch::tensor(cumulative_logprobs, torch::kFloat).to(device);
+
+  // [num_beams, vocab_size]
+  const auto scores =
+      logprobs.index_select(/*dim=*/0, idxes) + cum_logprobs.unsqueeze(1);
+  const int64_t vocab_size = scores.size(1);
+  // take 2 * beam_width candidates in case some of them are stopped
+  const int64_t k = std::min<int64_t>(
+      2 * static_cast<int64_t>(beam_group->beam_width()), scores.numel());
+  auto [top_scores, top_idxes] = scores.view({-1}).topk(k);
+  top_scores = top_scores.cpu();
+  top_idxes = top_idxes.cpu();
+
+  const float* top_scores_ptr = top_scores.data_ptr<float>();
+  const int64_t* top_idxes_ptr = top_idxes.data_ptr<int64_t>();
+  std::vector<BeamGroup::Candidate> candidates;
+  candidates.reserve(k);
+  for (int64_t i = 0; i < k; ++i) {
+    // the rest of candidates are not allowed by the grammar
+    if (std::isinf(top_scores_ptr[i])) {
+      break;
+    }
+    const size_t beam_idx = top_idxes_ptr[i] / vocab_size;
+    auto& candidate = candidates.emplace_back();
+    candidate.beam_idx = beam_idx;
+    candidate.token_id = static_cast<int32_t>(top_idxes_ptr[i] % vocab_size);
+    candidate.cumulative_logprob = top_scores_ptr[i];
+    candidate.logprob = top_scores_ptr[i] - cumulative_logprobs[beam_idx];
   }
+  beam_group->step(beams, candidates);
 }
 
 void Batch::process_validate_output(const torch::Tensor& accepted_ids) {
@@ -3,9 +3,14 @@
 #include <torch/torch.h>
 
 #include <limits>
+#include <utility>
 #include <vector>
 
+#include "common/threadpool.h"
+#include "memory/block.h"
+#include "model_input_builder.h"
 #include "parameters.h"
+#include "request/beam_group.h"
 #include "request/sequence.h"
 
 namespace llm {
@@ -44,11 +49,30 @@ class Batch {
   // TODO: remove this operator once refactoring is done
   Sequence* operator[](size_t i) { return sequences_[i]; }
 
+  // split the batch into up to max_batches batches of consecutive sequences
+  // with similar sizes, keeping beams of a group in the same batch. pending
+  // block copies go to the first batch.
+  std::vector<Batch> split(size_t max_batches) const;
+
   // prepare inputs for the batch, a stateful operation
+  // the allowed tokens of constrained sequences are computed in the threadpool
+  // alongside the forward pass if given, otherwise computed inline.
+  // inputs are built in the buffers of the builder if given, which are reused
+  // across steps, otherwise in temporary buffers.
   ModelInput prepare_model_input(uint32_t num_decoding_tokens,
-                                 uint32_t min_decoding_bach_size);
+                                 uint32_t min_decoding_bach_size,
+                                 ThreadPool* threadpool = nullptr,
+                                 ModelInputBuilder* builder = nullptr);
+
+  // get the number of decoding steps, up to max_steps, that the batch can run
+  // back to back without the host. all sequences should be decoding one token
+  // without beams, grammars or penalties, which depend on the sampled tokens
+  // of each step, and have kv cache slots for tokens of all steps.
+  uint32_t num_decoding_steps(uint32_t max_steps) const;
 
   // process the sample output for each sequence
+  // next tokens of multiple decoding steps are appended until the sequence
+  // finishes, with tokens after that discarded.
   void process_sample_output(const SampleOutput& sample_output);
 
   // process the accepted output for each sequence
@@ -58,6 +82,14 @@ class Batch {
   void set_engine_type(EngineType engine_type);
 
  private:
+  // advance beams of a beam group with one batched top-k over
+  // [num_beams, vocab_size] scores.
+  // logprobs: [num_seqs, vocab_size], output_idxes: row of each beam
+  void process_beam_search_output(BeamGroup* beam_group,
+                                  const std::vector<Sequence*>& beams,
+                                  const std::vector<int64_t>& output_idxes,
+                                  const torch::Tensor& logprobs);
+
   // sequences in the batch
   std::vector<Sequence*> sequences_;
 
@@ -67,6 +99,12 @@ class Batch {
 
   // number of used budget for each sequence
   std::vector<uint32_t> budget_used_;
+
+  // pending (src block, dst block id) copies for copy-on-write blocks
+  std::vector<std::pair<Block, int32_t>> block_copies_;
+
+  // whether the block copies should be carried in next model input
+  bool block_copies_pending_ = false;
 };
 
 }  // namespace llm
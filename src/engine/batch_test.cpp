@@ -140,4 +140,82 @@ TEST(BatchTest, Basic) {
   // clang-format on
 }
 
+TEST(BatchTest, NumDecodingSteps) {
+  BlockAllocator allocator(/*n_blocks=*/20, /*block_size=*/4);
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 20;
+  const size_t capacity = 100;
+
+  // 5 slots left in the kv cache
+  Sequence seq1(/*prompt=*/"", /*token_ids=*/{1, 2, 3, 4, 5, 6, 7}, capacity,
+                options);
+  seq1.append_blocks(allocator.allocate(3));
+  seq1.commit_kv_cache(/*size=*/7);
+  seq1.append_token(8);
+
+  // 2 tokens left to generate
+  options.stopping_criteria.max_tokens = 3;
+  Sequence seq2(/*prompt=*/"", /*token_ids=*/{1, 2, 3}, capacity, options);
+  seq2.append_blocks(allocator.allocate(3));
+  seq2.commit_kv_cache(/*size=*/3);
+  seq2.append_token(4);
+
+  EXPECT_EQ(Batch(&seq1).num_decoding_steps(/*max_steps=*/8), 5);
+  EXPECT_EQ(Batch(&seq1).num_decoding_steps(/*max_steps=*/4), 4);
+  EXPECT_EQ(Batch({&seq1, &seq2}).num_decoding_steps(/*max_steps=*/8), 2);
+
+  // prefill sequence
+  Sequence seq3(/*prompt=*/"", /*token_ids=*/{1, 2, 3}, capacity, options);
+  seq3.append_blocks(allocator.allocate(1));
+  EXPECT_EQ(Batch({&seq1, &seq3}).num_decoding_steps(/*max_steps=*/8), 1);
+
+  // penalties depend on the sampled tokens of each step
+  options.stopping_criteria.max_tokens = 20;
+  options.sampling_param.repetition_penalty = 1.2;
+  Sequence seq4(/*prompt=*/"", /*token_ids=*/{1, 2, 3}, capacity, options);
+  seq4.append_blocks(allocator.allocate(2));
+  seq4.commit_kv_cache(/*size=*/3);
+  seq4.append_token(4);
+  EXPECT_EQ(Batch({&seq1, &seq4}).num_decoding_steps(/*max_steps=*/8), 1);
+}
+
+TEST(BatchTest, ProcessMultiStepSampleOutput) {
+  BlockAllocator allocator(/*n_blocks=*/20, /*block_size=*/4);
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 20;
+  options.stopping_criteria.eos_token_id = 2;
+  const size_t capacity = 100;
+
+  Sequence seq1(/*prompt=*/"", /*token_ids=*/{1, 3, 5}, capacity, options);
+  seq1.append_blocks(allocator.allocate(2));
+  seq1.commit_kv_cache(/*size=*/3);
+  seq1.append_token(7);
+
+  Sequence seq2(/*prompt=*/"", /*token_ids=*/{4, 6}, capacity, options);
+  seq2.append_blocks(allocator.allocate(2));
+  seq2.commit_kv_cache(/*size=*/2);
+  seq2.append_token(8);
+
+  Batch batch({&seq1, &seq2});
+  EXPECT_EQ(batch.num_decoding_steps(/*max_steps=*/3), 3);
+  batch.prepare_model_input(/*num_decoding_tokens=*/1,
+                            /*min_decoding_bach_size=*/0);
+
+  // tokens of 3 steps, and seq2 finishes at the second step
+  SampleOutput sample_output;
+  sample_output.next_tokens =
+      torch::tensor({{10, 11, 12}, {13, 2, 14}}, torch::kLong);
+  batch.process_sample_output(sample_output);
+
+  EXPECT_FALSE(seq1.is_finished());
+  EXPECT_EQ(seq1.num_tokens(), 7);
+  EXPECT_EQ(seq1.num_kv_cache_tokens(), 6);
+  EXPECT_EQ(seq1.token_ids().back(), 12);
+
+  EXPECT_TRUE(seq2.is_finished());
+  EXPECT_EQ(seq2.num_tokens(), 5);
+  EXPECT_EQ(seq2.num_kv_cache_tokens(), 4);
+  EXPECT_EQ(seq2.token_ids().back(), 2);
+}
+
 }  // namespace llm
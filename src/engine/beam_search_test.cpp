@@ -0,0 +1,214 @@
+#include <gtest/gtest.h>
+#include <torch/torch.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "engine/batch.h"
+#include "engine/worker.h"
+#include "memory/block_manager.h"
+#include "model_loader/state_dict.h"
+#include "models/simple_model.h"
+#include "quantization/quant_args.h"
+#include "request/request.h"
+
+namespace llm {
+namespace {
+
+// the simple model uses hidden states as logits
+constexpr int64_t kVocabSize = 32;
+constexpr int64_t kHiddenSize = kVocabSize;
+constexpr int64_t kIntermediateSize = 64;
+constexpr int64_t kNumHeads = 4;
+constexpr int64_t kBlockSize = 4;
+constexpr int64_t kNumBlocks = 256;
+
+class BeamSearchTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    args_.model_type("simple")
+        .vocab_size(kVocabSize)
+        .hidden_size(kHiddenSize)
+        .n_layers(1)
+        .n_heads(kNumHeads)
+        .n_kv_heads(kNumHeads)
+        .intermediate_size(kIntermediateSize)
+        .hidden_act("silu")
+        .max_position_embeddings(128);
+
+    const torch::Device device(torch::kCPU);
+    worker_ = std::make_unique<Worker>(ParallelArgs(0, 1, nullptr),
+                                       device,
+                                       ModelRunner::Options(),
+                                       Worker::Options());
+    ASSERT_TRUE(worker_->init_model(torch::kFloat, args_, QuantArgs()));
+
+    // random weights to avoid ties between candidates
+    torch::manual_seed(42);
+    std::unordered_map<std::string, torch::Tensor> dict;
+    dict.emplace("model.embed_tokens.weight",
+                 torch::randn({kVocabSize, kHiddenSize}));
+    dict.emplace("model.layers.0.mlp.gate_proj.weight",
+                 torch::randn({kIntermediateSize, kHiddenSize}));
+    dict.emplace("model.layers.0.mlp.up_proj.weight",
+                 torch::randn({kIntermediateSize, kHiddenSize}));
+    dict.emplace("model.layers.0.mlp.down_proj.weight",
+                 torch::randn({kHiddenSize, kIntermediateSize}));
+    worker_->load_state_dict(StateDict(dict, 0, 1));
+    worker_->verify_loaded_weights();
+
+    const int64_t head_dim = kHiddenSize / kNumHeads;
+    ASSERT_TRUE(worker_->init_kv_cache(
+        {kNumBlocks, kBlockSize, kNumHeads, head_dim}));
+    ASSERT_TRUE(worker_->capture_cuda_graphs());
+
+    BlockManager::Options options;
+    options.num_blocks(kNumBlocks)
+        .block_size(kBlockSize)
+        .enable_prefix_cache(false);
+    block_manager_ = std::make_unique<BlockManager>(options);
+  }
+
+  // run one step for all unfinished sequences of the request
+  void step(Request* request) {
+    std::vector<Sequence*> sequences;
+    for (Sequence& sequence : request->sequences) {
+      if (!sequence.is_finished()) {
+        ASSERT_TRUE(block_manager_->allocate_blocks_for(&sequence));
+        sequences.push_back(&sequence);
+      }
+    }
+    Batch batch(sequences);
+    auto model_input =
+        batch.prepare_model_input(/*num_decoding_tokens=*/1,
+                                  /*min_decoding_bach_size=*/0);
+    auto model_output = worker_->execute_model(model_input);
+    batch.process_sample_output(model_output.sample_output);
+  }
+
+  // the simple model has no attention, the next token only depends on the
+  // last token. returns transition logprobs: [vocab_size, vocab_size]
+  torch::Tensor transition_logprobs() {
+    Sequence::Options options;
+    options.stopping_criteria.ignore_eos_token = true;
+    std::deque<Sequence> sequences;
+    std::vector<Sequence*> sequence_ptrs;
+    for (int32_t i = 0; i < kVocabSize; ++i) {
+      auto& sequence = sequences.emplace_back(/*prompt=*/"",
+                                              std::vector<int32_t>{i},
+                                              /*capacity=*/4,
+                                              options);
+      EXPECT_TRUE(block_manager_->allocate_blocks_for(&sequence));
+      sequence_ptrs.push_back(&sequence);
+    }
+    Batch batch(sequence_ptrs);
+    auto model_input =
+        batch.prepare_model_input(/*num_decoding_tokens=*/1,
+                                  /*min_decoding_bach_size=*/0);
+    auto model_output = worker_->execute_model(model_input);
+    block_manager_->release_blocks_for(sequence_ptrs);
+    return model_output.sample_output.logprobs;
+  }
+
+  ModelArgs args_;
+  std::unique_ptr<Worker> worker_;
+  std::unique_ptr<BlockManager> block_manager_;
+};
+
+struct Beam {
+  std::vector<int32_t> token_ids;
+  float score = 0.0f;
+};
+
+// exhaustive beam search over the transition logprobs
+std::vector<Beam> reference_beam_search(const torch::Tensor& logprobs,
+                                        int32_t last_token_id,
+                                        size_t beam_width,
+                                        size_t max_tokens) {
+  std::vector<Beam> beams = {{{last_token_id}, 0.0f}};
+  for (size_t i = 0; i < max_tokens; ++i) {
+    std::vector<Beam> candidates;
+    for (const auto& beam : beams) {
+      const auto row = logprobs[beam.token_ids.back()];
+      for (int32_t token_id = 0; token_id < kVocabSize; ++token_id) {
+        Beam candidate = beam;
+        candidate.token_ids.push_back(token_id);
+        candidate.score += row[token_id].item<float>();
+        candidates.push_back(std::move(candidate));
+      }
+    }
+    std::sort(candidates.begin(),
+              candidates.end(),
+              [](const Beam& a, const Beam& b) { return a.score > b.score; });
+    candidates.resize(beam_width);
+    beams = std::move(candidates);
+  }
+  // remove the last prompt token
+  for (auto& beam : beams) {
+    beam.token_ids.erase(beam.token_ids.begin());
+  }
+  return beams;
+}
+
+}  // namespace
+
+TEST_F(BeamSearchTest, SimpleModel) {
+  const size_t beam_width = 4;
+  const size_t n = 2;
+  const size_t max_tokens = 5;
+  const std::vector<int32_t> prompt_tokens = {3, 7, 1, 9, 5};
+
+  Request request("beam-search",
+                  /*prompt=*/"",
+                  prompt_tokens,
+                  /*seq_capacity=*/prompt_tokens.size() + max_tokens + 1,
+                  n,
+                  /*best_of=*/beam_width);
+  request.use_beam_search = true;
+  request.stopping_criteria.max_tokens = max_tokens;
+  request.stopping_criteria.ignore_eos_token = true;
+  request.add_sequence();
+  ASSERT_NE(request.beam_group, nullptr);
+  EXPECT_FALSE(request.should_expand_sequences());
+
+  // prefill the prompt, then fork beams from the single sequence
+  step(&request);
+  ASSERT_EQ(request.sequences.size(), beam_width);
+  // all beams share the blocks of the prompt
+  const Block& first_block = request.sequences[0].blocks()[0];
+  EXPECT_EQ(first_block.ref_count(), beam_width);
+  for (const Sequence& sequence : request.sequences) {
+    EXPECT_EQ(sequence.blocks()[0], first_block);
+    EXPECT_EQ(sequence.num_generated_tokens(), 1);
+  }
+
+  for (size_t i = 1; i < max_tokens && !request.is_finished(); ++i) {
+    step(&request);
+  }
+  ASSERT_TRUE(request.is_finished());
+
+  const auto hypotheses = request.beam_group->best_hypotheses(n);
+  ASSERT_EQ(hypotheses.size(), n);
+
+  const auto expected = reference_beam_search(
+      transition_logprobs(), prompt_tokens.back(), beam_width, max_tokens);
+  for (size_t i = 0; i < n; ++i) {
+    const auto& token_ids = hypotheses[i].token_ids;
+    ASSERT_EQ(token_ids.size(), prompt_tokens.size() + max_tokens);
+    const std::vector<int32_t> generated(
+        token_ids.begin() + prompt_tokens.size(), token_ids.end());
+    EXPECT_EQ(generated, expected[i].token_ids);
+    // same length for all beams, score = cumulative_logprob / length
+    EXPECT_NEAR(hypotheses[i].score,
+                expected[i].score / static_cast<float>(max_tokens),
+                1e-4);
+    EXPECT_EQ(hypotheses[i].finish_reason, FinishReason::LENGTH);
+  }
+}
+
+}  // namespace llm
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <folly/futures/Future.h>
+
 #include "batch.h"
 #include "memory/block_manager.h"
 #include "models/model_args.h"
@@ -14,6 +16,14 @@ class Engine {
   // execute the model with the given batch, results are stored in the batch
   virtual ModelOutput execute_model(Batch& batch) = 0;
 
+  // execute the model with the given batch without blocking. the batch is
+  // updated with the results once the future completes, in the thread waiting
+  // for it, so the batch should outlive the future. runs synchronously by
+  // default.
+  virtual folly::SemiFuture<ModelOutput> execute_model_async(Batch& batch) {
+    return folly::makeSemiFuture(execute_model(batch));
+  }
+
   // return a clone of the tokenizer
   virtual std::unique_ptr<Tokenizer> tokenizer() const = 0;
 
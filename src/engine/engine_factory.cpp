@@ -3,6 +3,7 @@
 #include <absl/strings/numbers.h>
 #include <absl/strings/str_split.h>
 
+#include "common/cpu_affinity.h"
 #include "engine/llm_engine.h"
 #include "speculative/speculative_engine.h"
 
@@ -34,7 +35,44 @@ DEFINE_string(
     "auto",
     "batch sizes to capture cuda graphs for draft model, comma separated list");
 
+DEFINE_int32(num_decoding_steps,
+             1,
+             "max number of decoding steps to run back to back for pure "
+             "decoding batches");
+
+DEFINE_int32(num_worker_threads,
+             0,
+             "number of intra-op threads for each worker, 0 to use the "
+             "default");
+
+DEFINE_string(worker_cpus,
+              "",
+              "cpus to pin workers to, e.g. 0-15,32-47, split evenly between "
+              "workers. empty to not pin");
+
+DEFINE_bool(bind_numa_node,
+            false,
+            "bind memory of each worker to the numa node of its cpus");
+
+DEFINE_int32(num_pipeline_stages,
+             1,
+             "number of pipeline stages with layers partitioned across "
+             "devices, one device per stage. 1 to disable");
+
+DEFINE_int32(num_micro_batches,
+             2,
+             "max number of micro batches in flight through pipeline stages");
+
+DEFINE_bool(enable_workspace,
+            false,
+            "reuse memory of intermediate tensors across steps, sized by "
+            "--max_num_tokens_per_batch: a workspace arena on cuda workers for "
+            "qkv and mlp projections, attention outputs and llama residuals, "
+            "or a memory pool for all intermediate tensors on cpu workers. "
+            "disabled with pipeline stages");
+
 DECLARE_int32(num_speculative_tokens);
+DECLARE_int64(max_num_tokens_per_batch);
 
 namespace llm {
 namespace {
@@ -120,6 +158,42 @@ std::vector<torch::Device> parse_devices(const std::string& device_str) {
   return devices;
 }
 
+// options of llm engines from flags, with the given devices and cpus to pin
+// workers to
+LLMEngine::Options llm_engine_options(std::vector<torch::Device> devices,
+                                      const std::vector<int32_t>& worker_cpus) {
+  // pipeline stages on cpu share the cpu device
+  if (FLAGS_num_pipeline_stages > 1 && devices.size() == 1 &&
+      devices[0].is_cpu()) {
+    devices.resize(FLAGS_num_pipeline_stages, devices[0]);
+  }
+
+  LLMEngine::Options options;
+  options.devices(devices)
+      .block_size(FLAGS_block_size)
+      .max_cache_size(FLAGS_max_cache_size)
+      .max_memory_utilization(FLAGS_max_memory_utilization)
+      .enable_prefix_cache(FLAGS_enable_prefix_cache)
+      .num_decoding_steps(FLAGS_num_decoding_steps)
+      .num_worker_threads(FLAGS_num_worker_threads)
+      .worker_cpus(worker_cpus)
+      .bind_numa_node(FLAGS_bind_numa_node)
+      .num_pipeline_stages(FLAGS_num_pipeline_stages)
+      .num_micro_batches(FLAGS_num_micro_batches);
+  if (FLAGS_enable_workspace) {
+    options.workspace_max_tokens(FLAGS_max_num_tokens_per_batch);
+  }
+  if (FLAGS_enable_cuda_graph && FLAGS_num_pipeline_stages == 1) {
+    LOG(INFO) << "Using cuda graph optimization, batch sizes: "
+              << FLAGS_cuda_graph_batch_sizes;
+    const auto batch_sizes =
+        parse_cuda_graph_batch_sizes(FLAGS_cuda_graph_batch_sizes, devices);
+    options.cuda_graph_max_seq_len(FLAGS_cuda_graph_max_seq_len)
+        .cuda_graph_batch_sizes(batch_sizes);
+  }
+  return options;
+}
+
 std::string to_string(const std::vector<torch::Device>& devices) {
   std::stringstream ss;
   for (size_t i = 0; i < devices.size(); ++i) {
@@ -170,21 +244,8 @@ std::unique_ptr<Engine> EngineFactory::create(
     return engine;
   }
 
-  LLMEngine::Options options;
-  options.devices(devices)
-      .block_size(FLAGS_block_size)
-      .max_cache_size(FLAGS_max_cache_size)
-      .max_memory_utilization(FLAGS_max_memory_utilization)
-      .enable_prefix_cache(FLAGS_enable_prefix_cache);
-  if (FLAGS_enable_cuda_graph) {
-    LOG(INFO) << "Using cuda graph optimization, batch sizes: "
-              << FLAGS_cuda_graph_batch_sizes;
-    const auto batch_sizes =
-        parse_cuda_graph_batch_sizes(FLAGS_cuda_graph_batch_sizes, devices);
-    options.cuda_graph_max_seq_len(FLAGS_cuda_graph_max_seq_len)
-        .cuda_graph_batch_sizes(batch_sizes);
-  }
-
+  const auto options =
+      llm_engine_options(devices, parse_cpu_list(FLAGS_worker_cpus));
   auto engine = std::make_unique<LLMEngine>(options);
   CHECK(engine->init(model_path));
   return engine;
@@ -195,23 +256,55 @@ std::unique_ptr<Engine> EngineFactory::create(const std::string& model_path,
   const auto devices = parse_devices(devices_str);
   LOG(INFO) << "Using devices: " << to_string(devices);
 
-  LLMEngine::Options options;
-  options.devices(devices)
-      .block_size(FLAGS_block_size)
-      .max_cache_size(FLAGS_max_cache_size)
-      .max_memory_utilization(FLAGS_max_memory_utilization)
-      .enable_prefix_cache(FLAGS_enable_prefix_cache);
-  if (FLAGS_enable_cuda_graph) {
-    LOG(INFO) << "Using cuda graph optimization, batch sizes: "
-              << FLAGS_cuda_graph_batch_sizes;
-    const auto batch_sizes =
-        parse_cuda_graph_batch_sizes(FLAGS_cuda_graph_batch_sizes, devices);
-    options.cuda_graph_max_seq_len(FLAGS_cuda_graph_max_seq_len)
-        .cuda_graph_batch_sizes(batch_sizes);
-  }
+  const auto options =
+      llm_engine_options(devices, parse_cpu_list(FLAGS_worker_cpus));
   auto engine = std::make_unique<LLMEngine>(options);
   CHECK(engine->init(model_path));
   return engine;
 }
 
+std::vector<std::unique_ptr<Engine>> EngineFactory::create_replicas(
+    const std::string& model_path,
+    const std::string& devices_str,
+    int32_t num_replicas) {
+  CHECK_GT(num_replicas, 0);
+  const auto devices = parse_devices(devices_str);
+  // devices are split evenly between replicas, while cpu replicas may share
+  // the cpu device
+  const bool share_devices = devices.size() == 1 && devices[0].is_cpu();
+  CHECK(share_devices || devices.size() % num_replicas == 0)
+      << "Can't split " << devices.size() << " devices between "
+      << num_replicas << " replicas";
+  const size_t devices_per_replica =
+      share_devices ? devices.size() : devices.size() / num_replicas;
+
+  // cpus to pin workers to are also split evenly between replicas
+  const auto worker_cpus = parse_cpu_list(FLAGS_worker_cpus);
+  const size_t cpus_per_replica = worker_cpus.size() / num_replicas;
+  CHECK(worker_cpus.empty() || cpus_per_replica > 0)
+      << "Not enough worker cpus for " << num_replicas << " replicas";
+
+  std::vector<std::unique_ptr<Engine>> engines;
+  engines.reserve(num_replicas);
+  for (int32_t i = 0; i < num_replicas; ++i) {
+    const auto devices_begin =
+        devices.begin() + (share_devices ? 0 : i * devices_per_replica);
+    const std::vector<torch::Device> replica_devices(
+        devices_begin, devices_begin + devices_per_replica);
+    std::vector<int32_t> replica_cpus;
+    if (cpus_per_replica > 0) {
+      const auto cpus_begin = worker_cpus.begin() + i * cpus_per_replica;
+      replica_cpus.assign(cpus_begin, cpus_begin + cpus_per_replica);
+    }
+    LOG(INFO) << "Using devices for replica " << i << ": "
+              << to_string(replica_devices);
+
+    auto engine = std::make_unique<LLMEngine>(
+        llm_engine_options(replica_devices, replica_cpus));
+    CHECK(engine->init(model_path));
+    engines.push_back(std::move(engine));
+  }
+  return engines;
+}
+
 }  // namespace llm
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <memory>
 #include <string_view>
+#include <vector>
 
 #include "engine.h"
 
@@ -15,6 +17,13 @@ class EngineFactory {
 
   static std::unique_ptr<Engine> create(const std::string& model_path,
                                         const std::string& devices_str);
+
+  // create independent replicas of the model for data parallelism, with
+  // devices and worker cpus split evenly between them
+  static std::vector<std::unique_ptr<Engine>> create_replicas(
+      const std::string& model_path,
+      const std::string& devices_str,
+      int32_t num_replicas);
 };
 
 }  // namespace llm
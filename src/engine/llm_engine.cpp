@@ -1,12 +1,17 @@
 #include "llm_engine.h"
 
 #include <ATen/cuda/CUDAContext.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <folly/futures/Future.h>
 #include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 
 #include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include <memory>
+#include <numeric>
+#include <vector>
 
 #include "common/pretty_print.h"
 #include "model_loader/model_loader.h"
@@ -72,8 +77,23 @@ LLMEngine::LLMEngine(const Options& options) : options_(options) {
     }
   }
 
+  // each pipeline stage runs on its own device without tensor parallelism
+  if (pipelined()) {
+    CHECK_EQ(devices.size(),
+             static_cast<size_t>(options_.num_pipeline_stages()))
+        << "One device is required for each pipeline stage";
+    CHECK_GT(options_.num_micro_batches(), 0);
+    // hidden states are passed between stages once per step
+    options_.num_decoding_steps(1);
+    if (!options_.cuda_graph_batch_sizes().empty()) {
+      LOG(WARNING) << "CUDA graphs are disabled with pipeline stages";
+      options_.cuda_graph_batch_sizes().clear();
+    }
+  }
+
   // initialize process groups if there are multiple devices
-  const int32_t world_size = static_cast<int32_t>(devices.size());
+  const int32_t world_size =
+      pipelined() ? 1 : static_cast<int32_t>(devices.size());
   if (world_size > 1) {
     // create a process group for each device if there are multiple gpus
     process_groups_ = ProcessGroup::create_process_groups(devices);
@@ -83,18 +103,45 @@ LLMEngine::LLMEngine(const Options& options) : options_(options) {
   auto& batch_sizes = options_.cuda_graph_batch_sizes();
   std::sort(batch_sizes.begin(), batch_sizes.end());
 
+  // pin host buffers of inputs for faster copies to gpus
+  for (auto& input_builder : input_builders_) {
+    input_builder = std::make_unique<ModelInputBuilder>(
+        /*pin_memory=*/devices[0].is_cuda());
+  }
+  if (pipelined()) {
+    for (int32_t i = 0; i < 2 * options_.num_micro_batches(); ++i) {
+      micro_batch_builders_.push_back(std::make_unique<ModelInputBuilder>(
+          /*pin_memory=*/devices[0].is_cuda()));
+    }
+  }
+
   // create a worker for each device
   ModelRunner::Options runner_options;
   runner_options.block_size(options_.block_size())
       .num_decoding_tokens(options_.num_decoding_tokens())
       .cuda_graph_max_seq_len(options_.cuda_graph_max_seq_len())
       .cuda_graph_batch_sizes(options_.cuda_graph_batch_sizes());
+  const auto& worker_cpus = options_.worker_cpus();
+  const size_t cpus_per_worker = worker_cpus.size() / devices.size();
+  CHECK(worker_cpus.empty() || cpus_per_worker > 0)
+      << "Not enough cpus for " << devices.size() << " workers";
   for (size_t i = 0; i < devices.size(); ++i) {
-    const int32_t rank = static_cast<int32_t>(i);
+    const int32_t rank = world_size > 1 ? static_cast<int32_t>(i) : 0;
     ProcessGroup* pg = world_size > 1 ? process_groups_[i].get() : nullptr;
     ParallelArgs parallel_args(rank, world_size, pg);
-    workers_.emplace_back(
-        std::make_unique<Worker>(parallel_args, devices[i], runner_options));
+    // hidden states are sent to the next stage on another stream or device,
+    // which may still read them after the arena hands the memory out again
+    Worker::Options worker_options;
+    worker_options.num_threads(options_.num_worker_threads())
+        .bind_numa_node(options_.bind_numa_node())
+        .workspace_max_tokens(pipelined() ? 0
+                                          : options_.workspace_max_tokens());
+    if (cpus_per_worker > 0) {
+      const auto begin = worker_cpus.begin() + i * cpus_per_worker;
+      worker_options.cpus({begin, begin + cpus_per_worker});
+    }
+    workers_.emplace_back(std::make_unique<Worker>(
+        parallel_args, devices[i], runner_options, worker_options));
   }
 
   if (FLAGS_disable_custom_kernels) {
@@ -130,15 +177,36 @@ bool LLMEngine::init_model(const std::string& model_weights_path) {
   auto model_loader = ModelLoader::create(model_weights_path);
   LOG(INFO) << "Initializing model from: " << model_weights_path;
 
+  const absl::Time start = absl::Now();
   tokenizer_ = model_loader->tokenizer();
   CHECK(tokenizer_ != nullptr);
+  LOG(INFO) << "Loaded tokenizer in "
+            << absl::ToDoubleMilliseconds(absl::Now() - start) << " ms";
 
   args_ = model_loader->model_args();
   quant_args_ = model_loader->quant_args();
   tokenizer_args_ = model_loader->tokenizer_args();
 
+  // each pipeline stage holds its own layers
+  args_.n_pipeline_stages(options_.num_pipeline_stages());
+  const auto& stage_layers = args_.pipeline_stage_layers();
+  if (!stage_layers.empty()) {
+    // the given layers of stages should cover all layers
+    CHECK_EQ(static_cast<int32_t>(stage_layers.size()),
+             args_.n_pipeline_stages())
+        << "layers of " << stage_layers.size() << " stages are given for "
+        << args_.n_pipeline_stages() << " pipeline stages";
+    CHECK_EQ(std::accumulate(
+                 stage_layers.begin(), stage_layers.end(), int64_t{0}),
+             args_.n_layers())
+        << "layers of pipeline stages don't add up to the model layers";
+  } else {
+    CHECK_LE(args_.n_pipeline_stages(), args_.n_layers())
+        << "more pipeline stages than layers";
+  }
+
   // compute the number of local kv heads and head dim
-  const int world_size = static_cast<int>(workers_.size());
+  const int world_size = pipelined() ? 1 : static_cast<int>(workers_.size());
   const int64_t n_heads = args_.n_heads();
   const int64_t n_kv_heads = args_.n_kv_heads().value_or(n_heads);
   n_local_kv_heads_ = std::max<int64_t>(1, n_kv_heads / world_size);
@@ -169,7 +237,7 @@ bool LLMEngine::init_model(const std::string& model_weights_path) {
   LOG(INFO) << "Initializing model with quant args: " << quant_args_;
   LOG(INFO) << "Initializing model with tokenizer args: " << tokenizer_args_;
 
-  if (workers_.size() == 1) {
+  if (call_worker_inline()) {
     Worker* worker = workers_[0].get();
     // only one worker, call init_model in current thread
     if (!worker->init_model(dtype_, args_, quant_args_)) {
@@ -183,12 +251,22 @@ bool LLMEngine::init_model(const std::string& model_weights_path) {
     return true;
   }
 
+  // model args of each worker, with the pipeline stage of the worker
+  std::vector<ModelArgs> worker_args(workers_.size(), args_);
+  if (pipelined()) {
+    for (size_t i = 0; i < worker_args.size(); ++i) {
+      worker_args[i].pipeline_stage(static_cast<int32_t>(i));
+      LOG(INFO) << "Initializing pipeline stage with " << worker_args[i];
+    }
+  }
+
   // init model for each worker in parallel
   // multiple workers, call async init
   std::vector<folly::SemiFuture<bool>> futures;
   futures.reserve(workers_.size());
-  for (auto& worker : workers_) {
-    futures.push_back(worker->init_model_async(dtype_, args_, quant_args_));
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    futures.push_back(
+        workers_[i]->init_model_async(dtype_, worker_args[i], quant_args_));
   }
   // wait for all futures to complete
   auto results = folly::collectAll(futures).get();
@@ -222,7 +300,7 @@ bool LLMEngine::init_model(const std::string& model_weights_path) {
 }
 
 bool LLMEngine::capture_cuda_graphs() {
-  if (workers_.size() == 1) {
+  if (call_worker_inline()) {
     // only one worker, call blocking forward
     return workers_[0]->capture_cuda_graphs();
   }
@@ -322,7 +400,7 @@ bool LLMEngine::init_kv_cache(int64_t n_blocks) {
   block_manager_ = std::make_unique<BlockManager>(options);
 
   // init kv cache for each worker in parallel
-  if (workers_.size() == 1) {
+  if (call_worker_inline()) {
     // only one worker, call init_kv_cache in current thread
     return workers_[0]->init_kv_cache(kv_cache_shape);
   }
@@ -343,6 +421,14 @@ bool LLMEngine::init_kv_cache(int64_t n_blocks) {
 }
 
 ModelOutput LLMEngine::execute_model(Batch& batch) {
+  return execute_model_async(batch).get();
+}
+
+folly::SemiFuture<ModelOutput> LLMEngine::execute_model_async(Batch& batch) {
+  if (pipelined()) {
+    return execute_pipeline(batch);
+  }
+
   // prepare inputs for workers
   const auto& batch_sizes = options_.cuda_graph_batch_sizes();
   const auto batch_size = batch.size();
@@ -351,39 +437,138 @@ ModelOutput LLMEngine::execute_model(Batch& batch) {
       std::lower_bound(batch_sizes.begin(), batch_sizes.end(), batch_size);
   uint32_t adjusted_batch_size = it == batch_sizes.end() ? 0 : *it;
 
+  // run multiple decoding steps for pure decoding batches if possible
+  uint32_t num_decoding_steps = 1;
+  if (options_.num_decoding_steps() > 1 &&
+      options_.num_decoding_tokens() == 1) {
+    num_decoding_steps = batch.num_decoding_steps(
+        static_cast<uint32_t>(options_.num_decoding_steps()));
+  }
+
+  auto* input_builder = input_builders_[next_input_builder_].get();
+  next_input_builder_ = (next_input_builder_ + 1) % input_builders_.size();
   auto model_inputs = batch.prepare_model_input(options_.num_decoding_tokens(),
-                                                adjusted_batch_size);
+                                                adjusted_batch_size,
+                                                &grammar_threadpool_,
+                                                input_builder);
   if (!model_inputs.token_ids.defined()) {
     // empty input, just return
-    return {};
+    return folly::makeSemiFuture(ModelOutput());
   }
+  model_inputs.num_decoding_steps = static_cast<int32_t>(num_decoding_steps);
 
-  if (workers_.size() == 1) {
-    // only one worker, call blocking forward
-    auto model_output = workers_[0]->execute_model(model_inputs);
+  // update the batch once the sample output is copied to the host
+  auto process_output = [&batch](ModelOutput model_output) {
+    model_output.synchronize();
     batch.process_sample_output(model_output.sample_output);
     return model_output;
+  };
+
+  if (call_worker_inline() && workers_[0]->device().is_cuda()) {
+    // only one worker, launch the forward in the current thread. kernels run
+    // asynchronously on cuda, so the step overlaps with the host until the
+    // output is synchronized.
+    auto model_output = workers_[0]->execute_model(model_inputs);
+    return folly::makeSemiFuture(std::move(model_output))
+        .deferValue(std::move(process_output));
   }
 
-  // multiple workers, call async forward
+  // run the forward in working threads of workers, which on cpu leaves the
+  // current thread free to overlap host work with the step
   std::vector<folly::SemiFuture<ModelOutput>> futures;
   futures.reserve(workers_.size());
   for (auto& worker : workers_) {
     futures.push_back(worker->execute_model_async(model_inputs));
   }
-  // wait for the all future to complete
-  auto results = folly::collectAll(futures).get();
-  // return the result from the first worker
-  auto model_output = results.front().value();
-  batch.process_sample_output(model_output.sample_output);
-  return model_output;
+  // return the result from the first worker once all complete
+  return folly::collectAll(futures).deferValue(
+      [process_output = std::move(process_output)](
+          std::vector<folly::Try<ModelOutput>> results) {
+        return process_output(std::move(results.front().value()));
+      });
+}
+
+folly::SemiFuture<ModelOutput> LLMEngine::execute_pipeline(Batch& batch) {
+  // builders of micro batches of this step
+  const size_t num_builders = micro_batch_builders_.size() / 2;
+  const size_t builder_offset = next_input_builder_ * num_builders;
+  next_input_builder_ = (next_input_builder_ + 1) % 2;
+
+  // prepare inputs of all micro batches before running them
+  auto micro_batches = batch.split(num_builders);
+  std::vector<size_t> running_batches;
+  std::vector<folly::SemiFuture<ModelOutput>> futures;
+  for (size_t i = 0; i < micro_batches.size(); ++i) {
+    auto model_inputs = micro_batches[i].prepare_model_input(
+        options_.num_decoding_tokens(),
+        /*min_decoding_bach_size=*/0,
+        &grammar_threadpool_,
+        micro_batch_builders_[builder_offset + i].get());
+    if (!model_inputs.token_ids.defined()) {
+      continue;
+    }
+
+    // chain the stages of the micro batch, each stage waits for the previous
+    // one in its own worker, after the previous micro batch in the stage
+    auto output = folly::makeSemiFuture(ModelOutput());
+    for (auto& worker : workers_) {
+      output = worker->execute_stage_async(model_inputs, std::move(output));
+    }
+    running_batches.push_back(i);
+    futures.push_back(std::move(output));
+  }
+
+  // micro batches share sequences with the batch, which outlives the future
+  return folly::collectAll(futures).deferValue(
+      [micro_batches = std::move(micro_batches),
+       running_batches = std::move(running_batches)](
+          std::vector<folly::Try<ModelOutput>> results) mutable {
+        std::vector<torch::Tensor> next_tokens;
+        std::vector<torch::Tensor> next_logprobs;
+        std::vector<torch::Tensor> logits;
+        for (size_t i = 0; i < results.size(); ++i) {
+          const auto& output = results[i].value();
+          output.synchronize();
+          micro_batches[running_batches[i]].process_sample_output(
+              output.sample_output);
+          if (output.sample_output.next_tokens.defined()) {
+            next_tokens.push_back(output.sample_output.next_tokens);
+          }
+          if (output.sample_output.next_logprobs.defined()) {
+            next_logprobs.push_back(output.sample_output.next_logprobs);
+          }
+          if (output.logits.defined()) {
+            logits.push_back(output.logits);
+          }
+        }
+
+        // concatenate outputs of micro batches in the order of sequences
+        ModelOutput model_output;
+        if (!next_tokens.empty()) {
+          model_output.sample_output.next_tokens = torch::cat(next_tokens);
+        }
+        if (!next_logprobs.empty()) {
+          model_output.sample_output.next_logprobs =
+              torch::cat(next_logprobs);
+        }
+        if (!logits.empty()) {
+          model_output.logits = torch::cat(logits);
+        }
+        return model_output;
+      });
 }
 
 int64_t LLMEngine::kv_cache_slot_size_in_bytes() const {
   const auto dtype_size = torch::scalarTypeToTypeMeta(dtype_).itemsize();
+  // each pipeline stage holds kv caches of its own layers
+  int64_t n_layers = 0;
+  for (int32_t i = 0; i < args_.n_pipeline_stages(); ++i) {
+    const auto [begin, end] = args_.stage_layers(i);
+    n_layers = std::max(n_layers, end - begin);
+  }
   // key + value for all layers
   const int64_t slot_size_in_bytes =
-      2 * n_local_kv_heads_ * head_dim_ * args_.n_layers() * dtype_size;
+      2 * n_local_kv_heads_ * head_dim_ * n_layers * dtype_size;
   return slot_size_in_bytes;
 }
 
@@ -1,11 +1,17 @@
 #pragma once
 
+#include <folly/futures/Future.h>
+
+#include <array>
 #include <memory>
+#include <vector>
 
 #include "batch.h"
 #include "common/macros.h"
+#include "common/threadpool.h"
 #include "engine.h"
 #include "memory/block_manager.h"
+#include "model_input_builder.h"
 #include "quantization/quant_args.h"
 #include "tokenizer/tokenizer.h"
 #include "tokenizer/tokenizer_args.h"
@@ -48,11 +54,38 @@ class LLMEngine : public Engine {
     // in speculative decoding, it is the number of speculative tokens + 1
     DEFINE_ARG(int64_t, num_decoding_tokens) = 1;
 
+    // max number of decoding steps to run back to back in workers for pure
+    // decoding batches, with one token per sequence per step
+    DEFINE_ARG(int64_t, num_decoding_steps) = 1;
+
     // max sequence length used to capture cuda graphs
     DEFINE_ARG(int64_t, cuda_graph_max_seq_len) = 1024;
 
     // batch sizes to capture cuda graphs
     DEFINE_ARG(std::vector<uint32_t>, cuda_graph_batch_sizes);
+
+    // number of intra-op threads for each worker, 0 to use the default
+    DEFINE_ARG(int32_t, num_worker_threads) = 0;
+
+    // cpus to pin workers to, split evenly in order between workers. workers
+    // run in their own threads if given, otherwise the only worker runs in
+    // the calling thread.
+    DEFINE_ARG(std::vector<int32_t>, worker_cpus);
+
+    // bind memory of each worker to the numa node of its cpus
+    DEFINE_ARG(bool, bind_numa_node) = false;
+
+    // number of pipeline stages, with layers partitioned evenly across
+    // stages and one device per stage. 1 to disable pipeline parallelism.
+    DEFINE_ARG(int32_t, num_pipeline_stages) = 1;
+
+    // max number of micro batches in flight through pipeline stages
+    DEFINE_ARG(int32_t, num_micro_batches) = 2;
+
+    // max number of tokens per batch to size the memory reserved by each
+    // worker for intermediate tensors: a workspace arena on cuda or a memory
+    // pool on cpu. 0 to disable, ignored with pipeline stages.
+    DEFINE_ARG(int64_t, workspace_max_tokens) = 0;
   };
 
   // create an engine with the given devices
@@ -63,6 +96,11 @@ class LLMEngine : public Engine {
   // step the engine forward by one step with the batch
   ModelOutput execute_model(Batch& batch) override;
 
+  // step the engine forward by one step with the batch without blocking on
+  // the devices. inputs are built into alternating host buffers, so the next
+  // step can be prepared while the current one runs.
+  folly::SemiFuture<ModelOutput> execute_model_async(Batch& batch) override;
+
   std::unique_ptr<Tokenizer> tokenizer() const override {
     return tokenizer_->clone();
   }
@@ -98,6 +136,18 @@ class LLMEngine : public Engine {
   int64_t calculate_kv_cache_blocks(int64_t cache_size_in_bytes) const;
 
  private:
+  bool pipelined() const { return options_.num_pipeline_stages() > 1; }
+
+  // run micro batches of the batch through pipeline stages, with each stage
+  // running a micro batch while the next stage runs the previous one
+  folly::SemiFuture<ModelOutput> execute_pipeline(Batch& batch);
+
+  // whether to call the only worker in the current thread instead of its
+  // working thread, which is pinned to cpus if worker_cpus is given
+  bool call_worker_inline() const {
+    return workers_.size() == 1 && options_.worker_cpus().empty();
+  }
+
   // options
   Options options_;
 
@@ -125,6 +175,21 @@ class LLMEngine : public Engine {
   // a list of workers, with each worker handling a partial of model
   std::vector<std::unique_ptr<Worker>> workers_;
 
+  // threadpool to compute allowed tokens alongside the forward pass
+  ThreadPool grammar_threadpool_;
+
+  // builders of model inputs, reusing their pinned host buffers across steps.
+  // double buffered, so that building inputs of the next step doesn't
+  // overwrite inputs still being copied to devices.
+  std::array<std::unique_ptr<ModelInputBuilder>, 2> input_builders_;
+
+  // index of the builder for the next step
+  size_t next_input_builder_ = 0;
+
+  // builders of model inputs of micro batches in flight through pipeline
+  // stages, double buffered as well
+  std::vector<std::unique_ptr<ModelInputBuilder>> micro_batch_builders_;
+
   // config for kv cache
   int64_t n_local_kv_heads_ = 0;
   int64_t head_dim_ = 0;
@@ -0,0 +1,385 @@
+#include "model_input_builder.h"
+
+#include <glog/logging.h>
+#include <torch/torch.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "request/sequence.h"
+#include "sampling/parameters.h"
+
+namespace llm {
+
+namespace {
+
+// alignment of tensors in the packed buffer in bytes
+constexpr int64_t kPackAlignment = 16;
+
+// pad the rows in CSR layout into a [num_rows, max_row_size] tensor
+template <typename T>
+torch::Tensor pad_rows(const HostBuffer<T>& values,
+                       const HostBuffer<int32_t>& offsets,
+                       T pad_value,
+                       HostBuffer<T>* padded) {
+  const size_t num_rows = offsets.size() - 1;
+  int32_t max_row_size = 0;
+  for (size_t i = 0; i < num_rows; ++i) {
+    max_row_size = std::max(max_row_size, offsets[i + 1] - offsets[i]);
+  }
+  padded->clear();
+  T* data = padded->extend(num_rows * max_row_size);
+  for (size_t i = 0; i < num_rows; ++i) {
+    T* row = data + i * max_row_size;
+    const T* begin = values.data() + offsets[i];
+    const T* end = values.data() + offsets[i + 1];
+    std::fill(std::copy(begin, end, row), row + max_row_size, pad_value);
+  }
+  return padded->tensor().view(
+      {static_cast<int64_t>(num_rows), static_cast<int64_t>(max_row_size)});
+}
+
+}  // namespace
+
+ModelInputBuilder::ModelInputBuilder(bool pin_memory)
+    : pin_memory_(pin_memory && torch::cuda::is_available()),
+      token_ids_(pin_memory_),
+      positions_(pin_memory_),
+      q_cu_seq_lens_(pin_memory_),
+      kv_cu_seq_lens_(pin_memory_),
+      new_cache_slots_(pin_memory_),
+      block_ids_(pin_memory_),
+      block_offsets_(pin_memory_),
+      block_tables_(pin_memory_),
+      src_block_ids_(pin_memory_),
+      dst_block_ids_(pin_memory_),
+      selected_token_idxes_(pin_memory_),
+      sample_idxes_(pin_memory_),
+      constrained_token_idxes_(pin_memory_),
+      frequency_penalties_(pin_memory_),
+      presence_penalties_(pin_memory_),
+      repetition_penalties_(pin_memory_),
+      temperatures_(pin_memory_),
+      top_p_(pin_memory_),
+      top_k_(pin_memory_),
+      do_sample_(pin_memory_),
+      unique_ids_(pin_memory_),
+      unique_counts_(pin_memory_),
+      unique_offsets_(pin_memory_),
+      unique_lens_(pin_memory_),
+      padded_unique_ids_(pin_memory_),
+      padded_unique_counts_(pin_memory_),
+      packed_(pin_memory_) {
+  reset();
+}
+
+void ModelInputBuilder::reset() {
+  token_ids_.clear();
+  positions_.clear();
+  q_cu_seq_lens_.clear();
+  q_cu_seq_lens_.push_back(0);
+  kv_cu_seq_lens_.clear();
+  kv_cu_seq_lens_.push_back(0);
+  q_max_seq_len_ = 0;
+  kv_max_seq_len_ = 0;
+  new_cache_slots_.clear();
+  block_ids_.clear();
+  block_offsets_.clear();
+  block_offsets_.push_back(0);
+  src_block_ids_.clear();
+  dst_block_ids_.clear();
+  selected_token_idxes_.clear();
+  sample_idxes_.clear();
+  constrained_token_idxes_.clear();
+  constrained_sequences_.clear();
+  frequency_penalties_.clear();
+  presence_penalties_.clear();
+  repetition_penalties_.clear();
+  temperatures_.clear();
+  top_p_.clear();
+  top_k_.clear();
+  do_sample_.clear();
+  need_token_stats_ = false;
+  need_temperatures_ = false;
+  need_top_p_ = false;
+  need_top_k_ = false;
+  unique_ids_.clear();
+  unique_counts_.clear();
+  unique_offsets_.clear();
+  unique_offsets_.push_back(0);
+}
+
+void ModelInputBuilder::add_sequence(const Sequence& sequence,
+                                     uint32_t n_kv_cache_tokens,
+                                     uint32_t seq_len) {
+  const auto token_ids = sequence.token_ids();
+  const uint32_t q_seq_len = seq_len - n_kv_cache_tokens;
+  q_max_seq_len_ = std::max(q_max_seq_len_, q_seq_len);
+  kv_max_seq_len_ = std::max(kv_max_seq_len_, seq_len);
+  q_cu_seq_lens_.push_back(q_cu_seq_lens_.back() + q_seq_len);
+  kv_cu_seq_lens_.push_back(kv_cu_seq_lens_.back() + seq_len);
+
+  // select tokens after the prompt, including the last prompt token
+  const uint32_t n_prompt_tokens = sequence.num_prompt_tokens();
+  const uint32_t first_selected =
+      std::max(n_kv_cache_tokens, std::max(n_prompt_tokens, 1u) - 1);
+
+  // count tokens after each selected token, which are excluded from its
+  // unique tokens. tokens are counted and uncounted as they are selected.
+  const auto* param = sequence.sampling_param();
+  const bool need_token_stats = param->frequency_penalty != 0.0 ||
+                                param->presence_penalty != 0.0 ||
+                                param->repetition_penalty != 1.0;
+  if (need_token_stats && seq_len > first_selected + 1) {
+    for (uint32_t j = first_selected; j < seq_len; ++j) {
+      const auto token_id = static_cast<size_t>(token_ids[j]);
+      if (token_id >= later_token_counts_.size()) {
+        later_token_counts_.resize(token_id + 1, 0);
+      }
+      ++later_token_counts_[token_id];
+    }
+  }
+
+  const size_t token_offset = token_ids_.size();
+  std::copy(token_ids.data() + n_kv_cache_tokens,
+            token_ids.data() + seq_len,
+            token_ids_.extend(q_seq_len));
+  int32_t* positions = positions_.extend(q_seq_len);
+  for (uint32_t j = n_kv_cache_tokens; j < seq_len; ++j) {
+    positions[j - n_kv_cache_tokens] = static_cast<int32_t>(j);
+  }
+
+  for (uint32_t j = first_selected; j < seq_len; ++j) {
+    selected_token_idxes_.push_back(
+        static_cast<int32_t>(token_offset + j - n_kv_cache_tokens));
+    frequency_penalties_.push_back(param->frequency_penalty);
+    presence_penalties_.push_back(param->presence_penalty);
+    repetition_penalties_.push_back(param->repetition_penalty);
+    temperatures_.push_back(param->temperature);
+    top_p_.push_back(param->top_p);
+    top_k_.push_back(param->top_k);
+    need_token_stats_ = need_token_stats_ || need_token_stats;
+    need_temperatures_ =
+        need_temperatures_ ||
+        (param->temperature != 0.0 && param->temperature != 1.0);
+    need_top_p_ = need_top_p_ || param->top_p != 1.0;
+    need_top_k_ = need_top_k_ || param->top_k != 0;
+
+    if (need_token_stats) {
+      add_unique_tokens(sequence, j);
+    }
+    unique_offsets_.push_back(static_cast<int32_t>(unique_ids_.size()));
+
+    // sample the last token of the sequence
+    if (j == seq_len - 1) {
+      sample_idxes_.push_back(
+          static_cast<int32_t>(selected_token_idxes_.size() - 1));
+      do_sample_.push_back(param->do_sample || param->temperature != 0.0 ||
+                           param->top_p != 1.0 || param->top_k != 0);
+      if (sequence.grammar() != nullptr) {
+        constrained_token_idxes_.push_back(sample_idxes_.back());
+        constrained_sequences_.push_back(&sequence);
+      }
+    }
+  }
+
+  // assign slot ids for new tokens [n_kv_cache_tokens, seq_len)
+  sequence.kv_cache_slots(
+      n_kv_cache_tokens, seq_len, new_cache_slots_.extend(q_seq_len));
+
+  const auto blocks = sequence.blocks();
+  int32_t* block_ids = block_ids_.extend(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    block_ids[i] = blocks[i].id();
+  }
+  block_offsets_.push_back(static_cast<int32_t>(block_ids_.size()));
+}
+
+void ModelInputBuilder::add_unique_tokens(const Sequence& sequence,
+                                          uint32_t j) {
+  const auto token_ids = sequence.token_ids();
+  // exclude the current token from the later tokens
+  const auto token_id = static_cast<size_t>(token_ids[j]);
+  const bool has_later_tokens =
+      token_id < later_token_counts_.size() &&
+      later_token_counts_[token_id] > 0;
+  if (has_later_tokens) {
+    --later_token_counts_[token_id];
+  }
+
+  const auto& token_counts = sequence.token_to_count_map();
+  int64_t* ids = unique_ids_.extend(token_counts.size());
+  int32_t* counts = unique_counts_.extend(token_counts.size());
+  size_t n = 0;
+  for (const auto& [id, count] : token_counts) {
+    const auto later_count =
+        static_cast<size_t>(id) < later_token_counts_.size()
+            ? later_token_counts_[id]
+            : 0;
+    if (count > later_count) {
+      ids[n] = id;
+      counts[n] = count - later_count;
+      ++n;
+    }
+  }
+  // drop the unused tail
+  unique_ids_.resize(unique_ids_.size() - token_counts.size() + n);
+  unique_counts_.resize(unique_counts_.size() - token_counts.size() + n);
+}
+
+void ModelInputBuilder::add_padding_sequences(uint32_t num_sequences,
+                                              uint32_t num_tokens) {
+  for (uint32_t i = 0; i < num_sequences; ++i) {
+    token_ids_.append(num_tokens, 0);
+    positions_.append(num_tokens, 0);
+    new_cache_slots_.append(num_tokens, 0);
+    q_cu_seq_lens_.push_back(q_cu_seq_lens_.back() + num_tokens);
+    kv_cu_seq_lens_.push_back(kv_cu_seq_lens_.back() + num_tokens);
+    block_offsets_.push_back(static_cast<int32_t>(block_ids_.size()));
+  }
+}
+
+void ModelInputBuilder::add_block_copy(int32_t src_block_id,
+                                       int32_t dst_block_id) {
+  src_block_ids_.push_back(src_block_id);
+  dst_block_ids_.push_back(dst_block_id);
+}
+
+ModelInput ModelInputBuilder::build() {
+  ModelInput model_input;
+  model_input.token_ids = token_ids_.tensor();
+  model_input.positions = positions_.tensor();
+
+  auto& input_params = model_input.input_params;
+  input_params.kv_max_seq_len = static_cast<int32_t>(kv_max_seq_len_);
+  input_params.q_max_seq_len = static_cast<int32_t>(q_max_seq_len_);
+  input_params.kv_cu_seq_lens = kv_cu_seq_lens_.tensor();
+  input_params.q_cu_seq_lens = q_cu_seq_lens_.tensor();
+  input_params.new_cache_slots = new_cache_slots_.tensor();
+  input_params.block_tables =
+      pad_rows(block_ids_, block_offsets_, /*pad_value=*/0, &block_tables_);
+
+  if (!src_block_ids_.empty()) {
+    model_input.src_block_ids = src_block_ids_.tensor();
+    model_input.dst_block_ids = dst_block_ids_.tensor();
+  }
+
+  if (!selected_token_idxes_.empty()) {
+    build_sampling_params(&model_input.sampling_params);
+  }
+
+  // pack all tensors for a single transfer to devices
+  pack(&model_input);
+  return model_input;
+}
+
+void ModelInputBuilder::build_sampling_params(SamplingParameters* params) {
+  auto& sampling_params = *params;
+  sampling_params.selected_token_idxes = selected_token_idxes_.tensor();
+  if (need_token_stats_) {
+    // only set the penalties with non-default values
+    const size_t num_selected = selected_token_idxes_.size();
+    auto non_default = [num_selected](const HostBuffer<float>& values,
+                                      float default_value) {
+      for (size_t i = 0; i < num_selected; ++i) {
+        if (values[i] != default_value) {
+          return true;
+        }
+      }
+      return false;
+    };
+    if (non_default(frequency_penalties_, 0.0)) {
+      sampling_params.frequency_penalties = frequency_penalties_.tensor();
+    }
+    if (non_default(presence_penalties_, 0.0)) {
+      sampling_params.presence_penalties = presence_penalties_.tensor();
+    }
+    if (non_default(repetition_penalties_, 1.0)) {
+      sampling_params.repetition_penalties = repetition_penalties_.tensor();
+    }
+
+    unique_lens_.clear();
+    for (size_t i = 0; i + 1 < unique_offsets_.size(); ++i) {
+      unique_lens_.push_back(unique_offsets_[i + 1] - unique_offsets_[i]);
+    }
+    sampling_params.unique_token_ids = pad_rows<int64_t>(
+        unique_ids_, unique_offsets_, /*pad_value=*/0, &padded_unique_ids_);
+    sampling_params.unique_token_counts = pad_rows(unique_counts_,
+                                                   unique_offsets_,
+                                                   /*pad_value=*/0,
+                                                   &padded_unique_counts_);
+    sampling_params.unique_token_ids_lens = unique_lens_.tensor();
+  }
+  if (need_temperatures_) {
+    sampling_params.temperatures = temperatures_.tensor();
+  }
+  if (need_top_p_) {
+    sampling_params.top_p = top_p_.tensor();
+  }
+  if (need_top_k_) {
+    sampling_params.top_k = top_k_.tensor();
+  }
+  sampling_params.sample_idxes = sample_idxes_.tensor();
+  sampling_params.do_sample = do_sample_.tensor();
+  // choose the sampling strategy on host
+  const bool* do_sample = do_sample_.data();
+  sampling_params.all_random_sample =
+      std::all_of(do_sample, do_sample + do_sample_.size(), [](bool sample) {
+        return sample;
+      });
+  sampling_params.all_greedy_sample =
+      std::none_of(do_sample, do_sample + do_sample_.size(), [](bool sample) {
+        return sample;
+      });
+  if (!constrained_token_idxes_.empty()) {
+    sampling_params.constrained_token_idxes = constrained_token_idxes_.tensor();
+  }
+}
+
+void ModelInputBuilder::pack(ModelInput* model_input) {
+  auto& packed = model_input->packed;
+  // reuse the layouts unless an earlier input still holds them
+  if (layouts_ == nullptr || layouts_.use_count() > 1) {
+    layouts_ = std::make_shared<std::vector<TensorLayout>>();
+  }
+  layouts_->clear();
+  packed.layouts = layouts_;
+  // place tensors at aligned offsets, so that they can be viewed as any type
+  int64_t num_bytes = 0;
+  model_input->for_each_tensor([this, &num_bytes](torch::Tensor& t) {
+    auto& layout = layouts_->emplace_back();
+    if (!t.defined()) {
+      return;
+    }
+    CHECK(t.is_contiguous());
+    CHECK_LE(t.dim(), 2);
+    layout.defined = true;
+    layout.dtype = t.scalar_type();
+    layout.offset = num_bytes;
+    layout.dim = t.dim();
+    for (int64_t i = 0; i < t.dim(); ++i) {
+      layout.sizes[i] = t.size(i);
+    }
+    num_bytes += (static_cast<int64_t>(t.nbytes()) + kPackAlignment - 1) /
+                 kPackAlignment * kPackAlignment;
+  });
+
+  packed_.clear();
+  uint8_t* data = packed_.extend(num_bytes);
+  packed.buffer = packed_.tensor();
+
+  // copy tensors into the buffer and replace them with views of it
+  size_t i = 0;
+  model_input->for_each_tensor([this, &packed, &i, data](torch::Tensor& t) {
+    const auto& layout = (*layouts_)[i];
+    if (layout.defined) {
+      std::memcpy(data + layout.offset, t.data_ptr(), t.nbytes());
+      t = packed.tensor(i);
+    }
+    ++i;
+  });
+}
+
+}  // namespace llm
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <glog/logging.h>
+#include <torch/torch.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "parameters.h"
+#include "request/sequence.h"
+
+namespace llm {
+
+// A grow-only flat host buffer, which keeps its capacity when cleared.
+// tensors returned are views of the buffer, valid until the buffer is written
+// again.
+template <typename T>
+class HostBuffer final {
+ public:
+  explicit HostBuffer(bool pin_memory = false) : pin_memory_(pin_memory) {}
+
+  void clear() { size_ = 0; }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  T* data() { return data_; }
+  const T* data() const { return data_; }
+
+  T& operator[](size_t i) { return data_[i]; }
+  const T& operator[](size_t i) const { return data_[i]; }
+
+  T& back() { return data_[size_ - 1]; }
+
+  void push_back(T value) {
+    if (size_ == capacity_) {
+      reserve(size_ + 1);
+    }
+    data_[size_++] = value;
+  }
+
+  // append n elements and return the pointer to the first one
+  T* extend(size_t n) {
+    reserve(size_ + n);
+    T* data = data_ + size_;
+    size_ += n;
+    return data;
+  }
+
+  // resize without initializing new elements
+  void resize(size_t size) {
+    reserve(size);
+    size_ = size;
+  }
+
+  // append n elements with the value
+  void append(size_t n, T value) {
+    T* data = extend(n);
+    std::fill(data, data + n, value);
+  }
+
+  void reserve(size_t capacity) {
+    if (capacity <= capacity_) {
+      return;
+    }
+    // grow geometrically to amortize the allocations
+    capacity = std::max({capacity, capacity_ * 2, size_t(64)});
+    auto storage = torch::empty(
+        {static_cast<int64_t>(capacity)},
+        torch::dtype(c10::CppTypeToScalarType<T>::value)
+            .pinned_memory(pin_memory_));
+    T* data = storage.template data_ptr<T>();
+    if (size_ > 0) {
+      std::memcpy(data, data_, size_ * sizeof(T));
+    }
+    storage_ = std::move(storage);
+    data_ = data;
+    capacity_ = capacity;
+  }
+
+  // get a view of the elements as a 1-D tensor
+  torch::Tensor tensor() {
+    reserve(1);
+    return storage_.slice(/*dim=*/0, /*start=*/0, /*end=*/size_);
+  }
+
+ private:
+  torch::Tensor storage_;
+  T* data_ = nullptr;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+  bool pin_memory_ = false;
+};
+
+// A builder of model inputs that reuses flat host buffers across steps.
+// inputs of each sequence are appended in one pass, and 2-D inputs, like
+// block tables and unique tokens, are kept in CSR layout and only padded when
+// building the tensors, so that preparing inputs for steady-state decoding
+// doesn't allocate on the host. buffers are pinned if requested, for
+// asynchronous copies to devices.
+// all tensors of the built input are packed into one buffer at last, to be
+// copied to devices with a single transfer. they are views of the buffer,
+// which are valid until the next build. not thread safe.
+class ModelInputBuilder final {
+ public:
+  explicit ModelInputBuilder(bool pin_memory = false);
+
+  // clear the buffers for a new input, keeping their capacity
+  void reset();
+
+  // add tokens of the sequence in [n_kv_cache_tokens, seq_len), and select
+  // tokens after the prompt, including the last prompt token, for sampling.
+  void add_sequence(const Sequence& sequence,
+                    uint32_t n_kv_cache_tokens,
+                    uint32_t seq_len);
+
+  // add padding sequences with num_tokens tokens each, without blocks
+  void add_padding_sequences(uint32_t num_sequences, uint32_t num_tokens);
+
+  // add a kv cache block copy to apply before running the model
+  void add_block_copy(int32_t src_block_id, int32_t dst_block_id);
+
+  // get the number of tokens added
+  size_t num_tokens() const { return token_ids_.size(); }
+
+  // get the max number of tokens to process among sequences
+  uint32_t q_max_seq_len() const { return q_max_seq_len_; }
+
+  // get the sequences constrained by grammars, in order of their sampled
+  // tokens
+  const std::vector<const Sequence*>& constrained_sequences() const {
+    return constrained_sequences_;
+  }
+
+  // build the model input packed into one buffer
+  ModelInput build();
+
+ private:
+  void build_sampling_params(SamplingParameters* params);
+
+  // pack all tensors of the model input into one buffer, and replace them
+  // with views of the buffer
+  void pack(ModelInput* model_input);
+
+  // add the unique tokens and counts of tokens in [0, j] of the sequence
+  void add_unique_tokens(const Sequence& sequence, uint32_t j);
+
+  bool pin_memory_ = false;
+
+  // flatten token ids and positions
+  HostBuffer<int32_t> token_ids_;
+  HostBuffer<int32_t> positions_;
+
+  // cumulative sequence lengths, starting with 0
+  HostBuffer<int32_t> q_cu_seq_lens_;
+  HostBuffer<int32_t> kv_cu_seq_lens_;
+  uint32_t q_max_seq_len_ = 0;
+  uint32_t kv_max_seq_len_ = 0;
+
+  // kv cache slots of new tokens
+  HostBuffer<int32_t> new_cache_slots_;
+
+  // block ids of each sequence in CSR layout, and the padded block tables
+  HostBuffer<int32_t> block_ids_;
+  HostBuffer<int32_t> block_offsets_;
+  HostBuffer<int32_t> block_tables_;
+
+  // kv cache block copies
+  HostBuffer<int32_t> src_block_ids_;
+  HostBuffer<int32_t> dst_block_ids_;
+
+  // selected tokens for sampling, and the last one of each sequence
+  HostBuffer<int32_t> selected_token_idxes_;
+  HostBuffer<int32_t> sample_idxes_;
+  HostBuffer<int32_t> constrained_token_idxes_;
+  std::vector<const Sequence*> constrained_sequences_;
+
+  // sampling parameters of each selected token
+  HostBuffer<float> frequency_penalties_;
+  HostBuffer<float> presence_penalties_;
+  HostBuffer<float> repetition_penalties_;
+  HostBuffer<float> temperatures_;
+  HostBuffer<float> top_p_;
+  HostBuffer<int64_t> top_k_;
+  // whether to sample for each sampled token
+  HostBuffer<bool> do_sample_;
+
+  // whether any selected token uses the non-default parameters
+  bool need_token_stats_ = false;
+  bool need_temperatures_ = false;
+  bool need_top_p_ = false;
+  bool need_top_k_ = false;
+
+  // unique tokens and counts of each selected token in CSR layout, only
+  // for tokens with penalties, and the padded tensors
+  HostBuffer<int64_t> unique_ids_;
+  HostBuffer<int32_t> unique_counts_;
+  HostBuffer<int32_t> unique_offsets_;
+  HostBuffer<int32_t> unique_lens_;
+  HostBuffer<int64_t> padded_unique_ids_;
+  HostBuffer<int32_t> padded_unique_counts_;
+
+  // counts of tokens after the selected token of the sequence being added,
+  // indexed by token id, which are all zeros between sequences.
+  std::vector<int32_t> later_token_counts_;
+
+  // all tensors of the built input
+  HostBuffer<uint8_t> packed_;
+  // layouts of tensors in the packed buffer, shared with built inputs
+  std::shared_ptr<std::vector<TensorLayout>> layouts_;
+};
+
+}  // namespace llm
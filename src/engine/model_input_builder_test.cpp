@@ -0,0 +1,185 @@
+#include "model_input_builder.h"
+
+#include <gtest/gtest.h>
+#include <torch/torch.h>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "memory/block_allocator.h"
+#include "request/sequence.h"
+
+namespace llm {
+
+namespace {
+
+template <typename T>
+std::vector<T> to_vector(const torch::Tensor& t) {
+  const auto flatten_t = t.contiguous().flatten();
+  return {flatten_t.data_ptr<T>(), flatten_t.data_ptr<T>() + flatten_t.numel()};
+}
+
+// get the unique token counts of the row, which are in any order
+std::map<int64_t, int32_t> unique_tokens(const SamplingParameters& params,
+                                         int64_t row) {
+  const auto ids = to_vector<int64_t>(params.unique_token_ids[row]);
+  const auto counts = to_vector<int32_t>(params.unique_token_counts[row]);
+  const int32_t len = params.unique_token_ids_lens[row].item<int32_t>();
+  std::map<int64_t, int32_t> tokens;
+  for (int32_t i = 0; i < len; ++i) {
+    tokens[ids[i]] = counts[i];
+  }
+  return tokens;
+}
+
+}  // namespace
+
+TEST(ModelInputBuilderTest, ReuseBuffers) {
+  BlockAllocator allocator(/*num_blocks=*/20, /*block_size=*/4);
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 20;
+
+  Sequence seq(/*prompt=*/"", /*token_ids=*/{1, 3, 5, 7, 5}, 100, options);
+  seq.append_blocks(allocator.allocate(2));
+  seq.commit_kv_cache(/*size=*/5);
+  seq.append_token(9);
+
+  ModelInputBuilder builder;
+  builder.add_sequence(seq, /*n_kv_cache_tokens=*/5, /*seq_len=*/6);
+  builder.add_padding_sequences(/*num_sequences=*/1, /*num_tokens=*/1);
+  const auto input = builder.build();
+  EXPECT_EQ(to_vector<int32_t>(input.token_ids),
+            std::vector<int32_t>({9, 0}));
+  EXPECT_EQ(to_vector<int32_t>(input.positions),
+            std::vector<int32_t>({5, 0}));
+  EXPECT_EQ(to_vector<int32_t>(input.input_params.q_cu_seq_lens),
+            std::vector<int32_t>({0, 1, 2}));
+  EXPECT_EQ(to_vector<int32_t>(input.input_params.kv_cu_seq_lens),
+            std::vector<int32_t>({0, 6, 7}));
+  // padding sequences have no blocks
+  const auto& block_tables = input.input_params.block_tables;
+  EXPECT_EQ(block_tables.sizes(), torch::IntArrayRef({2, 2}));
+  const auto blocks = seq.blocks();
+  EXPECT_EQ(to_vector<int32_t>(block_tables),
+            std::vector<int32_t>({blocks[0].id(), blocks[1].id(), 0, 0}));
+  EXPECT_EQ(to_vector<int32_t>(input.sampling_params.selected_token_idxes),
+            std::vector<int32_t>({0}));
+  EXPECT_FALSE(input.sampling_params.unique_token_ids.defined());
+  // sample with the default temperature
+  EXPECT_TRUE(input.sampling_params.all_random_sample);
+  EXPECT_FALSE(input.sampling_params.all_greedy_sample);
+
+  // the same buffers are used for the next step
+  const auto* token_ids_data = input.token_ids.data_ptr<int32_t>();
+  seq.commit_kv_cache(/*size=*/1);
+  seq.append_token(11);
+  builder.reset();
+  builder.add_sequence(seq, /*n_kv_cache_tokens=*/6, /*seq_len=*/7);
+  const auto next_input = builder.build();
+  EXPECT_EQ(next_input.token_ids.data_ptr<int32_t>(), token_ids_data);
+  EXPECT_EQ(to_vector<int32_t>(next_input.token_ids),
+            std::vector<int32_t>({11}));
+  EXPECT_EQ(next_input.input_params.kv_max_seq_len, 7);
+}
+
+TEST(ModelInputBuilderTest, UniqueTokensOfSelectedTokens) {
+  BlockAllocator allocator(/*num_blocks=*/20, /*block_size=*/4);
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 20;
+  options.sampling_param.frequency_penalty = 0.1;
+
+  // two tokens to verify after the prompt
+  Sequence seq1(/*prompt=*/"", /*token_ids=*/{1, 2, 3}, 100, options);
+  seq1.append_blocks(allocator.allocate(2));
+  seq1.commit_kv_cache(/*size=*/3);
+  seq1.append_token(2);
+  seq1.append_token(4);
+
+  // no penalties, no unique tokens
+  options.sampling_param.frequency_penalty = 0.0;
+  Sequence seq2(/*prompt=*/"", /*token_ids=*/{5, 6}, 100, options);
+  seq2.append_blocks(allocator.allocate(1));
+
+  ModelInputBuilder builder;
+  builder.add_sequence(seq1, /*n_kv_cache_tokens=*/3, /*seq_len=*/5);
+  builder.add_sequence(seq2, /*n_kv_cache_tokens=*/0, /*seq_len=*/2);
+  const auto input = builder.build();
+
+  const auto& params = input.sampling_params;
+  EXPECT_EQ(to_vector<int32_t>(params.selected_token_idxes),
+            std::vector<int32_t>({0, 1, 3}));
+  EXPECT_EQ(to_vector<int32_t>(params.sample_idxes),
+            std::vector<int32_t>({1, 2}));
+  // tokens after the selected token are not counted
+  EXPECT_EQ(unique_tokens(params, 0),
+            (std::map<int64_t, int32_t>{{1, 1}, {2, 2}, {3, 1}}));
+  EXPECT_EQ(unique_tokens(params, 1),
+            (std::map<int64_t, int32_t>{{1, 1}, {2, 2}, {3, 1}, {4, 1}}));
+  EXPECT_TRUE(unique_tokens(params, 2).empty());
+  EXPECT_EQ(params.unique_token_ids.sizes(), torch::IntArrayRef({3, 4}));
+}
+
+TEST(ModelInputBuilderTest, PackTensors) {
+  BlockAllocator allocator(/*num_blocks=*/20, /*block_size=*/4);
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 20;
+  options.sampling_param.frequency_penalty = 0.1;
+  options.sampling_param.top_k = 10;
+
+  Sequence seq(/*prompt=*/"", /*token_ids=*/{1, 2, 3, 2}, 100, options);
+  seq.append_blocks(allocator.allocate(2));
+  seq.commit_kv_cache(/*size=*/4);
+  seq.append_token(5);
+
+  ModelInputBuilder builder;
+  builder.add_sequence(seq, /*n_kv_cache_tokens=*/4, /*seq_len=*/5);
+  builder.add_block_copy(/*src_block_id=*/3, /*dst_block_id=*/7);
+  auto input = builder.build();
+
+  // all tensors are views of the packed buffer
+  const auto& packed = input.packed;
+  ASSERT_TRUE(packed.defined());
+  const auto* begin = packed.buffer.data_ptr<uint8_t>();
+  const auto* end = begin + packed.buffer.numel();
+  size_t num_tensors = 0;
+  input.for_each_tensor([&](torch::Tensor& t) {
+    if (t.defined()) {
+      const auto* data = static_cast<const uint8_t*>(t.data_ptr());
+      EXPECT_TRUE(data >= begin && data + t.nbytes() <= end);
+      ++num_tensors;
+    }
+  });
+  EXPECT_EQ(num_tensors, 16);
+
+  // tensors are taken as views of the copied buffer
+  ModelInput copied_input = input;
+  copied_input.packed.buffer = packed.buffer.clone();
+  const auto device_input = copied_input.to(torch::kCPU, torch::kHalf);
+  EXPECT_FALSE(device_input.packed.defined());
+  EXPECT_EQ(device_input.token_ids.data_ptr(),
+            copied_input.packed.buffer.data_ptr());
+  EXPECT_TRUE(torch::equal(device_input.token_ids, input.token_ids));
+  EXPECT_TRUE(torch::equal(device_input.input_params.block_tables,
+                           input.input_params.block_tables));
+  EXPECT_TRUE(torch::equal(device_input.sampling_params.unique_token_ids,
+                           input.sampling_params.unique_token_ids));
+  EXPECT_TRUE(torch::equal(device_input.sampling_params.top_k,
+                           input.sampling_params.top_k));
+  EXPECT_TRUE(torch::equal(device_input.src_block_ids, input.src_block_ids));
+  EXPECT_EQ(device_input.sampling_params.frequency_penalties.scalar_type(),
+            torch::kHalf);
+  EXPECT_FALSE(device_input.sampling_params.temperatures.defined());
+
+  // layouts are shared with copies, and reused once inputs are released
+  const auto* layouts = input.packed.layouts.get();
+  EXPECT_EQ(copied_input.packed.layouts.get(), layouts);
+  input = {};
+  copied_input = {};
+  builder.reset();
+  builder.add_sequence(seq, /*n_kv_cache_tokens=*/4, /*seq_len=*/5);
+  input = builder.build();
+  EXPECT_EQ(input.packed.layouts.get(), layouts);
+}
+
+}  // namespace llm
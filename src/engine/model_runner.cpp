@@ -6,12 +6,23 @@
 #include <glog/logging.h>
 #include <torch/torch.h>
 
+#include "memory/cpu_memory_pool.h"
 #include "memory/kv_cache.h"
 #include "models/causal_lm.h"
 #include "models/parameters.h"
 
 namespace llm {
 
+ModelRunner::ModelRunner(CausalLM* model,
+                         const torch::Device& device,
+                         const Options& options)
+    : model_(model), device_(device), options_(options) {
+  if (device_.is_cpu() && options_.cpu_memory_pool_bytes() > 0) {
+    cpu_memory_pool_ =
+        std::make_unique<CpuMemoryPool>(options_.cpu_memory_pool_bytes());
+  }
+}
+
 // capture graph with batch size list
 void ModelRunner::capture_cuda_graphs(std::vector<KVCache>& kv_cache) {
   if (!device_.is_cuda()) {
@@ -105,7 +116,8 @@ void ModelRunner::capture_cuda_graphs(std::vector<KVCache>& kv_cache) {
 torch::Tensor ModelRunner::forward(const torch::Tensor& tokens,
                                    const torch::Tensor& positions,
                                    std::vector<KVCache>& kv_caches,
-                                   const InputParameters& params) {
+                                   const InputParameters& params,
+                                   const ForwardContext& context) {
   const uint32_t batch_size = params.num_sequences;
   // check if captured graph exists
   auto it = graphs_.find(batch_size);
@@ -127,8 +139,14 @@ torch::Tensor ModelRunner::forward(const torch::Tensor& tokens,
     }
   }
 
+  if (cpu_memory_pool_ != nullptr) {
+    // intermediate tensors reuse blocks freed by earlier steps
+    CpuMemoryPool::Guard memory_pool_guard(cpu_memory_pool_.get());
+    return model_->forward(tokens, positions, kv_caches, params, context);
+  }
+
   // run model directly in eager mode
-  return model_->forward(tokens, positions, kv_caches, params);
+  return model_->forward(tokens, positions, kv_caches, params, context);
 }
 
 void ModelRunner::CudaGraph::capture(at::cuda::MempoolId_t mem_pool,
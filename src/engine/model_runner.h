@@ -8,6 +8,7 @@
 #include <memory>
 
 #include "common/macros.h"
+#include "memory/cpu_memory_pool.h"
 #include "memory/kv_cache.h"
 #include "models/causal_lm.h"
 #include "models/parameters.h"
@@ -29,23 +30,28 @@ class ModelRunner final {
 
     // batch sizes to capture cuda graphs
     DEFINE_ARG(std::vector<uint32_t>, cuda_graph_batch_sizes);
+
+    // max bytes of freed blocks cached across steps by a memory pool for
+    // intermediate tensors of forward passes on cpu, 0 to disable the pool
+    DEFINE_ARG(int64_t, cpu_memory_pool_bytes) = 0;
   };
 
   ModelRunner(CausalLM* model,
               const torch::Device& device,
-              const Options& options)
-      : model_(model), device_(device), options_(options) {}
+              const Options& options);
 
   // capture graph with batch size list
   void capture_cuda_graphs(std::vector<KVCache>& kv_cache);
 
   // tokens: [num_tokens]
   // positions: [num_tokens] token pos in the sequence
+  // context: allocations of intermediate tensors in eager mode
   // returns: [num_tokens, hidden_size]
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& params);
+                        const InputParameters& params,
+                        const ForwardContext& context = ForwardContext());
 
  private:
   // model, do not own
@@ -93,6 +99,10 @@ class ModelRunner final {
     // output tensors
     torch::Tensor hidden_states_;
   };
+
+  // memory pool for intermediate tensors of forward passes on cpu, nullptr
+  // if disabled
+  std::unique_ptr<CpuMemoryPool> cpu_memory_pool_;
 };
 
 }  // namespace llm
@@ -0,0 +1,90 @@
+#include "model_runner.h"
+
+#include <gtest/gtest.h>
+#include <torch/torch.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "memory/kv_cache.h"
+#include "model_loader/state_dict.h"
+#include "models/causal_lm.h"
+#include "models/simple_model.h"
+#include "quantization/quant_args.h"
+
+namespace llm {
+
+TEST(ModelRunnerTest, CpuMemoryPool) {
+  constexpr int64_t kHiddenSize = 32;
+  constexpr int64_t kIntermediateSize = 64;
+  constexpr int64_t kNumHeads = 4;
+  constexpr int64_t kBlockSize = 4;
+  constexpr int64_t kNumBlocks = 16;
+
+  ModelArgs args;
+  args.model_type("simple")
+      .vocab_size(kHiddenSize)
+      .hidden_size(kHiddenSize)
+      .n_layers(1)
+      .n_heads(kNumHeads)
+      .n_kv_heads(kNumHeads)
+      .intermediate_size(kIntermediateSize)
+      .hidden_act("silu")
+      .max_position_embeddings(128);
+  const auto options = torch::dtype(torch::kFloat).device(torch::kCPU);
+  auto model = CausalLM::create(
+      args, QuantArgs(), ParallelArgs(0, 1, nullptr), options);
+  ASSERT_TRUE(model != nullptr);
+
+  torch::manual_seed(42);
+  std::unordered_map<std::string, torch::Tensor> dict;
+  dict.emplace("model.embed_tokens.weight",
+               torch::randn({kHiddenSize, kHiddenSize}));
+  dict.emplace("model.layers.0.mlp.gate_proj.weight",
+               torch::randn({kIntermediateSize, kHiddenSize}));
+  dict.emplace("model.layers.0.mlp.up_proj.weight",
+               torch::randn({kIntermediateSize, kHiddenSize}));
+  dict.emplace("model.layers.0.mlp.down_proj.weight",
+               torch::randn({kHiddenSize, kIntermediateSize}));
+  model->load_state_dict(StateDict(dict, 0, 1));
+
+  const int64_t head_dim = kHiddenSize / kNumHeads;
+  std::vector<KVCache> kv_caches;
+  kv_caches.emplace_back(
+      torch::zeros({kNumBlocks, kBlockSize, kNumHeads, head_dim}, options),
+      torch::zeros({kNumBlocks, kBlockSize, kNumHeads, head_dim}, options));
+
+  ModelRunner::Options runner_options;
+  runner_options.block_size(kBlockSize)
+      .cpu_memory_pool_bytes(int64_t(1) << 30);
+  ModelRunner runner(model.get(), torch::kCPU, runner_options);
+
+  // a decoding step of two sequences with 5 and 4 tokens
+  const auto int_options = torch::dtype(torch::kInt);
+  InputParameters params;
+  params.empty_kv_cache = false;
+  params.num_sequences = 2;
+  params.q_max_seq_len = 1;
+  params.kv_max_seq_len = 5;
+  params.q_cu_seq_lens = torch::tensor({0, 1, 2}, int_options);
+  params.kv_cu_seq_lens = torch::tensor({0, 5, 9}, int_options);
+  params.new_cache_slots = torch::tensor({8, 15}, int_options);
+  params.block_tables = torch::tensor({{1, 2}, {3, 0}}, int_options);
+  const auto positions = torch::tensor({4, 3}, int_options);
+
+  auto tokens = torch::tensor({3, 7}, int_options);
+  auto output = runner.forward(tokens, positions, kv_caches, params);
+  EXPECT_TRUE(torch::allclose(
+      output, model->forward(tokens, positions, kv_caches, params)));
+
+  // later steps reuse blocks released by earlier ones
+  output.reset();
+  tokens = torch::tensor({5, 1}, int_options);
+  output = runner.forward(tokens, positions, kv_caches, params);
+  EXPECT_TRUE(torch::allclose(
+      output, model->forward(tokens, positions, kv_caches, params)));
+}
+
+}  // namespace llm
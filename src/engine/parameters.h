@@ -1,15 +1,124 @@
 #pragma once
 
+#include <ATen/cuda/CUDAEvent.h>
 #include <torch/torch.h>
 
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common/tensor_helper.h"
 #include "models/parameters.h"
 #include "sampling/parameters.h"
 
 namespace llm {
 
+// layout of a tensor in a packed buffer
+struct TensorLayout {
+  // undefined tensors take no space
+  bool defined = false;
+
+  torch::ScalarType dtype = torch::kByte;
+
+  // offset in bytes from the start of the buffer
+  int64_t offset = 0;
+
+  // tensors have at most 2 dimensions
+  int64_t dim = 0;
+  std::array<int64_t, 2> sizes = {0, 0};
+};
+
+// tensors packed into one contiguous byte buffer, which are copied to a
+// device with a single transfer and taken as views on the device side.
+struct PackedTensors {
+  bool defined() const { return buffer.defined(); }
+
+  // copy the buffer to the device, asynchronously if the buffer is pinned
+  PackedTensors to(const torch::Device& device) const {
+    PackedTensors packed;
+    packed.buffer = buffer.to(device, /*non_blocking=*/true);
+    packed.layouts = layouts;
+    return packed;
+  }
+
+  // get the i-th tensor as a view of the buffer
+  torch::Tensor tensor(size_t i) const {
+    const auto& layout = (*layouts)[i];
+    if (!layout.defined) {
+      return {};
+    }
+    const torch::IntArrayRef sizes(layout.sizes.data(), layout.dim);
+    const int64_t num_bytes =
+        c10::multiply_integers(sizes) * torch::elementSize(layout.dtype);
+    return buffer.slice(/*dim=*/0, layout.offset, layout.offset + num_bytes)
+        .view(layout.dtype)
+        .view(sizes);
+  }
+
+  // [num_bytes] ByteTensor
+  torch::Tensor buffer;
+
+  // layouts of tensors in the order of ModelInput::for_each_tensor, shared
+  // with the builder and copies of the input
+  std::shared_ptr<const std::vector<TensorLayout>> layouts;
+};
+
 // input for the model that encapsulates all the necessary
 // input information.
 struct ModelInput {
+  // move the input to the device, with a single transfer if packed.
+  // floating point sampling parameters are converted to dtype. allowed token
+  // bitmasks are left as is, to be resolved after the forward pass.
+  ModelInput to(const torch::Device& device, torch::ScalarType dtype) const {
+    ModelInput input = *this;
+    input.packed = {};
+    if (packed.defined()) {
+      const auto buffer = packed.to(device);
+      size_t i = 0;
+      input.for_each_tensor(
+          [&buffer, &i](torch::Tensor& t) { t = buffer.tensor(i++); });
+    } else {
+      input.for_each_tensor(
+          [&device](torch::Tensor& t) { t = safe_to(t, device); });
+    }
+
+    auto& params = input.sampling_params;
+    const auto options = torch::dtype(dtype);
+    params.frequency_penalties = safe_to(params.frequency_penalties, options);
+    params.presence_penalties = safe_to(params.presence_penalties, options);
+    params.repetition_penalties = safe_to(params.repetition_penalties, options);
+    params.temperatures = safe_to(params.temperatures, options);
+    params.top_p = safe_to(params.top_p, options);
+    return input;
+  }
+
+  // visit all tensors, except allowed token bitmasks, in a fixed order
+  template <typename Visitor>
+  void for_each_tensor(Visitor&& visitor) {
+    visitor(token_ids);
+    visitor(positions);
+    visitor(input_params.q_cu_seq_lens);
+    visitor(input_params.kv_cu_seq_lens);
+    visitor(input_params.new_cache_slots);
+    visitor(input_params.block_tables);
+    visitor(sampling_params.selected_token_idxes);
+    visitor(sampling_params.frequency_penalties);
+    visitor(sampling_params.presence_penalties);
+    visitor(sampling_params.repetition_penalties);
+    visitor(sampling_params.temperatures);
+    visitor(sampling_params.top_p);
+    visitor(sampling_params.top_k);
+    visitor(sampling_params.unique_token_ids);
+    visitor(sampling_params.unique_token_counts);
+    visitor(sampling_params.unique_token_ids_lens);
+    visitor(sampling_params.sample_idxes);
+    visitor(sampling_params.do_sample);
+    visitor(sampling_params.constrained_token_idxes);
+    visitor(src_block_ids);
+    visitor(dst_block_ids);
+  }
+
   // flatten token ids
   torch::Tensor token_ids;
   // flatten positions
@@ -18,6 +127,20 @@ struct ModelInput {
   InputParameters input_params;
   // sampling parameters, mainly for sampling
   SamplingParameters sampling_params;
+
+  // kv cache blocks to copy before running the model, for copy-on-write
+  // [num_copies] IntTensor
+  torch::Tensor src_block_ids;
+  // [num_copies] IntTensor
+  torch::Tensor dst_block_ids;
+
+  // number of decoding steps to run back to back, with the sampled tokens of
+  // each step fed into the next one. only for batches decoding one token per
+  // sequence.
+  int32_t num_decoding_steps = 1;
+
+  // tensors above packed into one buffer if defined, which are views of it
+  PackedTensors packed;
 };
 
 // output for the model that encapsulates all the necessary
@@ -27,11 +150,27 @@ struct ModelOutput {
   torch::Tensor do_sample;
 
   // output of sampling
+  // for multiple decoding steps, next tokens and logprobs of all steps are
+  // stacked into [num_seqs, num_steps], others are of the last step.
   SampleOutput sample_output;
 
-  // logits for selected indices
+  // logits for selected indices, of the last step
   torch::Tensor logits;
 
+  // hidden states passed to the next pipeline stage
+  torch::Tensor hidden_states;
+
+  // event recorded after the sample output is copied to the host without
+  // blocking, nullptr if the sample output is ready
+  std::shared_ptr<at::cuda::CUDAEvent> ready_event;
+
+  // wait until the sample output is copied to the host
+  void synchronize() const {
+    if (ready_event != nullptr) {
+      ready_event->synchronize();
+    }
+  }
+
   // torch::Tensor logprob;
 };
 
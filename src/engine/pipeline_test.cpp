@@ -0,0 +1,176 @@
+#include <folly/futures/Future.h>
+#include <gtest/gtest.h>
+#include <torch/torch.h>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "engine/batch.h"
+#include "engine/worker.h"
+#include "memory/block_manager.h"
+#include "model_loader/state_dict.h"
+#include "models/simple_model.h"
+#include "quantization/quant_args.h"
+#include "request/sequence.h"
+
+namespace llm {
+namespace {
+
+// the simple model uses hidden states as logits
+constexpr int64_t kVocabSize = 32;
+constexpr int64_t kHiddenSize = kVocabSize;
+constexpr int64_t kIntermediateSize = 64;
+constexpr int64_t kNumHeads = 4;
+constexpr int64_t kNumLayers = 3;
+constexpr int64_t kBlockSize = 4;
+constexpr int64_t kNumBlocks = 64;
+
+class PipelineTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    args_.model_type("simple")
+        .vocab_size(kVocabSize)
+        .hidden_size(kHiddenSize)
+        .n_layers(kNumLayers)
+        .n_heads(kNumHeads)
+        .n_kv_heads(kNumHeads)
+        .intermediate_size(kIntermediateSize)
+        .hidden_act("silu")
+        .max_position_embeddings(128);
+
+    torch::manual_seed(42);
+    dict_.emplace("model.embed_tokens.weight",
+                  torch::randn({kVocabSize, kHiddenSize}));
+    for (int64_t i = 0; i < kNumLayers; ++i) {
+      const std::string prefix = "model.layers." + std::to_string(i) + ".";
+      dict_.emplace(prefix + "mlp.gate_proj.weight",
+                    torch::randn({kIntermediateSize, kHiddenSize}));
+      dict_.emplace(prefix + "mlp.up_proj.weight",
+                    torch::randn({kIntermediateSize, kHiddenSize}));
+      dict_.emplace(prefix + "mlp.down_proj.weight",
+                    torch::randn({kHiddenSize, kIntermediateSize}));
+    }
+
+    BlockManager::Options options;
+    options.num_blocks(kNumBlocks)
+        .block_size(kBlockSize)
+        .enable_prefix_cache(false);
+    block_manager_ = std::make_unique<BlockManager>(options);
+  }
+
+  // create a worker on cpu running the layers of the model args
+  std::unique_ptr<Worker> create_worker(const ModelArgs& args) {
+    auto worker = std::make_unique<Worker>(ParallelArgs(0, 1, nullptr),
+                                           torch::Device(torch::kCPU),
+                                           ModelRunner::Options(),
+                                           Worker::Options());
+    EXPECT_TRUE(worker->init_model(torch::kFloat, args, QuantArgs()));
+    worker->load_state_dict(StateDict(dict_, 0, 1));
+    worker->verify_loaded_weights();
+    const int64_t head_dim = kHiddenSize / kNumHeads;
+    EXPECT_TRUE(worker->init_kv_cache(
+        {kNumBlocks, kBlockSize, kNumHeads, head_dim}));
+    EXPECT_TRUE(worker->capture_cuda_graphs());
+    return worker;
+  }
+
+  // create sequences with the given prompts and allocate their blocks
+  std::vector<Sequence*> create_sequences(
+      const std::vector<std::vector<int32_t>>& prompts) {
+    std::vector<Sequence*> sequences;
+    for (const auto& prompt : prompts) {
+      auto& sequence = sequences_.emplace_back(
+          /*prompt=*/"", prompt, /*capacity=*/16, Sequence::Options());
+      EXPECT_TRUE(block_manager_->allocate_blocks_for(&sequence));
+      sequences.push_back(&sequence);
+    }
+    return sequences;
+  }
+
+  ModelArgs args_;
+  std::unordered_map<std::string, torch::Tensor> dict_;
+  std::unique_ptr<BlockManager> block_manager_;
+  std::deque<Sequence> sequences_;
+};
+
+}  // namespace
+
+TEST(PipelineStageTest, StageLayers) {
+  ModelArgs args;
+  args.n_layers(7).n_pipeline_stages(3);
+  EXPECT_EQ(args.stage_layers(0), std::pair<int64_t, int64_t>(0, 2));
+  EXPECT_EQ(args.stage_layers(1), std::pair<int64_t, int64_t>(2, 4));
+  EXPECT_EQ(args.stage_layers(2), std::pair<int64_t, int64_t>(4, 7));
+  EXPECT_TRUE(args.is_first_stage());
+  EXPECT_FALSE(args.is_last_stage());
+
+  args.pipeline_stage(2);
+  EXPECT_EQ(args.n_stage_layers(), 3);
+  EXPECT_FALSE(args.is_first_stage());
+  EXPECT_TRUE(args.is_last_stage());
+
+  // given number of layers of each stage
+  args.pipeline_stage_layers({1, 4, 2});
+  EXPECT_EQ(args.stage_layers(1), std::pair<int64_t, int64_t>(1, 5));
+  EXPECT_EQ(args.stage_layers(), std::pair<int64_t, int64_t>(5, 7));
+}
+
+TEST_F(PipelineTest, TwoStages) {
+  auto reference = create_worker(args_);
+  std::vector<std::unique_ptr<Worker>> stages;
+  for (int32_t i = 0; i < 2; ++i) {
+    ModelArgs args = args_;
+    args.n_pipeline_stages(2).pipeline_stage(i);
+    stages.push_back(create_worker(args));
+  }
+
+  const std::vector<std::vector<int32_t>> prompts = {
+      {1, 3, 5}, {2, 4}, {7, 8, 9, 10, 11}};
+  Batch reference_batch(create_sequences(prompts));
+  auto reference_input =
+      reference_batch.prepare_model_input(/*num_decoding_tokens=*/1,
+                                          /*min_decoding_bach_size=*/0);
+  const auto expected = reference->execute_model(reference_input);
+
+  // micro batches of the batch keep the order of sequences
+  Batch batch(create_sequences(prompts));
+  auto micro_batches = batch.split(/*max_batches=*/2);
+  ASSERT_EQ(micro_batches.size(), 2);
+  EXPECT_EQ(micro_batches[0].size(), 2);
+  EXPECT_EQ(micro_batches[1].size(), 1);
+
+  // chain stages of micro batches, running in their own workers
+  std::vector<folly::SemiFuture<ModelOutput>> futures;
+  for (auto& micro_batch : micro_batches) {
+    const auto input =
+        micro_batch.prepare_model_input(/*num_decoding_tokens=*/1,
+                                        /*min_decoding_bach_size=*/0);
+    auto output = folly::makeSemiFuture(ModelOutput());
+    for (auto& stage : stages) {
+      output = stage->execute_stage_async(input, std::move(output));
+    }
+    futures.push_back(std::move(output));
+  }
+  auto results = folly::collectAll(futures).get();
+  ASSERT_EQ(results.size(), 2);
+
+  std::vector<torch::Tensor> logits;
+  std::vector<torch::Tensor> next_tokens;
+  for (auto& result : results) {
+    const auto& output = result.value();
+    // the last stage samples without passing hidden states
+    EXPECT_FALSE(output.hidden_states.defined());
+    logits.push_back(output.logits);
+    next_tokens.push_back(output.sample_output.next_tokens);
+  }
+  EXPECT_TRUE(torch::allclose(torch::cat(logits), expected.logits));
+  EXPECT_TRUE(torch::equal(torch::cat(next_tokens),
+                           expected.sample_output.next_tokens));
+}
+
+}  // namespace llm
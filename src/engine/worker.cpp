@@ -1,5 +1,6 @@
 #include "worker.h"
 
+#include <ATen/cuda/CUDAEvent.h>
 #include <ATen/cuda/CUDAGraph.h>
 #include <c10/core/Device.h>
 #include <c10/cuda/CUDAGuard.h>
@@ -8,25 +9,79 @@
 #include <glog/logging.h>
 #include <torch/torch.h>
 
+#include <algorithm>
 #include <memory>
 #include <utility>
+#include <vector>
 
+#include "common/cpu_affinity.h"
+#include "common/metrics.h"
 #include "common/threadpool.h"
 #include "memory/kv_cache.h"
 #include "memory/memory.h"
+#include "memory/workspace.h"
 #include "model_loader/state_dict.h"
 #include "models/parameters.h"
-#include "sampling/logits_processor.h"
-#include "sampling/sampler.h"
+#include "sampling/sampling_pipeline.h"
 
 namespace llm {
 
+namespace {
+
+// copy the tensor into pinned host memory without blocking the host, which
+// is not reused until the copy completes
+torch::Tensor to_host_async(const torch::Tensor& tensor) {
+  if (!tensor.defined()) {
+    return tensor;
+  }
+  auto host = torch::empty(
+      tensor.sizes(),
+      tensor.options().device(torch::kCPU).pinned_memory(true));
+  host.copy_(tensor, /*non_blocking=*/true);
+  return host;
+}
+
+}  // namespace
+
+DEFINE_GAUGE(workspace_peak_allocated_bytes,
+             "Peak bytes of the workspace arena in use during the last step");
+DEFINE_GAUGE(workspace_num_allocations,
+             "Number of tensors allocated from the workspace in the last step");
+DEFINE_COUNTER(workspace_num_fallbacks_total,
+               "Total number of tensors allocated outside the full workspace");
+
 Worker::Worker(const ParallelArgs& parallel_args,
                const torch::Device& device,
-               const ModelRunner::Options& runner_options)
-    : parallel_args_(parallel_args),
+               const ModelRunner::Options& runner_options,
+               const Options& options)
+    : options_(options),
+      parallel_args_(parallel_args),
       device_(device),
-      runner_options_(runner_options) {}
+      runner_options_(runner_options) {
+  // set up the working thread before any other task
+  threadpool_.schedule([this]() { init_thread(); });
+}
+
+void Worker::init_thread() const {
+  const auto& cpus = options_.cpus();
+  if (!cpus.empty()) {
+    // intra-op threads created afterwards inherit the affinity
+    if (set_thread_affinity(cpus)) {
+      LOG(INFO) << "Pinned worker " << parallel_args_.rank() << " to "
+                << cpus.size() << " cpus from cpu " << cpus.front();
+    }
+    if (options_.bind_numa_node()) {
+      const int32_t node = numa_node_of_cpu(cpus.front());
+      if (node >= 0 && bind_memory_to_numa_node(node)) {
+        LOG(INFO) << "Bound memory of worker " << parallel_args_.rank()
+                  << " to numa node " << node;
+      }
+    }
+  }
+  if (options_.num_threads() > 0) {
+    torch::set_num_threads(options_.num_threads());
+  }
+}
 
 bool Worker::init_model(torch::ScalarType dtype,
                         const ModelArgs& args,
@@ -39,6 +94,42 @@ bool Worker::init_model(torch::ScalarType dtype,
   const auto options = torch::dtype(dtype_).device(device_);
   model_ = CausalLM::create(args, quant_args, parallel_args_, options);
   CHECK(model_ != nullptr) << "Failed to create model.";
+
+  // reserve memory for intermediate tensors before profiling memory for kv
+  // caches
+  const int64_t max_tokens = options_.workspace_max_tokens();
+  if (max_tokens > 0) {
+    // live intermediate tensors of a decoder layer: the layer input, the
+    // residual and the layer output, plus either the qkv projection and the
+    // attention output of local heads, or the gate and up projections
+    const int64_t world_size = parallel_args_.world_size();
+    const int64_t hidden_size = args.hidden_size();
+    const int64_t n_heads = args.n_heads();
+    const int64_t n_kv_heads = args.n_kv_heads().value_or(n_heads);
+    const int64_t head_dim =
+        args.head_dim() > 0 ? args.head_dim() : hidden_size / n_heads;
+    const int64_t attn_size = n_heads / world_size * head_dim;
+    const int64_t kv_size =
+        std::max<int64_t>(1, n_kv_heads / world_size) * head_dim;
+    const int64_t qkv_size = attn_size + 2 * kv_size;
+    const int64_t gate_up_size = 2 * args.intermediate_size() / world_size;
+    const int64_t bytes_per_token =
+        (3 * hidden_size + std::max(qkv_size + attn_size, gate_up_size)) *
+        static_cast<int64_t>(c10::elementSize(dtype_));
+    const int64_t size_in_bytes = max_tokens * bytes_per_token;
+    if (device_.is_cpu()) {
+      // the memory pool of the model runner serves all intermediate tensors
+      // on cpu, including those not drawn from the forward context
+      runner_options_.cpu_memory_pool_bytes(size_in_bytes);
+      LOG(INFO) << "Caching up to " << size_in_bytes
+                << " bytes of intermediate tensors for " << max_tokens
+                << " tokens";
+    } else {
+      workspace_ = std::make_unique<Workspace>(size_in_bytes, device_);
+      LOG(INFO) << "Allocated workspace of " << workspace_->size_in_bytes()
+                << " bytes for " << max_tokens << " tokens";
+    }
+  }
   return true;
 }
 
@@ -46,8 +137,8 @@ bool Worker::init_kv_cache(const std::vector<int64_t>& kv_cache_shape) {
   CHECK(model_ != nullptr) << "Model is not initialized.";
   CHECK(kv_caches_.empty()) << "KV caches are already initialized.";
 
-  // create a KVCache for each layer
-  const int64_t num_layers = args_.n_layers();
+  // create a KVCache for each layer of the pipeline stage
+  const int64_t num_layers = args_.n_stage_layers();
   kv_caches_.reserve(num_layers);
   for (int64_t i = 0; i < num_layers; ++i) {
     auto key_cache =
@@ -91,53 +182,181 @@ std::tuple<int64_t, int64_t> Worker::profile_device_memory() {
 }
 
 ModelOutput Worker::execute_model(const ModelInput& inputs) {
-  torch::DeviceGuard device_guard(device_);
+  return execute_stage(inputs, /*prev_hidden_states=*/torch::Tensor());
+}
 
-  // all tensors should be on the same device as model
-  auto flatten_tokens = inputs.token_ids.to(device_);
-  auto flatten_positions = inputs.positions.to(device_);
-  InputParameters params = inputs.input_params.to(device_);
+ModelOutput Worker::execute_stage(const ModelInput& inputs,
+                                  const torch::Tensor& prev_hidden_states) {
+  torch::DeviceGuard device_guard(device_);
 
-  // call model runner forward to get hidden states
-  auto hidden_states = model_runner_->forward(
-      flatten_tokens, flatten_positions, kv_caches_, params);
+  // all tensors should be on the same device as model, copied with a single
+  // transfer if packed
+  ModelInput device_inputs = inputs.to(device_, dtype_);
+  ForwardContext context;
+  if (workspace_ != nullptr) {
+    context.workspace = workspace_.get();
+    workspace_->reset_stats();
+  }
 
-  // waits for all kernels in current streams to complete.
-  at::cuda::getCurrentCUDAStream().synchronize();
+  // copy kv cache blocks shared among forked sequences before writing
+  if (device_inputs.src_block_ids.defined()) {
+    for (auto& kv_cache : kv_caches_) {
+      kv_cache.copy_blocks(device_inputs.src_block_ids,
+                           device_inputs.dst_block_ids);
+    }
+  }
 
-  // prepare model output
+  auto& sampling_params = device_inputs.sampling_params;
+  const int32_t num_steps = std::max(inputs.num_decoding_steps, 1);
+  CHECK(args_.n_pipeline_stages() == 1 || num_steps == 1)
+      << "Multiple decoding steps are not supported with pipeline stages";
+  // stages after the first take hidden states of the previous stage
+  if (!args_.is_first_stage()) {
+    CHECK(prev_hidden_states.defined())
+        << "Missing hidden states of the previous stage";
+    device_inputs.token_ids = prev_hidden_states.to(device_);
+  }
+  std::vector<torch::Tensor> next_tokens;
+  std::vector<torch::Tensor> next_logprobs;
   ModelOutput output;
-  if (inputs.sampling_params.selected_token_idxes.defined()) {
-    SamplingParameters sampling_params =
-        inputs.sampling_params.to(device_, dtype_);
+  for (int32_t step = 0; step < num_steps; ++step) {
+    if (step > 0) {
+      // feed the sampled tokens into the next step without the host
+      advance_decoding_step(output.sample_output.next_tokens, &device_inputs);
+    }
+
+    // call model runner forward to get hidden states
+    auto hidden_states = model_runner_->forward(device_inputs.token_ids,
+                                                device_inputs.positions,
+                                                kv_caches_,
+                                                device_inputs.input_params,
+                                                context);
+
+    // hidden states are passed to the next stage on another device once
+    // kernels in current streams complete
+    if (device_.is_cuda() && !args_.is_last_stage()) {
+      at::cuda::getCurrentCUDAStream().synchronize();
+    }
+
+    if (workspace_ != nullptr && step + 1 == num_steps) {
+      report_workspace_stats();
+    }
+
+    // pass hidden states to the next stage
+    if (!args_.is_last_stage()) {
+      output.hidden_states = hidden_states;
+      return output;
+    }
+
+    // prepare model output
+    if (!sampling_params.selected_token_idxes.defined()) {
+      break;
+    }
+    if (step == 0) {
+      // wait for the bitmasks computed alongside the forward pass
+      if (sampling_params.allowed_token_bitmasks_future.valid()) {
+        sampling_params.allowed_token_bitmasks =
+            sampling_params.allowed_token_bitmasks_future.get();
+      }
+      sampling_params.allowed_token_bitmasks =
+          safe_to(sampling_params.allowed_token_bitmasks, device_);
+    }
+
     // call model to get logits
     torch::Tensor logits =
         model_->logits(hidden_states, sampling_params.selected_token_idxes);
 
-    // create and call logits processors
-    auto logits_processor = LogitsProcessor::create(sampling_params);
-    // apply logits processors to logits (in place)
-    logits = logits_processor->forward(logits,
-                                       sampling_params.unique_token_ids,
-                                       sampling_params.unique_token_counts,
-                                       sampling_params.unique_token_ids_lens);
+    // apply enabled logits processors to logits (in place)
+    logits = sampling_pipeline_.process(logits, sampling_params);
     // set logits to output
     output.logits = logits;
 
-    auto sampler = std::make_unique<Sampler>(sampling_params.do_sample);
-    // select sample logits
-    auto sample_logits =
-        logits.index_select(/*dim=*/0, sampling_params.sample_idxes);
-    auto sample_output = sampler->forward(sample_logits);
+    // sample next tokens, without synchronizing with the device
+    auto sample_output = sampling_pipeline_.sample(logits, sampling_params);
     // set sample output to output
     output.sample_output = sample_output;
 
     // carry over the sampling params
     output.do_sample = sampling_params.do_sample;
+
+    if (num_steps > 1) {
+      next_tokens.push_back(sample_output.next_tokens);
+      if (sample_output.next_logprobs.defined()) {
+        next_logprobs.push_back(sample_output.next_logprobs);
+      }
+    }
+  }
+
+  // stack the next tokens of all steps into [num_seqs, num_steps]
+  if (num_steps > 1 && !next_tokens.empty()) {
+    output.sample_output.next_tokens = torch::stack(next_tokens, /*dim=*/1);
+    if (!next_logprobs.empty()) {
+      output.sample_output.next_logprobs =
+          torch::stack(next_logprobs, /*dim=*/1);
+    }
+  }
+
+  // copy the sample output to the host without blocking, and record an event
+  // to wait for it instead of the whole stream
+  if (device_.is_cuda()) {
+    auto& sample_output = output.sample_output;
+    sample_output.next_tokens = to_host_async(sample_output.next_tokens);
+    sample_output.next_logprobs = to_host_async(sample_output.next_logprobs);
+    output.ready_event = std::make_shared<at::cuda::CUDAEvent>();
+    output.ready_event->record();
   }
   return output;
 }
 
+void Worker::report_workspace_stats() const {
+  const auto stats = workspace_->stats();
+  workspace_peak_allocated_bytes.Set(
+      static_cast<double>(stats.peak_allocated_bytes));
+  workspace_num_allocations.Set(static_cast<double>(stats.num_allocations));
+  workspace_num_fallbacks_total.Increment(
+      static_cast<double>(stats.num_fallbacks));
+  VLOG(2) << "Workspace peak bytes: " << stats.peak_allocated_bytes
+          << ", allocations: " << stats.num_allocations
+          << ", fallbacks: " << stats.num_fallbacks;
+}
+
+void Worker::advance_decoding_step(const torch::Tensor& next_tokens,
+                                   ModelInput* inputs) const {
+  auto& params = inputs->input_params;
+  const int64_t num_seqs = next_tokens.size(/*dim=*/0);
+  CHECK_EQ(params.num_sequences, num_seqs);
+
+  // sampled tokens of sequences, followed by padding sequences for cuda graph
+  const auto& token_ids = inputs->token_ids;
+  inputs->token_ids = torch::cat(
+      {next_tokens.to(token_ids.scalar_type()),
+       token_ids.slice(/*dim=*/0, /*start=*/num_seqs)});
+  inputs->positions = inputs->positions + 1;
+
+  // each sequence has one more token in the kv cache
+  const auto& kv_cu_seq_lens = params.kv_cu_seq_lens;
+  params.kv_cu_seq_lens =
+      kv_cu_seq_lens + torch::arange(kv_cu_seq_lens.size(/*dim=*/0),
+                                     kv_cu_seq_lens.options());
+  params.kv_max_seq_len += 1;
+
+  // slots of new tokens from their blocks, padding sequences keep their slots
+  const int64_t block_size = runner_options_.block_size();
+  const auto positions =
+      inputs->positions.slice(/*dim=*/0, /*start=*/0, /*end=*/num_seqs);
+  const auto block_idxes =
+      positions.div(block_size, /*rounding_mode=*/"floor").to(torch::kLong);
+  const auto block_ids =
+      params.block_tables.slice(/*dim=*/0, /*start=*/0, /*end=*/num_seqs)
+          .gather(/*dim=*/1, block_idxes.unsqueeze(/*dim=*/1))
+          .squeeze(/*dim=*/1);
+  const auto& new_cache_slots = params.new_cache_slots;
+  params.new_cache_slots = torch::cat(
+      {(block_ids * block_size + positions.remainder(block_size))
+           .to(new_cache_slots.scalar_type()),
+       new_cache_slots.slice(/*dim=*/0, /*start=*/num_seqs)});
+}
+
 folly::SemiFuture<std::tuple<int64_t, int64_t>>
 Worker::profile_device_memory_async() {
   folly::Promise<std::tuple<int64_t, int64_t>> promise;
@@ -162,6 +381,23 @@ folly::SemiFuture<ModelOutput> Worker::execute_model_async(
   return future;
 }
 
+folly::SemiFuture<ModelOutput> Worker::execute_stage_async(
+    const ModelInput& inputs,
+    folly::SemiFuture<ModelOutput> prev_output) {
+  folly::Promise<ModelOutput> promise;
+  auto future = promise.getSemiFuture();
+  threadpool_.schedule([this,
+                        inputs = inputs,
+                        prev_output = std::move(prev_output),
+                        promise = std::move(promise)]() mutable {
+    // wait for the previous stage in working thread
+    const auto prev = std::move(prev_output).get();
+    const auto output = this->execute_stage(inputs, prev.hidden_states);
+    promise.setValue(output);
+  });
+  return future;
+}
+
 // initialize model, cache manager. async call
 folly::SemiFuture<bool> Worker::init_model_async(torch::ScalarType dtype,
                                                  const ModelArgs& args,
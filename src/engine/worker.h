@@ -3,7 +3,9 @@
 #include <folly/futures/Future.h>
 #include <torch/torch.h>
 
+#include "common/macros.h"
 #include "common/threadpool.h"
+#include "memory/workspace.h"
 #include "model_loader/state_dict.h"
 #include "model_parallel/parallel_args.h"
 #include "model_runner.h"
@@ -12,14 +14,34 @@
 #include "models/parameters.h"
 #include "parameters.h"
 #include "quantization/quant_args.h"
+#include "sampling/sampling_pipeline.h"
 
 namespace llm {
 
 class Worker final {
  public:
+  // options of the working thread, mainly for cpu workers
+  struct Options {
+    // number of intra-op threads to run the model, 0 to use the default
+    DEFINE_ARG(int32_t, num_threads) = 0;
+
+    // cpus to pin the working thread and its intra-op threads to, empty to
+    // not pin
+    DEFINE_ARG(std::vector<int32_t>, cpus);
+
+    // bind memory allocations, e.g. weights and kv caches, to the numa node
+    // of the pinned cpus
+    DEFINE_ARG(bool, bind_numa_node) = false;
+
+    // max number of tokens per batch to size the workspace arena for
+    // attention outputs and residuals, 0 to disable the workspace
+    DEFINE_ARG(int64_t, workspace_max_tokens) = 0;
+  };
+
   Worker(const ParallelArgs& parallel_args,
          const torch::Device& device,
-         const ModelRunner::Options& runner_options);
+         const ModelRunner::Options& runner_options,
+         const Options& options);
 
   ~Worker() = default;
 
@@ -42,8 +64,18 @@ class Worker final {
   bool init_kv_cache(const std::vector<int64_t>& kv_cache_shape);
 
   // Run the model on the given input. blocking call
+  // for multiple decoding steps, the sampled tokens of each step are fed into
+  // the next step on the device.
+  // on gpus, it returns once kernels are launched, with the sample output
+  // being copied to the host until output.synchronize().
   ModelOutput execute_model(const ModelInput& inputs);
 
+  // Run the layers of the pipeline stage on the given input. blocking call
+  // stages after the first take hidden states of the previous stage, and
+  // stages before the last return hidden states instead of samples.
+  ModelOutput execute_stage(const ModelInput& inputs,
+                            const torch::Tensor& prev_hidden_states);
+
   // capture cuda graph for the model. blocking call
   bool capture_cuda_graphs();
 
@@ -67,12 +99,34 @@ class Worker final {
   // the future returns a successfull status with no meaningful value
   folly::SemiFuture<ModelOutput> execute_model_async(const ModelInput& inputs);
 
+  // Run the layers of the pipeline stage once the output of the previous
+  // stage is ready. async call
+  // the previous output is waited for in the working thread, so stages of
+  // different micro batches run concurrently in their own workers.
+  folly::SemiFuture<ModelOutput> execute_stage_async(
+      const ModelInput& inputs,
+      folly::SemiFuture<ModelOutput> prev_output);
+
   // capture cuda graph for the model. async call
   folly::SemiFuture<bool> capture_cuda_graphs_async();
 
   const torch::Device& device() const { return device_; }
 
  private:
+  // advance the inputs of a pure decoding batch by one step with the sampled
+  // tokens, computing new cache slots from the block tables.
+  void advance_decoding_step(const torch::Tensor& next_tokens,
+                             ModelInput* inputs) const;
+
+  // report the workspace usage of the current step
+  void report_workspace_stats() const;
+
+  // set up the working thread with the options, run in the thread
+  void init_thread() const;
+
+  // options of the working thread
+  Options options_;
+
   // working thread
   ThreadPool threadpool_;
 
@@ -91,6 +145,9 @@ class Worker final {
   // kv caches
   std::vector<llm::KVCache> kv_caches_;
 
+  // workspace arena for intermediate tensors, nullptr if disabled
+  std::unique_ptr<Workspace> workspace_;
+
   // causal LM model
   std::unique_ptr<CausalLM> model_;
 
@@ -99,6 +156,9 @@ class Worker final {
 
   // model runner that runs the model, with cuda graph if enabled
   std::unique_ptr<ModelRunner> model_runner_;
+
+  // logits processors and sampler reused across steps
+  SamplingPipeline sampling_pipeline_;
 };
 
 }  // namespace llm
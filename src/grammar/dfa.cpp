@@ -0,0 +1,766 @@
+#include "dfa.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace llm {
+
+namespace {
+
+// limits to guard against regexes blowing up the automaton
+constexpr int32_t kMaxRepeat = 1000;
+constexpr size_t kMaxNfaStates = 100000;
+constexpr size_t kMaxDfaStates = 10000;
+
+using ByteSet = std::bitset<256>;
+
+struct RegexNode {
+  enum class Type : int8_t {
+    // matches the empty string
+    EMPTY = 0,
+    // matches one byte in the byte set
+    BYTES = 1,
+    // matches children one after another
+    CONCAT = 2,
+    // matches any of the children
+    ALTERNATE = 3,
+    // matches the only child repeated [min_repeat, max_repeat] times
+    REPEAT = 4,
+  };
+
+  explicit RegexNode(Type type) : type(type) {}
+
+  Type type;
+  ByteSet bytes;
+  std::vector<std::unique_ptr<RegexNode>> children;
+  int32_t min_repeat = 0;
+  // -1 means unbounded
+  int32_t max_repeat = -1;
+};
+
+std::unique_ptr<RegexNode> make_bytes_node(const ByteSet& bytes) {
+  auto node = std::make_unique<RegexNode>(RegexNode::Type::BYTES);
+  node->bytes = bytes;
+  return node;
+}
+
+ByteSet byte_range(uint8_t first, uint8_t last) {
+  ByteSet bytes;
+  for (int32_t b = first; b <= last; ++b) {
+    bytes.set(b);
+  }
+  return bytes;
+}
+
+ByteSet byte_chars(const std::string_view& chars) {
+  ByteSet bytes;
+  for (const char c : chars) {
+    bytes.set(static_cast<uint8_t>(c));
+  }
+  return bytes;
+}
+
+// byte sets for \d, \w and \s, returns false for other escapes
+bool escape_byte_class(char c, ByteSet* bytes) {
+  switch (c) {
+    case 'd':
+    case 'D':
+      *bytes = byte_range('0', '9');
+      break;
+    case 'w':
+    case 'W':
+      *bytes = byte_range('a', 'z') | byte_range('A', 'Z') |
+               byte_range('0', '9') | byte_chars("_");
+      break;
+    case 's':
+    case 'S':
+      *bytes = byte_chars(" \t\n\r\f\v");
+      break;
+    default:
+      return false;
+  }
+  // negated classes accept all non-ascii bytes
+  if (c == 'D' || c == 'W' || c == 'S') {
+    bytes->flip();
+  }
+  return true;
+}
+
+// append the utf-8 encoding of the code point
+void append_utf8(uint32_t code_point, std::string* out) {
+  if (code_point < 0x80) {
+    out->push_back(static_cast<char>(code_point));
+  } else if (code_point < 0x800) {
+    out->push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  } else {
+    out->push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  }
+}
+
+// a recursive descent parser for regular expressions
+class RegexParser final {
+ public:
+  explicit RegexParser(const std::string_view& regex) : regex_(regex) {}
+
+  std::unique_ptr<RegexNode> parse(std::string* error) {
+    auto node = parse_alternate();
+    if (node != nullptr && !eof()) {
+      // only unbalanced ')' stops the top level alternation
+      node = fail("unmatched ')'");
+    }
+    if (node == nullptr && error != nullptr) {
+      *error = error_;
+    }
+    return node;
+  }
+
+ private:
+  bool eof() const { return pos_ >= regex_.size(); }
+
+  char peek() const { return regex_[pos_]; }
+
+  char next() { return regex_[pos_++]; }
+
+  std::unique_ptr<RegexNode> fail(const std::string& message) {
+    if (error_.empty()) {
+      error_ = message + " at position " + std::to_string(pos_);
+    }
+    return nullptr;
+  }
+
+  // alternate := concat ('|' concat)*
+  std::unique_ptr<RegexNode> parse_alternate() {
+    auto node = std::make_unique<RegexNode>(RegexNode::Type::ALTERNATE);
+    while (true) {
+      auto child = parse_concat();
+      if (child == nullptr) {
+        return nullptr;
+      }
+      node->children.push_back(std::move(child));
+      if (eof() || peek() != '|') {
+        break;
+      }
+      next();
+    }
+    if (node->children.size() == 1) {
+      return std::move(node->children.front());
+    }
+    return node;
+  }
+
+  // concat := repeat*
+  std::unique_ptr<RegexNode> parse_concat() {
+    auto node = std::make_unique<RegexNode>(RegexNode::Type::CONCAT);
+    while (!eof() && peek() != '|' && peek() != ')') {
+      auto child = parse_repeat();
+      if (child == nullptr) {
+        return nullptr;
+      }
+      node->children.push_back(std::move(child));
+    }
+    if (node->children.empty()) {
+      return std::make_unique<RegexNode>(RegexNode::Type::EMPTY);
+    }
+    if (node->children.size() == 1) {
+      return std::move(node->children.front());
+    }
+    return node;
+  }
+
+  // repeat := atom ('*' | '+' | '?' | '{m}' | '{m,}' | '{m,n}')*
+  std::unique_ptr<RegexNode> parse_repeat() {
+    auto node = parse_atom();
+    while (node != nullptr && !eof()) {
+      int32_t min_repeat = 0;
+      int32_t max_repeat = -1;
+      const char c = peek();
+      if (c == '*') {
+        next();
+      } else if (c == '+') {
+        next();
+        min_repeat = 1;
+      } else if (c == '?') {
+        next();
+        max_repeat = 1;
+      } else if (c == '{') {
+        next();
+        if (!parse_number(&min_repeat)) {
+          return fail("invalid repetition");
+        }
+        max_repeat = min_repeat;
+        if (!eof() && peek() == ',') {
+          next();
+          max_repeat = -1;
+          if (!eof() && peek() != '}' && !parse_number(&max_repeat)) {
+            return fail("invalid repetition");
+          }
+        }
+        if (eof() || next() != '}') {
+          return fail("missing '}'");
+        }
+        if (max_repeat != -1 && max_repeat < min_repeat) {
+          return fail("invalid repetition range");
+        }
+      } else {
+        break;
+      }
+      // lazy quantifiers make no difference for a full match
+      if (!eof() && peek() == '?') {
+        next();
+      }
+
+      auto repeat = std::make_unique<RegexNode>(RegexNode::Type::REPEAT);
+      repeat->min_repeat = min_repeat;
+      repeat->max_repeat = max_repeat;
+      repeat->children.push_back(std::move(node));
+      node = std::move(repeat);
+    }
+    return node;
+  }
+
+  bool parse_number(int32_t* value) {
+    const size_t start = pos_;
+    int32_t result = 0;
+    while (!eof() && peek() >= '0' && peek() <= '9') {
+      result = result * 10 + (next() - '0');
+      if (result > kMaxRepeat) {
+        return false;
+      }
+    }
+    *value = result;
+    return pos_ > start;
+  }
+
+  std::unique_ptr<RegexNode> parse_atom() {
+    const char c = next();
+    switch (c) {
+      case '(': {
+        // non-capturing group is the same as group
+        if (pos_ + 1 < regex_.size() && peek() == '?' &&
+            regex_[pos_ + 1] == ':') {
+          pos_ += 2;
+        }
+        auto node = parse_alternate();
+        if (node == nullptr) {
+          return nullptr;
+        }
+        if (eof() || next() != ')') {
+          return fail("missing ')'");
+        }
+        return node;
+      }
+      case '[':
+        return parse_class();
+      case '.': {
+        ByteSet bytes;
+        bytes.set();
+        bytes.reset('\n');
+        return make_bytes_node(bytes);
+      }
+      case '^':
+      case '$':
+        return std::make_unique<RegexNode>(RegexNode::Type::EMPTY);
+      case '\\':
+        return parse_escape();
+      case '*':
+      case '+':
+      case '?':
+      case '{':
+        return fail("nothing to repeat");
+      default: {
+        ByteSet bytes;
+        bytes.set(static_cast<uint8_t>(c));
+        return make_bytes_node(bytes);
+      }
+    }
+  }
+
+  bool parse_hex(size_t num_digits, uint32_t* value) {
+    if (pos_ + num_digits > regex_.size()) {
+      return false;
+    }
+    uint32_t result = 0;
+    for (size_t i = 0; i < num_digits; ++i) {
+      const char c = next();
+      result <<= 4;
+      if (c >= '0' && c <= '9') {
+        result |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        result |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        result |= c - 'A' + 10;
+      } else {
+        return false;
+      }
+    }
+    *value = result;
+    return true;
+  }
+
+  // parse an escape after '\', returns the bytes of a single character
+  bool parse_escape_bytes(ByteSet* bytes, std::string* utf8) {
+    if (eof()) {
+      fail("trailing '\\'");
+      return false;
+    }
+    const char c = next();
+    if (escape_byte_class(c, bytes)) {
+      return true;
+    }
+    uint32_t code_point = 0;
+    switch (c) {
+      case 'n':
+        code_point = '\n';
+        break;
+      case 't':
+        code_point = '\t';
+        break;
+      case 'r':
+        code_point = '\r';
+        break;
+      case 'f':
+        code_point = '\f';
+        break;
+      case 'v':
+        code_point = '\v';
+        break;
+      case '0':
+        code_point = 0;
+        break;
+      case 'x':
+        if (!parse_hex(2, &code_point)) {
+          fail("invalid \\x escape");
+          return false;
+        }
+        // \xHH matches the raw byte
+        bytes->set(code_point);
+        return true;
+      case 'u':
+        if (!parse_hex(4, &code_point)) {
+          fail("invalid \\u escape");
+          return false;
+        }
+        break;
+      default:
+        code_point = static_cast<uint8_t>(c);
+        break;
+    }
+    if (code_point < 0x80) {
+      bytes->set(code_point);
+    } else {
+      append_utf8(code_point, utf8);
+    }
+    return true;
+  }
+
+  std::unique_ptr<RegexNode> parse_escape() {
+    ByteSet bytes;
+    std::string utf8;
+    if (!parse_escape_bytes(&bytes, &utf8)) {
+      return nullptr;
+    }
+    if (utf8.empty()) {
+      return make_bytes_node(bytes);
+    }
+    // non-ascii character matches a sequence of bytes
+    auto node = std::make_unique<RegexNode>(RegexNode::Type::CONCAT);
+    for (const char c : utf8) {
+      ByteSet byte;
+      byte.set(static_cast<uint8_t>(c));
+      node->children.push_back(make_bytes_node(byte));
+    }
+    return node;
+  }
+
+  // class := '[' '^'? (char | char '-' char | escape)+ ']'
+  std::unique_ptr<RegexNode> parse_class() {
+    bool negated = false;
+    if (!eof() && peek() == '^') {
+      next();
+      negated = true;
+    }
+    ByteSet bytes;
+    bool first = true;
+    while (true) {
+      if (eof()) {
+        return fail("missing ']'");
+      }
+      // ']' is a literal if it is the first character
+      if (peek() == ']' && !first) {
+        next();
+        break;
+      }
+      first = false;
+
+      ByteSet item;
+      int32_t low = -1;
+      if (!parse_class_char(&item, &low)) {
+        return nullptr;
+      }
+      // range: char '-' char
+      if (low >= 0 && pos_ + 1 < regex_.size() && peek() == '-' &&
+          regex_[pos_ + 1] != ']') {
+        next();
+        ByteSet unused;
+        int32_t high = -1;
+        if (!parse_class_char(&unused, &high)) {
+          return nullptr;
+        }
+        if (high < 0 || high < low) {
+          return fail("invalid character class range");
+        }
+        item = byte_range(low, high);
+      }
+      bytes |= item;
+    }
+    if (negated) {
+      bytes.flip();
+    }
+    return make_bytes_node(bytes);
+  }
+
+  // parse a character in a class, sets value for single ascii characters
+  bool parse_class_char(ByteSet* bytes, int32_t* value) {
+    const char c = next();
+    if (static_cast<uint8_t>(c) >= 0x80) {
+      fail("non-ascii characters in character class are not supported");
+      return false;
+    }
+    if (c != '\\') {
+      bytes->set(static_cast<uint8_t>(c));
+      *value = static_cast<uint8_t>(c);
+      return true;
+    }
+    std::string utf8;
+    if (!parse_escape_bytes(bytes, &utf8)) {
+      return false;
+    }
+    if (!utf8.empty()) {
+      fail("non-ascii characters in character class are not supported");
+      return false;
+    }
+    if (bytes->count() == 1) {
+      for (int32_t b = 0; b < 256; ++b) {
+        if (bytes->test(b)) {
+          *value = b;
+        }
+      }
+    }
+    return true;
+  }
+
+  std::string_view regex_;
+  size_t pos_ = 0;
+  std::string error_;
+};
+
+struct NfaState {
+  // transition on any byte in the set to next
+  ByteSet bytes;
+  int32_t next = -1;
+  std::vector<int32_t> epsilons;
+};
+
+// Thompson's construction of a nfa from the regex tree
+class NfaBuilder final {
+ public:
+  struct Fragment {
+    int32_t start = -1;
+    int32_t end = -1;
+  };
+
+  bool build(const RegexNode& node, Fragment* fragment) {
+    switch (node.type) {
+      case RegexNode::Type::EMPTY: {
+        const int32_t state = add_state();
+        *fragment = {state, state};
+        break;
+      }
+      case RegexNode::Type::BYTES: {
+        const int32_t start = add_state();
+        const int32_t end = add_state();
+        states_[start].bytes = node.bytes;
+        states_[start].next = end;
+        *fragment = {start, end};
+        break;
+      }
+      case RegexNode::Type::CONCAT: {
+        Fragment result;
+        for (const auto& child : node.children) {
+          Fragment child_fragment;
+          if (!build(*child, &child_fragment)) {
+            return false;
+          }
+          if (result.start == -1) {
+            result = child_fragment;
+          } else {
+            add_epsilon(result.end, child_fragment.start);
+            result.end = child_fragment.end;
+          }
+        }
+        *fragment = result;
+        break;
+      }
+      case RegexNode::Type::ALTERNATE: {
+        const int32_t start = add_state();
+        const int32_t end = add_state();
+        for (const auto& child : node.children) {
+          Fragment child_fragment;
+          if (!build(*child, &child_fragment)) {
+            return false;
+          }
+          add_epsilon(start, child_fragment.start);
+          add_epsilon(child_fragment.end, end);
+        }
+        *fragment = {start, end};
+        break;
+      }
+      case RegexNode::Type::REPEAT:
+        return build_repeat(node, fragment);
+    }
+    return states_.size() <= kMaxNfaStates;
+  }
+
+  const std::vector<NfaState>& states() const { return states_; }
+
+ private:
+  bool build_repeat(const RegexNode& node, Fragment* fragment) {
+    const RegexNode& child = *node.children.front();
+    const int32_t start = add_state();
+    int32_t end = start;
+    // required copies
+    for (int32_t i = 0; i < node.min_repeat; ++i) {
+      Fragment child_fragment;
+      if (!build(child, &child_fragment)) {
+        return false;
+      }
+      add_epsilon(end, child_fragment.start);
+      end = child_fragment.end;
+    }
+
+    if (node.max_repeat == -1) {
+      // unbounded: loop back to the child
+      Fragment child_fragment;
+      if (!build(child, &child_fragment)) {
+        return false;
+      }
+      const int32_t loop_end = add_state();
+      add_epsilon(end, child_fragment.start);
+      add_epsilon(end, loop_end);
+      add_epsilon(child_fragment.end, end);
+      end = loop_end;
+    } else {
+      // optional copies, each can be skipped to the end
+      const int32_t final_end = add_state();
+      for (int32_t i = node.min_repeat; i < node.max_repeat; ++i) {
+        Fragment child_fragment;
+        if (!build(child, &child_fragment)) {
+          return false;
+        }
+        add_epsilon(end, child_fragment.start);
+        add_epsilon(end, final_end);
+        end = child_fragment.end;
+      }
+      add_epsilon(end, final_end);
+      end = final_end;
+    }
+    *fragment = {start, end};
+    return states_.size() <= kMaxNfaStates;
+  }
+
+  int32_t add_state() {
+    states_.emplace_back();
+    return static_cast<int32_t>(states_.size() - 1);
+  }
+
+  void add_epsilon(int32_t from, int32_t to) {
+    states_[from].epsilons.push_back(to);
+  }
+
+  std::vector<NfaState> states_;
+};
+
+// sorted set of nfa states reachable through epsilon transitions
+std::vector<int32_t> epsilon_closure(const std::vector<NfaState>& nfa,
+                                     const std::vector<int32_t>& states) {
+  std::vector<bool> visited(nfa.size(), false);
+  std::vector<int32_t> stack = states;
+  std::vector<int32_t> closure;
+  while (!stack.empty()) {
+    const int32_t state = stack.back();
+    stack.pop_back();
+    if (visited[state]) {
+      continue;
+    }
+    visited[state] = true;
+    closure.push_back(state);
+    for (const int32_t next : nfa[state].epsilons) {
+      if (!visited[next]) {
+        stack.push_back(next);
+      }
+    }
+  }
+  std::sort(closure.begin(), closure.end());
+  return closure;
+}
+
+}  // namespace
+
+std::unique_ptr<Dfa> Dfa::compile(const std::string_view& regex,
+                                  std::string* error) {
+  RegexParser parser(regex);
+  auto root = parser.parse(error);
+  if (root == nullptr) {
+    return nullptr;
+  }
+
+  NfaBuilder builder;
+  NfaBuilder::Fragment fragment;
+  if (!builder.build(*root, &fragment)) {
+    if (error != nullptr) {
+      *error = "regex is too complex";
+    }
+    return nullptr;
+  }
+  const auto& nfa = builder.states();
+
+  // subset construction
+  std::vector<std::array<int32_t, 256>> transitions;
+  std::vector<bool> accepting;
+  std::map<std::vector<int32_t>, int32_t> set_to_state;
+  std::vector<std::vector<int32_t>> state_sets;
+
+  auto get_or_add_state = [&](std::vector<int32_t> set) -> int32_t {
+    auto it = set_to_state.find(set);
+    if (it != set_to_state.end()) {
+      return it->second;
+    }
+    const int32_t state = static_cast<int32_t>(state_sets.size());
+    accepting.push_back(
+        std::binary_search(set.begin(), set.end(), fragment.end));
+    set_to_state.emplace(set, state);
+    state_sets.push_back(std::move(set));
+    return state;
+  };
+
+  get_or_add_state(epsilon_closure(nfa, {fragment.start}));
+  for (size_t i = 0; i < state_sets.size(); ++i) {
+    if (state_sets.size() > kMaxDfaStates) {
+      if (error != nullptr) {
+        *error = "regex is too complex";
+      }
+      return nullptr;
+    }
+    std::array<int32_t, 256> next_states;
+    next_states.fill(kDeadState);
+    // bytes moving to the same nfa states share the closure
+    std::map<std::vector<int32_t>, int32_t> moves_to_state;
+    for (int32_t byte = 0; byte < 256; ++byte) {
+      std::vector<int32_t> moves;
+      for (const int32_t state : state_sets[i]) {
+        if (nfa[state].next != -1 && nfa[state].bytes.test(byte)) {
+          moves.push_back(nfa[state].next);
+        }
+      }
+      if (moves.empty()) {
+        continue;
+      }
+      auto it = moves_to_state.find(moves);
+      if (it == moves_to_state.end()) {
+        const int32_t next = get_or_add_state(epsilon_closure(nfa, moves));
+        it = moves_to_state.emplace(std::move(moves), next).first;
+      }
+      next_states[byte] = it->second;
+    }
+    transitions.push_back(next_states);
+  }
+
+  // find states that can reach an accepting state
+  const size_t num_states = transitions.size();
+  std::vector<std::vector<int32_t>> reverse_edges(num_states);
+  for (size_t state = 0; state < num_states; ++state) {
+    for (const int32_t next : transitions[state]) {
+      if (next != kDeadState) {
+        reverse_edges[next].push_back(static_cast<int32_t>(state));
+      }
+    }
+  }
+  std::vector<bool> live(num_states, false);
+  std::queue<int32_t> queue;
+  for (size_t state = 0; state < num_states; ++state) {
+    if (accepting[state]) {
+      live[state] = true;
+      queue.push(static_cast<int32_t>(state));
+    }
+  }
+  while (!queue.empty()) {
+    const int32_t state = queue.front();
+    queue.pop();
+    for (const int32_t prev : reverse_edges[state]) {
+      if (!live[prev]) {
+        live[prev] = true;
+        queue.push(prev);
+      }
+    }
+  }
+  if (!live[0]) {
+    if (error != nullptr) {
+      *error = "regex doesn't match any input";
+    }
+    return nullptr;
+  }
+
+  // renumber the live states reachable from the start state
+  std::vector<int32_t> new_ids(num_states, kDeadState);
+  std::vector<int32_t> order = {0};
+  new_ids[0] = 0;
+  for (size_t i = 0; i < order.size(); ++i) {
+    for (const int32_t next : transitions[order[i]]) {
+      if (next != kDeadState && live[next] && new_ids[next] == kDeadState) {
+        new_ids[next] = static_cast<int32_t>(order.size());
+        order.push_back(next);
+      }
+    }
+  }
+
+  std::unique_ptr<Dfa> dfa(new Dfa());
+  dfa->transitions_.resize(order.size());
+  dfa->accepting_.resize(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    const int32_t old_state = order[i];
+    for (int32_t byte = 0; byte < 256; ++byte) {
+      const int32_t next = transitions[old_state][byte];
+      dfa->transitions_[i][byte] =
+          next == kDeadState ? kDeadState : new_ids[next];
+    }
+    dfa->accepting_[i] = accepting[old_state];
+  }
+  return dfa;
+}
+
+int32_t Dfa::next_state(int32_t state, const std::string_view& bytes) const {
+  for (const char c : bytes) {
+    if (state == kDeadState) {
+      break;
+    }
+    state = next_state(state, static_cast<uint8_t>(c));
+  }
+  return state;
+}
+
+bool Dfa::matches(const std::string_view& text) const {
+  const int32_t state = next_state(start_state(), text);
+  return state != kDeadState && is_accepting(state);
+}
+
+}  // namespace llm
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace llm {
+
+// A deterministic finite automaton over bytes, compiled from a regular
+// expression that must match the whole input. States that can't reach any
+// accepting state are pruned, so every live state can still be completed.
+//
+// supported syntax:
+//  literals, escapes (\d \D \w \W \s \S \n \t \r \f \v \xHH \uHHHH), '.',
+//  character classes ([a-z], [^"\\]), groups ((...), (?:...)), alternation
+//  '|' and quantifiers (*, +, ?, {m}, {m,}, {m,n}). anchors '^' and '$' are
+//  ignored since the whole input is always matched.
+// character classes only support ascii characters, and negated classes accept
+// all non-ascii bytes.
+class Dfa final {
+ public:
+  static constexpr int32_t kDeadState = -1;
+
+  // compile the regular expression into a dfa.
+  // returns nullptr and sets the error message if failed.
+  static std::unique_ptr<Dfa> compile(const std::string_view& regex,
+                                      std::string* error);
+
+  // get the start state
+  int32_t start_state() const { return 0; }
+
+  // get the number of states
+  size_t num_states() const { return transitions_.size(); }
+
+  // get the next state, returns kDeadState if the byte is rejected
+  int32_t next_state(int32_t state, uint8_t byte) const {
+    return transitions_[state][byte];
+  }
+
+  // get the next state after consuming all bytes
+  int32_t next_state(int32_t state, const std::string_view& bytes) const;
+
+  // check if the state is accepting
+  bool is_accepting(int32_t state) const { return accepting_[state]; }
+
+  // check if the whole text matches the regular expression
+  bool matches(const std::string_view& text) const;
+
+ private:
+  Dfa() = default;
+
+  // transitions for each state: [num_states, 256]
+  std::vector<std::array<int32_t, 256>> transitions_;
+
+  // whether each state is accepting
+  std::vector<bool> accepting_;
+};
+
+}  // namespace llm
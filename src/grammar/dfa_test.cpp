@@ -0,0 +1,116 @@
+#include "dfa.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "json_schema.h"
+
+namespace llm {
+
+TEST(DfaTest, Regex) {
+  std::string error;
+  auto dfa = Dfa::compile(R"(-?(0|[1-9]\d*)(\.\d+)?)", &error);
+  ASSERT_NE(dfa, nullptr) << error;
+  EXPECT_TRUE(dfa->matches("0"));
+  EXPECT_TRUE(dfa->matches("-12.50"));
+  EXPECT_FALSE(dfa->matches(""));
+  EXPECT_FALSE(dfa->matches("01"));
+  EXPECT_FALSE(dfa->matches("1."));
+
+  dfa = Dfa::compile("(?:ab|c)+d{2,3}[^x-z]?", &error);
+  ASSERT_NE(dfa, nullptr) << error;
+  EXPECT_TRUE(dfa->matches("abcdd"));
+  EXPECT_TRUE(dfa->matches("cddda"));
+  EXPECT_FALSE(dfa->matches("dd"));
+  EXPECT_FALSE(dfa->matches("abddddd"));
+  EXPECT_FALSE(dfa->matches("abddy"));
+
+  // non-ascii characters
+  dfa = Dfa::compile(R"((é|中)+)", &error);
+  ASSERT_NE(dfa, nullptr) << error;
+  EXPECT_TRUE(dfa->matches("é中é"));
+  EXPECT_FALSE(dfa->matches("e"));
+}
+
+TEST(DfaTest, DeadStatesArePruned) {
+  std::string error;
+  auto dfa = Dfa::compile("a(b|cx{0}y)", &error);
+  ASSERT_NE(dfa, nullptr) << error;
+  // every reachable state can still reach an accepting state
+  const int32_t state = dfa->next_state(dfa->start_state(), "ac");
+  ASSERT_NE(state, Dfa::kDeadState);
+  EXPECT_EQ(dfa->next_state(state, 'y'), dfa->next_state(state, "y"));
+  EXPECT_TRUE(dfa->is_accepting(dfa->next_state(state, 'y')));
+  EXPECT_EQ(dfa->next_state(dfa->start_state(), "b"), Dfa::kDeadState);
+}
+
+TEST(DfaTest, InvalidRegex) {
+  std::string error;
+  for (const char* regex : {"(a", "a)", "*a", "[a-", "a{3,1}", "\\"}) {
+    EXPECT_EQ(Dfa::compile(regex, &error), nullptr) << regex;
+    EXPECT_FALSE(error.empty());
+    error.clear();
+  }
+}
+
+TEST(JsonSchemaTest, Object) {
+  const std::string schema = R"({
+    "type": "object",
+    "properties": {
+      "name": {"type": "string", "maxLength": 8},
+      "age": {"type": "integer"},
+      "tags": {"type": "array", "items": {"enum": ["a", "b"]}, "maxItems": 2},
+      "ok": {"type": ["boolean", "null"]}
+    },
+    "required": ["name", "age"]
+  })";
+  std::string regex;
+  std::string error;
+  ASSERT_TRUE(json_schema_to_regex(schema, &regex, &error)) << error;
+  auto dfa = Dfa::compile(regex, &error);
+  ASSERT_NE(dfa, nullptr) << error;
+
+  EXPECT_TRUE(dfa->matches(R"({"name":"bob","age":3})"));
+  EXPECT_TRUE(dfa->matches(R"({ "name": "bob", "age": -3, "ok": null })"));
+  EXPECT_TRUE(dfa->matches(R"({"name":"\"b\"","age":3,"tags":["a","b"]})"));
+  // missing required property
+  EXPECT_FALSE(dfa->matches(R"({"name":"bob"})"));
+  // properties out of order
+  EXPECT_FALSE(dfa->matches(R"({"age":3,"name":"bob"})"));
+  // string too long
+  EXPECT_FALSE(dfa->matches(R"({"name":"bobbobbob","age":3})"));
+  // too many items
+  EXPECT_FALSE(dfa->matches(R"({"name":"bob","age":3,"tags":["a","b","a"]})"));
+}
+
+TEST(JsonSchemaTest, Ref) {
+  const std::string schema = R"({
+    "$defs": {"point": {"type": "array", "items": {"type": "number"}}},
+    "anyOf": [{"$ref": "#/$defs/point"}, {"const": "none"}]
+  })";
+  std::string regex;
+  std::string error;
+  ASSERT_TRUE(json_schema_to_regex(schema, &regex, &error)) << error;
+  auto dfa = Dfa::compile(regex, &error);
+  ASSERT_NE(dfa, nullptr) << error;
+  EXPECT_TRUE(dfa->matches("[1.5, -2e3]"));
+  EXPECT_TRUE(dfa->matches("[]"));
+  EXPECT_TRUE(dfa->matches(R"("none")"));
+  EXPECT_FALSE(dfa->matches(R"("some")"));
+}
+
+TEST(JsonSchemaTest, Unsupported) {
+  std::string regex;
+  std::string error;
+  // recursive schema
+  EXPECT_FALSE(json_schema_to_regex(
+      R"({"$defs": {"n": {"type": "object", "properties": {"c": {"$ref": "#/$defs/n"}}}},
+          "$ref": "#/$defs/n"})",
+      &regex,
+      &error));
+  EXPECT_FALSE(json_schema_to_regex(R"({"type": "object"})", &regex, &error));
+  EXPECT_FALSE(json_schema_to_regex("{bad json", &regex, &error));
+}
+
+}  // namespace llm
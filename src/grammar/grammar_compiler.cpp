@@ -0,0 +1,73 @@
+#include "grammar_compiler.h"
+
+#include <glog/logging.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "dfa.h"
+#include "json_schema.h"
+
+namespace llm {
+
+GrammarCompiler::GrammarCompiler(std::unique_ptr<Tokenizer> tokenizer,
+                                 size_t max_cached_grammars)
+    : tokenizer_(std::move(tokenizer)),
+      max_cached_grammars_(max_cached_grammars) {
+  CHECK(tokenizer_ != nullptr);
+}
+
+std::shared_ptr<const TokenGrammar> GrammarCompiler::compile_regex(
+    const std::string& regex,
+    std::string* error) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = cache_.find(regex);
+    if (it != cache_.end()) {
+      // move to the front of the lru list
+      lru_list_.splice(lru_list_.begin(), lru_list_, it->second);
+      return it->second->second;
+    }
+  }
+
+  // compile outside of the lock
+  auto dfa = Dfa::compile(regex, error);
+  if (dfa == nullptr) {
+    return nullptr;
+  }
+  auto grammar = std::make_shared<const TokenGrammar>(std::move(dfa), vocab());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = cache_.find(regex);
+  if (it != cache_.end()) {
+    // compiled by others in the meantime
+    return it->second->second;
+  }
+  lru_list_.emplace_front(regex, grammar);
+  cache_[regex] = lru_list_.begin();
+  if (lru_list_.size() > max_cached_grammars_) {
+    cache_.erase(lru_list_.back().first);
+    lru_list_.pop_back();
+  }
+  return grammar;
+}
+
+std::shared_ptr<const TokenGrammar> GrammarCompiler::compile_json_schema(
+    const std::string& schema,
+    std::string* error) {
+  std::string regex;
+  if (!json_schema_to_regex(schema, &regex, error)) {
+    return nullptr;
+  }
+  return compile_regex(regex, error);
+}
+
+std::shared_ptr<const TokenVocab> GrammarCompiler::vocab() {
+  std::call_once(vocab_flag_, [this]() {
+    vocab_ = TokenVocab::from_tokenizer(*tokenizer_);
+  });
+  return vocab_;
+}
+
+}  // namespace llm
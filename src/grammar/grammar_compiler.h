@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "token_grammar.h"
+#include "tokenizer/tokenizer.h"
+
+namespace llm {
+
+// Compiles grammars over the vocabulary of the tokenizer. Compiled grammars are
+// cached by their regular expressions, so requests with the same grammar share
+// the cached bitmasks of allowed tokens. thread safe.
+class GrammarCompiler final {
+ public:
+  GrammarCompiler(std::unique_ptr<Tokenizer> tokenizer,
+                  size_t max_cached_grammars = 64);
+
+  // compile a regular expression into a grammar.
+  // returns nullptr and sets the error message if failed.
+  std::shared_ptr<const TokenGrammar> compile_regex(const std::string& regex,
+                                                    std::string* error);
+
+  // compile a json schema into a grammar.
+  // returns nullptr and sets the error message if failed.
+  std::shared_ptr<const TokenGrammar> compile_json_schema(
+      const std::string& schema,
+      std::string* error);
+
+ private:
+  // get the vocab, built from the tokenizer on first use
+  std::shared_ptr<const TokenVocab> vocab();
+
+  std::unique_ptr<Tokenizer> tokenizer_;
+
+  std::once_flag vocab_flag_;
+  std::shared_ptr<const TokenVocab> vocab_;
+
+  // max number of cached grammars
+  size_t max_cached_grammars_ = 0;
+
+  // mutex to protect the lru cache of compiled grammars
+  std::mutex mutex_;
+
+  // cached (regex, grammar) with the most recently used at the front
+  using CacheEntry = std::pair<std::string, std::shared_ptr<const TokenGrammar>>;
+  std::list<CacheEntry> lru_list_;
+  std::unordered_map<std::string, std::list<CacheEntry>::iterator> cache_;
+};
+
+}  // namespace llm
@@ -0,0 +1,375 @@
+#include "json_schema.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace llm {
+
+namespace {
+
+// keep the declaration order of properties
+using json = nlohmann::ordered_json;
+
+// optional whitespace between json tokens, bounded to avoid endless whitespace
+constexpr char kWhitespace[] = "[ \\t\\n]{0,4}";
+
+// a character in a json string, either unescaped or escaped
+constexpr char kStringChar[] =
+    R"(([^"\\\x00-\x1F\x7F]|\\["\\/bfnrt]|\\u[0-9a-fA-F]{4}))";
+
+constexpr char kInteger[] = R"(-?(0|[1-9][0-9]*))";
+
+constexpr char kNumber[] = R"(-?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?)";
+
+constexpr char kBoolean[] = "(true|false)";
+
+constexpr char kNull[] = "null";
+
+// max depth of nested schemas, also guards against recursive $ref
+constexpr int32_t kMaxDepth = 32;
+
+// max value of size keywords, such as maxItems and maxLength
+constexpr int64_t kMaxSize = 1000;
+
+std::string escape_regex(const std::string& text) {
+  static constexpr std::string_view kSpecialChars = R"(\.^$|?*+()[]{})";
+  std::string escaped;
+  escaped.reserve(text.size());
+  for (const char c : text) {
+    if (kSpecialChars.find(c) != std::string_view::npos) {
+      escaped.push_back('\\');
+    }
+    escaped.push_back(c);
+  }
+  return escaped;
+}
+
+std::string join_alternatives(const std::vector<std::string>& alternatives) {
+  std::string regex = "(";
+  for (size_t i = 0; i < alternatives.size(); ++i) {
+    if (i > 0) {
+      regex += "|";
+    }
+    regex += alternatives[i];
+  }
+  regex += ")";
+  return regex;
+}
+
+class JsonSchemaConverter final {
+ public:
+  explicit JsonSchemaConverter(const json& root) : root_(root) {}
+
+  // NOLINTNEXTLINE(readability-function-cognitive-complexity)
+  bool convert(const json& schema, int32_t depth, std::string* regex) {
+    if (depth > kMaxDepth) {
+      return fail("schema is too deep or recursive");
+    }
+    if (!schema.is_object()) {
+      return fail("schema must be an object");
+    }
+
+    if (schema.contains("$ref")) {
+      const json* target = nullptr;
+      if (!resolve_ref(schema["$ref"], &target)) {
+        return false;
+      }
+      return convert(*target, depth + 1, regex);
+    }
+
+    if (schema.contains("const")) {
+      *regex = escape_regex(schema["const"].dump());
+      return true;
+    }
+
+    if (schema.contains("enum")) {
+      const auto& values = schema["enum"];
+      if (!values.is_array() || values.empty()) {
+        return fail("enum must be a non-empty array");
+      }
+      std::vector<std::string> alternatives;
+      for (const auto& value : values) {
+        alternatives.push_back(escape_regex(value.dump()));
+      }
+      *regex = join_alternatives(alternatives);
+      return true;
+    }
+
+    for (const char* key : {"anyOf", "oneOf"}) {
+      if (schema.contains(key)) {
+        const auto& schemas = schema[key];
+        if (!schemas.is_array() || schemas.empty()) {
+          return fail(std::string(key) + " must be a non-empty array");
+        }
+        std::vector<std::string> alternatives;
+        for (const auto& sub_schema : schemas) {
+          if (!convert(sub_schema, depth + 1, &alternatives.emplace_back())) {
+            return false;
+          }
+        }
+        *regex = join_alternatives(alternatives);
+        return true;
+      }
+    }
+
+    if (schema.contains("allOf")) {
+      const auto& schemas = schema["allOf"];
+      if (!schemas.is_array() || schemas.size() != 1) {
+        return fail("allOf with multiple schemas is not supported");
+      }
+      return convert(schemas[0], depth + 1, regex);
+    }
+
+    if (schema.contains("type")) {
+      const auto& type = schema["type"];
+      if (type.is_string()) {
+        return convert_type(schema, type, depth, regex);
+      }
+      if (!type.is_array() || type.empty()) {
+        return fail("type must be a string or a non-empty array");
+      }
+      std::vector<std::string> alternatives;
+      for (const auto& t : type) {
+        if (!t.is_string()) {
+          return fail("type must be a string or a non-empty array");
+        }
+        if (!convert_type(schema, t, depth, &alternatives.emplace_back())) {
+          return false;
+        }
+      }
+      *regex = join_alternatives(alternatives);
+      return true;
+    }
+
+    if (schema.contains("properties")) {
+      return convert_object(schema, depth, regex);
+    }
+    if (schema.contains("items")) {
+      return convert_array(schema, depth, regex);
+    }
+    return fail("schema without type is not supported");
+  }
+
+  const std::string& error() const { return error_; }
+
+ private:
+  bool fail(const std::string& message) {
+    if (error_.empty()) {
+      error_ = message;
+    }
+    return false;
+  }
+
+  bool convert_type(const json& schema,
+                    const std::string& type,
+                    int32_t depth,
+                    std::string* regex) {
+    if (type == "string") {
+      return convert_string(schema, regex);
+    }
+    if (type == "integer") {
+      *regex = kInteger;
+    } else if (type == "number") {
+      *regex = kNumber;
+    } else if (type == "boolean") {
+      *regex = kBoolean;
+    } else if (type == "null") {
+      *regex = kNull;
+    } else if (type == "array") {
+      return convert_array(schema, depth, regex);
+    } else if (type == "object") {
+      return convert_object(schema, depth, regex);
+    } else {
+      return fail("unsupported type: " + type);
+    }
+    return true;
+  }
+
+  bool convert_string(const json& schema, std::string* regex) {
+    if (schema.contains("pattern")) {
+      const auto& pattern = schema["pattern"];
+      if (!pattern.is_string()) {
+        return fail("pattern must be a string");
+      }
+      *regex = "\"(" + pattern.get<std::string>() + ")\"";
+      return true;
+    }
+
+    int64_t min_length = 0;
+    int64_t max_length = -1;
+    if (!get_size(schema, "minLength", &min_length) ||
+        !get_size(schema, "maxLength", &max_length)) {
+      return false;
+    }
+    *regex = "\"" + std::string(kStringChar) +
+             repetition(min_length, max_length) + "\"";
+    return true;
+  }
+
+  bool convert_array(const json& schema, int32_t depth, std::string* regex) {
+    if (!schema.contains("items") || !schema["items"].is_object()) {
+      return fail("array without items schema is not supported");
+    }
+    std::string item;
+    if (!convert(schema["items"], depth + 1, &item)) {
+      return false;
+    }
+
+    int64_t min_items = 0;
+    int64_t max_items = -1;
+    if (!get_size(schema, "minItems", &min_items) ||
+        !get_size(schema, "maxItems", &max_items)) {
+      return false;
+    }
+
+    std::string body;
+    if (max_items != 0) {
+      const std::string separator =
+          std::string(kWhitespace) + "," + kWhitespace;
+      // the first item followed by the rest
+      body = "(" + item + ")" + "(" + separator + "(" + item + "))" +
+             repetition(std::max<int64_t>(min_items - 1, 0),
+                        max_items == -1 ? -1 : max_items - 1);
+      if (min_items == 0) {
+        body = "(" + body + ")?";
+      }
+    }
+    *regex = "\\[" + std::string(kWhitespace) + body + kWhitespace + "\\]";
+    return true;
+  }
+
+  bool convert_object(const json& schema, int32_t depth, std::string* regex) {
+    if (!schema.contains("properties") || !schema["properties"].is_object()) {
+      return fail("object without properties is not supported");
+    }
+
+    std::set<std::string> required;
+    if (schema.contains("required")) {
+      for (const auto& name : schema["required"]) {
+        if (!name.is_string()) {
+          return fail("required must be an array of strings");
+        }
+        required.insert(name.get<std::string>());
+      }
+    }
+
+    // "key": value for each property
+    std::vector<std::string> items;
+    std::vector<bool> is_required;
+    for (const auto& [name, property] : schema["properties"].items()) {
+      std::string value;
+      if (!convert(property, depth + 1, &value)) {
+        return false;
+      }
+      items.push_back(escape_regex(json(name).dump()) + kWhitespace + ":" +
+                      kWhitespace + "(" + value + ")");
+      is_required.push_back(required.count(name) > 0);
+    }
+
+    const size_t num_items = items.size();
+    const std::string separator = std::string(kWhitespace) + "," + kWhitespace;
+    // the properties after index i, each prefixed with a separator
+    std::vector<std::string> tails(num_items + 1);
+    for (size_t i = num_items; i > 0; --i) {
+      const std::string& item = items[i - 1];
+      tails[i - 1] = is_required[i - 1] ? separator + item
+                                        : "(" + separator + item + ")?";
+      tails[i - 1] += tails[i];
+    }
+
+    // the first property could be any optional one before the first required
+    std::vector<std::string> alternatives;
+    bool has_required = false;
+    for (size_t i = 0; i < num_items; ++i) {
+      alternatives.push_back(items[i] + tails[i + 1]);
+      if (is_required[i]) {
+        has_required = true;
+        break;
+      }
+    }
+
+    std::string body;
+    if (!alternatives.empty()) {
+      body = join_alternatives(alternatives);
+      if (!has_required) {
+        body += "?";
+      }
+    }
+    *regex = "\\{" + std::string(kWhitespace) + body + kWhitespace + "\\}";
+    return true;
+  }
+
+  bool resolve_ref(const json& ref, const json** target) {
+    if (!ref.is_string()) {
+      return fail("$ref must be a string");
+    }
+    const auto path = ref.get<std::string>();
+    if (path.empty() || path[0] != '#') {
+      return fail("only local $ref is supported: " + path);
+    }
+    try {
+      *target = &root_.at(json::json_pointer(path.substr(1)));
+    } catch (const json::exception& /*e*/) {
+      return fail("invalid $ref: " + path);
+    }
+    return true;
+  }
+
+  bool get_size(const json& schema, const char* key, int64_t* value) {
+    if (!schema.contains(key)) {
+      return true;
+    }
+    const auto& size = schema[key];
+    if (!size.is_number_unsigned() || size.get<int64_t>() > kMaxSize) {
+      return fail(std::string(key) + " must be an integer between 0 and " +
+                  std::to_string(kMaxSize));
+    }
+    *value = size.get<int64_t>();
+    return true;
+  }
+
+  static std::string repetition(int64_t min_repeat, int64_t max_repeat) {
+    if (min_repeat == 0 && max_repeat == -1) {
+      return "*";
+    }
+    return "{" + std::to_string(min_repeat) + "," +
+           (max_repeat == -1 ? "" : std::to_string(max_repeat)) + "}";
+  }
+
+  const json& root_;
+
+  std::string error_;
+};
+
+}  // namespace
+
+bool json_schema_to_regex(const std::string_view& schema,
+                          std::string* regex,
+                          std::string* error) {
+  const auto root = json::parse(schema,
+                                /*cb=*/nullptr,
+                                /*allow_exceptions=*/false);
+  if (root.is_discarded()) {
+    if (error != nullptr) {
+      *error = "invalid json schema";
+    }
+    return false;
+  }
+
+  JsonSchemaConverter converter(root);
+  if (!converter.convert(root, /*depth=*/0, regex)) {
+    if (error != nullptr) {
+      *error = converter.error();
+    }
+    return false;
+  }
+  return true;
+}
+
+}  // namespace llm
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace llm {
+
+// convert a json schema into a regular expression matching the json documents
+// conforming to the schema, which can be compiled into a dfa.
+// supported keywords:
+//  type (string, integer, number, boolean, null, array, object), enum, const,
+//  anyOf, oneOf, allOf (single schema), $ref (non-recursive, to $defs or
+//  definitions), properties, required, items, minItems, maxItems, minLength,
+//  maxLength and pattern.
+// object properties are generated in the order of declaration.
+// returns false and sets the error message if the schema is not supported.
+bool json_schema_to_regex(const std::string_view& schema,
+                          std::string* regex,
+                          std::string* error);
+
+}  // namespace llm
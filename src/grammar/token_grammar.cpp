@@ -0,0 +1,155 @@
+#include "token_grammar.h"
+
+#include <absl/strings/match.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llm {
+
+namespace {
+
+// utf-8 encoding of U+FFFD, the replacement character for partial characters
+constexpr char kReplacementChar[] = "\xEF\xBF\xBD";
+
+}  // namespace
+
+TokenVocab::TokenVocab(std::vector<std::string> tokens)
+    : tokens_(std::move(tokens)) {
+  sorted_ids_.resize(tokens_.size());
+  for (size_t i = 0; i < tokens_.size(); ++i) {
+    sorted_ids_[i] = static_cast<int32_t>(i);
+    max_token_len_ = std::max(max_token_len_, tokens_[i].size());
+  }
+  std::sort(sorted_ids_.begin(),
+            sorted_ids_.end(),
+            [this](int32_t a, int32_t b) { return tokens_[a] < tokens_[b]; });
+
+  prefix_lens_.resize(tokens_.size(), 0);
+  for (size_t i = 1; i < sorted_ids_.size(); ++i) {
+    const auto& prev = tokens_[sorted_ids_[i - 1]];
+    const auto& curr = tokens_[sorted_ids_[i]];
+    const size_t max_len = std::min(prev.size(), curr.size());
+    uint32_t len = 0;
+    while (len < max_len && prev[len] == curr[len]) {
+      ++len;
+    }
+    prefix_lens_[i] = len;
+  }
+}
+
+std::shared_ptr<TokenVocab> TokenVocab::from_tokenizer(
+    const Tokenizer& tokenizer) {
+  // decode each token after an anchor token to keep the leading space, which
+  // is dropped by some tokenizers when decoding a single token.
+  std::vector<int32_t> anchor_ids;
+  CHECK(tokenizer.encode("a", &anchor_ids) && !anchor_ids.empty());
+  const int32_t anchor_id = anchor_ids.back();
+  const std::string anchor = tokenizer.decode(
+      std::vector<int32_t>{anchor_id}, /*skip_special_tokens=*/true);
+
+  const size_t vocab_size = tokenizer.vocab_size();
+  std::vector<std::string> tokens(vocab_size);
+  for (size_t i = 0; i < vocab_size; ++i) {
+    const auto token_id = static_cast<int32_t>(i);
+    std::string text =
+        tokenizer.decode(std::vector<int32_t>{anchor_id, token_id},
+                         /*skip_special_tokens=*/true);
+    if (absl::StartsWith(text, anchor)) {
+      text.erase(0, anchor.size());
+    } else {
+      text = tokenizer.decode(std::vector<int32_t>{token_id},
+                              /*skip_special_tokens=*/true);
+    }
+    // tokens of partial utf-8 characters can't be matched byte by byte
+    if (absl::StrContains(text, kReplacementChar)) {
+      text.clear();
+    }
+    tokens[i] = std::move(text);
+  }
+  return std::make_shared<TokenVocab>(std::move(tokens));
+}
+
+TokenGrammar::TokenGrammar(std::unique_ptr<Dfa> dfa,
+                           std::shared_ptr<const TokenVocab> vocab)
+    : dfa_(std::move(dfa)), vocab_(std::move(vocab)) {
+  CHECK(dfa_ != nullptr);
+  CHECK(vocab_ != nullptr);
+  const size_t num_states = dfa_->num_states();
+  bitmask_flags_ = std::make_unique<std::once_flag[]>(num_states);
+  bitmasks_.resize(num_states);
+}
+
+int32_t TokenGrammar::next_state(int32_t state, int32_t token_id) const {
+  if (token_id < 0 || static_cast<size_t>(token_id) >= vocab_->size()) {
+    return Dfa::kDeadState;
+  }
+  const auto& token = vocab_->token(token_id);
+  if (token.empty()) {
+    return Dfa::kDeadState;
+  }
+  return dfa_->next_state(state, token);
+}
+
+const std::vector<uint32_t>& TokenGrammar::allowed_tokens(
+    int32_t state) const {
+  CHECK(state >= 0 && static_cast<size_t>(state) < dfa_->num_states());
+  std::call_once(bitmask_flags_[state], [this, state]() {
+    bitmasks_[state] = compute_allowed_tokens(state);
+  });
+  return bitmasks_[state];
+}
+
+void TokenGrammar::precompute() const {
+  const auto num_states = static_cast<int32_t>(dfa_->num_states());
+  for (int32_t state = 0; state < num_states; ++state) {
+    allowed_tokens(state);
+  }
+}
+
+std::vector<uint32_t> TokenGrammar::compute_allowed_tokens(
+    int32_t state) const {
+  std::vector<uint32_t> bitmask(num_bitmask_words(), 0);
+
+  const auto& sorted_ids = vocab_->sorted_ids();
+  const auto& prefix_lens = vocab_->prefix_lens();
+  // states[i]: the state after the first i bytes of the current token
+  std::vector<int32_t> states(vocab_->max_token_len() + 1);
+  states[0] = state;
+  // the position of the first rejected byte of the previous token
+  size_t rejected_pos = std::numeric_limits<size_t>::max();
+  for (size_t i = 0; i < sorted_ids.size(); ++i) {
+    const int32_t token_id = sorted_ids[i];
+    const auto& token = vocab_->token(token_id);
+    const size_t prefix_len = prefix_lens[i];
+    // the token shares the rejected prefix with the previous token
+    if (rejected_pos < prefix_len) {
+      continue;
+    }
+
+    // resume the walk after the common prefix
+    rejected_pos = std::numeric_limits<size_t>::max();
+    for (size_t pos = prefix_len; pos < token.size(); ++pos) {
+      const int32_t next =
+          dfa_->next_state(states[pos], static_cast<uint8_t>(token[pos]));
+      if (next == Dfa::kDeadState) {
+        rejected_pos = pos;
+        break;
+      }
+      states[pos + 1] = next;
+    }
+    if (rejected_pos == std::numeric_limits<size_t>::max() && !token.empty()) {
+      bitmask[token_id / 32] |= (1u << (token_id % 32));
+    }
+  }
+  return bitmask;
+}
+
+}  // namespace llm
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "dfa.h"
+#include "tokenizer/tokenizer.h"
+
+namespace llm {
+
+// The byte strings of all tokens in the vocabulary. Tokens are also kept in
+// sorted order so that tokens sharing a prefix share the automaton walk over
+// the prefix when computing allowed tokens.
+class TokenVocab final {
+ public:
+  // tokens: byte string of each token, empty for tokens never allowed by
+  // grammars, such as special tokens.
+  explicit TokenVocab(std::vector<std::string> tokens);
+
+  // build the vocab by decoding each token with the tokenizer.
+  static std::shared_ptr<TokenVocab> from_tokenizer(const Tokenizer& tokenizer);
+
+  size_t size() const { return tokens_.size(); }
+
+  const std::string& token(int32_t token_id) const {
+    return tokens_[token_id];
+  }
+
+  // token ids sorted by their byte strings
+  const std::vector<int32_t>& sorted_ids() const { return sorted_ids_; }
+
+  // length of the common prefix with the previous token in sorted order
+  const std::vector<uint32_t>& prefix_lens() const { return prefix_lens_; }
+
+  // length of the longest token
+  size_t max_token_len() const { return max_token_len_; }
+
+ private:
+  std::vector<std::string> tokens_;
+
+  std::vector<int32_t> sorted_ids_;
+
+  std::vector<uint32_t> prefix_lens_;
+
+  size_t max_token_len_ = 0;
+};
+
+// A grammar compiled over the token vocabulary. The state of the grammar is a
+// dfa state that is advanced token by token, and the tokens allowed in each
+// state are kept as a packed bitmask, which is computed on first use and
+// cached so that each decoding step only copies the precomputed mask.
+// thread safe.
+class TokenGrammar final {
+ public:
+  TokenGrammar(std::unique_ptr<Dfa> dfa,
+               std::shared_ptr<const TokenVocab> vocab);
+
+  // get the start state of the grammar
+  int32_t start_state() const { return dfa_->start_state(); }
+
+  // get the state after the token, returns Dfa::kDeadState if rejected
+  int32_t next_state(int32_t state, int32_t token_id) const;
+
+  // check if the generated text is complete in the state, where the
+  // generation can stop.
+  bool is_accepting(int32_t state) const { return dfa_->is_accepting(state); }
+
+  // get the number of states
+  size_t num_states() const { return dfa_->num_states(); }
+
+  // get the vocab size of the grammar
+  size_t vocab_size() const { return vocab_->size(); }
+
+  // number of 32-bit words of the bitmask of allowed tokens
+  size_t num_bitmask_words() const { return (vocab_->size() + 31) / 32; }
+
+  // get the bitmask of allowed tokens in the state, where token i is allowed
+  // if (bitmask[i / 32] >> (i % 32)) & 1. computed on first use and cached.
+  const std::vector<uint32_t>& allowed_tokens(int32_t state) const;
+
+  // compute the bitmasks for all states ahead of time
+  void precompute() const;
+
+  // compute the bitmask of allowed tokens in the state without caching
+  std::vector<uint32_t> compute_allowed_tokens(int32_t state) const;
+
+ private:
+  std::unique_ptr<Dfa> dfa_;
+
+  std::shared_ptr<const TokenVocab> vocab_;
+
+  // cached bitmasks for each state, guarded by once flags
+  std::unique_ptr<std::once_flag[]> bitmask_flags_;
+  mutable std::vector<std::vector<uint32_t>> bitmasks_;
+};
+
+}  // namespace llm
@@ -0,0 +1,106 @@
+#include "token_grammar.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dfa.h"
+
+namespace llm {
+namespace {
+
+std::vector<int32_t> to_token_ids(const std::vector<uint32_t>& bitmask,
+                                  size_t vocab_size) {
+  std::vector<int32_t> token_ids;
+  for (size_t i = 0; i < vocab_size; ++i) {
+    if ((bitmask[i / 32] >> (i % 32)) & 1) {
+      token_ids.push_back(static_cast<int32_t>(i));
+    }
+  }
+  return token_ids;
+}
+
+// compute the allowed tokens by walking every token from the state
+std::vector<int32_t> allowed_token_ids(const TokenGrammar& grammar,
+                                       int32_t state) {
+  std::vector<int32_t> token_ids;
+  for (size_t i = 0; i < grammar.vocab_size(); ++i) {
+    const auto token_id = static_cast<int32_t>(i);
+    if (grammar.next_state(state, token_id) != Dfa::kDeadState) {
+      token_ids.push_back(token_id);
+    }
+  }
+  return token_ids;
+}
+
+}  // namespace
+
+TEST(TokenGrammarTest, AllowedTokens) {
+  // the empty token is never allowed
+  auto vocab = std::make_shared<TokenVocab>(std::vector<std::string>{
+      "", "{", "}", "\"", "a", "ab", "abc", "b", "\"a", "\"}", ":", "1", "12"});
+  EXPECT_EQ(vocab->max_token_len(), 3);
+
+  std::string error;
+  auto dfa = Dfa::compile(R"(\{"[a-c]+":1?2?\})", &error);
+  ASSERT_NE(dfa, nullptr) << error;
+  const TokenGrammar grammar(std::move(dfa), vocab);
+  EXPECT_EQ(grammar.num_bitmask_words(), 1);
+
+  int32_t state = grammar.start_state();
+  const std::vector<std::vector<int32_t>> expected_tokens = {
+      {1},                 // {
+      {3, 8},              // " or "a
+      {4, 5, 6, 7},        // a, ab, abc, b
+      {3, 4, 5, 6, 7},     // a or "
+      {10},                // :
+      {2, 11, 12},         // }, 1, 12
+  };
+  const std::vector<int32_t> next_tokens = {1, 3, 6, 3, 10, 12};
+  for (size_t i = 0; i < next_tokens.size(); ++i) {
+    const auto& bitmask = grammar.allowed_tokens(state);
+    EXPECT_EQ(to_token_ids(bitmask, vocab->size()), expected_tokens[i]) << i;
+    EXPECT_EQ(to_token_ids(bitmask, vocab->size()),
+              allowed_token_ids(grammar, state));
+    // cached bitmask is returned
+    EXPECT_EQ(&grammar.allowed_tokens(state), &bitmask);
+    EXPECT_FALSE(grammar.is_accepting(state));
+    state = grammar.next_state(state, next_tokens[i]);
+    ASSERT_NE(state, Dfa::kDeadState);
+  }
+  // only } is allowed to close the object
+  EXPECT_EQ(to_token_ids(grammar.allowed_tokens(state), vocab->size()),
+            std::vector<int32_t>{2});
+  state = grammar.next_state(state, 2);
+  EXPECT_TRUE(grammar.is_accepting(state));
+  EXPECT_TRUE(to_token_ids(grammar.allowed_tokens(state), vocab->size())
+                  .empty());
+}
+
+TEST(TokenGrammarTest, LargeVocab) {
+  // all tokens of up to 2 bytes over a small alphabet
+  const std::string alphabet = "ab01\"";
+  std::vector<std::string> tokens;
+  for (const char c1 : alphabet) {
+    tokens.emplace_back(1, c1);
+    for (const char c2 : alphabet) {
+      tokens.push_back(std::string{c1, c2});
+    }
+  }
+  auto vocab = std::make_shared<TokenVocab>(tokens);
+
+  std::string error;
+  auto dfa = Dfa::compile(R"("[ab]*"|[01]{1,3})", &error);
+  ASSERT_NE(dfa, nullptr) << error;
+  const TokenGrammar grammar(std::move(dfa), vocab);
+  grammar.precompute();
+  for (size_t state = 0; state < grammar.num_states(); ++state) {
+    const auto s = static_cast<int32_t>(state);
+    EXPECT_EQ(to_token_ids(grammar.allowed_tokens(s), vocab->size()),
+              allowed_token_ids(grammar, s));
+  }
+}
+
+}  // namespace llm
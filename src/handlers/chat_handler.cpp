@@ -6,24 +6,47 @@
 #include <torch/torch.h>
 #include <uuid.h>
 
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include <cstdint>
+#include <optional>
 #include <string>
+#include <vector>
 
 #include "chat_template/jinja_chat_template.h"
+#include "common/metrics.h"
 #include "engine/engine.h"
 #include "models/model_args.h"
 #include "models/model_registry.h"
 #include "request/request.h"
 #include "scheduler/scheduler.h"
+#include "tokenizer/prefix_token_cache.h"
 #include "utils.h"
 
 DEFINE_bool(enable_jinja_chat_template, false, "Enable Jinja chat template");
 
+DEFINE_int32(max_cached_prompt_prefixes,
+             0,
+             "max number of rendered prompt prefixes to cache their token ids, "
+             "0 to disable the cache. prompts are only split before special "
+             "tokens, use --verify_prompt_prefix_cache to check all prompts");
+
+DEFINE_bool(verify_prompt_prefix_cache,
+            false,
+            "verify the token ids of prompts with cached prefixes against "
+            "encoding the whole prompts");
+
 DECLARE_int32(num_speculative_tokens);
 
+DECLARE_int32(num_tokenizer_threads);
+
 namespace llm {
 
+DEFINE_GAUGE(prompt_prefix_cache_hit_rate,
+             "Hit rate of the token ids cache of prompt prefixes");
+DEFINE_GAUGE(prompt_prefix_cache_saved_seconds,
+             "Estimated tokenization time saved by the prompt prefix cache");
+
 namespace {
 
 std::string generate_request_id() {
@@ -39,8 +62,8 @@ bool verify_request_arguments(ChatCallData* call_data) {
     return false;
   }
 
-  // up to 4 stop sequences
-  if (request.stop_size() > 4) {
+  // up to 64 stop sequences
+  if (request.stop_size() > 64) {
     call_data->finish_with_error(grpc::StatusCode::INVALID_ARGUMENT,
                                  "stop size is too large");
     return false;
@@ -81,6 +104,19 @@ bool verify_request_arguments(ChatCallData* call_data) {
       return false;
     }
   }
+  if (request.has_guided_json() && request.has_guided_regex()) {
+    call_data->finish_with_error(
+        grpc::StatusCode::INVALID_ARGUMENT,
+        "only one of guided_json and guided_regex can be set");
+    return false;
+  }
+  if ((request.has_guided_json() || request.has_guided_regex()) &&
+      FLAGS_num_speculative_tokens > 0) {
+    call_data->finish_with_error(
+        grpc::StatusCode::UNIMPLEMENTED,
+        "guided decoding is not supported with speculative decoding");
+    return false;
+  }
   return true;
 }
 
@@ -165,37 +201,119 @@ bool send_result_to_client(ChatCallData* call_data,
   return call_data->finish();
 }
 
-// NOLINTNEXTLINE(readability-function-cognitive-complexity)
-std::unique_ptr<Request> grpc_request_to_request(ChatCallData* call_data,
-                                                 ChatTemplate* chat_template,
-                                                 const Tokenizer& tokenizer,
-                                                 const ModelArgs& model_args) {
-  const ChatRequest& grpc_request = call_data->request();
-  const int64_t max_context_len = model_args.max_position_embeddings();
-
-  // construct prompt from dialog messages
+// construct prompt from dialog messages
+std::optional<std::string> render_prompt(ChatCallData* call_data,
+                                         const ChatTemplate* chat_template,
+                                         const ModelArgs& model_args) {
   if (chat_template == nullptr) {
     call_data->finish_with_error(
         grpc::StatusCode::INVALID_ARGUMENT,
         "Chat template has not configured, please use /completion API");
     LOG(ERROR) << "Failed to get dialog factory for model type: "
                << model_args.model_type();
-    return nullptr;
+    return std::nullopt;
   }
 
-  auto prompt = chat_template->apply(grpc_request.messages());
+  auto prompt = chat_template->apply(call_data->request().messages());
   if (!prompt.has_value()) {
     call_data->finish_with_error(grpc::StatusCode::INVALID_ARGUMENT,
                                  "Failed to construct prompt from messages");
     LOG(ERROR) << "Failed to construct prompt from messages";
-    return nullptr;
+    return std::nullopt;
+  }
+  return prompt;
+}
+
+// whether a special token of the template starts at pos of the prompt
+bool starts_with_special_token(const std::string& prompt,
+                               size_t pos,
+                               const std::vector<std::string>& special_tokens) {
+  return std::any_of(special_tokens.begin(),
+                     special_tokens.end(),
+                     [&prompt, pos](const std::string& token) {
+                       return prompt.compare(pos, token.size(), token) == 0;
+                     });
+}
+
+// the end of each message in the prompt, where the prompt is split to reuse
+// the token ids of the previous turns and the shared system prompt.
+// the prompt is only split right before special tokens, which are encoded
+// on their own, so that no token crosses the boundaries. occurrences of the
+// content in the template text, or not followed by a special token, are
+// skipped.
+std::vector<size_t> find_message_boundaries(
+    const std::string& prompt,
+    const ChatMessages& messages,
+    const std::vector<std::string>& special_tokens) {
+  std::vector<size_t> boundaries;
+  if (special_tokens.empty()) {
+    return boundaries;
+  }
+  size_t pos = 0;
+  for (const auto& message : messages) {
+    const auto& content = message.content();
+    if (content.empty()) {
+      continue;
+    }
+    size_t start = prompt.find(content, pos);
+    while (start != std::string::npos &&
+           !starts_with_special_token(
+               prompt, start + content.size(), special_tokens)) {
+      start = prompt.find(content, start + 1);
+    }
+    if (start == std::string::npos) {
+      // the content is changed by the template, e.g. stripped
+      break;
+    }
+    pos = start + content.size();
+    boundaries.push_back(pos);
   }
+  return boundaries;
+}
+
+bool encode_prompt(ChatCallData* call_data,
+                   const std::string& prompt,
+                   const Tokenizer& tokenizer,
+                   PrefixTokenCache* prefix_token_cache,
+                   const std::vector<std::string>& special_tokens,
+                   std::vector<int>* prompt_tokens) {
+  if (prefix_token_cache == nullptr) {
+    return tokenizer.encode(prompt, prompt_tokens);
+  }
+  const auto boundaries = find_message_boundaries(
+      prompt, call_data->request().messages(), special_tokens);
+  if (!prefix_token_cache->encode(
+          tokenizer, prompt, boundaries, prompt_tokens)) {
+    return false;
+  }
+  const auto stats = prefix_token_cache->stats();
+  prompt_prefix_cache_hit_rate.Set(stats.hit_rate());
+  prompt_prefix_cache_saved_seconds.Set(stats.saved_seconds());
+  return true;
+}
+
+// NOLINTNEXTLINE(readability-function-cognitive-complexity)
+std::unique_ptr<Request> grpc_request_to_request(
+    ChatCallData* call_data,
+    const std::string& prompt,
+    const Tokenizer& tokenizer,
+    PrefixTokenCache* prefix_token_cache,
+    const std::vector<std::string>& special_tokens,
+    const ModelArgs& model_args,
+    GrammarCompiler* grammar_compiler) {
+  const ChatRequest& grpc_request = call_data->request();
+  const int64_t max_context_len = model_args.max_position_embeddings();
 
   std::vector<int> prompt_tokens;
-  if (!tokenizer.encode(prompt.value(), &prompt_tokens)) {
+  if (!encode_prompt(call_data,
+                     prompt,
+                     tokenizer,
+                     prefix_token_cache,
+                     special_tokens,
+                     &prompt_tokens)) {
     call_data->finish_with_error(grpc::StatusCode::INVALID_ARGUMENT,
                                  "Failed to encode prompt");
-    LOG(ERROR) << "Failed to encode prompt: " << prompt.value();
+    LOG(ERROR) << "Failed to encode prompt: " << prompt;
     return nullptr;
   }
   if (prompt_tokens.size() >= max_context_len) {
@@ -219,8 +337,12 @@ std::unique_ptr<Request> grpc_request_to_request(ChatCallData* call_data,
   // tokens
   const size_t capacity = prompt_tokens.size() + max_tokens +
                           FLAGS_num_speculative_tokens + /*bouns_token*/ 1;
-  auto request = std::make_unique<Request>(
-      generate_request_id(), "", prompt_tokens, capacity, num_seqs);
+  auto request = std::make_unique<Request>(generate_request_id(),
+                                           "",
+                                           prompt_tokens,
+                                           capacity,
+                                           /*n=*/num_seqs,
+                                           /*best_of=*/num_seqs);
 
   // construct sampling parameters
   auto& sampling_param = request->sampling_param;
@@ -261,16 +383,13 @@ std::unique_ptr<Request> grpc_request_to_request(ChatCallData* call_data,
   }
 
   // construct stop sequences
-  for (const auto& stop_seq : grpc_request.stop()) {
-    // encode stop sequence
-    std::vector<int> token_ids;
-    if (!tokenizer.encode(stop_seq, &token_ids)) {
-      call_data->finish_with_error(grpc::StatusCode::INVALID_ARGUMENT,
-                                   "Failed to encode stop sequence");
-      LOG(ERROR) << "Failed to encode stop sequence: " << stop_seq;
-      return nullptr;
-    }
-    stopping_criteria.stop_sequences.push_back(token_ids);
+  // match stop strings against the output text, which can't be done by
+  // token ids since a stop string may be tokenized differently in context.
+  if (grpc_request.stop_size() > 0) {
+    const std::vector<std::string> stop_strings(grpc_request.stop().begin(),
+                                                grpc_request.stop().end());
+    stopping_criteria.stop_strings =
+        std::make_shared<StopStringMatcher>(stop_strings);
   }
 
   if (grpc_request.has_stream()) {
@@ -282,6 +401,23 @@ std::unique_ptr<Request> grpc_request_to_request(ChatCallData* call_data,
   // disable echo for chat completion
   request->echo = false;
 
+  // compile the grammar for guided decoding
+  if (grpc_request.has_guided_json() || grpc_request.has_guided_regex()) {
+    std::string error;
+    request->grammar =
+        grpc_request.has_guided_json()
+            ? grammar_compiler->compile_json_schema(grpc_request.guided_json(),
+                                                    &error)
+            : grammar_compiler->compile_regex(grpc_request.guided_regex(),
+                                              &error);
+    if (request->grammar == nullptr) {
+      call_data->finish_with_error(grpc::StatusCode::INVALID_ARGUMENT,
+                                   "Invalid guided grammar: " + error);
+      LOG(ERROR) << "Failed to compile grammar: " << error;
+      return nullptr;
+    }
+  }
+
   // set callbacks
   if (request->stream) {
     // set callback for stream delta
@@ -319,11 +455,23 @@ std::unique_ptr<Request> grpc_request_to_request(ChatCallData* call_data,
 
 }  // namespace
 
-ChatHandler::ChatHandler(Scheduler* scheduler, const Engine* engine)
-    : scheduler_(scheduler) {
+ChatHandler::ChatHandler(Scheduler* scheduler,
+                         const Engine* engine,
+                         GrammarCompiler* grammar_compiler)
+    : scheduler_(scheduler),
+      grammar_compiler_(grammar_compiler),
+      tokenizer_threadpool_(FLAGS_num_tokenizer_threads) {
   CHECK(scheduler_ != nullptr);
+  CHECK(grammar_compiler_ != nullptr);
   tokenizer_ = engine->tokenizer();
   model_args_ = engine->model_args();
+  if (FLAGS_max_cached_prompt_prefixes > 0) {
+    prefix_token_cache_ = std::make_unique<PrefixTokenCache>(
+        FLAGS_max_cached_prompt_prefixes, FLAGS_verify_prompt_prefix_cache);
+    for (const auto& [token, id] : engine->tokenizer_args().special_tokens()) {
+      special_tokens_.push_back(token);
+    }
+  }
 
   // construct chat template
   auto factory = ModelRegistry::get_default_chat_template_factory(
@@ -344,14 +492,26 @@ ChatHandler::ChatHandler(Scheduler* scheduler, const Engine* engine)
 }
 
 void ChatHandler::chat_async(ChatCallData* call_data) {
-  converter_threadpool_.schedule([this, call_data = call_data]() {
+  // chat templates are thread safe, render and tokenize prompts of requests
+  // in parallel on the tokenizer threadpool.
+  tokenizer_threadpool_.schedule([this, call_data = call_data]() {
     if (!verify_request_arguments(call_data)) {
       // request is not valid, finish with error
       return;
     }
 
-    auto request = grpc_request_to_request(
-        call_data, chat_template_.get(), *tokenizer_, model_args_);
+    auto prompt = render_prompt(call_data, chat_template_.get(), model_args_);
+    if (!prompt.has_value()) {
+      return;
+    }
+
+    auto request = grpc_request_to_request(call_data,
+                                           prompt.value(),
+                                           *tokenizer_,
+                                           prefix_token_cache_.get(),
+                                           special_tokens_,
+                                           model_args_,
+                                           grammar_compiler_);
     if (request == nullptr) {
       return;
     }
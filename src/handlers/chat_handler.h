@@ -2,11 +2,16 @@
 
 #include <gflags/gflags.h>
 
+#include <string>
+#include <vector>
+
 #include "call_data.h"
 #include "chat.grpc.pb.h"  // IWYU pragma: keep
 #include "chat_template/chat_template.h"
 #include "common/threadpool.h"
+#include "grammar/grammar_compiler.h"
 #include "models/model_args.h"
+#include "tokenizer/prefix_token_cache.h"
 #include "tokenizer/tokenizer.h"
 
 DECLARE_bool(disable_default_chat_template);
@@ -20,7 +25,11 @@ class Engine;
 // a class to handle completion requests
 class ChatHandler final {
  public:
-  ChatHandler(Scheduler* scheduler, const Engine* engine);
+  // the grammar compiler is shared with other handlers, and should outlive
+  // the handler
+  ChatHandler(Scheduler* scheduler,
+              const Engine* engine,
+              GrammarCompiler* grammar_compiler);
 
   // caller needs to guarantee the lifetime of call_data.
   void chat_async(ChatCallData* call_data);
@@ -32,14 +41,23 @@ class ChatHandler final {
   // tokenizer instance
   std::unique_ptr<Tokenizer> tokenizer_;
 
+  // cache of token ids of prompt prefixes, nullptr if disabled
+  std::unique_ptr<PrefixTokenCache> prefix_token_cache_;
+
+  // special tokens of the template, where prompts are split for the cache
+  std::vector<std::string> special_tokens_;
+
   // chat template instance
   std::unique_ptr<ChatTemplate> chat_template_;
 
   // model args
   ModelArgs model_args_;
 
-  // converter threadpool
-  ThreadPool converter_threadpool_;
+  // compiler for grammars of guided decoding, not owned
+  GrammarCompiler* grammar_compiler_;
+
+  // threadpool to render chat templates and tokenize prompts
+  ThreadPool tokenizer_threadpool_;
 };
 
 }  // namespace llm
@@ -16,6 +16,8 @@
 
 DECLARE_int32(num_speculative_tokens);
 
+DECLARE_int32(num_tokenizer_threads);
+
 namespace llm {
 
 namespace {
@@ -27,21 +29,14 @@ std::string generate_request_id() {
 // NOLINTNEXTLINE(readability-function-cognitive-complexity)
 bool verify_request_arguments(CompletionCallData* call_data) {
   const auto& request = call_data->request();
-  const uint32_t n = request.has_n() ? request.n() : 1;
-  if (request.has_best_of() && request.best_of() != n) {
-    call_data->finish_with_error(grpc::StatusCode::UNIMPLEMENTED,
-                                 "best_of != n is not supported yet");
-    return false;
-  }
-
   // prompt is required
   if (request.prompt().empty()) {
     call_data->finish_with_error(grpc::StatusCode::INVALID_ARGUMENT,
                                  "missing prompt");
     return false;
   }
-  // up to 4 stop sequences
-  if (request.stop_size() > 4) {
+  // up to 64 stop sequences
+  if (request.stop_size() > 64) {
     call_data->finish_with_error(grpc::StatusCode::INVALID_ARGUMENT,
                                  "stop size is too large");
     return false;
@@ -91,12 +86,46 @@ bool verify_request_arguments(CompletionCallData* call_data) {
     }
   }
   // best_of >= n
-  if (request.has_best_of() && request.has_n()) {
-    if (request.best_of() < request.n()) {
+  const uint32_t n = request.has_n() ? request.n() : 1;
+  if (request.has_best_of()) {
+    if (request.best_of() < n) {
       call_data->finish_with_error(grpc::StatusCode::INVALID_ARGUMENT,
                                    "best_of must be greater or equal to n");
       return false;
     }
+    // results can't be streamed since the best ones are known at the end
+    if (request.stream() && request.best_of() > n) {
+      call_data->finish_with_error(
+          grpc::StatusCode::INVALID_ARGUMENT,
+          "best_of must be equal to n when streaming");
+      return false;
+    }
+  }
+  if (request.use_beam_search()) {
+    if (request.stream()) {
+      call_data->finish_with_error(grpc::StatusCode::INVALID_ARGUMENT,
+                                   "beam search can't be streamed");
+      return false;
+    }
+    if (FLAGS_num_speculative_tokens > 0) {
+      call_data->finish_with_error(
+          grpc::StatusCode::UNIMPLEMENTED,
+          "beam search is not supported with speculative decoding");
+      return false;
+    }
+  }
+  if (request.has_guided_json() && request.has_guided_regex()) {
+    call_data->finish_with_error(
+        grpc::StatusCode::INVALID_ARGUMENT,
+        "only one of guided_json and guided_regex can be set");
+    return false;
+  }
+  if ((request.has_guided_json() || request.has_guided_regex()) &&
+      FLAGS_num_speculative_tokens > 0) {
+    call_data->finish_with_error(
+        grpc::StatusCode::UNIMPLEMENTED,
+        "guided decoding is not supported with speculative decoding");
+    return false;
   }
   return true;
 }
@@ -169,9 +198,11 @@ bool send_result_to_client(CompletionCallData* call_data,
   return call_data->finish();
 }
 
-std::unique_ptr<Request> grpc_request_to_request(CompletionCallData* call_data,
-                                                 const Tokenizer& tokenizer,
-                                                 const ModelArgs& model_args) {
+std::unique_ptr<Request> grpc_request_to_request(
+    CompletionCallData* call_data,
+    const Tokenizer& tokenizer,
+    const ModelArgs& model_args,
+    GrammarCompiler* grammar_compiler) {
   const CompletionRequest& grpc_request = call_data->request();
   CHECK(!grpc_request.prompt().empty()) << "Prompt is empty";
 
@@ -203,12 +234,15 @@ std::unique_ptr<Request> grpc_request_to_request(CompletionCallData* call_data,
   const size_t capacity = prompt_tokens.size() + max_tokens +
                           FLAGS_num_speculative_tokens + /*bouns_token*/ 1;
 
-  const uint32_t num_seqs = grpc_request.has_n() ? grpc_request.n() : 1;
+  const uint32_t n = grpc_request.has_n() ? grpc_request.n() : 1;
+  const uint32_t best_of =
+      grpc_request.has_best_of() ? grpc_request.best_of() : n;
   auto request = std::make_unique<Request>(generate_request_id(),
                                            grpc_request.prompt(),
                                            prompt_tokens,
                                            capacity,
-                                           num_seqs);
+                                           n,
+                                           best_of);
 
   // construct sampling parameters
   auto& sampling_param = request->sampling_param;
@@ -245,16 +279,13 @@ std::unique_ptr<Request> grpc_request_to_request(CompletionCallData* call_data,
                                             stop_token_ids.end());
   }
 
-  for (const auto& stop_seq : grpc_request.stop()) {
-    // encode stop sequence
-    std::vector<int> token_ids;
-    if (!tokenizer.encode(stop_seq, &token_ids)) {
-      call_data->finish_with_error(grpc::StatusCode::INVALID_ARGUMENT,
-                                   "Failed to encode stop sequence");
-      LOG(ERROR) << "Failed to encode stop sequence: " << stop_seq;
-      return nullptr;
-    }
-    stopping_criteria.stop_sequences.push_back(token_ids);
+  // match stop strings against the output text, which can't be done by
+  // token ids since a stop string may be tokenized differently in context.
+  if (grpc_request.stop_size() > 0) {
+    const std::vector<std::string> stop_strings(grpc_request.stop().begin(),
+                                                grpc_request.stop().end());
+    stopping_criteria.stop_strings =
+        std::make_shared<StopStringMatcher>(stop_strings);
   }
 
   if (grpc_request.has_stream()) {
@@ -266,6 +297,29 @@ std::unique_ptr<Request> grpc_request_to_request(CompletionCallData* call_data,
   if (grpc_request.has_priority()) {
     request->priority = grpc_priority_to_priority(grpc_request.priority());
   }
+  if (grpc_request.has_use_beam_search()) {
+    request->use_beam_search = grpc_request.use_beam_search();
+  }
+  if (grpc_request.has_length_penalty()) {
+    request->length_penalty = grpc_request.length_penalty();
+  }
+
+  // compile the grammar for guided decoding
+  if (grpc_request.has_guided_json() || grpc_request.has_guided_regex()) {
+    std::string error;
+    request->grammar =
+        grpc_request.has_guided_json()
+            ? grammar_compiler->compile_json_schema(grpc_request.guided_json(),
+                                                    &error)
+            : grammar_compiler->compile_regex(grpc_request.guided_regex(),
+                                              &error);
+    if (request->grammar == nullptr) {
+      call_data->finish_with_error(grpc::StatusCode::INVALID_ARGUMENT,
+                                   "Invalid guided grammar: " + error);
+      LOG(ERROR) << "Failed to compile grammar: " << error;
+      return nullptr;
+    }
+  }
 
   // set callbacks
   if (request->stream) {
@@ -300,9 +354,14 @@ std::unique_ptr<Request> grpc_request_to_request(CompletionCallData* call_data,
 
 }  // namespace
 
-CompletionHandler::CompletionHandler(Scheduler* scheduler, const Engine* engine)
-    : scheduler_(scheduler) {
+CompletionHandler::CompletionHandler(Scheduler* scheduler,
+                                     const Engine* engine,
+                                     GrammarCompiler* grammar_compiler)
+    : scheduler_(scheduler),
+      grammar_compiler_(grammar_compiler),
+      converter_threadpool_(FLAGS_num_tokenizer_threads) {
   CHECK(scheduler_ != nullptr);
+  CHECK(grammar_compiler_ != nullptr);
   tokenizer_ = engine->tokenizer();
   model_args_ = engine->model_args();
 }
@@ -314,7 +373,8 @@ void CompletionHandler::complete_async(CompletionCallData* call_data) {
       return;
     }
 
-    auto request = grpc_request_to_request(call_data, *tokenizer_, model_args_);
+    auto request = grpc_request_to_request(
+        call_data, *tokenizer_, model_args_, grammar_compiler_);
     if (request == nullptr) {
       return;
     }
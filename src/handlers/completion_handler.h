@@ -2,6 +2,7 @@
 
 #include "call_data.h"
 #include "common/threadpool.h"
+#include "grammar/grammar_compiler.h"
 #include "completion.grpc.pb.h"  // IWYU pragma: keep
 #include "models/model_args.h"
 #include "tokenizer/tokenizer.h"
@@ -17,7 +18,11 @@ class Engine;
 // a class to handle completion requests
 class CompletionHandler final {
  public:
-  CompletionHandler(Scheduler* scheduler, const Engine* engine);
+  // the grammar compiler is shared with other handlers, and should outlive
+  // the handler
+  CompletionHandler(Scheduler* scheduler,
+                    const Engine* engine,
+                    GrammarCompiler* grammar_compiler);
 
   // caller needs to guarantee the lifetime of call_data.
   void complete_async(CompletionCallData* call_data);
@@ -32,7 +37,10 @@ class CompletionHandler final {
   // model args
   ModelArgs model_args_;
 
-  // converter threadpool
+  // compiler for grammars of guided decoding, not owned
+  GrammarCompiler* grammar_compiler_;
+
+  // converter threadpool to tokenize prompts in parallel
   ThreadPool converter_threadpool_;
 };
 
@@ -8,6 +8,7 @@ use safetensors::tensor::{SafeTensorError, SafeTensors};
 use safetensors::Dtype as RDtype;
 use std::ffi::{c_char, CStr, CString};
 use std::mem::forget;
+use std::sync::Arc;
 use thiserror::Error;
 use tokenizers::tokenizer::Tokenizer;
 
@@ -420,33 +421,32 @@ unsafe fn _get_tensor(
 // ported from https://github.com/mlc-ai/tokenizers-cpp
 
 pub struct TokenizerWrapper {
-    // The tokenizer
-    tokenizer: Tokenizer,
-    // Holds the encoded ids to avoid dropping them
-    encode_ids: Vec<u32>,
-    // Holds the decoded string to avoid dropping it
-    decode_str: String,
+    // The tokenizer, shared by all clones of the wrapper
+    tokenizer: Arc<Tokenizer>,
 }
 
 impl TokenizerWrapper {
-    pub fn encode(&mut self, text: &str, add_special_tokens: bool) {
-        // Encode the text and store the ids
-        self.encode_ids = Vec::from(
-            self.tokenizer
-                .encode(text, add_special_tokens)
-                .unwrap()
-                .get_ids(),
-        );
+    pub fn get_vocab_size(&self, with_added_tokens: bool) -> usize {
+        self.tokenizer.get_vocab_size(with_added_tokens)
     }
+}
 
-    pub fn decode(&mut self, ids: Vec<u32>, skip_special_tokens: bool) {
-        // Decode the ids and store the string
-        self.decode_str = self.tokenizer.decode(&ids, skip_special_tokens).unwrap();
+// get the slice from the raw parts, which can be null for empty slices
+unsafe fn as_slice<'a, T>(data: *const T, len: usize) -> &'a [T] {
+    if len == 0 {
+        &[]
+    } else {
+        std::slice::from_raw_parts(data, len)
     }
+}
 
-    pub fn get_vocab_size(&self, with_added_tokens: bool) -> usize {
-        self.tokenizer.get_vocab_size(with_added_tokens)
+// copy the data into the buffer with the capacity, and return the full length
+unsafe fn copy_into<T: Copy>(data: &[T], out: *mut T, capacity: usize) -> usize {
+    let n = data.len().min(capacity);
+    if n > 0 {
+        std::ptr::copy_nonoverlapping(data.as_ptr(), out, n);
     }
+    data.len()
 }
 
 #[no_mangle]
@@ -458,62 +458,80 @@ extern "C" fn tokenizer_from_file(path: *const c_char) -> *mut TokenizerWrapper
     };
 
     let boxed = Box::new(TokenizerWrapper {
-        tokenizer: Tokenizer::from_file(path_str).unwrap().into(),
-        encode_ids: Vec::new(),
-        decode_str: String::new(),
+        tokenizer: Arc::new(Tokenizer::from_file(path_str).unwrap()),
     });
 
     Box::into_raw(boxed)
 }
 
 #[no_mangle]
-extern "C" fn tokenizer_encode(
-    handle: *mut TokenizerWrapper,
-    input_cstr: *const u8,
-    len: usize,
-    add_special_tokens: bool,
-) {
-    unsafe {
-        let input_data = std::str::from_utf8(std::slice::from_raw_parts(input_cstr, len)).unwrap();
-        (*handle).encode(input_data, add_special_tokens);
-    }
+extern "C" fn tokenizer_clone(handle: *const TokenizerWrapper) -> *mut TokenizerWrapper {
+    // share the tokenizer
+    let boxed = unsafe {
+        Box::new(TokenizerWrapper {
+            tokenizer: Arc::clone(&(*handle).tokenizer),
+        })
+    };
+
+    Box::into_raw(boxed)
 }
 
+// Encode the texts and write the ids of each text into its buffer. The ids
+// are written up to the capacity of the buffer, and the full number of ids is
+// returned in out_lens. No state is kept in the handle between calls, so the
+// handle can be used by multiple threads concurrently.
 #[no_mangle]
-extern "C" fn tokenizer_get_encode_ids(
-    handle: *mut TokenizerWrapper,
-    out_data: *mut *mut u32,
-    out_len: *mut usize,
-) {
+extern "C" fn tokenizer_encode_batch(
+    handle: *const TokenizerWrapper,
+    texts: *const *const u8,
+    text_lens: *const usize,
+    num_texts: usize,
+    add_special_tokens: bool,
+    out_ids: *const *mut u32,
+    capacities: *const usize,
+    out_lens: *mut usize,
+) -> bool {
     unsafe {
-        *out_data = (*handle).encode_ids.as_mut_ptr();
-        *out_len = (*handle).encode_ids.len()
+        let tokenizer = &(*handle).tokenizer;
+        for i in 0..num_texts {
+            let bytes = as_slice(*texts.add(i), *text_lens.add(i));
+            let text = match std::str::from_utf8(bytes) {
+                Ok(text) => text,
+                Err(_) => return false,
+            };
+            let encoding = match tokenizer.encode(text, add_special_tokens) {
+                Ok(encoding) => encoding,
+                Err(_) => return false,
+            };
+            let ids = encoding.get_ids();
+            *out_lens.add(i) = copy_into(ids, *out_ids.add(i), *capacities.add(i));
+        }
     }
+    true
 }
 
+// Decode the ids and write the string into the buffer up to its capacity,
+// the full length of the string is returned in out_len. Same as encode, the
+// handle can be used by multiple threads concurrently.
 #[no_mangle]
-extern "C" fn tokenizer_decode(
-    handle: *mut TokenizerWrapper,
-    input_ids: *const u32,
+extern "C" fn tokenizer_decode_into(
+    handle: *const TokenizerWrapper,
+    ids: *const u32,
     len: usize,
     skip_special_tokens: bool,
-) {
-    unsafe {
-        let input_data = Vec::from(std::slice::from_raw_parts(input_ids, len));
-        (*handle).decode(input_data, skip_special_tokens);
-    }
-}
-
-#[no_mangle]
-extern "C" fn tokenizer_get_decode_str(
-    handle: *mut TokenizerWrapper,
-    out_cstr: *mut *mut u8,
+    out_str: *mut u8,
+    capacity: usize,
     out_len: *mut usize,
-) {
+) -> bool {
     unsafe {
-        *out_cstr = (*handle).decode_str.as_mut_ptr();
-        *out_len = (*handle).decode_str.len();
+        let ids = as_slice(ids, len);
+        let text = match (*handle).tokenizer.decode(ids, skip_special_tokens) {
+            Ok(text) => text,
+            Err(_) => return false,
+        };
+        *out_len = copy_into(text.as_bytes(), out_str, capacity);
     }
+    true
 }
 
 #[no_mangle]
@@ -13,25 +13,34 @@ extern "C" {
 using TokenizerHandle = void*;
 
 TokenizerHandle tokenizer_from_file(const char* path);
-// TokenizerHandle tokenizer_from_pretrained(const char* identifier);
-
-void tokenizer_encode(TokenizerHandle handle,
-                      const char* data,
-                      size_t len,
-                      bool add_special_tokens);
 
-void tokenizer_decode(TokenizerHandle handle,
-                      const uint32_t* data,
-                      size_t len,
-                      bool skip_special_tokens);
-
-void tokenizer_get_decode_str(TokenizerHandle handle,
-                              const char** data,
-                              size_t* len);
+// create a new handle sharing the tokenizer with the given handle.
+TokenizerHandle tokenizer_clone(TokenizerHandle handle);
+// TokenizerHandle tokenizer_from_pretrained(const char* identifier);
 
-void tokenizer_get_encode_ids(TokenizerHandle handle,
-                              const uint32_t** id_data,
-                              size_t* len);
+// encode the texts and write the ids of the i-th text into out_ids[i] up to
+// capacities[i] ids, and set out_lens[i] to the number of ids of the text,
+// which may be larger than the capacity. no state is kept in the handle, so
+// it can be used by multiple threads concurrently. returns false on errors.
+bool tokenizer_encode_batch(TokenizerHandle handle,
+                            const char* const* texts,
+                            const size_t* text_lens,
+                            size_t num_texts,
+                            bool add_special_tokens,
+                            uint32_t* const* out_ids,
+                            const size_t* capacities,
+                            size_t* out_lens);
+
+// decode the ids and write the text into out_str up to capacity bytes, and
+// set out_len to the length of the text, which may be larger than the
+// capacity. thread safe as encode. returns false on errors.
+bool tokenizer_decode_into(TokenizerHandle handle,
+                           const uint32_t* ids,
+                           size_t len,
+                           bool skip_special_tokens,
+                           char* out_str,
+                           size_t capacity,
+                           size_t* out_len);
 
 void tokenizer_free(TokenizerHandle handle);
 
@@ -23,7 +23,8 @@ torch::Tensor AttentionImpl::forward(const torch::Tensor& query,
                                      const torch::Tensor& value,
                                      const torch::Tensor& positions,
                                      KVCache& kv_cache,
-                                     const InputParameters& input_params) {
+                                     const InputParameters& input_params,
+                                     const ForwardContext& context) {
   const int64_t n_tokens = query.size(0);
   // [n_tokens, hidden_dim] => [n_tokens, n_heads, head_dim]
   auto q = query.view({n_tokens, n_heads_, head_dim_});
@@ -37,7 +38,7 @@ torch::Tensor AttentionImpl::forward(const torch::Tensor& query,
   // append key and value to kv_cache
   handler_->append_kv_cache(kv_cache, k, v, input_params);
 
-  auto output = torch::empty_like(q);
+  auto output = context.empty_like(q);
   if (input_params.empty_kv_cache) {
     handler_->batch_prefill(q, k, v, input_params, output);
   } else {
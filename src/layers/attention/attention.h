@@ -27,7 +27,8 @@ class AttentionImpl : public torch::nn::Module {
                         const torch::Tensor& value,
                         const torch::Tensor& positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context);
 
  private:
   int64_t n_heads_ = 0;
@@ -11,6 +11,7 @@
 #include <torch/csrc/distributed/c10d/ProcessGroupNCCL.hpp>
 
 #include "linear_impl.h"
+#include "memory/workspace.h"
 #include "model_loader/state_dict.h"
 
 namespace llm {
@@ -46,4 +47,51 @@ TEST(LayersTest, TestLoadStateDict) {
       torch::equal(state_dict_data["weight"], named_parameters["weight"]));
 }
 
+TEST(LayersTest, ForwardWithContext) {
+  const int64_t in_features = 10;
+  const int64_t out_features = 20;
+  const int64_t num_tokens = 4;
+
+  torch::Device device(torch::kCPU);
+  torch::ScalarType dtype(torch::kFloat);
+  const auto options = torch::dtype(dtype).device(device);
+  ParallelArgs parallel_args(0, 1, nullptr);
+  ColumnParallelLinearImpl column(in_features,
+                                  out_features,
+                                  /*bias=*/true,
+                                  /*gather_output=*/false,
+                                  parallel_args,
+                                  options);
+  RowParallelLinearImpl row(out_features,
+                            in_features,
+                            /*bias=*/true,
+                            /*input_is_parallelized=*/true,
+                            parallel_args,
+                            options);
+  std::unordered_map<std::string, torch::Tensor> column_dict_data;
+  column_dict_data["weight"] = torch::randn({out_features, in_features});
+  column_dict_data["bias"] = torch::randn({out_features});
+  column.load_state_dict(StateDict(column_dict_data, 0, 1));
+  std::unordered_map<std::string, torch::Tensor> row_dict_data;
+  row_dict_data["weight"] = torch::randn({in_features, out_features});
+  row_dict_data["bias"] = torch::randn({in_features});
+  row.load_state_dict(StateDict(row_dict_data, 0, 1));
+
+  // outputs are drawn from the workspace of the context
+  Workspace workspace(/*size_in_bytes=*/1024 * 1024, device);
+  ForwardContext context;
+  context.workspace = &workspace;
+  const auto input = torch::randn({num_tokens, in_features}, options);
+  const auto hidden = column.forward(input, context);
+  EXPECT_TRUE(torch::allclose(hidden, column.forward(input)));
+  const auto output = row.forward(hidden, context);
+  EXPECT_TRUE(torch::allclose(output, row.forward(hidden)));
+  EXPECT_EQ(workspace.stats().num_allocations, 2);
+
+  // fall back to the default allocator without a workspace
+  const auto default_output = column.forward(input, ForwardContext());
+  EXPECT_TRUE(torch::allclose(default_output, hidden));
+  EXPECT_EQ(workspace.stats().num_allocations, 2);
+}
+
 }  // namespace llm
@@ -5,6 +5,7 @@
 
 #include "model_loader/state_dict.h"
 #include "model_parallel/parallel_args.h"
+#include "models/parameters.h"
 #include "quantization/quant_args.h"
 
 namespace llm {
@@ -18,6 +19,13 @@ class ParallelLinearImpl : public torch::nn::Module {
 
   virtual torch::Tensor forward(torch::Tensor input) const = 0;
 
+  // forward with the output drawn from the context if supported, e.g. from
+  // its workspace
+  virtual torch::Tensor forward(torch::Tensor input,
+                                const ForwardContext& /*context*/) const {
+    return forward(input);
+  }
+
   virtual void load_state_dict(const StateDict& state_dict) = 0;
 
   virtual void verify_loaded_weights(const std::string& prefix = "") const = 0;
@@ -100,6 +100,20 @@ torch::Tensor ColumnParallelLinearImpl::forward(torch::Tensor input) const {
   return output;
 }
 
+torch::Tensor ColumnParallelLinearImpl::forward(
+    torch::Tensor input,
+    const ForwardContext& context) const {
+  if (context.workspace == nullptr ||
+      (parallel_args_.world_size() > 1 && gather_output_)) {
+    // the gathered output is allocated by the collective
+    return forward(input);
+  }
+  auto sizes = input.sizes().vec();
+  sizes.back() = weight_.size(0);
+  auto output = context.empty(sizes, input.options());
+  return torch::linear_out(output, input, weight_, bias_);
+}
+
 // load the weight from the checkpoint
 void ColumnParallelLinearImpl::load_state_dict(const StateDict& state_dict) {
   // call load_state_dict with identity transform
@@ -232,6 +246,19 @@ torch::Tensor RowParallelLinearImpl::forward(torch::Tensor input) const {
   return output;
 }
 
+torch::Tensor RowParallelLinearImpl::forward(
+    torch::Tensor input,
+    const ForwardContext& context) const {
+  if (context.workspace == nullptr || parallel_args_.world_size() > 1) {
+    // keep tensors passed to collectives on the default allocator
+    return forward(input);
+  }
+  auto sizes = input.sizes().vec();
+  sizes.back() = weight_.size(0);
+  auto output = context.empty(sizes, input.options());
+  return torch::linear_out(output, input, weight_, bias_);
+}
+
 // load the weight from the checkpoint
 void RowParallelLinearImpl::load_state_dict(const StateDict& state_dict) {
   const auto weight =
@@ -32,8 +32,13 @@ class ColumnParallelLinearImpl : public ParallelLinearImpl {
                            const ParallelArgs& parallel_args,
                            const torch::TensorOptions& options);
 
+  using ParallelLinearImpl::forward;
+
   torch::Tensor forward(torch::Tensor input) const override;
 
+  torch::Tensor forward(torch::Tensor input,
+                        const ForwardContext& context) const override;
+
   // load the weight from the checkpoint
   void load_state_dict(const StateDict& state_dict) override;
 
@@ -98,8 +103,13 @@ class RowParallelLinearImpl : public ParallelLinearImpl {
                         const ParallelArgs& parallel_args,
                         const torch::TensorOptions& options);
 
+  using ParallelLinearImpl::forward;
+
   torch::Tensor forward(torch::Tensor input) const override;
 
+  torch::Tensor forward(torch::Tensor input,
+                        const ForwardContext& context) const override;
+
   // load the weight from the checkpoint
   void load_state_dict(const StateDict& state_dict) override;
 
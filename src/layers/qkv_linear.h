@@ -28,6 +28,11 @@ class QKVColumnParallelLinearImpl : public torch::nn::Module {
     return parallel_linear_->forward(input);
   }
 
+  torch::Tensor forward(torch::Tensor input,
+                        const ForwardContext& context) const {
+    return parallel_linear_->forward(input, context);
+  }
+
   // special load_state_dict for fused cases
   void load_state_dict(const StateDict& state_dict,
                        const std::vector<std::string_view>& prefixes,
@@ -36,18 +36,45 @@ bool BlockManager::allocate_blocks_for(Sequence* sequence, size_t num_tokens) {
   // round up to the nearest block number
   const size_t block_size = options_.block_size();
   const size_t num_blocks_needed = (num_tokens + block_size - 1) / block_size;
-  if (num_blocks_needed <= num_blocks) {
-    return true;
+  if (num_blocks_needed > num_blocks) {
+    const uint32_t num_additional_blocks = num_blocks_needed - num_blocks;
+    if (!has_enough_blocks(num_additional_blocks)) {
+      // not enough blocks
+      return false;
+    }
+
+    const auto block_ids = block_allocator_.allocate(num_additional_blocks);
+    sequence->append_blocks(block_ids);
   }
 
-  const uint32_t num_additional_blocks = num_blocks_needed - num_blocks;
-  if (!has_enough_blocks(num_additional_blocks)) {
-    // not enough blocks
-    return false;
+  // blocks shared with forked sequences can't be written in place
+  return copy_on_write_blocks_for(sequence, num_tokens);
+}
+
+bool BlockManager::copy_on_write_blocks_for(Sequence* sequence,
+                                            size_t num_tokens) {
+  const size_t num_kv_cache_tokens = sequence->num_kv_cache_tokens();
+  if (num_tokens <= num_kv_cache_tokens) {
+    return true;
   }
 
-  const auto block_ids = block_allocator_.allocate(num_additional_blocks);
-  sequence->append_blocks(block_ids);
+  const size_t block_size = options_.block_size();
+  const size_t start_block_idx = num_kv_cache_tokens / block_size;
+  const size_t end_block_idx = (num_tokens + block_size - 1) / block_size;
+  const auto blocks = sequence->blocks();
+  CHECK_LE(end_block_idx, blocks.size());
+  for (size_t i = start_block_idx; i < end_block_idx; ++i) {
+    if (!blocks[i].is_shared()) {
+      continue;
+    }
+    if (!has_enough_blocks(1)) {
+      return false;
+    }
+    // the block may become private after evicting from the prefix cache
+    if (blocks[i].is_shared()) {
+      sequence->copy_on_write_block(i, block_allocator_.allocate());
+    }
+  }
   return true;
 }
 
@@ -46,11 +46,18 @@ class BlockManager final {
   // get the options for the block manager
   const Options& options() const { return options_; }
 
+  // get the number of free blocks, excluding blocks held by the prefix cache
+  size_t num_free_blocks() const { return block_allocator_.free_block_count(); }
+
  private:
   // check if block allocator has enough slots, if not, try to evict some blocks
   // from the prefix cache
   bool has_enough_blocks(uint32_t num_blocks);
 
+  // replace shared blocks to be written for tokens in [num_kv_cache_tokens,
+  // num_tokens) with new blocks, the kv cache would be copied before writing.
+  bool copy_on_write_blocks_for(Sequence* sequence, size_t num_tokens);
+
   // the options for the block manager
   Options options_;
 
@@ -12,4 +12,50 @@ TEST(BlockManagerTest, Basic) {
   // TODO: add more tests
 }
 
-}  // namespace llm
\ No newline at end of file
+TEST(BlockManagerTest, CopyOnWrite) {
+  BlockManager::Options options;
+  options.num_blocks(10).block_size(4).enable_prefix_cache(false);
+  BlockManager manager(options);
+
+  Sequence::Options seq_options;
+  seq_options.stopping_criteria.max_tokens = 10;
+  const std::vector<int32_t> prompt_tokens = {1, 2, 3, 4, 5, 6};
+  Sequence parent(/*prompt=*/"", prompt_tokens, /*capacity=*/20, seq_options);
+
+  // prefill the parent sequence
+  EXPECT_TRUE(manager.allocate_blocks_for(&parent));
+  EXPECT_EQ(parent.num_blocks(), 2);
+  parent.commit_kv_cache(prompt_tokens.size());
+  parent.append_token(7);
+
+  // fork a child sequence sharing all blocks, including the partial tail
+  Sequence child(parent, /*prompt=*/"", seq_options);
+  EXPECT_EQ(child.token_ids(), prompt_tokens);
+  EXPECT_EQ(child.num_kv_cache_tokens(), prompt_tokens.size() - 1);
+  ASSERT_EQ(child.num_blocks(), 2);
+  EXPECT_EQ(child.blocks()[0], parent.blocks()[0]);
+  EXPECT_EQ(child.blocks()[1], parent.blocks()[1]);
+  EXPECT_EQ(parent.blocks()[1].ref_count(), 2);
+
+  // the child writes into the shared tail block, copy on write
+  EXPECT_TRUE(manager.allocate_blocks_for(&child));
+  EXPECT_EQ(child.blocks()[0], parent.blocks()[0]);
+  EXPECT_NE(child.blocks()[1].id(), parent.blocks()[1].id());
+  EXPECT_FALSE(child.blocks()[1].is_shared());
+
+  auto block_copies = child.take_block_copies();
+  ASSERT_EQ(block_copies.size(), 1);
+  EXPECT_EQ(block_copies[0].first, parent.blocks()[1]);
+  EXPECT_EQ(block_copies[0].second, child.blocks()[1].id());
+  EXPECT_TRUE(child.take_block_copies().empty());
+
+  // the tail block is private to the parent once the copy is done
+  block_copies.clear();
+  EXPECT_FALSE(parent.blocks()[1].is_shared());
+  EXPECT_TRUE(manager.allocate_blocks_for(&parent));
+  EXPECT_TRUE(parent.take_block_copies().empty());
+  // the full block is still shared between parent and child
+  EXPECT_EQ(parent.blocks()[0].ref_count(), 2);
+}
+
+}  // namespace llm
@@ -0,0 +1,194 @@
+#include "cpu_memory_pool.h"
+
+#include <c10/core/Allocator.h>
+#include <c10/core/CPUAllocator.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace llm {
+namespace {
+
+// smallest size of blocks
+constexpr size_t kMinBlockSize = 512;
+
+// header in front of each block, keeping the data aligned
+constexpr size_t kHeaderSize = 64;
+
+// round up to a size class, multiples of 1/8 of the largest power of two not
+// greater than the size, to waste at most 1/8 of the memory
+size_t size_class(size_t nbytes) {
+  if (nbytes <= kMinBlockSize) {
+    return kMinBlockSize;
+  }
+  size_t power_of_two = kMinBlockSize;
+  while (power_of_two <= nbytes / 2) {
+    power_of_two *= 2;
+  }
+  const size_t step = power_of_two / 8;
+  return (nbytes + step - 1) / step * step;
+}
+
+// the cpu allocator before the pool allocator is installed, where blocks
+// come from
+c10::Allocator* system_allocator = nullptr;
+
+}  // namespace
+
+class CpuMemoryPool::State final
+    : public std::enable_shared_from_this<CpuMemoryPool::State> {
+ public:
+  explicit State(int64_t max_cached_bytes)
+      : max_cached_bytes_(max_cached_bytes) {}
+
+  ~State() {
+    for (auto& [size, blocks] : free_blocks_) {
+      for (void* block : blocks) {
+        system_allocator->raw_deallocate(block);
+      }
+    }
+  }
+
+  // get a block of the size class, cached or from the system
+  void* acquire(size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.num_allocations;
+    stats_.allocated_bytes += static_cast<int64_t>(size);
+    stats_.peak_allocated_bytes =
+        std::max(stats_.peak_allocated_bytes, stats_.allocated_bytes);
+    auto it = free_blocks_.find(size);
+    if (it != free_blocks_.end() && !it->second.empty()) {
+      void* block = it->second.back();
+      it->second.pop_back();
+      ++stats_.num_cache_hits;
+      stats_.cached_bytes -= static_cast<int64_t>(size);
+      return block;
+    }
+    return system_allocator->raw_allocate(size);
+  }
+
+  // cache the block for reuse, or return it to the system if the cache is
+  // full
+  void release(void* block, size_t size) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stats_.allocated_bytes -= static_cast<int64_t>(size);
+      if (stats_.cached_bytes + static_cast<int64_t>(size) <=
+          max_cached_bytes_) {
+        free_blocks_[size].push_back(block);
+        stats_.cached_bytes += static_cast<int64_t>(size);
+        return;
+      }
+    }
+    system_allocator->raw_deallocate(block);
+  }
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+ private:
+  const int64_t max_cached_bytes_;
+
+  mutable std::mutex mutex_;
+
+  // cached blocks by size class
+  std::unordered_map<size_t, std::vector<void*>> free_blocks_;
+
+  Stats stats_;
+};
+
+namespace {
+
+// the pool serving allocations of the current thread
+thread_local CpuMemoryPool::State* current_state = nullptr;
+
+struct BlockHeader {
+  // the pool of the block, nullptr if the block is from the system
+  std::shared_ptr<CpuMemoryPool::State> state;
+  // size of the block including the header
+  size_t size = 0;
+};
+static_assert(sizeof(BlockHeader) <= kHeaderSize);
+
+void release_block(void* data) {
+  auto* block = static_cast<char*>(data) - kHeaderSize;
+  auto* header = reinterpret_cast<BlockHeader*>(block);
+  // the pool may be destroyed after releasing the block
+  const std::shared_ptr<CpuMemoryPool::State> state = std::move(header->state);
+  const size_t size = header->size;
+  header->~BlockHeader();
+  if (state == nullptr) {
+    system_allocator->raw_deallocate(block);
+    return;
+  }
+  state->release(block, size);
+}
+
+// the cpu allocator installed with the first guard. it serves allocations
+// of threads with a guard from their pools, and others from the system
+// allocator. all data, raw allocations included, has a header in front
+// recording the pool, so blocks can be released from any thread with the
+// same deleter.
+class PoolAllocator final : public c10::Allocator {
+ public:
+  c10::DataPtr allocate(size_t nbytes) const override {
+    CpuMemoryPool::State* state = current_state;
+    void* block = nullptr;
+    size_t size = nbytes + kHeaderSize;
+    if (state != nullptr) {
+      size = size_class(size);
+      block = state->acquire(size);
+      new (block) BlockHeader{state->shared_from_this(), size};
+    } else {
+      block = system_allocator->raw_allocate(size);
+      new (block) BlockHeader{nullptr, size};
+    }
+    void* data = static_cast<char*>(block) + kHeaderSize;
+    return {data, data, &release_block, c10::Device(c10::DeviceType::CPU)};
+  }
+
+  c10::DeleterFnPtr raw_deleter() const override { return &release_block; }
+};
+
+PoolAllocator pool_allocator;
+
+// the cpu allocator is installed once and never swapped back, since other
+// threads read it without synchronization. allocations are routed by the
+// pool of the current thread instead.
+void install_pool_allocator() {
+  static std::once_flag install_flag;
+  std::call_once(install_flag, []() {
+    system_allocator = c10::GetCPUAllocator();
+    c10::SetCPUAllocator(&pool_allocator, /*priority=*/1);
+    LOG_IF(WARNING, c10::GetCPUAllocator() != &pool_allocator)
+        << "Failed to install the cpu memory pool allocator";
+  });
+}
+
+}  // namespace
+
+CpuMemoryPool::CpuMemoryPool(int64_t max_cached_bytes)
+    : state_(std::make_shared<State>(max_cached_bytes)) {}
+
+CpuMemoryPool::~CpuMemoryPool() = default;
+
+CpuMemoryPool::Stats CpuMemoryPool::stats() const { return state_->stats(); }
+
+CpuMemoryPool::Guard::Guard(CpuMemoryPool* pool) : prev_state_(current_state) {
+  CHECK(pool != nullptr);
+  install_pool_allocator();
+  current_state = pool->state_.get();
+}
+
+CpuMemoryPool::Guard::~Guard() { current_state = prev_state_; }
+
+}  // namespace llm
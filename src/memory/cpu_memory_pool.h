@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+namespace llm {
+
+// A pool of cpu memory that caches freed blocks by size class, to reuse the
+// memory of intermediate tensors across forward passes with the same shapes
+// instead of allocating it from the system each time.
+// it serves cpu allocations of a thread while a guard of the pool is alive in
+// the thread, and other allocations go to the default cpu allocator. the
+// process-wide cpu allocator is replaced once with the first guard.
+class CpuMemoryPool final {
+ public:
+  // states of the pool, shared with blocks in use
+  class State;
+
+  struct Stats {
+    // number of allocations served by the pool
+    int64_t num_allocations = 0;
+
+    // number of allocations served with cached blocks
+    int64_t num_cache_hits = 0;
+
+    // bytes of blocks in use
+    int64_t allocated_bytes = 0;
+
+    // peak bytes of blocks in use
+    int64_t peak_allocated_bytes = 0;
+
+    // bytes of cached blocks
+    int64_t cached_bytes = 0;
+  };
+
+  // freed blocks beyond max_cached_bytes are returned to the system
+  explicit CpuMemoryPool(int64_t max_cached_bytes);
+
+  // cached blocks are freed, and blocks in use are freed once released
+  ~CpuMemoryPool();
+
+  // not copyable
+  CpuMemoryPool(const CpuMemoryPool&) = delete;
+  CpuMemoryPool& operator=(const CpuMemoryPool&) = delete;
+
+  Stats stats() const;
+
+  // serve cpu allocations of the current thread from the pool in the scope
+  class Guard final {
+   public:
+    explicit Guard(CpuMemoryPool* pool);
+    ~Guard();
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+   private:
+    // the pool of the outer scope
+    State* prev_state_ = nullptr;
+  };
+
+ private:
+  // shared with blocks in use, which may outlive the pool
+  std::shared_ptr<State> state_;
+};
+
+}  // namespace llm
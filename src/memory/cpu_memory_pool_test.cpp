@@ -0,0 +1,89 @@
+#include "cpu_memory_pool.h"
+
+#include <c10/core/CPUAllocator.h>
+#include <gtest/gtest.h>
+#include <torch/torch.h>
+
+namespace llm {
+
+TEST(CpuMemoryPoolTest, ReuseBlocks) {
+  CpuMemoryPool pool(/*max_cached_bytes=*/1024 * 1024);
+  void* data = nullptr;
+  {
+    CpuMemoryPool::Guard guard(&pool);
+    data = torch::empty({1000}, torch::kFloat).data_ptr();
+  }
+  // freed blocks are cached
+  auto stats = pool.stats();
+  EXPECT_EQ(stats.num_allocations, 1);
+  EXPECT_EQ(stats.num_cache_hits, 0);
+  EXPECT_EQ(stats.allocated_bytes, 0);
+  EXPECT_GE(stats.cached_bytes, 4000);
+  EXPECT_EQ(stats.peak_allocated_bytes, stats.cached_bytes);
+
+  {
+    CpuMemoryPool::Guard guard(&pool);
+    // reuse the cached block of the same size class
+    auto tensor = torch::empty({990}, torch::kFloat);
+    EXPECT_EQ(tensor.data_ptr(), data);
+    // a new block while the cached one is in use
+    auto other = torch::empty({1000}, torch::kFloat);
+    EXPECT_NE(other.data_ptr(), data);
+  }
+  stats = pool.stats();
+  EXPECT_EQ(stats.num_allocations, 3);
+  EXPECT_EQ(stats.num_cache_hits, 1);
+  EXPECT_EQ(stats.allocated_bytes, 0);
+
+  // allocations outside of guards are not served by the pool
+  auto tensor = torch::empty({1000}, torch::kFloat);
+  EXPECT_EQ(pool.stats().num_allocations, 3);
+}
+
+TEST(CpuMemoryPoolTest, RawAllocations) {
+  CpuMemoryPool pool(/*max_cached_bytes=*/1024 * 1024);
+  c10::Allocator* allocator = nullptr;
+  void* data = nullptr;
+  {
+    CpuMemoryPool::Guard guard(&pool);
+    allocator = c10::GetCPUAllocator();
+    // raw allocations in guards are served by the pool
+    data = allocator->raw_allocate(1000);
+    EXPECT_EQ(pool.stats().num_allocations, 1);
+  }
+  // and released with the deleter of the allocator, from any thread
+  allocator->raw_deallocate(data);
+  EXPECT_EQ(pool.stats().allocated_bytes, 0);
+
+  // the allocator stays installed, serving others from the system
+  EXPECT_EQ(c10::GetCPUAllocator(), allocator);
+  data = allocator->raw_allocate(1000);
+  allocator->raw_deallocate(data);
+  EXPECT_EQ(pool.stats().num_allocations, 1);
+}
+
+TEST(CpuMemoryPoolTest, MaxCachedBytes) {
+  CpuMemoryPool pool(/*max_cached_bytes=*/0);
+  {
+    CpuMemoryPool::Guard guard(&pool);
+    auto tensor = torch::empty({1000}, torch::kFloat);
+    EXPECT_GT(pool.stats().allocated_bytes, 0);
+  }
+  const auto stats = pool.stats();
+  EXPECT_EQ(stats.allocated_bytes, 0);
+  EXPECT_EQ(stats.cached_bytes, 0);
+}
+
+TEST(CpuMemoryPoolTest, OutlivePool) {
+  torch::Tensor tensor;
+  {
+    CpuMemoryPool pool(/*max_cached_bytes=*/1024 * 1024);
+    CpuMemoryPool::Guard guard(&pool);
+    tensor = torch::ones({16}, torch::kFloat);
+  }
+  // blocks in use are released after the pool is destroyed
+  EXPECT_EQ(tensor.sum().item<float>(), 16);
+  tensor.reset();
+}
+
+}  // namespace llm
@@ -36,6 +36,17 @@ void KVCache::set_kv_cache(const torch::Tensor& slot_ids,
   return set_kv_cache_slow(slot_ids, keys, values);
 }
 
+void KVCache::copy_blocks(const torch::Tensor& src_block_ids,
+                          const torch::Tensor& dst_block_ids) {
+  DCHECK_EQ(src_block_ids.numel(), dst_block_ids.numel());
+  const auto src = src_block_ids.to(torch::kLong);
+  const auto dst = dst_block_ids.to(torch::kLong);
+  // key_cache_[dst] = key_cache_[src]
+  key_cache_.index_copy_(/*dim=*/0, dst, key_cache_.index_select(0, src));
+  // value_cache_[dst] = value_cache_[src]
+  value_cache_.index_copy_(/*dim=*/0, dst, value_cache_.index_select(0, src));
+}
+
 void KVCache::set_kv_cache_slow(const torch::Tensor& slot_ids,
                                 const torch::Tensor& keys,
                                 const torch::Tensor& values) {
@@ -39,6 +39,11 @@ class KVCache final {
       const torch::Tensor& block_table,
       int64_t context_len) const;
 
+  // copy key and value cache from src blocks to dst blocks
+  // src_block_ids/dst_block_ids: [num_copies] IntTensor
+  void copy_blocks(const torch::Tensor& src_block_ids,
+                   const torch::Tensor& dst_block_ids);
+
   // put following functions as public for testing/benchmarking
   void set_kv_cache_slow(const torch::Tensor& slot_ids,
                          const torch::Tensor& keys,
@@ -0,0 +1,116 @@
+#include "workspace.h"
+
+#include <glog/logging.h>
+#include <torch/torch.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+
+namespace llm {
+namespace {
+
+// alignment of tensors in the arena
+constexpr int64_t kAlignment = 256;
+
+int64_t align_up(int64_t size) {
+  return (size + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+}  // namespace
+
+Workspace::Workspace(int64_t size_in_bytes, const torch::Device& device)
+    : size_in_bytes_(align_up(size_in_bytes)) {
+  CHECK_GT(size_in_bytes_, 0);
+  buffer_ = torch::empty({size_in_bytes_},
+                         torch::dtype(torch::kUInt8).device(device));
+  base_ = static_cast<char*>(buffer_.data_ptr());
+  free_blocks_.emplace(0, size_in_bytes_);
+}
+
+torch::Tensor Workspace::empty(at::IntArrayRef sizes, torch::ScalarType dtype) {
+  const auto options = torch::dtype(dtype).device(buffer_.device());
+  int64_t numel = 1;
+  for (const int64_t size : sizes) {
+    numel *= size;
+  }
+  const int64_t nbytes =
+      align_up(numel * static_cast<int64_t>(c10::elementSize(dtype)));
+  if (nbytes == 0) {
+    return torch::empty(sizes, options);
+  }
+
+  int64_t offset = -1;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // first fit, with few free blocks as tensors are released in order
+    for (auto it = free_blocks_.begin(); it != free_blocks_.end(); ++it) {
+      const auto [block_offset, block_size] = *it;
+      if (block_size < nbytes) {
+        continue;
+      }
+      offset = block_offset;
+      free_blocks_.erase(it);
+      if (block_size > nbytes) {
+        free_blocks_.emplace(block_offset + nbytes, block_size - nbytes);
+      }
+      break;
+    }
+    if (offset < 0) {
+      ++stats_.num_fallbacks;
+      return torch::empty(sizes, options);
+    }
+    ++stats_.num_allocations;
+    stats_.allocated_bytes += nbytes;
+    stats_.peak_allocated_bytes =
+        std::max(stats_.peak_allocated_bytes, stats_.allocated_bytes);
+  }
+
+  return torch::from_blob(
+      base_ + offset,
+      sizes,
+      [this, offset, nbytes](void* /*data*/) { free(offset, nbytes); },
+      options);
+}
+
+torch::Tensor Workspace::empty_like(Workspace* workspace,
+                                    const torch::Tensor& tensor) {
+  if (workspace == nullptr) {
+    return torch::empty(tensor.sizes(), tensor.options());
+  }
+  return workspace->empty(tensor.sizes(), tensor.scalar_type());
+}
+
+void Workspace::free(int64_t offset, int64_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.allocated_bytes -= size;
+
+  // merge with adjacent free blocks
+  auto next = free_blocks_.lower_bound(offset);
+  if (next != free_blocks_.end() && offset + size == next->first) {
+    size += next->second;
+    next = free_blocks_.erase(next);
+  }
+  if (next != free_blocks_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      prev->second += size;
+      return;
+    }
+  }
+  free_blocks_.emplace_hint(next, offset, size);
+}
+
+Workspace::Stats Workspace::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void Workspace::reset_stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.num_allocations = 0;
+  stats_.num_fallbacks = 0;
+  stats_.peak_allocated_bytes = stats_.allocated_bytes;
+}
+
+}  // namespace llm
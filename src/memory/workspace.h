@@ -0,0 +1,73 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace llm {
+
+// A workspace arena preallocated on the device for intermediate tensors of
+// forward passes, e.g. attention outputs and residuals, to avoid allocator
+// churn on every step. the memory of a tensor returns to the arena once the
+// tensor is released, and tensors fall back to the default allocator when the
+// arena is full. the workspace should outlive tensors allocated from it.
+class Workspace final {
+ public:
+  struct Stats {
+    // number of tensors allocated from the arena
+    int64_t num_allocations = 0;
+
+    // number of tensors allocated by the default allocator when the arena is
+    // full
+    int64_t num_fallbacks = 0;
+
+    // bytes in use of the arena
+    int64_t allocated_bytes = 0;
+
+    // peak bytes in use of the arena
+    int64_t peak_allocated_bytes = 0;
+  };
+
+  Workspace(int64_t size_in_bytes, const torch::Device& device);
+
+  // not copyable
+  Workspace(const Workspace&) = delete;
+  Workspace& operator=(const Workspace&) = delete;
+
+  // allocate an uninitialized contiguous tensor from the arena
+  torch::Tensor empty(at::IntArrayRef sizes, torch::ScalarType dtype);
+
+  // allocate an uninitialized contiguous tensor with the same shape and dtype
+  // as the given tensor, from the workspace if given
+  static torch::Tensor empty_like(Workspace* workspace,
+                                  const torch::Tensor& tensor);
+
+  int64_t size_in_bytes() const { return size_in_bytes_; }
+
+  // get stats since the last reset
+  Stats stats() const;
+
+  // reset counters and peak bytes, e.g. for each step
+  void reset_stats();
+
+ private:
+  // return the memory [offset, offset + size) to the arena
+  void free(int64_t offset, int64_t size);
+
+  const int64_t size_in_bytes_;
+
+  // the arena
+  torch::Tensor buffer_;
+  char* base_ = nullptr;
+
+  mutable std::mutex mutex_;
+
+  // free memory of the arena, from offset to size
+  std::map<int64_t, int64_t> free_blocks_;
+
+  Stats stats_;
+};
+
+}  // namespace llm
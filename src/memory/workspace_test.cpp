@@ -0,0 +1,65 @@
+#include "workspace.h"
+
+#include <gtest/gtest.h>
+#include <torch/torch.h>
+
+namespace llm {
+
+TEST(WorkspaceTest, ReuseReleasedMemory) {
+  Workspace workspace(/*size_in_bytes=*/4096, torch::kCPU);
+  EXPECT_EQ(workspace.size_in_bytes(), 4096);
+
+  auto a = workspace.empty({16, 8}, torch::kFloat);
+  auto b = workspace.empty({100}, torch::kFloat);
+  EXPECT_EQ(a.sizes(), torch::IntArrayRef({16, 8}));
+  EXPECT_TRUE(a.is_contiguous());
+  // aligned to 256 bytes
+  const auto* a_data = static_cast<char*>(a.data_ptr());
+  EXPECT_EQ(static_cast<char*>(b.data_ptr()) - a_data, 512);
+
+  auto stats = workspace.stats();
+  EXPECT_EQ(stats.num_allocations, 2);
+  EXPECT_EQ(stats.allocated_bytes, 1024);
+
+  // released memory is reused
+  void* data = a.data_ptr();
+  a.reset();
+  EXPECT_EQ(workspace.stats().allocated_bytes, 512);
+  auto c = workspace.empty({128}, torch::kFloat);
+  EXPECT_EQ(c.data_ptr(), data);
+
+  // falls back to the default allocator when full
+  auto d = workspace.empty({1024}, torch::kFloat);
+  stats = workspace.stats();
+  EXPECT_EQ(stats.num_allocations, 3);
+  EXPECT_EQ(stats.num_fallbacks, 1);
+  EXPECT_EQ(stats.peak_allocated_bytes, 1024);
+
+  // adjacent free memory is merged
+  b.reset();
+  c.reset();
+  auto e = workspace.empty({1024}, torch::kFloat);
+  EXPECT_EQ(e.data_ptr(), data);
+  EXPECT_EQ(workspace.stats().num_fallbacks, 1);
+
+  workspace.reset_stats();
+  stats = workspace.stats();
+  EXPECT_EQ(stats.num_allocations, 0);
+  EXPECT_EQ(stats.num_fallbacks, 0);
+  EXPECT_EQ(stats.peak_allocated_bytes, 4096);
+}
+
+TEST(WorkspaceTest, EmptyLike) {
+  const auto tensor = torch::randn({4, 8});
+  // the default allocator without workspace
+  auto output = Workspace::empty_like(nullptr, tensor);
+  EXPECT_EQ(output.sizes(), tensor.sizes());
+  EXPECT_EQ(output.scalar_type(), tensor.scalar_type());
+
+  Workspace workspace(/*size_in_bytes=*/4096, torch::kCPU);
+  output = Workspace::empty_like(&workspace, tensor);
+  EXPECT_EQ(output.sizes(), tensor.sizes());
+  EXPECT_EQ(workspace.stats().num_allocations, 1);
+}
+
+}  // namespace llm
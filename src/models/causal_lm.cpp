@@ -3,16 +3,32 @@
 #include <glog/logging.h>
 #include <torch/torch.h>
 
+#include <string>
+
 #include "model_args.h"
 #include "models/model_registry.h"
 
 namespace llm {
+namespace {
+// whether the model only holds the layers of its pipeline stage
+bool support_pipeline_stages(const std::string& model_type) {
+  return model_type == "simple" || model_type == "llama" ||
+         model_type == "llama3" || model_type == "Yi";
+}
+}  // namespace
 
 std::unique_ptr<CausalLM> CausalLM::create(
     const ModelArgs& args,
     const QuantArgs& quant_args,
     const ParallelArgs& parallel_args,
     const torch::TensorOptions& options) {
+  if (args.n_pipeline_stages() > 1 &&
+      !support_pipeline_stages(args.model_type())) {
+    LOG(ERROR) << "Pipeline stages are not supported for model type: "
+               << args.model_type();
+    return nullptr;
+  }
+
   // get the factory function for the model type from model registry
   auto factory = ModelRegistry::get_causallm_factory(args.model_type());
   if (factory) {
@@ -21,11 +21,21 @@ class CausalLM : public torch::nn::Module {
 
   // tokens: [num_tokens]
   // positions: [num_tokens] token pos in the sequence
+  // context: allocations of intermediate tensors, e.g. from a workspace
   // returns: [num_tokens, hidden_size]
   virtual torch::Tensor forward(const torch::Tensor& tokens,
                                 const torch::Tensor& positions,
                                 std::vector<KVCache>& kv_caches,
-                                const InputParameters& parameters) = 0;
+                                const InputParameters& parameters,
+                                const ForwardContext& context) = 0;
+
+  // forward with intermediate tensors from the default allocator
+  torch::Tensor forward(const torch::Tensor& tokens,
+                        const torch::Tensor& positions,
+                        std::vector<KVCache>& kv_caches,
+                        const InputParameters& parameters) {
+    return forward(tokens, positions, kv_caches, parameters, ForwardContext());
+  }
 
   // hidden_states: [num_tokens, hidden_size]
   // seleted_idxes: [num_tokens]
@@ -57,11 +67,14 @@ class CausalLMImpl : public CausalLM {
   CausalLMImpl(Model model, const torch::TensorOptions& options)
       : model_(std::move(model)), options_(options) {}
 
+  using CausalLM::forward;
+
   torch::Tensor forward(const torch::Tensor& tokens,     // [num_tokens]
                         const torch::Tensor& positions,  // [num_tokens]
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& parameters) override {
-    return model_->forward(tokens, positions, kv_caches, parameters);
+                        const InputParameters& parameters,
+                        const ForwardContext& context) override {
+    return model_->forward(tokens, positions, kv_caches, parameters, context);
   }
 
   torch::Tensor logits(const torch::Tensor& hidden_states,
@@ -61,8 +61,8 @@ class BaichuanMLPImpl : public torch::nn::Module {
                                           options));
   }
 
-  torch::Tensor forward(torch::Tensor x) {
-    return down_proj_(act_with_mul_(gate_up_proj_(x)));
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    return down_proj_(act_with_mul_(gate_up_proj_(x, context)));
   }
 
   // load the weight from the checkpoint
@@ -134,15 +134,17 @@ class BaichuanAttentionImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // (num_tokens, dim) x (dim, n_local_heads * head_dim)
     // => (num_tokens, n_local_heads * head_dim)
-    auto qkv = W_pack_(x).split(/*split_size=*/qkv_sizes_, /*dim=*/-1);
+    auto qkv = W_pack_(x, context).split(/*split_size=*/qkv_sizes_, /*dim=*/-1);
     DCHECK_EQ(qkv.size(), 3);
 
     torch::Tensor output;
     // calculate attention, output: (num_tokens, n_local_heads * head_dim)
-    output = atten_(qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params);
+    output = atten_(
+        qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params, context);
     return o_proj_(output);
   }
 
@@ -202,13 +204,14 @@ class BaichuanDecoderLayerImpl : public torch::nn::Module {
                         torch::Tensor positions,
                         torch::Tensor& residual,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     auto hidden_states = input_layernorm_(x, residual);
 
     hidden_states =
-        self_attn_(hidden_states, positions, kv_cache, input_params);
+        self_attn_(hidden_states, positions, kv_cache, input_params, context);
     hidden_states = post_attention_layernorm_(hidden_states, residual);
-    hidden_states = mlp_(hidden_states);
+    hidden_states = mlp_(hidden_states, context);
     return hidden_states;
   }
 
@@ -288,14 +291,15 @@ class BaichuanModelImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor tokens,
                         torch::Tensor positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     auto h = embed_tokens_(tokens);
     torch::Tensor residual;
 
     // TODO: set working space for attention handler
     for (size_t i = 0; i < layers_.size(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, positions, residual, kv_caches[i], input_params);
+      h = layer(h, positions, residual, kv_caches[i], input_params, context);
     }
     return norm_(h, residual);
   }
@@ -412,8 +416,9 @@ class BaichuanForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return model_(tokens, positions, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return model_(tokens, positions, kv_caches, input_params, context);
   }
 
   // hidden_states: [num_tokens, hidden_size]
@@ -51,8 +51,8 @@ class BloomMLPImpl : public torch::nn::Module {
                                           options));
   }
 
-  torch::Tensor forward(torch::Tensor x) {
-    return dense_4h_to_h_(act_(dense_h_to_4h_(x)));
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    return dense_4h_to_h_(act_(dense_h_to_4h_(x, context)));
   }
 
   // load the weight from the checkpoint
@@ -116,8 +116,9 @@ class BloomAttentionImpl : public torch::nn::Module {
 
   torch::Tensor forward(torch::Tensor x,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
-    auto qkv = query_key_value_(x).chunk(/*chunks=*/3, /*dim=*/-1);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    auto qkv = query_key_value_(x, context).chunk(/*chunks=*/3, /*dim=*/-1);
     DCHECK_EQ(qkv.size(), 3);
     // calculate attention, output: (num_tokens, n_local_heads * head_dim)
     auto output = atten_(qkv[0],
@@ -125,7 +126,8 @@ class BloomAttentionImpl : public torch::nn::Module {
                          qkv[2],
                          /*positions=*/torch::Tensor{},
                          kv_cache,
-                         input_params);
+                         input_params,
+                         context);
     return dense_(output);
   }
 
@@ -198,16 +200,18 @@ class BloomBlockImpl : public torch::nn::Module {
 
   torch::Tensor forward(torch::Tensor x,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     auto ln_output = input_layernorm_(x);
     auto residual = residual_post_layernorm_ ? ln_output : x;
 
-    auto attn_output = self_attention_(ln_output, kv_cache, input_params);
+    auto attn_output =
+        self_attention_(ln_output, kv_cache, input_params, context);
     attn_output += residual;
 
     ln_output = post_attention_layernorm_(attn_output);
     residual = residual_post_layernorm_ ? ln_output : attn_output;
-    return mlp_(ln_output) + residual;
+    return mlp_(ln_output, context) + residual;
   }
 
   // load the weight from the checkpoint
@@ -283,14 +287,15 @@ class BloomModelImpl : public torch::nn::Module {
   // tokens: [num_tokens]
   torch::Tensor forward(torch::Tensor tokens,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     auto h = word_embeddings_(tokens);
     h = word_embeddings_layernorm_(h);
 
     // TODO: set working space for attention handler
     for (size_t i = 0; i < layers_.size(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, kv_caches[i], input_params);
+      h = layer(h, kv_caches[i], input_params, context);
     }
     return ln_f_(h);
   }
@@ -393,8 +398,9 @@ class BloomForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& /*positions*/,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return model_(tokens, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return model_(tokens, kv_caches, input_params, context);
   }
 
   // hidden_states: [num_tokens, hidden_size]
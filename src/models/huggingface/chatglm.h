@@ -53,8 +53,8 @@ class ChatGLMMLPImpl : public torch::nn::Module {
                                           options));
   }
 
-  torch::Tensor forward(torch::Tensor x) {
-    return dense_4h_to_h_(act_with_mul_(dense_h_to_4h_(x)));
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    return dense_4h_to_h_(act_with_mul_(dense_h_to_4h_(x, context)));
   }
 
   // load the weight from the checkpoint
@@ -127,14 +127,16 @@ class ChatGLMAttentionImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // (num_tokens, dim) x (dim, n_local_heads * head_dim)
     // => (num_tokens, n_local_heads * head_dim)
-    auto qkv = query_key_value_(x).split(/*split_size=*/qkv_sizes_, /*dim=*/-1);
+    auto qkv = query_key_value_(x, context)
+                   .split(/*split_size=*/qkv_sizes_, /*dim=*/-1);
     DCHECK_EQ(qkv.size(), 3);
     // calculate attention, output: (num_tokens, n_local_heads * head_dim)
-    auto output =
-        atten_(qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params);
+    auto output = atten_(
+        qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params, context);
     return dense_(output);
   }
 
@@ -205,7 +207,8 @@ class ChatGLMBlockImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     torch::Tensor ln_output;
     if (use_rms_norm_) {
       ln_output = input_rmsnorm_(x);
@@ -215,7 +218,7 @@ class ChatGLMBlockImpl : public torch::nn::Module {
     auto residual = residual_post_layernorm_ ? ln_output : x;
 
     auto attn_output =
-        self_attention_(ln_output, positions, kv_cache, input_params);
+        self_attention_(ln_output, positions, kv_cache, input_params, context);
     attn_output += residual;
 
     if (use_rms_norm_) {
@@ -224,7 +227,7 @@ class ChatGLMBlockImpl : public torch::nn::Module {
       ln_output = post_attention_layernorm_(attn_output);
     }
     residual = residual_post_layernorm_ ? ln_output : attn_output;
-    return mlp_(ln_output) + residual;
+    return mlp_(ln_output, context) + residual;
   }
 
   // load the weight from the checkpoint
@@ -314,11 +317,12 @@ class ChatGLMModelImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor h,
                         torch::Tensor positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // TODO: set working space for attention handler
     for (size_t i = 0; i < layers_.size(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, positions, kv_caches[i], input_params);
+      h = layer(h, positions, kv_caches[i], input_params, context);
     }
     // apply final layernorm if needed
     if (post_layernorm_) {
@@ -409,8 +413,13 @@ class ChatGLMForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return model_(word_embeddings_(tokens), positions, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return model_(word_embeddings_(tokens),
+                  positions,
+                  kv_caches,
+                  input_params,
+                  context);
   }
 
   // hidden_states: [num_tokens, hidden_size]
@@ -55,8 +55,8 @@ class GemmaMLPImpl : public torch::nn::Module {
                                           options));
   }
 
-  torch::Tensor forward(torch::Tensor x) {
-    return down_proj_(act_with_mul_(gate_up_proj_(x)));
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    return down_proj_(act_with_mul_(gate_up_proj_(x, context)));
   }
 
   // load the weight from the checkpoint
@@ -131,16 +131,18 @@ class GemmaAttentionImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // (num_tokens, dim) x (dim, n_local_heads * head_dim)
     // => (num_tokens, n_local_heads * head_dim)
-    auto qkv = qkv_proj_(x).split(/*split_size=*/qkv_sizes_, /*dim=*/-1);
+    auto qkv =
+        qkv_proj_(x, context).split(/*split_size=*/qkv_sizes_, /*dim=*/-1);
     DCHECK_EQ(qkv.size(), 3);
 
     // calculate attention,
     // output: (num_tokens, n_local_heads*head_dim)
-    auto output =
-        atten_(qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params);
+    auto output = atten_(
+        qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params, context);
     return o_proj_(output);
   }
 
@@ -199,16 +201,17 @@ class GemmaDecoderLayerImpl : public torch::nn::Module {
                         torch::Tensor positions,
                         KVCache& kv_cache,
                         const InputParameters& input_params,
-                        torch::Tensor& residual) {
+                        torch::Tensor& residual,
+                        const ForwardContext& context) {
     auto hidden_states = input_layernorm_(x, residual);
 
     hidden_states =
-        self_attn_(hidden_states, positions, kv_cache, input_params);
+        self_attn_(hidden_states, positions, kv_cache, input_params, context);
 
     // fully connected
     hidden_states = post_attention_layernorm_(hidden_states, residual);
 
-    return mlp_(hidden_states);
+    return mlp_(hidden_states, context);
   }
   // load the weight from the checkpoint
   void load_state_dict(const StateDict& state_dict) {
@@ -288,14 +291,15 @@ class GemmaModelImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor tokens,
                         torch::Tensor positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // embedding tokens
     auto h = embed_tokens_(tokens) * normalizer_;
 
     torch::Tensor residual;
     for (int32_t i = 0; i < modelArgs_.n_layers(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, positions, kv_caches[i], input_params, residual);
+      h = layer(h, positions, kv_caches[i], input_params, residual, context);
     }
 
     return norm_(h, residual);
@@ -373,8 +377,9 @@ class GemmaForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return model_(tokens, positions, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return model_(tokens, positions, kv_caches, input_params, context);
   }
 
   // hidden_states: [num_tokens, hidden_size]
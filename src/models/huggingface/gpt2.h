@@ -49,7 +49,9 @@ class GPT2MLPImpl : public torch::nn::Module {
                                                 options));
   }
 
-  torch::Tensor forward(torch::Tensor x) { return c_proj_(act_(c_fc_(x))); }
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    return c_proj_(act_(c_fc_(x, context)));
+  }
 
   // load the weight from the checkpoint
   void load_state_dict(const StateDict& state_dict) {
@@ -120,10 +122,11 @@ class GPT2AttentionImpl : public torch::nn::Module {
 
   torch::Tensor forward(torch::Tensor x,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // (num_tokens, dim) x (dim, n_heads * head_dim)
     // => (num_tokens, n_heads * head_dim)
-    auto qkv = c_attn_(x).chunk(/*chunks=*/3, /*dim=*/-1);
+    auto qkv = c_attn_(x, context).chunk(/*chunks=*/3, /*dim=*/-1);
     DCHECK_EQ(qkv.size(), 3);
     // calculate attention, output: (num_tokens, n_local_heads * head_dim)
     auto output = atten_(qkv[0],
@@ -131,7 +134,8 @@ class GPT2AttentionImpl : public torch::nn::Module {
                          qkv[2],
                          /*positions=*/torch::Tensor{},
                          kv_cache,
-                         input_params);
+                         input_params,
+                         context);
     return c_proj_(output);
   }
 
@@ -197,11 +201,12 @@ class GPT2BlockImpl : public torch::nn::Module {
 
   torch::Tensor forward(torch::Tensor x,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // x = x + attn(ln1(x))
     // x = x + mlp(ln2(x))
-    auto h = x + attn_(ln_1_(x), kv_cache, input_params);
-    return h + mlp_(ln_2_(h));
+    auto h = x + attn_(ln_1_(x), kv_cache, input_params, context);
+    return h + mlp_(ln_2_(h), context);
   }
 
   // load the weight from the checkpoint
@@ -269,12 +274,13 @@ class GPT2ModelImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor tokens,
                         torch::Tensor positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     auto h = wte_(tokens) + wpe_(positions);
     // TODO: set working space for attention handler
     for (size_t i = 0; i < layers_.size(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, kv_caches[i], input_params);
+      h = layer(h, kv_caches[i], input_params, context);
     }
     return ln_f_(h);
   }
@@ -343,8 +349,9 @@ class GPT2ForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return model_(tokens, positions, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return model_(tokens, positions, kv_caches, input_params, context);
   }
 
   // hidden_states: [num_tokens, hidden_size]
@@ -48,7 +48,9 @@ class GPTJMLPImpl : public torch::nn::Module {
                                                 options));
   }
 
-  torch::Tensor forward(torch::Tensor x) { return fc_out_(act_(fc_in_(x))); }
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    return fc_out_(act_(fc_in_(x, context)));
+  }
 
   // load the weight from the checkpoint
   void load_state_dict(const StateDict& state_dict) {
@@ -110,14 +112,15 @@ class GPTJAttentionImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // (num_tokens, dim) x (dim, n_heads * head_dim)
     // => (num_tokens, n_heads * head_dim)
-    auto qkv = qkv_proj_(x).chunk(/*chunks=*/3, /*dim=*/-1);
+    auto qkv = qkv_proj_(x, context).chunk(/*chunks=*/3, /*dim=*/-1);
     DCHECK_EQ(qkv.size(), 3);
     // calculate attention, output: (num_tokens, n_local_heads * head_dim)
-    auto output =
-        atten_(qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params);
+    auto output = atten_(
+        qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params, context);
     return out_proj_(output);
   }
 
@@ -166,11 +169,13 @@ class GPTJBlockImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // x = x + attn(ln1(x)) + mlp(ln1(x))
     const auto h = ln_1_(x);
-    const auto attn_output = attn_(h, positions, kv_cache, input_params);
-    const auto mlp_output = mlp_(h);
+    const auto attn_output =
+        attn_(h, positions, kv_cache, input_params, context);
+    const auto mlp_output = mlp_(h, context);
     return x + attn_output + mlp_output;
   }
 
@@ -233,13 +238,14 @@ class GPTJModelImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor tokens,
                         torch::Tensor positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     auto h = wte_(tokens);
 
     // TODO: set working space for attention handler
     for (size_t i = 0; i < layers_.size(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, positions, kv_caches[i], input_params);
+      h = layer(h, positions, kv_caches[i], input_params, context);
     }
     return ln_f_(h);
   }
@@ -304,8 +310,9 @@ class GPTJForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return transformer_(tokens, positions, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return transformer_(tokens, positions, kv_caches, input_params, context);
   }
 
   // hidden_states: [num_tokens, hidden_size]
@@ -50,8 +50,8 @@ class GPTNeoXMLPImpl : public torch::nn::Module {
                                           options));
   }
 
-  torch::Tensor forward(torch::Tensor x) {
-    return dense_4h_to_h_(act_(dense_h_to_4h_(x)));
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    return dense_4h_to_h_(act_(dense_h_to_4h_(x, context)));
   }
 
   // load the weight from the checkpoint
@@ -115,14 +115,15 @@ class GPTNeoXAttentionImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // (num_tokens, dim) x (dim, n_heads * head_dim)
     // => (num_tokens, n_heads * head_dim)
-    auto qkv = query_key_value_(x).chunk(/*chunks=*/3, /*dim=*/-1);
+    auto qkv = query_key_value_(x, context).chunk(/*chunks=*/3, /*dim=*/-1);
     DCHECK_EQ(qkv.size(), 3);
     // calculate attention, output: (num_tokens, n_local_heads * head_dim)
-    auto output =
-        atten_(qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params);
+    auto output = atten_(
+        qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params, context);
     return dense_(output);
   }
 
@@ -199,19 +200,20 @@ class GPTNeoXLayerImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
-    auto attn_output =
-        attention_(input_layernorm_(x), positions, kv_cache, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    auto attn_output = attention_(
+        input_layernorm_(x), positions, kv_cache, input_params, context);
 
     if (use_parallel_residual_) {
       // parallel residual: x = x + attn(ln1(x)) + mlp(ln2(x))
-      return x + attn_output + mlp_(post_attention_layernorm_(x));
+      return x + attn_output + mlp_(post_attention_layernorm_(x), context);
     }
 
     // x = x + attn(ln1(x))
     // x = x + mlp(ln2(x))
     auto h = x + attn_output;
-    return h + mlp_(post_attention_layernorm_(h));
+    return h + mlp_(post_attention_layernorm_(h), context);
   }
 
   // load the weight from the checkpoint
@@ -281,13 +283,14 @@ class GPTNeoXModelImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor tokens,
                         torch::Tensor positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     auto h = embed_in_(tokens);
 
     // TODO: set working space for attention handler
     for (size_t i = 0; i < layers_.size(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, positions, kv_caches[i], input_params);
+      h = layer(h, positions, kv_caches[i], input_params, context);
     }
     return final_layer_norm_(h);
   }
@@ -352,8 +355,9 @@ class GPTNeoXForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return gpt_neox_(tokens, positions, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return gpt_neox_(tokens, positions, kv_caches, input_params, context);
   }
 
   // hidden_states: [num_tokens, hidden_size]
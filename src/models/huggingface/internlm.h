@@ -50,8 +50,8 @@ class InternlmMLPImpl : public torch::nn::Module {
                                           options));
   }
 
-  torch::Tensor forward(torch::Tensor x) {
-    return down_proj_(act_with_mul_(gate_up_proj_(x)));
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    return down_proj_(act_with_mul_(gate_up_proj_(x, context)));
   }
 
   // load the weight from the checkpoint
@@ -116,14 +116,15 @@ class InternlmAttentionImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // (num_tokens, dim) x (dim, n_local_heads * head_dim)
     // => (num_tokens, n_local_heads * head_dim)
-    auto qkv = qkv_proj_(x).chunk(/*chunks=*/3, /*dim=*/1);
+    auto qkv = qkv_proj_(x, context).chunk(/*chunks=*/3, /*dim=*/1);
 
     // calculate attention, output: (num_tokens, n_local_heads * head_dim)
-    auto output =
-        atten_(qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params);
+    auto output = atten_(
+        qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params, context);
     return o_proj_(output);
   }
 
@@ -174,10 +175,14 @@ class InternlmDecoderLayerImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
-    auto h =
-        x + self_attn_(input_layernorm_(x), positions, kv_cache, input_params);
-    return h + mlp_(post_attention_layernorm_(h));
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    auto h = x + self_attn_(input_layernorm_(x),
+                            positions,
+                            kv_cache,
+                            input_params,
+                            context);
+    return h + mlp_(post_attention_layernorm_(h), context);
   }
 
   // load the weight from the checkpoint
@@ -242,13 +247,14 @@ class InternlmModelImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor tokens,
                         torch::Tensor positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     auto h = embed_tokens_(tokens);
 
     // TODO: set working space for attention handler
     for (size_t i = 0; i < layers_.size(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, positions, kv_caches[i], input_params);
+      h = layer(h, positions, kv_caches[i], input_params, context);
     }
     return norm_(h);
   }
@@ -313,8 +319,9 @@ class InternlmForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return model_(tokens, positions, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return model_(tokens, positions, kv_caches, input_params, context);
   }
 
   // hidden_states: [num_tokens, hidden_size]
@@ -52,8 +52,8 @@ class LlamaMLPImpl : public torch::nn::Module {
                                           options));
   }
 
-  torch::Tensor forward(torch::Tensor x) {
-    return down_proj_(act_with_mul_(gate_up_proj_(x)));
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    return down_proj_(act_with_mul_(gate_up_proj_(x, context)));
   }
 
   // load the weight from the checkpoint
@@ -129,15 +129,17 @@ class LlamaAttentionImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // (num_tokens, dim) x (dim, n_local_heads * head_dim)
     // => (num_tokens, n_local_heads * head_dim)
-    auto qkv = qkv_proj_(x).split(/*split_size=*/qkv_sizes_, /*dim=*/-1);
+    auto qkv =
+        qkv_proj_(x, context).split(/*split_size=*/qkv_sizes_, /*dim=*/-1);
     DCHECK_EQ(qkv.size(), 3);
 
     // calculate attention, output: (num_tokens, n_local_heads * head_dim)
-    auto output =
-        atten_(qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params);
+    auto output = atten_(
+        qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params, context);
     return o_proj_(output);
   }
 
@@ -192,10 +194,20 @@ class LlamaDecoderLayerImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
-    auto h =
-        x + self_attn_(input_layernorm_(x), positions, kv_cache, input_params);
-    return h + mlp_(post_attention_layernorm_(h));
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    // residuals are drawn from the workspace and released by the next layer
+    auto h = context.empty_like(x);
+    torch::add_out(h,
+                   x,
+                   self_attn_(input_layernorm_(x),
+                              positions,
+                              kv_cache,
+                              input_params,
+                              context));
+    auto output = context.empty_like(h);
+    return torch::add_out(
+        output, h, mlp_(post_attention_layernorm_(h), context));
   }
 
   // load the weight from the checkpoint
@@ -235,60 +247,80 @@ class LlamaModelImpl : public torch::nn::Module {
                  const ParallelArgs& parallel_args,
                  const torch::TensorOptions& options) {
     // register submodules
-    embed_tokens_ = register_module(
-        "embed_tokens",
-        ParallelEmbedding(
-            args.vocab_size(), args.hidden_size(), parallel_args, options));
+    // only the first pipeline stage embeds tokens
+    if (args.is_first_stage()) {
+      embed_tokens_ = register_module(
+          "embed_tokens",
+          ParallelEmbedding(
+              args.vocab_size(), args.hidden_size(), parallel_args, options));
+    }
 
     handler_ = AttentionHandler::create_handler_with_rope(
         args, /*interleaved=*/false, options);
 
+    // layers of the pipeline stage
+    const auto [layer_begin, layer_end] = args.stage_layers();
+    layer_begin_ = layer_begin;
     blocks_ = register_module("layers", torch::nn::ModuleList());
-    layers_.reserve(args.n_layers());
-    for (int32_t i = 0; i < args.n_layers(); i++) {
+    layers_.reserve(layer_end - layer_begin);
+    for (int64_t i = layer_begin; i < layer_end; i++) {
       auto block = LlamaDecoderLayer(
           args, quant_args, parallel_args, options, handler_.get());
       layers_.push_back(block);
       blocks_->push_back(block);
     }
-    norm_ = register_module(
-        "norm", RMSNorm(args.hidden_size(), args.rms_norm_eps(), options));
+
+    // only the last pipeline stage applies the final norm
+    if (args.is_last_stage()) {
+      norm_ = register_module(
+          "norm", RMSNorm(args.hidden_size(), args.rms_norm_eps(), options));
+    }
   }
 
-  // tokens: [num_tokens]
+  // tokens: [num_tokens] for the first pipeline stage, otherwise hidden
+  // states of the previous stage
   // positions: [num_tokens] token pos in the sequence
   torch::Tensor forward(torch::Tensor tokens,
                         torch::Tensor positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    auto h = embed_tokens_(tokens);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    auto h = embed_tokens_.is_empty() ? tokens : embed_tokens_(tokens);
 
     // TODO: set working space for attention handler
     for (size_t i = 0; i < layers_.size(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, positions, kv_caches[i], input_params);
+      h = layer(h, positions, kv_caches[i], input_params, context);
     }
-    return norm_(h);
+    return norm_.is_empty() ? h : norm_(h);
   }
 
   // load the weight from the checkpoint
   void load_state_dict(const StateDict& state_dict) {
-    embed_tokens_->load_state_dict(state_dict.select("embed_tokens."));
+    if (!embed_tokens_.is_empty()) {
+      embed_tokens_->load_state_dict(state_dict.select("embed_tokens."));
+    }
     // call each layer's load_state_dict function
     for (int i = 0; i < layers_.size(); i++) {
-      layers_[i]->load_state_dict(
-          state_dict.select("layers." + std::to_string(i) + "."));
+      layers_[i]->load_state_dict(state_dict.select(
+          "layers." + std::to_string(layer_begin_ + i) + "."));
+    }
+    if (!norm_.is_empty()) {
+      norm_->load_state_dict(state_dict.select("norm."));
     }
-    norm_->load_state_dict(state_dict.select("norm."));
   }
 
   void verify_loaded_weights(const std::string& prefix) const {
-    embed_tokens_->verify_loaded_weights(prefix + "embed_tokens.");
+    if (!embed_tokens_.is_empty()) {
+      embed_tokens_->verify_loaded_weights(prefix + "embed_tokens.");
+    }
     for (int i = 0; i < layers_.size(); i++) {
-      layers_[i]->verify_loaded_weights(prefix + "layers." + std::to_string(i) +
-                                        ".");
+      layers_[i]->verify_loaded_weights(
+          prefix + "layers." + std::to_string(layer_begin_ + i) + ".");
+    }
+    if (!norm_.is_empty()) {
+      norm_->verify_loaded_weights(prefix + "norm.");
     }
-    norm_->verify_loaded_weights(prefix + "norm.");
   }
 
  private:
@@ -302,6 +334,9 @@ class LlamaModelImpl : public torch::nn::Module {
   // hold same data but different type as blocks_ to avoid type cast
   std::vector<LlamaDecoderLayer> layers_;
 
+  // index of the first layer of the pipeline stage
+  int64_t layer_begin_ = 0;
+
   RMSNorm norm_{nullptr};
 };
 TORCH_MODULE(LlamaModel);
@@ -316,13 +351,16 @@ class LlamaForCausalLMImpl : public torch::nn::Module {
     model_ = register_module(
         "model", LlamaModel(args, quant_args, parallel_args, options));
 
-    lm_head_ = register_module("lm_head",
-                               ColumnParallelLinear(args.hidden_size(),
-                                                    args.vocab_size(),
-                                                    /*bias=*/false,
-                                                    /*gather_output=*/true,
-                                                    parallel_args,
-                                                    options));
+    // only the last pipeline stage computes logits
+    if (args.is_last_stage()) {
+      lm_head_ = register_module("lm_head",
+                                 ColumnParallelLinear(args.hidden_size(),
+                                                      args.vocab_size(),
+                                                      /*bias=*/false,
+                                                      /*gather_output=*/true,
+                                                      parallel_args,
+                                                      options));
+    }
   }
 
   // tokens: [num_tokens]
@@ -331,8 +369,9 @@ class LlamaForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return model_(tokens, positions, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return model_(tokens, positions, kv_caches, input_params, context);
   }
 
   // hidden_states: [num_tokens, hidden_size]
@@ -351,12 +390,16 @@ class LlamaForCausalLMImpl : public torch::nn::Module {
   // load the weight from the checkpoint
   void load_state_dict(const StateDict& state_dict) {
     model_->load_state_dict(state_dict.select("model."));
-    lm_head_->load_state_dict(state_dict.select("lm_head."));
+    if (!lm_head_.is_empty()) {
+      lm_head_->load_state_dict(state_dict.select("lm_head."));
+    }
   }
 
   void verify_loaded_weights() const {
     model_->verify_loaded_weights("model.");
-    lm_head_->verify_loaded_weights("lm_head.");
+    if (!lm_head_.is_empty()) {
+      lm_head_->verify_loaded_weights("lm_head.");
+    }
   }
 
  private:
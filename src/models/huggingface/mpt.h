@@ -51,8 +51,8 @@ class MPTMLPImpl : public torch::nn::Module {
                                           options));
   }
 
-  torch::Tensor forward(torch::Tensor x) {
-    return down_proj_(act_(up_proj_(x)));
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    return down_proj_(act_(up_proj_(x, context)));
   }
 
   // load the weight from the checkpoint
@@ -133,10 +133,11 @@ class MPTAttentionImpl : public torch::nn::Module {
 
   torch::Tensor forward(torch::Tensor x,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // (num_tokens, dim) x (dim, n_heads * head_dim)
     // => (num_tokens, n_heads * head_dim)
-    auto qkv = wqkv_(x);
+    auto qkv = wqkv_(x, context);
     if (attn_qkv_clip_) {
       const auto value = attn_qkv_clip_.value();
       qkv.clamp_(/*min=*/-value, /*max=*/value);
@@ -150,8 +151,13 @@ class MPTAttentionImpl : public torch::nn::Module {
       k = k_ln_(k);
     }
     // calculate attention, output: (num_tokens, n_local_heads * head_dim)
-    auto output =
-        atten_(q, k, v, /*positions=*/torch::Tensor{}, kv_cache, input_params);
+    auto output = atten_(q,
+                         k,
+                         v,
+                         /*positions=*/torch::Tensor{},
+                         kv_cache,
+                         input_params,
+                         context);
     return out_proj_(output);
   }
 
@@ -259,9 +265,10 @@ class MPTBlockImpl : public torch::nn::Module {
 
   torch::Tensor forward(torch::Tensor x,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
-    auto h = x + attn_(norm_1_(x), kv_cache, input_params);
-    return h + ffn_(norm_2_(h));
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    auto h = x + attn_(norm_1_(x), kv_cache, input_params, context);
+    return h + ffn_(norm_2_(h), context);
   }
 
   // load the weight from the checkpoint
@@ -329,13 +336,14 @@ class MPTModelImpl : public torch::nn::Module {
   // positions: [num_tokens] token pos in the sequence
   torch::Tensor forward(torch::Tensor tokens,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     auto h = wte_(tokens);
 
     // TODO: set working space for attention handler
     for (size_t i = 0; i < layers_.size(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, kv_caches[i], input_params);
+      h = layer(h, kv_caches[i], input_params, context);
     }
     return norm_f_(h);
   }
@@ -422,8 +430,9 @@ class MPTForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& /*positions*/,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return transformer_(tokens, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return transformer_(tokens, kv_caches, input_params, context);
   }
 
   // hidden_states: [num_tokens, hidden_size]
@@ -48,7 +48,9 @@ class PhiMLPImpl : public torch::nn::Module {
                                              options));
   }
 
-  torch::Tensor forward(torch::Tensor x) { return fc2_(act_(fc1_(x))); }
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    return fc2_(act_(fc1_(x, context)));
+  }
 
   // load the weight from the checkpoint
   void load_state_dict(const StateDict& state_dict) {
@@ -120,15 +122,16 @@ class PhiAttentionImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // (num_tokens, dim) x (dim, n_local_heads * head_dim)
     // => (num_tokens, n_local_heads * head_dim)
-    auto qkv = Wqkv_(x).split(/*split_size=*/qkv_sizes_, /*dim=*/-1);
+    auto qkv = Wqkv_(x, context).split(/*split_size=*/qkv_sizes_, /*dim=*/-1);
     DCHECK_EQ(qkv.size(), 3);
 
     // calculate attention, output: (num_tokens, n_local_heads * head_dim)
-    auto output =
-        atten_(qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params);
+    auto output = atten_(
+        qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params, context);
     return out_proj_(output);
   }
 
@@ -181,11 +184,13 @@ class PhiBlockImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // x = x + attn(ln(x)) + mlp(ln(x))
     const auto h = ln_(x);
-    const auto attn_output = mixer_(h, positions, kv_cache, input_params);
-    const auto mlp_output = mlp_(h);
+    const auto attn_output =
+        mixer_(h, positions, kv_cache, input_params, context);
+    const auto mlp_output = mlp_(h, context);
     return x + attn_output + mlp_output;
   }
 
@@ -243,13 +248,14 @@ class PhiModelImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor tokens,
                         torch::Tensor positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     auto h = wte_(tokens);
 
     // TODO: set working space for attention handler
     for (size_t i = 0; i < layers_.size(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, positions, kv_caches[i], input_params);
+      h = layer(h, positions, kv_caches[i], input_params, context);
     }
     return h;
   }
@@ -347,8 +353,9 @@ class PhiForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return transformer_(tokens, positions, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return transformer_(tokens, positions, kv_caches, input_params, context);
   }
 
   // hidden_states: [num_tokens, hidden_size]
@@ -54,8 +54,8 @@ class QWenMLPImpl : public torch::nn::Module {
                                                 options));
   }
 
-  torch::Tensor forward(torch::Tensor x) {
-    auto gate_up_proj = w1_w2_proj_(x);
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    auto gate_up_proj = w1_w2_proj_(x, context);
     auto chunks = gate_up_proj.chunk(/*chunks=*/2, /*dim=*/-1);
     return c_proj_(chunks[0] * act_(chunks[1]));
   }
@@ -121,13 +121,14 @@ class QWenAttentionImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // (num_tokens, dim) x (dim, n_local_heads * head_dim)
     // => (num_tokens, n_local_heads * head_dim)
-    auto qkv = c_attn_(x).chunk(/*chunks=*/3, /*dim=*/-1);
+    auto qkv = c_attn_(x, context).chunk(/*chunks=*/3, /*dim=*/-1);
     // calculate attention, output: (num_tokens, n_local_heads * head_dim)
-    auto output =
-        atten_(qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params);
+    auto output = atten_(
+        qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params, context);
     return c_proj_(output);
   }
 
@@ -176,9 +177,10 @@ class QWenBlockImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
-    auto h = x + attn_(ln_1_(x), positions, kv_cache, input_params);
-    return h + mlp_(ln_2_(h));
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    auto h = x + attn_(ln_1_(x), positions, kv_cache, input_params, context);
+    return h + mlp_(ln_2_(h), context);
   }
 
   // load the weight from the checkpoint
@@ -241,13 +243,14 @@ class QWenModelImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor tokens,
                         torch::Tensor positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     auto h = wte_(tokens);
 
     // TODO: set working space for attention handler
     for (size_t i = 0; i < layers_.size(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, positions, kv_caches[i], input_params);
+      h = layer(h, positions, kv_caches[i], input_params, context);
     }
     return ln_f_(h);
   }
@@ -312,8 +315,9 @@ class QWenForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return transformer_(tokens, positions, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return transformer_(tokens, positions, kv_caches, input_params, context);
   }
 
   // hidden_states: [num_tokens, hidden_size]
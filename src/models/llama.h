@@ -49,8 +49,8 @@ class LlamaFeedForwardImpl : public torch::nn::Module {
                                             options));
   }
 
-  torch::Tensor forward(torch::Tensor x) {
-    return w2_(act_with_mul_(w1_w3_(x)));
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    return w2_(act_with_mul_(w1_w3_(x, context)));
   }
 
   // load the weight from the checkpoint
@@ -122,15 +122,16 @@ class LlamaAttentionImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     // (num_tokens, dim) x (dim, n_local_heads * head_dim)
     // => (num_tokens, n_local_heads * head_dim)
-    auto qkv = wqkv_(x).split(/*split_size=*/qkv_sizes_, /*dim=*/-1);
+    auto qkv = wqkv_(x, context).split(/*split_size=*/qkv_sizes_, /*dim=*/-1);
     DCHECK_EQ(qkv.size(), 3);
 
     // calculate attention, output: (num_tokens, n_local_heads * head_dim)
-    auto output =
-        atten_(qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params);
+    auto output = atten_(
+        qkv[0], qkv[1], qkv[2], positions, kv_cache, input_params, context);
     return wo_(output);
   }
 
@@ -184,10 +185,14 @@ class LlamaTransformerBlockImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
-    auto h =
-        x + attention_(attention_norm_(x), positions, kv_cache, input_params);
-    return h + feed_forward_(ffn_norm_(h));
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    auto h = x + attention_(attention_norm_(x),
+                            positions,
+                            kv_cache,
+                            input_params,
+                            context);
+    return h + feed_forward_(ffn_norm_(h), context);
   }
 
   // load the weight from the checkpoint
@@ -249,12 +254,13 @@ class LlamaTransformerImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor tokens,
                         torch::Tensor positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
     auto h = tok_embeddings_(tokens);
     // TODO: set working space for attention handler
     for (size_t i = 0; i < layers_.size(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, positions, kv_caches[i], input_params);
+      h = layer(h, positions, kv_caches[i], input_params, context);
     }
     return norm_(h);
   }
@@ -318,8 +324,9 @@ class LlamaForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return transformer_(tokens, positions, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return transformer_(tokens, positions, kv_caches, input_params, context);
   }
 
   // hidden_states: [num_tokens, hidden_size]
@@ -4,6 +4,8 @@
 #include <ostream>
 #include <string>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "common/macros.h"
 
@@ -103,6 +105,48 @@ struct ModelArgs {
 
   // Stop token ids for decoding.
   DEFINE_ARG(std::unordered_set<int32_t>, stop_token_ids);
+
+  // configs for pipeline parallelism
+  // layers are partitioned into consecutive stages, and a model only holds
+  // the layers of its stage. the first stage embeds tokens, and the last stage
+  // applies the final norm and computes logits.
+  DEFINE_ARG(int32_t, n_pipeline_stages) = 1;
+
+  // the pipeline stage of the model, in [0, n_pipeline_stages)
+  DEFINE_ARG(int32_t, pipeline_stage) = 0;
+
+  // number of layers of each stage, split evenly if empty
+  DEFINE_ARG(std::vector<int64_t>, pipeline_stage_layers);
+
+ public:
+  bool is_first_stage() const { return pipeline_stage_ == 0; }
+
+  bool is_last_stage() const {
+    return pipeline_stage_ + 1 == n_pipeline_stages_;
+  }
+
+  // get the range [begin, end) of layers of the pipeline stage
+  std::pair<int64_t, int64_t> stage_layers(int32_t stage) const {
+    if (pipeline_stage_layers_.empty()) {
+      return {n_layers_ * stage / n_pipeline_stages_,
+              n_layers_ * (stage + 1) / n_pipeline_stages_};
+    }
+    int64_t begin = 0;
+    for (int32_t i = 0; i < stage; ++i) {
+      begin += pipeline_stage_layers_[i];
+    }
+    return {begin, begin + pipeline_stage_layers_[stage]};
+  }
+
+  std::pair<int64_t, int64_t> stage_layers() const {
+    return stage_layers(pipeline_stage_);
+  }
+
+  // get the number of layers held by the model
+  int64_t n_stage_layers() const {
+    const auto [begin, end] = stage_layers();
+    return end - begin;
+  }
 };
 
 inline std::ostream& operator<<(std::ostream& os, const ModelArgs& args) {
@@ -134,6 +178,12 @@ inline std::ostream& operator<<(std::ostream& os, const ModelArgs& args) {
   os << ", linear_bias: " << args.linear_bias();
   os << ", qkv_bias: " << args.qkv_bias();
   os << ", residual_post_layernorm: " << args.residual_post_layernorm();
+  if (args.n_pipeline_stages() > 1) {
+    const auto [begin, end] = args.stage_layers();
+    os << ", pipeline_stage: " << args.pipeline_stage() << "/"
+       << args.n_pipeline_stages() << ", layers: [" << begin << ", " << end
+       << ")";
+  }
   os << "]";
   return os;
 }
@@ -3,8 +3,10 @@
 #include <torch/torch.h>
 
 #include "common/tensor_helper.h"
+#include "memory/workspace.h"
 
 namespace llm {
+
 // input parameters for the model that encapsulates all the necessary
 // information required to process a batch efficiently, mainly for
 // self-attention and kv-cache.
@@ -56,4 +58,26 @@ struct InputParameters {
   torch::Tensor block_tables;
 };
 
+// context of a forward pass, passed to layers along with the inputs. unlike
+// the inputs, it stays on the worker and is not moved to devices.
+struct ForwardContext {
+  // allocate an uninitialized tensor for an intermediate result, from the
+  // workspace if given
+  torch::Tensor empty(at::IntArrayRef sizes,
+                      const torch::TensorOptions& options) const {
+    if (workspace == nullptr) {
+      return torch::empty(sizes, options);
+    }
+    return workspace->empty(sizes, options.dtype().toScalarType());
+  }
+
+  torch::Tensor empty_like(const torch::Tensor& tensor) const {
+    return Workspace::empty_like(workspace, tensor);
+  }
+
+  // workspace arena on the device for intermediate tensors, owned by the
+  // worker. nullptr to use the default allocator.
+  Workspace* workspace = nullptr;
+};
+
 }  // namespace llm
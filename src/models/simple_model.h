@@ -48,8 +48,8 @@ class SimpleMLPImpl : public torch::nn::Module {
                                                    options));
   }
 
-  torch::Tensor forward(torch::Tensor x) {
-    return down_proj_(act_with_mul_(gate_up_proj_(x)));
+  torch::Tensor forward(torch::Tensor x, const ForwardContext& context) {
+    return down_proj_(act_with_mul_(gate_up_proj_(x, context)));
   }
 
   void load_state_dict(const StateDict& state_dict) {
@@ -84,8 +84,9 @@ class SimpleDecoderLayerImpl : public torch::nn::Module {
   torch::Tensor forward(torch::Tensor x,
                         torch::Tensor positions,
                         KVCache& kv_cache,
-                        const InputParameters& input_params) {
-    return mlp_(x);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return mlp_(x, context);
   }
 
   void load_state_dict(const StateDict& state_dict) {
@@ -108,45 +109,58 @@ class SimpleModelImpl : public torch::nn::Module {
                   const QuantArgs& quant_args,
                   const ParallelArgs& parallel_args,
                   const torch::TensorOptions& options) {
-    embed_tokens_ = register_module(
-        "embed_tokens",
-        ParallelEmbedding(
-            args.vocab_size(), args.hidden_size(), parallel_args, options));
+    // only the first pipeline stage embeds tokens
+    if (args.is_first_stage()) {
+      embed_tokens_ = register_module(
+          "embed_tokens",
+          ParallelEmbedding(
+              args.vocab_size(), args.hidden_size(), parallel_args, options));
+    }
 
+    // layers of the pipeline stage
+    const auto [layer_begin, layer_end] = args.stage_layers();
+    layer_begin_ = layer_begin;
     blocks_ = register_module("layers", torch::nn::ModuleList());
-    layers_.reserve(args.n_layers());
-    for (int32_t i = 0; i < args.n_layers(); i++) {
+    layers_.reserve(layer_end - layer_begin);
+    for (int64_t i = layer_begin; i < layer_end; i++) {
       auto block = SimpleDecoderLayer(args, quant_args, parallel_args, options);
       layers_.push_back(block);
       blocks_->push_back(block);
     }
   }
 
+  // tokens: [num_tokens] for the first pipeline stage, otherwise hidden
+  // states of the previous stage
   torch::Tensor forward(torch::Tensor tokens,
                         torch::Tensor positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    auto h = embed_tokens_(tokens);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    auto h = embed_tokens_.is_empty() ? tokens : embed_tokens_(tokens);
     for (size_t i = 0; i < layers_.size(); i++) {
       auto& layer = layers_[i];
-      h = layer(h, positions, kv_caches[i], input_params);
+      h = layer(h, positions, kv_caches[i], input_params, context);
     }
     return h;
   }
 
   void load_state_dict(const StateDict& state_dict) {
-    embed_tokens_->load_state_dict(state_dict.select("embed_tokens."));
+    if (!embed_tokens_.is_empty()) {
+      embed_tokens_->load_state_dict(state_dict.select("embed_tokens."));
+    }
     for (int i = 0; i < layers_.size(); ++i) {
-      layers_[i]->load_state_dict(
-          state_dict.select("layers." + std::to_string(i) + "."));
+      layers_[i]->load_state_dict(state_dict.select(
+          "layers." + std::to_string(layer_begin_ + i) + "."));
     }
   }
 
   void verify_loaded_weights(const std::string& prefix) const {
-    embed_tokens_->verify_loaded_weights(prefix + "embed_tokens.");
+    if (!embed_tokens_.is_empty()) {
+      embed_tokens_->verify_loaded_weights(prefix + "embed_tokens.");
+    }
     for (int i = 0; i < layers_.size(); ++i) {
-      layers_[i]->verify_loaded_weights(prefix + "layers." + std::to_string(i) +
-                                        ".");
+      layers_[i]->verify_loaded_weights(
+          prefix + "layers." + std::to_string(layer_begin_ + i) + ".");
     }
   }
 
@@ -154,6 +168,8 @@ class SimpleModelImpl : public torch::nn::Module {
   ParallelEmbedding embed_tokens_{nullptr};
   torch::nn::ModuleList blocks_{nullptr};
   std::vector<SimpleDecoderLayer> layers_;
+  // index of the first layer of the pipeline stage
+  int64_t layer_begin_ = 0;
 };
 TORCH_MODULE(SimpleModel);
 
@@ -170,13 +186,16 @@ class SimpleForCausalLMImpl : public torch::nn::Module {
   torch::Tensor forward(const torch::Tensor& tokens,
                         const torch::Tensor& positions,
                         std::vector<KVCache>& kv_caches,
-                        const InputParameters& input_params) {
-    return model_(tokens, positions, kv_caches, input_params);
+                        const InputParameters& input_params,
+                        const ForwardContext& context) {
+    return model_(tokens, positions, kv_caches, input_params, context);
   }
 
+  // use hidden states of selected tokens as logits, vocab_size should be
+  // equal to hidden_size.
   torch::Tensor logits(const torch::Tensor& hidden_states,
                        const torch::Tensor& selected_idxes) {
-    return hidden_states;
+    return hidden_states.index_select(/*dim=*/0, selected_idxes);
   }
 
   void load_state_dict(const StateDict& state_dict) {
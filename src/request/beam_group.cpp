@@ -0,0 +1,173 @@
+#include "beam_group.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "request.h"
+#include "sequence.h"
+
+namespace llm {
+
+BeamGroup::BeamGroup(Request* request, size_t beam_width, float length_penalty)
+    : request_(request),
+      beam_width_(beam_width),
+      length_penalty_(length_penalty) {
+  CHECK(request_ != nullptr);
+  CHECK_GT(beam_width_, 0) << "beam width should be greater than 0";
+}
+
+size_t BeamGroup::num_live_beams() const {
+  return std::count_if(
+      request_->sequences.begin(),
+      request_->sequences.end(),
+      [](const Sequence& sequence) { return !sequence.is_finished(); });
+}
+
+void BeamGroup::step(const std::vector<Sequence*>& beams,
+                     const std::vector<Candidate>& candidates) {
+  CHECK(!is_done_) << "beam search is already done";
+  const size_t num_prompt_tokens = request_->num_prompt_tokens();
+
+  // select the best candidates to continue, stopped candidates are moved into
+  // hypotheses without taking any beam.
+  std::vector<const Candidate*> selected;
+  selected.reserve(beam_width_);
+  for (const auto& candidate : candidates) {
+    if (selected.size() >= beam_width_) {
+      break;
+    }
+    CHECK_LT(candidate.beam_idx, beams.size());
+    if (is_stop_token(candidate.token_id)) {
+      const auto parent_token_ids = beams[candidate.beam_idx]->token_ids();
+      std::vector<int32_t> token_ids(parent_token_ids.begin(),
+                                     parent_token_ids.end());
+      token_ids.push_back(candidate.token_id);
+      add_hypothesis(token_ids,
+                     num_prompt_tokens,
+                     candidate.cumulative_logprob,
+                     FinishReason::STOP);
+      continue;
+    }
+    selected.push_back(&candidate);
+  }
+
+  // the first child of a beam continues in place, the others are forked
+  std::vector<bool> has_child(beams.size(), false);
+  std::vector<std::pair<Sequence*, const Candidate*>> children;
+  std::vector<const Candidate*> forked;
+  for (const auto* candidate : selected) {
+    if (!has_child[candidate->beam_idx]) {
+      has_child[candidate->beam_idx] = true;
+      children.emplace_back(beams[candidate->beam_idx], candidate);
+    } else {
+      forked.push_back(candidate);
+    }
+  }
+
+  // beams without any child and finished sequences can be reused
+  std::vector<Sequence*> free_slots;
+  for (size_t i = 0; i < beams.size(); ++i) {
+    if (!has_child[i]) {
+      free_slots.push_back(beams[i]);
+    }
+  }
+  for (Sequence& sequence : request_->sequences) {
+    if (sequence.is_finished()) {
+      free_slots.push_back(&sequence);
+    }
+  }
+
+  // fork beams before any beam is advanced in place
+  for (const auto* candidate : forked) {
+    const Sequence& parent = *beams[candidate->beam_idx];
+    Sequence* slot = nullptr;
+    if (!free_slots.empty()) {
+      slot = free_slots.back();
+      free_slots.pop_back();
+    } else {
+      slot = request_->fork_sequence(parent);
+    }
+    slot->assign_beam(parent);
+    children.emplace_back(slot, candidate);
+  }
+
+  // prune the remaining slots to release their kv cache blocks
+  for (Sequence* slot : free_slots) {
+    slot->prune_beam();
+  }
+
+  // advance beams with the selected tokens
+  bool has_live_beam = false;
+  for (auto& [sequence, candidate] : children) {
+    sequence->append_token(candidate->token_id, candidate->logprob);
+    if (sequence->is_finished()) {
+      add_hypothesis(sequence->token_ids(),
+                     num_prompt_tokens,
+                     sequence->cumulative_logprob(),
+                     sequence->finish_reason());
+    } else {
+      has_live_beam = true;
+    }
+  }
+
+  // stop early once beam_width hypotheses are found
+  is_done_ = !has_live_beam || hypotheses_.size() >= beam_width_;
+}
+
+std::vector<BeamGroup::Hypothesis> BeamGroup::best_hypotheses(size_t n) const {
+  std::vector<Hypothesis> hypotheses = hypotheses_;
+  std::sort(hypotheses.begin(),
+            hypotheses.end(),
+            [](const Hypothesis& a, const Hypothesis& b) {
+              return a.score > b.score;
+            });
+  if (hypotheses.size() > n) {
+    hypotheses.resize(n);
+  }
+  return hypotheses;
+}
+
+void BeamGroup::add_hypothesis(const Slice<int32_t>& token_ids,
+                               size_t num_prompt_tokens,
+                               float cumulative_logprob,
+                               FinishReason finish_reason) {
+  const size_t num_generated_tokens =
+      std::max<size_t>(token_ids.size() - num_prompt_tokens, 1);
+  const float score =
+      cumulative_logprob /
+      std::pow(static_cast<float>(num_generated_tokens), length_penalty_);
+
+  Hypothesis* target = nullptr;
+  if (hypotheses_.size() < beam_width_) {
+    target = &hypotheses_.emplace_back();
+  } else {
+    // replace the worst hypothesis if the new one is better
+    auto worst = std::min_element(hypotheses_.begin(),
+                                  hypotheses_.end(),
+                                  [](const Hypothesis& a, const Hypothesis& b) {
+                                    return a.score < b.score;
+                                  });
+    if (worst->score >= score) {
+      return;
+    }
+    target = &(*worst);
+  }
+  target->token_ids.assign(token_ids.begin(), token_ids.end());
+  target->score = score;
+  target->finish_reason = finish_reason;
+}
+
+bool BeamGroup::is_stop_token(int32_t token_id) const {
+  const auto& stopping_criteria = request_->stopping_criteria;
+  if (!stopping_criteria.ignore_eos_token &&
+      token_id == stopping_criteria.eos_token_id) {
+    return true;
+  }
+  return stopping_criteria.stop_token_ids.count(token_id) > 0;
+}
+
+}  // namespace llm
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "sequence.h"
+#include "stopping_criteria.h"
+
+namespace llm {
+
+// forward declaration
+struct Request;
+
+// A group of beams for beam search decoding of a request. The beams are
+// sequences of the request sharing kv cache blocks through block ref counts.
+// On each step, the best candidates over [num_beams, vocab_size] are selected
+// to continue, beams with more than one child are forked while beams without
+// any child are pruned and reused for other children.
+class BeamGroup final {
+ public:
+  struct Candidate {
+    // index of the parent beam
+    size_t beam_idx = 0;
+
+    // the next token id
+    int32_t token_id = 0;
+
+    // log probability of the next token
+    float logprob = 0.0f;
+
+    // cumulative log probability including the next token
+    float cumulative_logprob = 0.0f;
+  };
+
+  struct Hypothesis {
+    // all token ids including prompt tokens
+    std::vector<int32_t> token_ids;
+
+    // cumulative logprob normalized by length penalty
+    float score = 0.0f;
+
+    FinishReason finish_reason = FinishReason::NONE;
+  };
+
+  BeamGroup(Request* request, size_t beam_width, float length_penalty);
+
+  // get the beam search width
+  size_t beam_width() const { return beam_width_; }
+
+  // get the number of live beams that are still searching
+  size_t num_live_beams() const;
+
+  // advance the beams with candidates sorted by cumulative logprob in
+  // descending order. beams: live beams of the group.
+  void step(const std::vector<Sequence*>& beams,
+            const std::vector<Candidate>& candidates);
+
+  // check if the beam search is done
+  bool is_done() const { return is_done_; }
+
+  // get the finished hypotheses sorted by score in descending order
+  std::vector<Hypothesis> best_hypotheses(size_t n) const;
+
+ private:
+  // add a finished hypothesis, keep the best beam_width ones
+  void add_hypothesis(const Slice<int32_t>& token_ids,
+                      size_t num_prompt_tokens,
+                      float cumulative_logprob,
+                      FinishReason finish_reason);
+
+  // check if the token stops the beam
+  bool is_stop_token(int32_t token_id) const;
+
+  // the request that owns the beams, not owned
+  Request* request_ = nullptr;
+
+  // the number of beams to keep
+  size_t beam_width_ = 0;
+
+  // length penalty: score = cumulative_logprob / (length ^ length_penalty)
+  float length_penalty_ = 1.0f;
+
+  // finished hypotheses
+  std::vector<Hypothesis> hypotheses_;
+
+  // whether the beam search is done
+  bool is_done_ = false;
+};
+
+}  // namespace llm
@@ -4,11 +4,12 @@
 
 #include <cstddef>
 #include <cstdint>
-#include <sstream>
 #include <string>
+#include <string_view>
 
 #include "common/slice.h"
 #include "tokenizer/tokenizer.h"
+#include "tokenizer/utf8.h"
 
 namespace llm {
 
@@ -28,16 +29,46 @@ IncrementalDecoder::IncrementalDecoder(const std::string_view& prompt,
 
 std::string IncrementalDecoder::decode(const Slice<int32_t>& token_ids,
                                        const Tokenizer& tokenizer) {
-  std::stringstream ss;
+  std::string text;
   // return prompt directly if prompt string is not empty
   if (output_offset_ < num_prompt_tokens_ && !prompt_.empty()) {
     // leave 6 tokens for the prefix to defeat cleanup algorithms in decode
     // which decide to add a space or not depending on the surrouding ids.
     prefix_offset_ = num_prompt_tokens_ <= 6 ? 0 : num_prompt_tokens_ - 6;
     output_offset_ = num_prompt_tokens_;
-    ss << prompt_;
+    text.append(prompt_);
+    is_first_ = false;
   }
 
+  if (use_window_ || !decode_tokens(token_ids, tokenizer, &text)) {
+    use_window_ = true;
+    decode_window(token_ids, tokenizer, &text);
+  }
+  return text;
+}
+
+bool IncrementalDecoder::decode_tokens(const Slice<int32_t>& token_ids,
+                                       const Tokenizer& tokenizer,
+                                       std::string* text) {
+  for (size_t i = output_offset_; i < token_ids.size(); ++i) {
+    if (!tokenizer.decode_token(
+            token_ids[i], skip_special_tokens_, &is_first_, &partial_bytes_)) {
+      // only happens for the first token since it is tokenizer specific
+      return false;
+    }
+  }
+  prefix_offset_ = output_offset_;
+  output_offset_ = token_ids.size();
+
+  // output complete characters and hold back the partial one
+  const size_t consumed = append_utf8(partial_bytes_, text);
+  partial_bytes_.erase(0, consumed);
+  return true;
+}
+
+void IncrementalDecoder::decode_window(const Slice<int32_t>& token_ids,
+                                       const Tokenizer& tokenizer,
+                                       std::string* text) {
   const auto prefix_text = tokenizer.decode(
       token_ids.slice(prefix_offset_, output_offset_), skip_special_tokens_);
   const auto new_text =
@@ -48,9 +79,8 @@ std::string IncrementalDecoder::decode(const Slice<int32_t>& token_ids,
     prefix_offset_ = output_offset_;
     output_offset_ = token_ids.size();
     // only print the delta text
-    ss << new_text.substr(prefix_text.size());
+    text->append(new_text, prefix_text.size(), std::string::npos);
   }
-  return ss.str();
 }
 
 }  // namespace llm
@@ -9,6 +9,9 @@
 namespace llm {
 
 // a stateful decoder that can decode tokens incrementally.
+// tokens are decoded one by one with Tokenizer::decode_token if supported,
+// which appends the bytes of each new token in O(1). otherwise, a window of
+// tokens is decoded on each call to get the delta text.
 class IncrementalDecoder final {
  public:
   IncrementalDecoder(const std::string_view& prompt,
@@ -28,6 +31,16 @@ class IncrementalDecoder final {
   size_t prefix_offset() const { return prefix_offset_; }
 
  private:
+  // decode new tokens one by one, returns false if not supported
+  bool decode_tokens(const Slice<int32_t>& token_ids,
+                     const Tokenizer& tokenizer,
+                     std::string* text);
+
+  // decode new tokens with a window of previous tokens
+  void decode_window(const Slice<int32_t>& token_ids,
+                     const Tokenizer& tokenizer,
+                     std::string* text);
+
   // the original prompt string, used to skip the prompt decoding when streaming
   std::string_view prompt_;
 
@@ -43,6 +56,18 @@ class IncrementalDecoder final {
   size_t prefix_offset_ = 0;
   // all tokens before output_offset_ have been decoded
   size_t output_offset_ = 0;
+
+  // whether to decode tokens with a window, set if the tokenizer can't decode
+  // tokens one by one.
+  bool use_window_ = false;
+
+  // whether the next token is at the beginning of the text, updated by the
+  // tokenizer for the leading space handling.
+  bool is_first_ = true;
+
+  // decoded bytes ending with a partial utf-8 character, which are held back
+  // until the character is complete.
+  std::string partial_bytes_;
 };
 
 }  // namespace llm
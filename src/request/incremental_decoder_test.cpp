@@ -0,0 +1,179 @@
+#include "incremental_decoder.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tokenizer/tokenizer.h"
+
+namespace llm {
+namespace {
+// a tokenizer decoding each token into bytes, a partial utf-8 character at
+// the end is decoded as the replacement character, like byte fallback tokens.
+// decode_token is supported if incremental is true.
+class FakeTokenizer : public Tokenizer {
+ public:
+  FakeTokenizer(std::unordered_map<int32_t, std::string> pieces,
+                bool incremental)
+      : pieces_(std::move(pieces)), incremental_(incremental) {}
+
+  bool encode(const std::string_view& /*text*/,
+              std::vector<int32_t>* /*ids*/) const override {
+    return false;
+  }
+
+  std::string decode(const Slice<int32_t>& tokens,
+                     bool /*skip_special_tokens*/) const override {
+    std::string text;
+    for (const int32_t token : tokens) {
+      auto it = pieces_.find(token);
+      if (it != pieces_.end()) {
+        text += it->second;
+      }
+    }
+    // find the start of the last character and check if it is complete
+    size_t start = text.size();
+    while (start > 0 &&
+           (static_cast<uint8_t>(text[start - 1]) & 0xC0) == 0x80) {
+      --start;
+    }
+    if (start > 0) {
+      const auto lead = static_cast<uint8_t>(text[start - 1]);
+      const size_t len = lead >= 0xF0   ? 4
+                         : lead >= 0xE0 ? 3
+                         : lead >= 0xC0 ? 2
+                                        : 1;
+      if (text.size() - (start - 1) < len) {
+        text.resize(start - 1);
+        text += "\xEF\xBF\xBD";
+      }
+    }
+    return text;
+  }
+
+  bool decode_token(int32_t id,
+                    bool /*skip_special_tokens*/,
+                    bool* /*is_first*/,
+                    std::string* text) const override {
+    if (!incremental_) {
+      return false;
+    }
+    auto it = pieces_.find(id);
+    if (it != pieces_.end()) {
+      *text += it->second;
+    }
+    return true;
+  }
+
+  size_t vocab_size() const override { return pieces_.size(); }
+
+  std::unique_ptr<Tokenizer> clone() const override {
+    return std::make_unique<FakeTokenizer>(pieces_, incremental_);
+  }
+
+ private:
+  std::unordered_map<int32_t, std::string> pieces_;
+
+  bool incremental_ = false;
+};
+
+// decode tokens one by one and collect the delta texts
+std::vector<std::string> decode_stream(const std::vector<int32_t>& token_ids,
+                                       size_t num_prompt_tokens,
+                                       const std::string& prompt,
+                                       bool echo,
+                                       const Tokenizer& tokenizer) {
+  IncrementalDecoder decoder(prompt,
+                             num_prompt_tokens,
+                             echo,
+                             /*skip_special_tokens=*/true);
+  std::vector<std::string> deltas;
+  for (size_t i = num_prompt_tokens; i <= token_ids.size(); ++i) {
+    const Slice<int32_t> ids(token_ids.data(), i);
+    deltas.push_back(decoder.decode(ids, tokenizer));
+  }
+  return deltas;
+}
+
+}  // namespace
+
+class IncrementalDecoderTest : public ::testing::TestWithParam<bool> {};
+
+TEST_P(IncrementalDecoderTest, Basic) {
+  const FakeTokenizer tokenizer(
+      {{1, "How"}, {2, " are"}, {3, " you"}, {4, "?"}}, GetParam());
+  const std::vector<int32_t> token_ids = {1, 2, 3, 4};
+
+  // skip the prompt
+  auto deltas = decode_stream(token_ids,
+                              /*num_prompt_tokens=*/2,
+                              "How are",
+                              /*echo=*/false,
+                              tokenizer);
+  EXPECT_EQ(deltas, (std::vector<std::string>{"", " you", "?"}));
+
+  // echo the prompt
+  deltas = decode_stream(token_ids,
+                         /*num_prompt_tokens=*/2,
+                         "How are",
+                         /*echo=*/true,
+                         tokenizer);
+  EXPECT_EQ(deltas, (std::vector<std::string>{"How are", " you", "?"}));
+
+  // echo the prompt decoded from tokens
+  deltas = decode_stream(token_ids,
+                         /*num_prompt_tokens=*/2,
+                         "",
+                         /*echo=*/true,
+                         tokenizer);
+  EXPECT_EQ(deltas, (std::vector<std::string>{"How are", " you", "?"}));
+}
+
+TEST_P(IncrementalDecoderTest, Utf8) {
+  // "你" is split into 3 byte tokens, "好" into 2 tokens
+  const FakeTokenizer tokenizer({{1, "Hi"},
+                                 {2, "\xE4"},
+                                 {3, "\xBD"},
+                                 {4, "\xA0"},
+                                 {5, "\xE5\xA5"},
+                                 {6, "\xBD!"}},
+                                GetParam());
+  const std::vector<int32_t> token_ids = {1, 2, 3, 4, 5, 6};
+  const auto deltas = decode_stream(token_ids,
+                                    /*num_prompt_tokens=*/1,
+                                    "Hi",
+                                    /*echo=*/false,
+                                    tokenizer);
+  EXPECT_EQ(deltas,
+            (std::vector<std::string>{"", "", "", "你", "", "好!"}));
+}
+
+TEST(IncrementalDecoderUtf8Test, InvalidBytes) {
+  const FakeTokenizer tokenizer(
+      {{1, "a"}, {2, "\xBD"}, {3, "\xE4\xBD"}, {4, "b"}, {5, "\xFF"}},
+      /*incremental=*/true);
+  const std::vector<int32_t> token_ids = {1, 2, 3, 4, 5};
+  const auto deltas = decode_stream(token_ids,
+                                    /*num_prompt_tokens=*/0,
+                                    "",
+                                    /*echo=*/false,
+                                    tokenizer);
+  // invalid bytes are replaced with U+FFFD
+  EXPECT_EQ(deltas,
+            (std::vector<std::string>{"",
+                                      "a",
+                                      "\xEF\xBF\xBD",
+                                      "",
+                                      "\xEF\xBF\xBD\xEF\xBF\xBD"
+                                      "b",
+                                      "\xEF\xBF\xBD"}));
+}
+
+INSTANTIATE_TEST_SUITE_P(Incremental,
+                         IncrementalDecoderTest,
+                         ::testing::Bool());
+
+}  // namespace llm
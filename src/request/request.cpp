@@ -5,10 +5,12 @@
 #include <glog/logging.h>
 
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#include "beam_group.h"
 #include "sequence.h"
 
 namespace llm {
@@ -17,20 +19,35 @@ Request::Request(const std::string& id,
                  const std::string_view& prompt,
                  const std::vector<int32_t>& prompt_tokens,
                  size_t seq_capacity,
-                 size_t num_seqs)
+                 size_t n,
+                 size_t best_of)
     : id(id),
-      prompt(prompt),
-      seq_capacity(seq_capacity),
-      num_seqs(num_seqs),
       created_time(absl::ToUnixSeconds(absl::Now())),
-      prompt_tokens(prompt_tokens) {}
+      prompt(prompt),
+      n(n),
+      best_of(best_of),
+      prompt_tokens(prompt_tokens),
+      seq_capacity(seq_capacity) {
+  CHECK_GE(best_of, n) << "best_of must be greater or equal to n";
+}
 
-void Request::add_sequence() {
+Sequence::Options Request::sequence_options() {
   Sequence::Options options;
   options.echo = this->echo;
+  options.skip_special_tokens = this->skip_special_tokens;
   options.sampling_param = this->sampling_param;
   options.stopping_criteria = this->stopping_criteria;
 
+  if (use_beam_search) {
+    if (beam_group == nullptr) {
+      beam_group =
+          std::make_unique<BeamGroup>(this, this->best_of, this->length_penalty);
+    }
+    options.beam_group = beam_group.get();
+  }
+  options.grammar = this->grammar;
+  options.tokenizer = this->tokenizer;
+
   if (stream) {
     CHECK(on_stream_delta);
     options.on_delta =
@@ -38,13 +55,30 @@ void Request::add_sequence() {
           return this->on_stream_delta(index, output);
         };
   }
-  sequences.emplace_back(
-      this->prompt, this->prompt_tokens, this->seq_capacity, options);
+  return options;
+}
+
+void Request::add_sequence() {
+  sequences.emplace_back(this->prompt,
+                         this->prompt_tokens,
+                         this->seq_capacity,
+                         sequence_options());
+}
+
+void Request::set_tokenizer(const Tokenizer* tokenizer) {
+  this->tokenizer = tokenizer;
+  for (Sequence& seq : sequences) {
+    seq.set_tokenizer(tokenizer);
+  }
 }
 
 bool Request::is_finished() const {
+  if (beam_group != nullptr && beam_group->is_done()) {
+    return true;
+  }
+
   // still need to generate more sequences
-  if (sequences.size() < num_seqs) {
+  if (sequences.size() < best_of) {
     return false;
   }
 
@@ -66,7 +100,11 @@ bool Request::is_cancelled() const {
 }
 
 bool Request::should_expand_sequences() const {
-  if (sequences.size() < num_seqs) {
+  // beams are forked by the beam group on demand
+  if (beam_group != nullptr) {
+    return false;
+  }
+  if (sequences.size() < best_of) {
     CHECK(!sequences.empty());
     const auto& first_sequence = sequences.front();
     // if all prompt tokens are in kv cache, then expand
@@ -77,9 +115,15 @@ bool Request::should_expand_sequences() const {
 }
 
 void Request::expand_sequences() {
-  while (sequences.size() < num_seqs) {
-    add_sequence();
+  CHECK(!sequences.empty());
+  while (sequences.size() < best_of) {
+    // fork from the first sequence to share the kv cache blocks of prompt
+    fork_sequence(sequences.front());
   }
 }
 
+Sequence* Request::fork_sequence(const Sequence& parent) {
+  return &sequences.emplace_back(parent, this->prompt, sequence_options());
+}
+
 }  // namespace llm
@@ -2,13 +2,17 @@
 
 #include <cstdint>
 #include <deque>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "beam_group.h"
+#include "grammar/token_grammar.h"
 #include "sampling/parameters.h"
 #include "sequence.h"
 #include "status.h"
 #include "stopping_criteria.h"
+#include "tokenizer/tokenizer.h"
 
 namespace llm {
 
@@ -82,7 +86,8 @@ struct Request final {
           const std::string_view& prompt,
           const std::vector<int32_t>& prompt_tokens,
           size_t seq_capacity,
-          size_t num_seqs);
+          size_t n,
+          size_t best_of);
 
   void add_sequence();
 
@@ -94,8 +99,16 @@ struct Request final {
 
   bool should_expand_sequences() const;
 
+  // fork sequences from the first one to share the prompt kv cache
   void expand_sequences();
 
+  // fork a new sequence from the parent sharing the prompt kv cache
+  Sequence* fork_sequence(const Sequence& parent);
+
+  // set the tokenizer to decode the output text for stop strings, which is
+  // used in the thread checking the finish status of sequences.
+  void set_tokenizer(const Tokenizer* tokenizer);
+
   // The unique id of the request.
   // NOLINTNEXTLINE
   const std::string id;
@@ -108,9 +121,14 @@ struct Request final {
   // NOLINTNEXTLINE
   const std::string_view prompt;
 
+  // the number of sequences to return for the prompt.
+  // NOLINTNEXTLINE
+  const size_t n;
+
   // the number of sequences to generate completions for the prompt.
+  // the best n sequences ranked by cumulative logprob are returned.
   // NOLINTNEXTLINE
-  const size_t num_seqs;
+  const size_t best_of;
 
   // the token ids from request's prompt.
   // NOLINTNEXTLINE
@@ -132,9 +150,29 @@ struct Request final {
   // Whether to echo back the prompt in the output.
   bool echo = true;
 
+  // Whether to skip special tokens when decoding the output.
+  bool skip_special_tokens = true;
+
   // the priority of the request.
   RequestPriority priority = RequestPriority::MEDIUM;
 
+  // whether to use beam search with best_of beams.
+  bool use_beam_search = false;
+
+  // length penalty for beam search, the score of a finished beam is
+  // cumulative_logprob / (num_generated_tokens ^ length_penalty).
+  float length_penalty = 1.0f;
+
+  // the beam group for beam search, created with the first sequence.
+  std::unique_ptr<BeamGroup> beam_group;
+
+  // the grammar to constrain the generated tokens, null if unconstrained.
+  std::shared_ptr<const TokenGrammar> grammar;
+
+  // the tokenizer to decode the output text for stop strings, not owned.
+  // set by the scheduler with set_tokenizer().
+  const Tokenizer* tokenizer = nullptr;
+
   // list of sequences to generate completions for the prompt
   // use deque instead of vector to avoid no-copy move for Sequence
   std::deque<Sequence> sequences;
@@ -150,6 +188,10 @@ struct Request final {
 
   // function to check rpc health.
   IsRpcOK is_rpc_ok;
+
+ private:
+  // build the options for a new sequence of the request
+  Sequence::Options sequence_options();
 };
 
 // Compare two request contexts based on priority then scheduled time.
@@ -2,6 +2,7 @@
 
 #include <absl/strings/match.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
 #include <string>
@@ -36,20 +37,101 @@ Sequence::Sequence(const std::string_view& prompt,
     token_ids_[num_tokens_++] = token_id;
     token_to_count_map_[token_id]++;
   }
+
+  if (options_.grammar != nullptr) {
+    grammar_state_ = options_.grammar->start_state();
+  }
+  if (has_stop_strings()) {
+    stop_state_ = options_.stopping_criteria.stop_strings->start_state();
+    // skip the echoed prompt when matching stop strings
+    output_text_start_ = options_.echo ? prompt.size() : 0;
+  }
+  update_finish_status();
+}
+
+Sequence::Sequence(const Sequence& parent,
+                   const std::string_view& prompt,
+                   const Options& option)
+    : id_(next_id_.fetch_add(1)),
+      options_(option),
+      decoder_(prompt,
+               parent.num_prompt_tokens_,
+               option.echo,
+               option.skip_special_tokens),
+      num_prompt_tokens_(parent.num_prompt_tokens_),
+      num_kv_cache_tokens_(static_cast<size_t>(EngineType::COUNT), 0) {
+  CHECK_GE(parent.num_kv_cache_tokens(EngineType::LLM), num_prompt_tokens_)
+      << "only sequences finished prefill stage can be forked";
+  CHECK(!parent.blocks_.empty());
+
+  // copy the prompt tokens only, the generated tokens are discarded
+  token_ids_.resize(parent.token_ids_.size());
+  for (size_t i = 0; i < num_prompt_tokens_; ++i) {
+    const int32_t token_id = parent.token_ids_[i];
+    token_ids_[num_tokens_++] = token_id;
+    token_to_count_map_[token_id]++;
+  }
+
+  // share the blocks holding the prompt kv cache with the parent
+  const size_t block_size = parent.blocks_[0].size();
+  const size_t num_blocks = (num_prompt_tokens_ + block_size - 1) / block_size;
+  CHECK_LE(num_blocks, parent.blocks_.size());
+  blocks_.assign(parent.blocks_.begin(), parent.blocks_.begin() + num_blocks);
+
+  // recompute the last prompt token to sample the first token independently,
+  // which triggers a copy of the tail block if it is still shared.
+  std::fill(num_kv_cache_tokens_.begin(),
+            num_kv_cache_tokens_.end(),
+            num_prompt_tokens_ - 1);
+
+  if (options_.grammar != nullptr) {
+    grammar_state_ = options_.grammar->start_state();
+  }
+  if (has_stop_strings()) {
+    stop_state_ = options_.stopping_criteria.stop_strings->start_state();
+    // skip the echoed prompt when matching stop strings
+    output_text_start_ = options_.echo ? prompt.size() : 0;
+  }
+  update_finish_status();
 }
 
-void Sequence::append_token(int32_t token_id) {
+void Sequence::append_token(int32_t token_id, float logprob) {
   CHECK(num_tokens_ < token_ids_.size())
       << "exceed the token capacity of the sequence";
   CHECK(!is_finished_) << "cannot append token to a finished sequence";
   CHECK(!is_prefill_stage()) << "cannot append token to a prefill sequence";
 
+  const bool is_draft = engine_type_ == static_cast<size_t>(EngineType::SSM);
+  // advance the grammar, eos and stop tokens finish the sequence instead once
+  // the grammar is complete
+  if (options_.grammar != nullptr) {
+    const int32_t next_state =
+        options_.grammar->next_state(grammar_state_, token_id);
+    if (next_state != Dfa::kDeadState) {
+      grammar_state_ = next_state;
+    } else if (!is_draft && num_draft_tokens_ == 0 &&
+               !(options_.grammar->is_accepting(grammar_state_) &&
+                 is_stop_token(token_id))) {
+      // the token is rejected by the grammar, stop without appending it.
+      // draft and bonus tokens are left to the validation instead.
+      finish_reason_ = FinishReason::STOP;
+      is_finished_ = true;
+      return;
+    }
+  }
+
   // append the token id and update the token count
   token_ids_[num_tokens_++] = token_id;
   token_to_count_map_[token_id]++;
-
-  // invalidate the finish status once a new token is appended
-  finish_status_invalidated_ = true;
+  cumulative_logprob_ += logprob;
+
+  // draft tokens and the bonus token after them are checked once validated
+  // with the target model
+  if (is_draft) {
+    ++num_draft_tokens_;
+  } else if (num_draft_tokens_ == 0) {
+    update_finish_status();
+  }
 }
 
 size_t Sequence::validate_tokens(const Slice<int64_t>& accpeted_token_ids) {
@@ -85,9 +167,7 @@ size_t Sequence::validate_tokens(const Slice<int64_t>& accpeted_token_ids) {
     }
 
     // check if sequence is finished
-    const Slice<int32_t> token_ids(token_ids_, cur_idx + 1);
-    auto finish_reason = options_.stopping_criteria.check_finished(
-        token_ids, num_prompt_tokens_);
+    auto finish_reason = check_finished(cur_idx + 1);
     if (finish_reason != FinishReason::NONE) {
       finish_reason_ = finish_reason;
       is_finished_ = true;
@@ -109,16 +189,27 @@ size_t Sequence::validate_tokens(const Slice<int64_t>& accpeted_token_ids) {
   }
 
   CHECK_GT(num_accpeted, 0) << "no token accepted";
-
-  // the finish status is valid after the validation
-  finish_status_invalidated_ = false;
+  num_draft_tokens_ = 0;
   return num_accpeted;
 }
 
 // decode the sequence to get delta text using the tokenizer
 std::string Sequence::decode_delta_text(const Slice<int32_t>& token_ids,
                                         const Tokenizer& tokenizer) {
-  return decoder_.decode(token_ids, tokenizer);
+  if (!has_stop_strings()) {
+    return decoder_.decode(token_ids, tokenizer);
+  }
+
+  // the output text has been decoded when checking stop strings, hold back
+  // the text that may become a stop string until the sequence is finished.
+  size_t end = output_text_.size();
+  if (!is_finished_) {
+    end -= options_.stopping_criteria.stop_strings->partial_len(stop_state_);
+  }
+  end = std::max(end, num_output_bytes_);
+  auto delta = output_text_.substr(num_output_bytes_, end - num_output_bytes_);
+  num_output_bytes_ = end;
+  return delta;
 }
 
 void Sequence::append_blocks(const std::vector<Block>& new_blocks) {
@@ -158,6 +249,79 @@ void Sequence::release_blocks() {
   // reset the kv cache position to 0
   std::fill(num_kv_cache_tokens_.begin(), num_kv_cache_tokens_.end(), 0);
   blocks_.clear();
+  // drop pending copies since the kv cache would be recomputed
+  block_copies_.clear();
+}
+
+void Sequence::assign_beam(const Sequence& beam) {
+  CHECK(this != &beam);
+  CHECK_EQ(num_prompt_tokens_, beam.num_prompt_tokens_);
+  CHECK_LE(beam.num_tokens_, token_ids_.size());
+
+  std::copy(beam.token_ids_.begin(),
+            beam.token_ids_.begin() + beam.num_tokens_,
+            token_ids_.begin());
+  num_tokens_ = beam.num_tokens_;
+  token_to_count_map_ = beam.token_to_count_map_;
+  num_kv_cache_tokens_ = beam.num_kv_cache_tokens_;
+  // share all blocks, the tail block would be copied on next write
+  blocks_ = beam.blocks_;
+  block_copies_.clear();
+  cumulative_logprob_ = beam.cumulative_logprob_;
+  grammar_state_ = beam.grammar_state_;
+  decoder_ = beam.decoder_;
+  output_text_ = beam.output_text_;
+  num_output_bytes_ = beam.num_output_bytes_;
+  stop_state_ = beam.stop_state_;
+
+  // beams are assigned from unfinished beams
+  is_finished_ = false;
+  finish_reason_ = FinishReason::NONE;
+}
+
+void Sequence::prune_beam() {
+  release_blocks();
+  is_finished_ = true;
+}
+
+bool Sequence::is_stop_token(int32_t token_id) const {
+  const auto& stopping_criteria = options_.stopping_criteria;
+  return token_id == stopping_criteria.eos_token_id ||
+         stopping_criteria.stop_token_ids.count(token_id) > 0;
+}
+
+void Sequence::fill_allowed_tokens(uint32_t* bitmask, size_t num_words) const {
+  CHECK(options_.grammar != nullptr);
+  const auto& allowed_tokens = options_.grammar->allowed_tokens(grammar_state_);
+  const size_t n_words = std::min(num_words, allowed_tokens.size());
+  std::copy(allowed_tokens.begin(), allowed_tokens.begin() + n_words, bitmask);
+  std::fill(bitmask + n_words, bitmask + num_words, 0);
+
+  // allow to stop once the grammar is complete
+  if (options_.grammar->is_accepting(grammar_state_)) {
+    const auto& stopping_criteria = options_.stopping_criteria;
+    auto allow_token = [&](int32_t token_id) {
+      if (token_id >= 0 && static_cast<size_t>(token_id) < num_words * 32) {
+        bitmask[token_id / 32] |= (1u << (token_id % 32));
+      }
+    };
+    allow_token(stopping_criteria.eos_token_id);
+    for (const int32_t token_id : stopping_criteria.stop_token_ids) {
+      allow_token(token_id);
+    }
+  }
+}
+
+void Sequence::copy_on_write_block(size_t index, const Block& new_block) {
+  CHECK_LT(index, blocks_.size());
+  block_copies_.emplace_back(blocks_[index], new_block.id());
+  blocks_[index] = new_block;
+}
+
+std::vector<std::pair<Block, int32_t>> Sequence::take_block_copies() {
+  std::vector<std::pair<Block, int32_t>> block_copies;
+  block_copies.swap(block_copies_);
+  return block_copies;
 }
 
 size_t Sequence::kv_cache_capacity() const {
@@ -171,18 +335,22 @@ size_t Sequence::kv_cache_capacity() const {
 
 std::vector<int32_t> Sequence::kv_cache_slots(int32_t pos_start,
                                               int32_t pos_end) const {
-  CHECK(!blocks_.empty()) << "no cache blocks available";
+  std::vector<int32_t> slots(pos_end - pos_start);
+  kv_cache_slots(pos_start, pos_end, slots.data());
+  return slots;
+}
 
-  std::vector<int32_t> slots;
-  slots.reserve(pos_end - pos_start);
+void Sequence::kv_cache_slots(int32_t pos_start,
+                              int32_t pos_end,
+                              int32_t* slots) const {
+  CHECK(!blocks_.empty()) << "no cache blocks available";
 
   const size_t block_size = blocks_[0].size();
   for (int32_t i = pos_start; i < pos_end; ++i) {
     const int32_t block_id = blocks_[i / block_size].id();
     const int32_t block_offset = i % block_size;
-    slots.push_back(block_id * block_size + block_offset);
+    slots[i - pos_start] = block_id * block_size + block_offset;
   }
-  return slots;
 }
 
 void Sequence::stream_delta(const SequenceDeltaOutput& output) {
@@ -198,21 +366,38 @@ bool Sequence::is_cancelled() const {
   return is_cancelled_.load(std::memory_order_relaxed);
 }
 
-bool Sequence::is_finished() const {
-  // return the cached finish status
-  if (!finish_status_invalidated_) {
-    return is_finished_;
-  }
+void Sequence::update_finish_status() {
+  finish_reason_ = check_finished(num_tokens_);
+  is_finished_ = finish_reason_ != FinishReason::NONE;
+}
 
-  // reset the finish status invalidation flag
-  finish_status_invalidated_ = false;
+FinishReason Sequence::check_finished(size_t num_tokens) {
+  const Slice<int32_t> token_ids(token_ids_, num_tokens);
+  // check stop strings first to truncate the output text at the stop string,
+  // only the generated text can match
+  if (has_stop_strings() && num_tokens > num_prompt_tokens_ &&
+      check_stop_strings(token_ids)) {
+    return FinishReason::STOP;
+  }
+  return options_.stopping_criteria.check_finished(token_ids,
+                                                   num_prompt_tokens_);
+}
 
-  auto finish_reason = options_.stopping_criteria.check_finished(
-      token_ids(), num_prompt_tokens_);
-  if (finish_reason != FinishReason::NONE) {
-    finish_reason_ = finish_reason;
-    is_finished_ = true;
-    return true;
+bool Sequence::check_stop_strings(const Slice<int32_t>& token_ids) {
+  const auto& stop_strings = options_.stopping_criteria.stop_strings;
+  CHECK(options_.tokenizer != nullptr) << "no tokenizer for stop strings";
+  // only the new text since last check is matched
+  size_t pos = std::max(output_text_.size(), output_text_start_);
+  output_text_ += decoder_.decode(token_ids, *options_.tokenizer);
+  for (; pos < output_text_.size(); ++pos) {
+    stop_state_ = stop_strings->next_state(
+        stop_state_, static_cast<uint8_t>(output_text_[pos]));
+    const size_t match_len = stop_strings->match_len(stop_state_);
+    if (match_len > 0) {
+      // exclude the stop string and the text after it from the output
+      output_text_.resize(pos + 1 - match_len);
+      return true;
+    }
   }
   return false;
 }
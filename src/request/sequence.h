@@ -3,10 +3,13 @@
 #include <atomic>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "common/slice.h"
+#include "grammar/token_grammar.h"
 #include "incremental_decoder.h"
 #include "memory/block.h"
 #include "sampling/parameters.h"
@@ -23,6 +26,9 @@ struct SequenceDeltaOutput {
 
 using OnDelta = std::function<bool(const SequenceDeltaOutput& output)>;
 
+// forward declaration
+class BeamGroup;
+
 // The sequence is shared between LLM and SSM for speculative decoding, and
 // it's possible that the numbers of tokens in kv cache are out of sync.
 // Specifying the engine type to ensure accurate updating of the the number
@@ -56,6 +62,17 @@ class Sequence final {
 
     // the callback function to call when new tokens are generated
     OnDelta on_delta = nullptr;
+
+    // the beam group the sequence belongs to, null if beam search is disabled
+    BeamGroup* beam_group = nullptr;
+
+    // the grammar to constrain the generated tokens, null if unconstrained
+    std::shared_ptr<const TokenGrammar> grammar;
+
+    // the tokenizer to decode the output text for stop strings, not owned.
+    // required to append tokens if stop strings are specified in the stopping
+    // criteria.
+    const Tokenizer* tokenizer = nullptr;
   };
 
   Sequence(const std::string_view& prompt,
@@ -63,6 +80,13 @@ class Sequence final {
            size_t capacity,
            const Options& option);
 
+  // fork a new sequence from the parent that has finished the prefill stage.
+  // all kv cache blocks of the prompt, including the partial tail block, are
+  // shared with the parent and copied on the first divergent write.
+  Sequence(const Sequence& parent,
+           const std::string_view& prompt,
+           const Options& option);
+
   // get the id of the sequence
   int64_t id() const { return id_; }
 
@@ -80,6 +104,9 @@ class Sequence final {
   // get the number of prompt tokens
   size_t num_prompt_tokens() const { return num_prompt_tokens_; }
 
+  // get the max number of tokens the sequence can hold
+  size_t capacity() const { return token_ids_.size(); }
+
   // get the number of generated tokens
   // returns 0 if still in prefill stage
   size_t num_generated_tokens() const {
@@ -117,6 +144,9 @@ class Sequence final {
   // generate the kv cache slots for the position range [pos_start, pos_end)
   std::vector<int32_t> kv_cache_slots(int32_t pos_start, int32_t pos_end) const;
 
+  // write the kv cache slots for the position range into the slots buffer
+  void kv_cache_slots(int32_t pos_start, int32_t pos_end, int32_t* slots) const;
+
   // get the number of tokens to process
   size_t num_tokens_to_process() const {
     return num_tokens() - num_kv_cache_tokens();
@@ -127,9 +157,15 @@ class Sequence final {
     return num_kv_cache_tokens() < num_prompt_tokens();
   }
 
-  // add a new token id to the sequence and update the count
+  // add a new token id to the sequence and update the count and the finish
+  // status, decoding the output text to match stop strings if any. with draft
+  // tokens, the finish status is updated by validate_tokens instead.
+  // a token rejected by the grammar stops the sequence without being appended.
   // the token would be discarded if the sequence is still in prefill stage
-  void append_token(int32_t token_id);
+  void append_token(int32_t token_id, float logprob = 0.0f);
+
+  // get the cumulative log probability of the generated tokens
+  float cumulative_logprob() const { return cumulative_logprob_; }
 
   // validate draft tokens with accepted tokens for speculative decoding
   // N.B. take int64_t as input to be compatible with torch::Tensor
@@ -148,6 +184,30 @@ class Sequence final {
   // release all cache blocks
   void release_blocks();
 
+  // replace the state with another beam of the same request, including the
+  // token ids and kv cache blocks, which are shared with the other beam.
+  void assign_beam(const Sequence& beam);
+
+  // stop the beam and release its cache blocks
+  void prune_beam();
+
+  // get the beam group the sequence belongs to
+  BeamGroup* beam_group() const { return options_.beam_group; }
+
+  // get the grammar constraining the generated tokens, null if unconstrained
+  const TokenGrammar* grammar() const { return options_.grammar.get(); }
+
+  // fill the packed bitmask of tokens allowed by the grammar for the next
+  // token, including eos and stop tokens once the grammar is complete.
+  void fill_allowed_tokens(uint32_t* bitmask, size_t num_words) const;
+
+  // replace the shared block at index with a new block, the kv cache content
+  // would be copied from the shared block before next forward pass
+  void copy_on_write_block(size_t index, const Block& new_block);
+
+  // take the pending block copies, returns a list of (src block, dst block id)
+  std::vector<std::pair<Block, int32_t>> take_block_copies();
+
   // returns allocated cache blocks
   Slice<Block> blocks() const { return blocks_; }
 
@@ -159,9 +219,24 @@ class Sequence final {
 
   // decode the tokens till end to get delta text using the tokenizer
   // not thread safe
+  // N.B. with stop strings, the output text has been decoded when appending
+  // tokens, the text before any potential stop string is returned, so it
+  // should be called on the thread appending tokens if the sequence is not
+  // finished yet.
   std::string decode_delta_text(const Slice<int32_t>& token_ids,
                                 const Tokenizer& tokenizer);
 
+  // check if stop strings are matched against the output text
+  bool has_stop_strings() const {
+    return options_.stopping_criteria.stop_strings != nullptr;
+  }
+
+  // set the tokenizer to decode the output text for stop strings, before any
+  // token is appended
+  void set_tokenizer(const Tokenizer* tokenizer) {
+    options_.tokenizer = tokenizer;
+  }
+
   // get the offset of output tokens
   size_t output_offset() const { return decoder_.output_offset(); }
 
@@ -175,8 +250,8 @@ class Sequence final {
   // check if the sequence is cancelled
   bool is_cancelled() const;
 
-  // check finish status, use cached value if not invalidated
-  bool is_finished() const;
+  // check finish status, updated when tokens are changed
+  bool is_finished() const { return is_finished_; }
 
   // set engine type this sequence is used for
   void set_engine_type(EngineType engine_type) {
@@ -191,6 +266,13 @@ class Sequence final {
     num_kv_cache_tokens += size;
   }
 
+  // rollback the kv cache by n tokens to recompute them
+  void rollback_kv_cache(size_t size) {
+    size_t& num_kv_cache_tokens = num_kv_cache_tokens_[engine_type_];
+    CHECK(num_kv_cache_tokens >= size);
+    num_kv_cache_tokens -= size;
+  }
+
   // get the sampling parameters
   const SamplingParameter* sampling_param() const {
     return &options_.sampling_param;
@@ -202,13 +284,29 @@ class Sequence final {
   }
 
  private:
+  // check if the token is an eos or stop token, allowed once the grammar is
+  // complete
+  bool is_stop_token(int32_t token_id) const;
+
+  // check the finish status of the first num_tokens tokens, matching stop
+  // strings against the generated text decoded so far
+  FinishReason check_finished(size_t num_tokens);
+
+  // update the finish status with all tokens of the sequence
+  void update_finish_status();
+
+  // decode the output text of the token ids and match it against the stop
+  // strings, the text is truncated at the first stop string if found.
+  bool check_stop_strings(const Slice<int32_t>& token_ids);
+
   // global unique id for the sequence
   const int64_t id_;
 
   // options for the sequence
   Options options_;
 
-  // incremental decoder to decode the tokens
+  // incremental decoder to decode the tokens, which decodes the output text
+  // when tokens are appended if stop strings are specified.
   IncrementalDecoder decoder_;
 
   // token ids generated for the sequence
@@ -231,17 +329,39 @@ class Sequence final {
   // physical blocks that hold the kv cache.
   std::vector<Block> blocks_;
 
+  // pending (src block, dst block id) copies for copy-on-write, the src block
+  // is held until the copy is done to avoid being reused by other sequences.
+  std::vector<std::pair<Block, int32_t>> block_copies_;
+
+  // the cumulative log probability of the generated tokens
+  float cumulative_logprob_ = 0.0f;
+
+  // number of draft tokens appended since the last validation
+  size_t num_draft_tokens_ = 0;
+
+  // the state of the grammar after the generated tokens
+  int32_t grammar_state_ = 0;
+
+  // the output text decoded for stop strings, including the echoed prompt
+  std::string output_text_;
+
+  // the start of the generated text in output_text_ to match stop strings
+  size_t output_text_start_ = 0;
+
+  // the number of bytes of output_text_ returned by decode_delta_text
+  size_t num_output_bytes_ = 0;
+
+  // the state of the stop string matcher after the output text
+  int32_t stop_state_ = 0;
+
   // is the sequence cancelled
   std::atomic_bool is_cancelled_{false};
 
   // is the sequence finished
-  mutable bool is_finished_ = false;
-
-  // is the finish status invalidated
-  mutable bool finish_status_invalidated_ = true;
+  bool is_finished_ = false;
 
   // the reason why the sequence is finished
-  mutable FinishReason finish_reason_ = FinishReason::NONE;
+  FinishReason finish_reason_ = FinishReason::NONE;
 
   // id allocator for sequences
   // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
@@ -3,10 +3,70 @@
 #include <absl/time/clock.h>
 #include <gtest/gtest.h>
 
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "grammar/dfa.h"
+#include "grammar/token_grammar.h"
 #include "memory/block.h"
+#include "stop_string_matcher.h"
+#include "tokenizer/tokenizer.h"
 
 namespace llm {
 namespace {
+// a tokenizer decoding each token into bytes, a partial utf-8 character at
+// the end is decoded as the replacement character, like byte fallback tokens.
+class FakeTokenizer : public Tokenizer {
+ public:
+  explicit FakeTokenizer(std::unordered_map<int32_t, std::string> pieces)
+      : pieces_(std::move(pieces)) {}
+
+  bool encode(const std::string_view& /*text*/,
+              std::vector<int32_t>* /*ids*/) const override {
+    return false;
+  }
+
+  std::string decode(const Slice<int32_t>& tokens,
+                     bool /*skip_special_tokens*/) const override {
+    std::string text;
+    for (const int32_t token : tokens) {
+      auto it = pieces_.find(token);
+      if (it != pieces_.end()) {
+        text += it->second;
+      }
+    }
+    // find the start of the last character and check if it is complete
+    size_t start = text.size();
+    while (start > 0 &&
+           (static_cast<uint8_t>(text[start - 1]) & 0xC0) == 0x80) {
+      --start;
+    }
+    if (start > 0) {
+      const auto lead = static_cast<uint8_t>(text[start - 1]);
+      const size_t len = lead >= 0xF0   ? 4
+                         : lead >= 0xE0 ? 3
+                         : lead >= 0xC0 ? 2
+                                        : 1;
+      if (text.size() - (start - 1) < len) {
+        text.resize(start - 1);
+        text += "\xEF\xBF\xBD";
+      }
+    }
+    return text;
+  }
+
+  size_t vocab_size() const override { return pieces_.size(); }
+
+  std::unique_ptr<Tokenizer> clone() const override {
+    return std::make_unique<FakeTokenizer>(pieces_);
+  }
+
+ private:
+  std::unordered_map<int32_t, std::string> pieces_;
+};
+
 void run_speculative_decoding(Sequence& sequence,
                               const std::vector<int32_t>& draft_token_ids,
                               const int32_t bonus_token_id,
@@ -175,6 +235,42 @@ TEST(SequenceTest, DiscardTokenIds) {
   EXPECT_EQ(sequence.token_ids(), desired_tokens);
 }
 
+TEST(SequenceTest, Fork) {
+  std::vector<int32_t> prompt_tokens = {1, 2, 4};
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 100;
+  Sequence parent(/*prompt=*/"", prompt_tokens, /*capacity=*/200, options);
+  parent.append_block({/*id=*/1, /*size=*/2});
+  parent.append_block({/*id=*/2, /*size=*/2});
+  parent.append_block({/*id=*/3, /*size=*/2});
+  parent.commit_kv_cache(prompt_tokens.size());
+  parent.append_token(40, /*logprob=*/-0.5f);
+  parent.append_token(50, /*logprob=*/-1.5f);
+  EXPECT_FLOAT_EQ(parent.cumulative_logprob(), -2.0f);
+
+  Sequence child(parent, /*prompt=*/"", options);
+  EXPECT_NE(child.id(), parent.id());
+  // only prompt tokens are forked
+  EXPECT_EQ(child.token_ids(), prompt_tokens);
+  EXPECT_EQ(child.num_generated_tokens(), 0);
+  EXPECT_FLOAT_EQ(child.cumulative_logprob(), 0.0f);
+  // only blocks holding the prompt are shared
+  ASSERT_EQ(child.num_blocks(), 2);
+  EXPECT_EQ(child.blocks()[0].id(), 1);
+  EXPECT_EQ(child.blocks()[1].id(), 2);
+  // the last prompt token is recomputed to sample the first token
+  EXPECT_EQ(child.num_kv_cache_tokens(EngineType::LLM), 2);
+  EXPECT_EQ(child.num_kv_cache_tokens(EngineType::SSM), 2);
+  EXPECT_TRUE(child.is_prefill_stage());
+  EXPECT_EQ(child.num_tokens_to_process(), 1);
+
+  child.commit_kv_cache(1);
+  child.append_token(60, /*logprob=*/-0.25f);
+  EXPECT_FLOAT_EQ(child.cumulative_logprob(), -0.25f);
+  const std::vector<int32_t> desired_tokens = {1, 2, 4, 60};
+  EXPECT_EQ(child.token_ids(), desired_tokens);
+}
+
 TEST(SequenceTest, SpeculativeBasic) {
   // test scenarios speculative decoding
   std::vector<int32_t> prompt_tokens = {1, 2, 4};
@@ -400,4 +496,126 @@ TEST(SequenceTest, SpeculativeStopEosTokenId) {
             desired_tokens.size() - 1);
 }
 
+TEST(SequenceTest, StopStrings) {
+  // "世" is split into two tokens: {0xE4 0xB8} and {0x96 + "界"}
+  FakeTokenizer tokenizer({{10, "Hello"},
+                           {11, "\xE4\xB8"},
+                           {12, "\x96\xE7\x95\x8C"},
+                           {13, "!"}});
+  std::vector<int32_t> prompt_tokens = {1, 2, 4};
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 100;
+  options.stopping_criteria.stop_strings = std::make_shared<StopStringMatcher>(
+      std::vector<std::string>{"世界", "lo!"});
+  options.tokenizer = &tokenizer;
+  Sequence sequence(/*prompt=*/"", prompt_tokens, /*capacity=*/20, options);
+  sequence.append_block({/*id=*/0, /*size=*/20});
+  sequence.commit_kv_cache(prompt_tokens.size());
+
+  sequence.append_token(10);
+  EXPECT_FALSE(sequence.is_finished());
+  // "lo" is held back since it may become "lo!"
+  EXPECT_EQ(sequence.decode_delta_text(sequence.token_ids(), tokenizer), "Hel");
+
+  // partial utf-8 character is not decoded yet
+  sequence.append_token(11);
+  EXPECT_FALSE(sequence.is_finished());
+  EXPECT_EQ(sequence.decode_delta_text(sequence.token_ids(), tokenizer), "");
+
+  sequence.append_token(12);
+  EXPECT_TRUE(sequence.is_finished());
+  EXPECT_EQ(sequence.finish_reason(), FinishReason::STOP);
+  // the output is truncated before the stop string
+  EXPECT_EQ(sequence.decode_delta_text(sequence.token_ids(), tokenizer), "lo");
+}
+
+TEST(SequenceTest, StopStringsFinishStatus) {
+  FakeTokenizer tokenizer({{10, "a"}, {11, "b"}});
+  std::vector<int32_t> prompt_tokens = {1, 2, 4};
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 100;
+  options.stopping_criteria.stop_strings =
+      std::make_shared<StopStringMatcher>(std::vector<std::string>{"ab"});
+  Sequence sequence(/*prompt=*/"", prompt_tokens, /*capacity=*/20, options);
+  sequence.append_block({/*id=*/0, /*size=*/20});
+  sequence.commit_kv_cache(prompt_tokens.size());
+
+  // the finish status is read without decoding, before the tokenizer is set
+  EXPECT_FALSE(sequence.is_finished());
+  EXPECT_EQ(sequence.finish_reason(), FinishReason::NONE);
+
+  // stop strings are matched when tokens are appended
+  sequence.set_tokenizer(&tokenizer);
+  sequence.append_token(10);
+  EXPECT_FALSE(sequence.is_finished());
+  sequence.commit_kv_cache(1);
+  sequence.append_token(11);
+  EXPECT_TRUE(sequence.is_finished());
+  EXPECT_EQ(sequence.finish_reason(), FinishReason::STOP);
+}
+
+TEST(SequenceTest, GrammarRejectedToken) {
+  auto vocab =
+      std::make_shared<TokenVocab>(std::vector<std::string>{"a", "b", "c", ""});
+  std::string error;
+  auto dfa = Dfa::compile("ab", &error);
+  ASSERT_NE(dfa, nullptr) << error;
+
+  std::vector<int32_t> prompt_tokens = {1, 2, 4};
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 100;
+  options.stopping_criteria.eos_token_id = 3;
+  options.grammar = std::make_shared<TokenGrammar>(std::move(dfa), vocab);
+
+  // a token rejected by the grammar stops the sequence without being appended
+  Sequence sequence(/*prompt=*/"", prompt_tokens, /*capacity=*/20, options);
+  sequence.append_block({/*id=*/0, /*size=*/20});
+  sequence.commit_kv_cache(prompt_tokens.size());
+  sequence.append_token(0);
+  EXPECT_FALSE(sequence.is_finished());
+  sequence.commit_kv_cache(1);
+  sequence.append_token(2);
+  EXPECT_TRUE(sequence.is_finished());
+  EXPECT_EQ(sequence.finish_reason(), FinishReason::STOP);
+  EXPECT_EQ(sequence.num_tokens(), prompt_tokens.size() + 1);
+  EXPECT_EQ(sequence.token_ids().back(), 0);
+
+  // the eos token is appended once the grammar is complete
+  Sequence complete(/*prompt=*/"", prompt_tokens, /*capacity=*/20, options);
+  complete.append_block({/*id=*/0, /*size=*/20});
+  complete.commit_kv_cache(prompt_tokens.size());
+  complete.append_token(0);
+  complete.commit_kv_cache(1);
+  complete.append_token(1);
+  EXPECT_FALSE(complete.is_finished());
+  complete.commit_kv_cache(1);
+  complete.append_token(3);
+  EXPECT_TRUE(complete.is_finished());
+  EXPECT_EQ(complete.num_tokens(), prompt_tokens.size() + 3);
+  EXPECT_EQ(complete.token_ids().back(), 3);
+}
+
+TEST(SequenceTest, SpeculativeStopStrings) {
+  FakeTokenizer tokenizer({{10, "a"}, {11, "b"}, {12, "c"}, {13, "d"}});
+  std::vector<int32_t> prompt_tokens = {1, 2, 4};
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 100;
+  options.stopping_criteria.stop_strings =
+      std::make_shared<StopStringMatcher>(std::vector<std::string>{"bc"});
+  options.tokenizer = &tokenizer;
+  Sequence sequence(/*prompt=*/"", prompt_tokens, /*capacity=*/200, options);
+  sequence.append_block({/*id=*/0, /*size=*/200});
+
+  // draft tokens {a, b, c, d} are fully accepted, stop at "bc"
+  run_speculative_decoding(sequence,
+                           /*draft_token_ids=*/{10, 11, 12, 13},
+                           /*bonus_token_id=*/13,
+                           /*resample_token_id=*/-1,
+                           /*num_accepted_tokens=*/4);
+  EXPECT_EQ(sequence.finish_reason(), FinishReason::STOP);
+  const std::vector<int32_t> desired_tokens = {1, 2, 4, 10, 11, 12};
+  EXPECT_EQ(sequence.token_ids(), desired_tokens);
+  EXPECT_EQ(sequence.decode_delta_text(sequence.token_ids(), tokenizer), "a");
+}
+
 }  // namespace llm
@@ -0,0 +1,104 @@
+#include "stop_string_matcher.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace llm {
+
+StopStringMatcher::StopStringMatcher(
+    const std::vector<std::string>& stop_strings) {
+  // build the trie of stop strings
+  nodes_.emplace_back();
+  for (const auto& stop_string : stop_strings) {
+    int32_t state = 0;
+    for (const char c : stop_string) {
+      const auto byte = static_cast<uint8_t>(c);
+      int32_t next = child(state, byte);
+      if (next < 0) {
+        next = static_cast<int32_t>(nodes_.size());
+        nodes_.emplace_back();
+        nodes_[next].depth = nodes_[state].depth + 1;
+        auto& children = nodes_[state].children;
+        children.insert(
+            std::upper_bound(children.begin(),
+                             children.end(),
+                             std::make_pair(byte, int32_t{-1})),
+            {byte, next});
+      }
+      state = next;
+    }
+    // the root is never a match, which ignores empty stop strings
+    if (state != 0) {
+      nodes_[state].match_len = nodes_[state].depth;
+    }
+  }
+
+  // the root transitions are dense, missing bytes loop back to the root
+  root_next_.fill(0);
+  for (const auto& [byte, next] : nodes_[0].children) {
+    root_next_[byte] = next;
+  }
+
+  // compute fail links in bfs order so that the fail node of a node is always
+  // processed before the node itself.
+  std::queue<int32_t> queue;
+  for (const auto& [byte, next] : nodes_[0].children) {
+    nodes_[next].fail = 0;
+    queue.push(next);
+  }
+  while (!queue.empty()) {
+    const int32_t state = queue.front();
+    queue.pop();
+    for (const auto& [byte, next] : nodes_[state].children) {
+      auto& node = nodes_[next];
+      node.fail = next_state(nodes_[state].fail, byte);
+      // inherit the longest match ending at the fail node
+      if (node.match_len == 0) {
+        node.match_len = nodes_[node.fail].match_len;
+      }
+      queue.push(next);
+    }
+  }
+}
+
+int32_t StopStringMatcher::child(int32_t state, uint8_t byte) const {
+  const auto& children = nodes_[state].children;
+  for (const auto& [child_byte, next] : children) {
+    if (child_byte == byte) {
+      return next;
+    }
+  }
+  return -1;
+}
+
+int32_t StopStringMatcher::next_state(int32_t state, uint8_t byte) const {
+  DCHECK(state >= 0 && static_cast<size_t>(state) < nodes_.size());
+  while (state != 0) {
+    const int32_t next = child(state, byte);
+    if (next >= 0) {
+      return next;
+    }
+    state = nodes_[state].fail;
+  }
+  return root_next_[byte];
+}
+
+size_t StopStringMatcher::find(const std::string_view& text, size_t pos) const {
+  int32_t state = start_state();
+  for (; pos < text.size(); ++pos) {
+    state = next_state(state, static_cast<uint8_t>(text[pos]));
+    const size_t len = match_len(state);
+    if (len > 0) {
+      return pos + 1 - len;
+    }
+  }
+  return std::string_view::npos;
+}
+
+}  // namespace llm
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace llm {
+
+// An Aho-Corasick automaton over the bytes of stop strings, used to find stop
+// strings in the output text incrementally as it is decoded. The state of the
+// matcher is a node of the automaton that is advanced byte by byte, which is
+// amortized O(1) per byte regardless of the number of stop strings. Since the
+// text is matched byte by byte, stop strings are found across token and utf-8
+// character boundaries. immutable and thread safe once constructed.
+class StopStringMatcher final {
+ public:
+  // empty stop strings are ignored
+  explicit StopStringMatcher(const std::vector<std::string>& stop_strings);
+
+  // get the start state of the matcher
+  int32_t start_state() const { return 0; }
+
+  // get the state after the byte
+  int32_t next_state(int32_t state, uint8_t byte) const;
+
+  // get the length of the longest stop string ending at the state, 0 if none
+  size_t match_len(int32_t state) const { return nodes_[state].match_len; }
+
+  // get the length of the longest suffix of the text matched so far that is a
+  // prefix of a stop string, which should be held back from streaming since
+  // it may become a stop string.
+  size_t partial_len(int32_t state) const { return nodes_[state].depth; }
+
+  // find the first stop string in the text starting from pos, returns the
+  // start position of the stop string, or npos if not found.
+  size_t find(const std::string_view& text, size_t pos = 0) const;
+
+  // get the number of states
+  size_t num_states() const { return nodes_.size(); }
+
+ private:
+  struct Node {
+    // transitions to children, sorted by byte
+    std::vector<std::pair<uint8_t, int32_t>> children;
+
+    // the node of the longest proper suffix that is also in the automaton
+    int32_t fail = 0;
+
+    // the length of the prefix represented by the node
+    uint32_t depth = 0;
+
+    // the length of the longest stop string that is a suffix of the prefix
+    uint32_t match_len = 0;
+  };
+
+  // get the child of the node with the byte, -1 if not found
+  int32_t child(int32_t state, uint8_t byte) const;
+
+  std::vector<Node> nodes_;
+
+  // dense transitions of the root, to stop following fail links at the root
+  std::array<int32_t, 256> root_next_{};
+};
+
+}  // namespace llm
@@ -0,0 +1,91 @@
+#include "stop_string_matcher.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace llm {
+
+namespace {
+// feed the text chunk by chunk, returns the start of the first stop string
+size_t match(const StopStringMatcher& matcher,
+             const std::vector<std::string>& chunks) {
+  int32_t state = matcher.start_state();
+  size_t pos = 0;
+  for (const auto& chunk : chunks) {
+    for (const char c : chunk) {
+      state = matcher.next_state(state, static_cast<uint8_t>(c));
+      ++pos;
+      const size_t len = matcher.match_len(state);
+      if (len > 0) {
+        return pos - len;
+      }
+    }
+  }
+  return std::string::npos;
+}
+}  // namespace
+
+TEST(StopStringMatcherTest, Find) {
+  StopStringMatcher matcher({"he", "she", "his", "hers", ""});
+  EXPECT_EQ(matcher.find("ushers"), 1);
+  EXPECT_EQ(matcher.find("ahishers"), 1);
+  EXPECT_EQ(matcher.find("xxhxex"), std::string::npos);
+  EXPECT_EQ(matcher.find(""), std::string::npos);
+  // the longest stop string ending at the first match is used
+  StopStringMatcher overlap({"bc", "abc"});
+  EXPECT_EQ(overlap.find("xabcd"), 1);
+  // start matching from pos
+  EXPECT_EQ(matcher.find("he said", 1), std::string::npos);
+}
+
+TEST(StopStringMatcherTest, AcrossChunks) {
+  StopStringMatcher matcher({"\n\nUser:", "</s>", "###"});
+  EXPECT_EQ(match(matcher, {"Hello", "\n", "\nUs", "er", ":"}), 5);
+  EXPECT_EQ(match(matcher, {"a#", "#b", "##", "#"}), 4);
+  EXPECT_EQ(match(matcher, {"</", "s", ">"}), 0);
+  EXPECT_EQ(match(matcher, {"\n\nUser", " said"}), std::string::npos);
+}
+
+TEST(StopStringMatcherTest, Utf8) {
+  // "世界" and "🙂" in multi-byte utf-8
+  StopStringMatcher matcher({"世界", "🙂"});
+  const std::string text = "你好, 世界!";
+  const size_t expected = text.find("世界");
+  // split at every byte position, including the middle of characters
+  for (size_t i = 0; i <= text.size(); ++i) {
+    EXPECT_EQ(match(matcher, {text.substr(0, i), text.substr(i)}), expected);
+  }
+  EXPECT_EQ(match(matcher, {"ok \xF0\x9F", "\x99", "\x82"}), 3);
+  // a different character sharing the leading bytes
+  EXPECT_EQ(matcher.find("世间"), std::string::npos);
+  EXPECT_EQ(matcher.find("\xF0\x9F\x99\x83"), std::string::npos);
+}
+
+TEST(StopStringMatcherTest, PartialLen) {
+  StopStringMatcher matcher({"abcd", "bce"});
+  int32_t state = matcher.start_state();
+  const std::string text = "xabc";
+  const std::vector<size_t> expected = {0, 1, 2, 3};
+  for (size_t i = 0; i < text.size(); ++i) {
+    state = matcher.next_state(state, text[i]);
+    EXPECT_EQ(matcher.partial_len(state), expected[i]);
+    EXPECT_EQ(matcher.match_len(state), 0);
+  }
+  // "abce" falls back to "bce"
+  state = matcher.next_state(state, 'e');
+  EXPECT_EQ(matcher.match_len(state), 3);
+}
+
+TEST(StopStringMatcherTest, ManyStopStrings) {
+  std::vector<std::string> stop_strings;
+  for (int i = 0; i < 64; ++i) {
+    stop_strings.push_back("<stop" + std::to_string(i) + ">");
+  }
+  StopStringMatcher matcher(stop_strings);
+  EXPECT_EQ(matcher.find("text <stop6 <stop63>"), 12);
+  EXPECT_EQ(matcher.find("text <stop64>"), std::string::npos);
+}
+
+}  // namespace llm
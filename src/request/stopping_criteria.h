@@ -1,10 +1,12 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <unordered_set>
 #include <vector>
 
 #include "common/slice.h"
+#include "stop_string_matcher.h"
 
 namespace llm {
 
@@ -42,6 +44,10 @@ struct StoppingCriteria {
   // stop sequences
   std::vector<std::vector<int32_t>> stop_sequences;
 
+  // stop strings matched against the decoded output text, which is checked by
+  // the sequence since it requires the tokenizer to decode the output.
+  std::shared_ptr<const StopStringMatcher> stop_strings;
+
   // max context length
   size_t max_context_len = 0;
 };
@@ -11,7 +11,13 @@ std::unique_ptr<LogitsProcessor> LogitsProcessor::create(
 
   // construct logits processors based on the given parameters
   // always try to skip creating a processor if possible
-  if (params.frequency_penalties.defined()) {
+  if (params.allowed_token_bitmasks.defined()) {
+    processors.push_back(std::make_unique<AllowedTokensLogitsProcessor>(
+        params.constrained_token_idxes, params.allowed_token_bitmasks));
+  }
+
+  if (params.frequency_penalties.defined() ||
+      params.presence_penalties.defined()) {
     processors.push_back(
         std::make_unique<FrequencyPresencePenaltyLogitsProcessor>(
             params.frequency_penalties, params.presence_penalties));
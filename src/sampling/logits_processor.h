@@ -1,6 +1,7 @@
 #pragma once
 #include <torch/torch.h>
 
+#include <limits>
 #include <memory>
 #include <vector>
 
@@ -55,9 +56,11 @@ inline void apply_frequency_presence_penalty(
 }  // namespace detail
 
 // supported logits processors:
-// 1. frequency and presence penalty
-// 2. repetition penalty
-// 3. temperature
+// 1. allowed tokens for constrained decoding
+// 2. frequency and presence penalty
+// 3. repetition penalty
+// 4. temperature
+// 5. top_k and top_p
 
 // inspired by transformers LogistProcessor:
 // https://github.com/huggingface/transformers/blob/main/src/transformers/generation/logits_process.py#L44
@@ -111,6 +114,54 @@ class LogitsProcessorList : public LogitsProcessor {
   std::vector<std::unique_ptr<LogitsProcessor>> processors_;
 };
 
+// mask out tokens that are not allowed by grammars for constrained decoding.
+// the allowed tokens are given as packed bitmasks precomputed on host, which
+// are unpacked on device. tokens beyond the bitmasks are not allowed.
+class AllowedTokensLogitsProcessor : public LogitsProcessor {
+ public:
+  AllowedTokensLogitsProcessor(const torch::Tensor& token_idxes,
+                               const torch::Tensor& bitmasks) {
+    CHECK(token_idxes.defined() && bitmasks.defined());
+    CHECK_EQ(token_idxes.size(0), bitmasks.size(0));
+    token_idxes_ = token_idxes.to(torch::kLong);
+    // unpack bitmasks: [n_tokens, num_words] => [n_tokens, num_words * 32]
+    const auto shifts = torch::arange(32, bitmasks.options());
+    allowed_ = bitmasks.unsqueeze(-1)
+                   .bitwise_right_shift(shifts)
+                   .bitwise_and(1)
+                   .to(torch::kBool)
+                   .flatten(/*start_dim=*/1);
+  }
+
+  torch::Tensor forward(
+      const torch::Tensor& logits,
+      const torch::Tensor& /*unique_token_ids*/,
+      const torch::Tensor& /*unique_token_counts*/,
+      const torch::Tensor& /*unique_token_lens*/) const override {
+    const int64_t vocab_size = logits.size(-1);
+    const int64_t num_bits = allowed_.size(-1);
+    auto allowed = allowed_;
+    if (num_bits > vocab_size) {
+      allowed = allowed.slice(/*dim=*/1, /*start=*/0, /*end=*/vocab_size);
+    } else if (num_bits < vocab_size) {
+      allowed = torch::constant_pad_nd(allowed, {0, vocab_size - num_bits}, 0);
+    }
+
+    torch::Tensor logits_ = logits;
+    const float filter_value = -std::numeric_limits<float>::infinity();
+    auto constrained_logits = logits_.index_select(/*dim=*/0, token_idxes_);
+    constrained_logits.masked_fill_(allowed.logical_not(), filter_value);
+    logits_.index_copy_(/*dim=*/0, token_idxes_, constrained_logits);
+    return logits_;
+  }
+
+ private:
+  // [n_constrained_tokens] LongTensor
+  torch::Tensor token_idxes_;
+  // [n_constrained_tokens, num_words * 32] BoolTensor
+  torch::Tensor allowed_;
+};
+
 // https://platform.openai.com/docs/api-reference/parameter-details
 // The frequency and presence penalties can be used to reduce the likelihood of
 // sampling repetitive sequences of tokens. They work by directly modifying the
@@ -119,12 +170,19 @@ class LogitsProcessorList : public LogitsProcessor {
 // where c[j] is the number of times the token j has already appeared.
 class FrequencyPresencePenaltyLogitsProcessor : public LogitsProcessor {
  public:
+  // either penalty may be undefined, which is treated as zeros
   FrequencyPresencePenaltyLogitsProcessor(
       const torch::Tensor& frequency_penalties,
       const torch::Tensor& presence_penalties) {
-    CHECK(frequency_penalties.defined() && presence_penalties.defined());
-    frequency_penalties_ = frequency_penalties.unsqueeze(1);
-    presence_penalties_ = presence_penalties.unsqueeze(1);
+    CHECK(frequency_penalties.defined() || presence_penalties.defined());
+    frequency_penalties_ = frequency_penalties.defined()
+                               ? frequency_penalties
+                               : torch::zeros_like(presence_penalties);
+    presence_penalties_ = presence_penalties.defined()
+                              ? presence_penalties
+                              : torch::zeros_like(frequency_penalties);
+    frequency_penalties_ = frequency_penalties_.unsqueeze(1);
+    presence_penalties_ = presence_penalties_.unsqueeze(1);
   }
 
   torch::Tensor forward(const torch::Tensor& logits,
@@ -223,8 +281,12 @@ class TemperatureLogitsProcessor : public LogitsProcessor {
 // combine top_k and top_p sampling, apply top_k first then top_p
 class TopKTopPLogitsProcessor : public LogitsProcessor {
  public:
+  // vocab_idxes: optional [vocab_size] token ids to build top_k masks,
+  // which can be reused across steps
   TopKTopPLogitsProcessor(const torch::Tensor& top_k,
-                          const torch::Tensor& top_p) {
+                          const torch::Tensor& top_p,
+                          const torch::Tensor& vocab_idxes = {})
+      : vocab_idxes_(vocab_idxes) {
     CHECK(top_k.defined() || top_p.defined());
     if (top_k.defined()) {
       // [n_tokens, 1]
@@ -254,8 +316,12 @@ class TopKTopPLogitsProcessor : public LogitsProcessor {
     if (top_k_.defined()) {
       CHECK_EQ(logits.size(0), top_k_.size(0));
       const auto vocab_size = logits.size(-1);
-      auto top_k_mask = torch::arange(vocab_size, logits_sort.device())
-                            .expand_as(logits_sort);
+      const bool reuse_vocab_idxes =
+          vocab_idxes_.defined() && vocab_idxes_.numel() == vocab_size;
+      auto top_k_mask =
+          (reuse_vocab_idxes ? vocab_idxes_
+                             : torch::arange(vocab_size, logits_sort.device()))
+              .expand_as(logits_sort);
       top_k_mask = top_k_mask >= top_k_;
       // mask fill the values that are not in the top k
       logits_sort.masked_fill_(top_k_mask, filter_value);
@@ -281,5 +347,7 @@ class TopKTopPLogitsProcessor : public LogitsProcessor {
   torch::Tensor top_k_;
   // [n_tokens, 1]
   torch::Tensor top_p_;
+  // [vocab_size]
+  torch::Tensor vocab_idxes_;
 };
 }  // namespace llm
@@ -338,4 +338,47 @@ TEST(LogitsProcessorTest, TopP) {
   }
 }
 
+TEST(LogitsProcessorTest, AllowedTokens) {
+  torch::manual_seed(100);
+  torch::ScalarType dtype(torch::kFloat32);
+  torch::Device device(torch::kCPU);
+  const auto options = torch::dtype(dtype).device(device);
+
+  // the bitmasks only cover 64 tokens, the rest are not allowed
+  const int64_t batch_size = 3;
+  const int64_t vocab_size = 70;
+  const float filter_value = -std::numeric_limits<float>::infinity();
+
+  // only the first and the last sequences are constrained
+  const std::vector<std::vector<int32_t>> allowed_token_ids = {{0, 5, 31},
+                                                               {32, 63}};
+  std::vector<int32_t> bitmasks_vec(allowed_token_ids.size() * 2, 0);
+  for (size_t i = 0; i < allowed_token_ids.size(); ++i) {
+    for (const int32_t token_id : allowed_token_ids[i]) {
+      bitmasks_vec[i * 2 + token_id / 32] |=
+          static_cast<int32_t>(1u << (token_id % 32));
+    }
+  }
+  const auto bitmasks = torch::tensor(bitmasks_vec, torch::kInt).view({2, 2});
+  const auto token_idxes = torch::tensor({0, 2}, torch::kInt);
+  AllowedTokensLogitsProcessor processor(token_idxes, bitmasks);
+
+  const auto logits = torch::randn({batch_size, vocab_size}, options);
+  torch::Tensor token_ids;
+  torch::Tensor token_counts;
+  torch::Tensor tokens_ids_lens;
+  auto output = logits.clone();
+  output = processor(output, token_ids, token_counts, tokens_ids_lens);
+
+  auto desired_logits = torch::full_like(logits, filter_value);
+  desired_logits[1] = logits[1];
+  for (size_t i = 0; i < allowed_token_ids.size(); ++i) {
+    const int64_t row = i == 0 ? 0 : 2;
+    for (const int32_t token_id : allowed_token_ids[i]) {
+      desired_logits[row][token_id] = logits[row][token_id];
+    }
+  }
+  EXPECT_TRUE(torch::equal(output, desired_logits));
+}
+
 }  // namespace llm
@@ -97,6 +97,10 @@ void SamplingParameters::init(
   }
   this->sample_idxes = torch::tensor(sample_idxes, torch::kInt);
   this->do_sample = torch::tensor(do_sample, torch::kBool);
+  this->all_random_sample = std::all_of(
+      do_sample.begin(), do_sample.end(), [](int32_t s) { return s != 0; });
+  this->all_greedy_sample = std::none_of(
+      do_sample.begin(), do_sample.end(), [](int32_t s) { return s != 0; });
 }
 
 }  // namespace llm
@@ -2,6 +2,7 @@
 #include <torch/torch.h>
 
 #include <cstdint>
+#include <future>
 #include <vector>
 
 #include "common/tensor_helper.h"
@@ -58,6 +59,17 @@ struct SamplingParameters {
 
     params.sample_idxes = safe_to(sample_idxes, device);
     params.do_sample = safe_to(do_sample, device);
+    params.all_random_sample = all_random_sample;
+    params.all_greedy_sample = all_greedy_sample;
+
+    params.constrained_token_idxes = safe_to(constrained_token_idxes, device);
+    // wait for the bitmasks computed alongside the forward pass
+    if (allowed_token_bitmasks_future.valid()) {
+      params.allowed_token_bitmasks =
+          safe_to(allowed_token_bitmasks_future.get(), device);
+    } else {
+      params.allowed_token_bitmasks = safe_to(allowed_token_bitmasks, device);
+    }
 
     return params;
   }
@@ -105,17 +117,41 @@ struct SamplingParameters {
   // whether to sample for each sequence.
   // [num_seqs] BoolTensor
   torch::Tensor do_sample;
+
+  // whether all or none of sequences sample, computed on host to choose the
+  // sampling strategy without synchronizing with the device. both false if
+  // mixed or unknown.
+  bool all_random_sample = false;
+  bool all_greedy_sample = false;
+
+  // ############ following parameters are used for constrained decoding ######
+  // the indexes of selected tokens constrained by grammars.
+  // [num_constrained_tokens] IntTensor
+  torch::Tensor constrained_token_idxes;
+
+  // packed bitmasks of allowed tokens for constrained tokens, where token i is
+  // allowed if (bitmask[i / 32] >> (i % 32)) & 1.
+  // [num_constrained_tokens, num_words] IntTensor
+  torch::Tensor allowed_token_bitmasks;
+
+  // the bitmasks being computed on host alongside the forward pass, which
+  // are resolved into allowed_token_bitmasks when moved to the device.
+  std::shared_future<torch::Tensor> allowed_token_bitmasks_future;
 };
 
 struct SampleOutput {
   // [num_seq] LongTensor
   torch::Tensor next_tokens;
 
-  // [num_seq] FloatTensor
+  // [num_seq, vocab_size] FloatTensor
   torch::Tensor probs;
 
-  // [num_seq] FloatTensor
+  // [num_seq, vocab_size] FloatTensor
   torch::Tensor logprobs;
+
+  // log probabilities of the next tokens
+  // [num_seq] FloatTensor
+  torch::Tensor next_logprobs;
 };
 
 }  // namespace llm
@@ -13,6 +13,15 @@ Sampler::Sampler(const torch::Tensor& do_sample) {
   all_greedy_sample_ = !do_sample.any().item<bool>();
 }
 
+Sampler::Sampler(const torch::Tensor& do_sample,
+                 bool all_random_sample,
+                 bool all_greedy_sample)
+    : do_sample_(do_sample),
+      all_random_sample_(all_random_sample),
+      all_greedy_sample_(all_greedy_sample) {
+  CHECK(do_sample.defined());
+}
+
 SampleOutput Sampler::forward(const torch::Tensor& logits) const {
   // same batch size
   CHECK_EQ(logits.size(0), do_sample_.size(0));
@@ -37,6 +46,9 @@ SampleOutput Sampler::forward(const torch::Tensor& logits) const {
     auto greedy = greedy_sample(probs);
     output.next_tokens = torch::where(do_sample_, random, greedy);
   }
+  output.next_logprobs =
+      logprobs.gather(/*dim=*/-1, output.next_tokens.unsqueeze(/*dim=*/-1))
+          .squeeze(/*dim=*/-1);
 
   return output;
 }
@@ -9,8 +9,15 @@ namespace llm {
 
 class Sampler final {
  public:
+  // the sampling strategy is determined by do_sample on device, which
+  // synchronizes with the device.
   Sampler(const torch::Tensor& do_sample);
 
+  // the sampling strategy is given by flags computed on host
+  Sampler(const torch::Tensor& do_sample,
+          bool all_random_sample,
+          bool all_greedy_sample);
+
   // operator() allows us to use the module as a function.
   template <typename... Args>
   auto operator()(Args&&... args) const {
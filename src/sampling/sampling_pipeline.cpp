@@ -0,0 +1,69 @@
+#include "sampling_pipeline.h"
+
+#include <torch/torch.h>
+
+#include "logits_processor.h"
+#include "parameters.h"
+#include "sampler.h"
+
+namespace llm {
+
+torch::Tensor SamplingPipeline::process(const torch::Tensor& logits,
+                                        const SamplingParameters& params) {
+  const auto& unique_token_ids = params.unique_token_ids;
+  const auto& unique_token_counts = params.unique_token_counts;
+  const auto& unique_token_lens = params.unique_token_ids_lens;
+
+  torch::Tensor logits_ = logits;
+  if (params.allowed_token_bitmasks.defined()) {
+    const AllowedTokensLogitsProcessor processor(
+        params.constrained_token_idxes, params.allowed_token_bitmasks);
+    logits_ = processor.forward(
+        logits_, unique_token_ids, unique_token_counts, unique_token_lens);
+  }
+
+  if (params.frequency_penalties.defined() ||
+      params.presence_penalties.defined()) {
+    const FrequencyPresencePenaltyLogitsProcessor processor(
+        params.frequency_penalties, params.presence_penalties);
+    logits_ = processor.forward(
+        logits_, unique_token_ids, unique_token_counts, unique_token_lens);
+  }
+
+  if (params.repetition_penalties.defined()) {
+    const RepetitionPenaltyLogitsProcessor processor(
+        params.repetition_penalties);
+    logits_ = processor.forward(
+        logits_, unique_token_ids, unique_token_counts, unique_token_lens);
+  }
+
+  if (params.temperatures.defined()) {
+    const TemperatureLogitsProcessor processor(params.temperatures);
+    logits_ = processor.forward(
+        logits_, unique_token_ids, unique_token_counts, unique_token_lens);
+  }
+
+  if (params.top_k.defined() || params.top_p.defined()) {
+    const int64_t vocab_size = logits_.size(-1);
+    if (!vocab_idxes_.defined() || vocab_idxes_.numel() != vocab_size ||
+        vocab_idxes_.device() != logits_.device()) {
+      vocab_idxes_ = torch::arange(vocab_size, logits_.device());
+    }
+    const TopKTopPLogitsProcessor processor(
+        params.top_k, params.top_p, vocab_idxes_);
+    logits_ = processor.forward(
+        logits_, unique_token_ids, unique_token_counts, unique_token_lens);
+  }
+  return logits_;
+}
+
+SampleOutput SamplingPipeline::sample(const torch::Tensor& logits,
+                                      const SamplingParameters& params) const {
+  const auto sample_logits =
+      logits.index_select(/*dim=*/0, params.sample_idxes);
+  const Sampler sampler(
+      params.do_sample, params.all_random_sample, params.all_greedy_sample);
+  return sampler.forward(sample_logits);
+}
+
+}  // namespace llm
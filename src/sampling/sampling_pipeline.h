@@ -0,0 +1,31 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include "parameters.h"
+
+namespace llm {
+
+// A pipeline of logits processors and the sampler, kept by a worker and
+// reused across steps. only processors enabled by the sampling parameters run,
+// applied in order without building a processor list, and the sampling
+// strategy is chosen by flags computed on host, without synchronizing with the
+// device.
+class SamplingPipeline final {
+ public:
+  // process logits of selected tokens in place
+  // logits: [num_selected_tokens, vocab_size]
+  torch::Tensor process(const torch::Tensor& logits,
+                        const SamplingParameters& params);
+
+  // sample next tokens from the logits of sample_idxes
+  // logits: [num_selected_tokens, vocab_size]
+  SampleOutput sample(const torch::Tensor& logits,
+                      const SamplingParameters& params) const;
+
+ private:
+  // [vocab_size] token ids to build top_k masks, cached across steps
+  torch::Tensor vocab_idxes_;
+};
+
+}  // namespace llm
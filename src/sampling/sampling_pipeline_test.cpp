@@ -0,0 +1,75 @@
+#include "sampling_pipeline.h"
+
+#include <gtest/gtest.h>
+#include <torch/torch.h>
+
+#include "logits_processor.h"
+#include "parameters.h"
+
+namespace llm {
+
+TEST(SamplingPipelineTest, ProcessAsLogitsProcessors) {
+  const auto options = torch::dtype(torch::kFloat32).device(torch::kCPU);
+  const int64_t vocab_size = 1000;
+  SamplingParameters params;
+  params.frequency_penalties = torch::tensor({0.1, 0.0, 0.2}, options);
+  params.repetition_penalties = torch::tensor({1.0, 1.2, 1.1}, options);
+  params.temperatures = torch::tensor({0.5, 0.0, 1.5}, options);
+  params.top_k = torch::tensor({0, 10, 20}, torch::kLong);
+  params.top_p = torch::tensor({0.9, 1.0, 0.5}, options);
+  params.unique_token_ids =
+      torch::tensor({{1, 2, 3}, {4, 5, 0}, {6, 0, 0}}, torch::kLong);
+  params.unique_token_counts =
+      torch::tensor({{1, 2, 1}, {3, 1, 0}, {2, 0, 0}}, torch::kInt);
+  params.unique_token_ids_lens = torch::tensor({3, 2, 1}, torch::kInt);
+
+  const auto logits = torch::randn({3, vocab_size}, options);
+  auto desired_logits = logits.clone();
+  desired_logits = LogitsProcessor::create(params)->forward(
+      desired_logits,
+      params.unique_token_ids,
+      params.unique_token_counts,
+      params.unique_token_ids_lens);
+
+  SamplingPipeline pipeline;
+  // processors are reused across steps
+  for (int i = 0; i < 2; ++i) {
+    auto output = logits.clone();
+    output = pipeline.process(output, params);
+    EXPECT_TRUE(torch::equal(output, desired_logits));
+  }
+}
+
+TEST(SamplingPipelineTest, FrequencyPenaltyOnly) {
+  const auto options = torch::dtype(torch::kFloat32).device(torch::kCPU);
+  SamplingParameters params;
+  params.frequency_penalties = torch::tensor({0.5, 1.0}, options);
+  params.unique_token_ids = torch::tensor({{1, 2}, {3, 0}}, torch::kLong);
+  params.unique_token_counts = torch::tensor({{1, 2}, {2, 0}}, torch::kInt);
+  params.unique_token_ids_lens = torch::tensor({2, 1}, torch::kInt);
+
+  const auto logits = torch::zeros({2, 4}, options);
+  SamplingPipeline pipeline;
+  const auto output = pipeline.process(logits.clone(), params);
+  const auto desired_logits =
+      torch::tensor({{0.0, -0.5, -1.0, 0.0}, {0.0, 0.0, 0.0, -2.0}}, options);
+  EXPECT_TRUE(torch::allclose(output, desired_logits));
+}
+
+TEST(SamplingPipelineTest, SampleWithHostFlags) {
+  const auto options = torch::dtype(torch::kFloat32).device(torch::kCPU);
+  SamplingParameters params;
+  params.sample_idxes = torch::tensor({1, 2}, torch::kInt);
+  params.do_sample = torch::tensor({false, false});
+  params.all_greedy_sample = true;
+
+  const auto logits = torch::randn({3, 1000}, options);
+  SamplingPipeline pipeline;
+  const auto output = pipeline.sample(logits, params);
+  const auto desired_tokens =
+      logits.index_select(/*dim=*/0, params.sample_idxes).argmax(/*dim=*/-1);
+  EXPECT_TRUE(torch::equal(output.next_tokens, desired_tokens));
+  EXPECT_EQ(output.next_logprobs.size(0), 2);
+}
+
+}  // namespace llm
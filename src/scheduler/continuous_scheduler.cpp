@@ -21,13 +21,13 @@ ContinuousScheduler::ContinuousScheduler(Engine* engine, const Options& options)
   CHECK(engine_ != nullptr);
   block_manager_ = engine_->block_manager();
   tokenizer_ = engine_->tokenizer();
+  stop_tokenizer_ = engine_->tokenizer();
   CHECK(block_manager_ != nullptr);
   CHECK(tokenizer_ != nullptr);
+  CHECK(stop_tokenizer_ != nullptr);
 
-  enable_prefix_cache_ = block_manager_->options().enable_prefix_cache();
-
-  response_handler_ =
-      std::make_unique<ResponseHandler>(block_manager_, tokenizer_.get());
+  response_handler_ = std::make_unique<ResponseHandler>(tokenizer_.get());
+  num_free_blocks_ = block_manager_->num_free_blocks();
 }
 
 ContinuousScheduler::~ContinuousScheduler() {
@@ -56,11 +56,14 @@ bool ContinuousScheduler::schedule(std::unique_ptr<Request>& request) {
   CHECK(request != nullptr);
   CHECK(!request->sequences.empty());
 
+  // count the request before the scheduler thread can finish it
+  num_pending_requests_.fetch_add(1, std::memory_order_relaxed);
   if (request_queue_.write(request.get())) {
     // take over the ownership of the request
     request.release();
     return true;
   }
+  num_pending_requests_.fetch_sub(1, std::memory_order_relaxed);
   // queue is full
   return false;
 }
@@ -72,13 +75,9 @@ Batch ContinuousScheduler::build_sequence_batch() {
     // read from request queue then push to priority queue
     request_queue_.read(request);
     CHECK(request != nullptr);
-
-    // expand sequences to the target number if prefix cache is disabled.
-    if (!enable_prefix_cache_) {
-      // expand sequences to the target number
-      request->expand_sequences();
+    if (request->stopping_criteria.stop_strings != nullptr) {
+      request->set_tokenizer(stop_tokenizer_.get());
     }
-
     priority_queue_.push(request);
   }
 
@@ -88,16 +87,15 @@ Batch ContinuousScheduler::build_sequence_batch() {
        ++it) {
     Request* request = *it;
     if (request->is_finished() || request->is_cancelled()) {
-      // release the ownership of the request
-      response_handler_->on_request_finish(std::unique_ptr<Request>(request));
+      finish_request(request);
       continue;
     }
 
     // check if the request can be expanded
     if (request->should_expand_sequences()) {
-      // cache the blocks to share among the sequences
+      // cache the blocks to share among requests with the same prefix
       block_manager_->cache_blocks_for(&request->sequences[0]);
-      // expand sequences to the target number
+      // fork sequences sharing the prompt kv cache with the first one
       request->expand_sequences();
     }
 
@@ -141,6 +139,7 @@ Batch ContinuousScheduler::build_sequence_batch() {
     candidates.reserve(request->sequences.size());
 
     bool has_enough_blocks = true;
+    bool has_enough_budget = true;
     size_t allocated_tokens = 0;
     size_t allocated_seqs = 0;
     for (Sequence& sequence : request->sequences) {
@@ -152,6 +151,7 @@ Batch ContinuousScheduler::build_sequence_batch() {
       if (allocated_tokens + options_.num_speculative_tokens() >=
               remaining_token_budget ||
           allocated_seqs >= remaining_seq_budget) {
+        has_enough_budget = false;
         break;
       }
 
@@ -172,6 +172,11 @@ Batch ContinuousScheduler::build_sequence_batch() {
     CHECK(allocated_tokens <= remaining_token_budget);
     CHECK(allocated_seqs <= remaining_seq_budget);
 
+    // all beams of a request should be scheduled in the same step
+    if (request->beam_group != nullptr && !has_enough_budget) {
+      break;
+    }
+
     // schedule candidates in the request if there are enough blocks
     if (has_enough_blocks) {
       // remove the request from the priority queue
@@ -203,7 +208,7 @@ Batch ContinuousScheduler::build_sequence_batch() {
     }
 
     // no requests left to preempt, partially schedule the request
-    if (!candidates.empty()) {
+    if (!candidates.empty() && request->beam_group == nullptr) {
       priority_queue_.pop();
       running_requests_.push_back(request);
       new_batch.insert(new_batch.end(), candidates.begin(), candidates.end());
@@ -241,9 +246,10 @@ Batch ContinuousScheduler::build_sequence_batch() {
     // no enough memory to schedule single sequence, just finish the request
     Request* request = priority_queue_.top();
     priority_queue_.pop();
-    // release the ownership of the request
-    response_handler_->on_request_finish(std::unique_ptr<Request>(request));
+    finish_request(request);
   }
+  num_free_blocks_.store(block_manager_->num_free_blocks(),
+                         std::memory_order_relaxed);
 
   // update the batch
   Batch batch;
@@ -265,6 +271,8 @@ void ContinuousScheduler::step(const absl::Duration& timeout) {
       // find one batch of requests to process
       break;
     }
+    // respond to the last step before waiting for new requests
+    flush_responses();
     const auto now = absl::Now();
     if (now > deadline) {
       // no requests to process
@@ -277,18 +285,40 @@ void ContinuousScheduler::step(const absl::Duration& timeout) {
     absl::SleepFor(time_to_sleep);
   }
 
-  engine_->execute_model(batch);
+  // run the batch without blocking, and respond to the last step while the
+  // batch is in flight. sequences are only updated once the step completes.
+  auto output = engine_->execute_model_async(batch);
+  flush_responses();
+  std::move(output).get();
 
-  // process sequence in batch
+  // stream deltas of this step alongside the next step
   for (int64_t i = 0; i < batch.size(); ++i) {
     Sequence* seq = batch[i];
-    // stream delta to client if streaming is enabled
     if (seq->is_streaming()) {
-      response_handler_->on_sequence_stream(seq);
+      pending_stream_sequences_.push_back(seq);
     }
   }
+}
 
-  // TODO: return a task to support waiting for the completion of the batch
+void ContinuousScheduler::finish_request(Request* request) {
+  // free blocks for the next batch right away, and respond once deltas of
+  // the last step are streamed
+  block_manager_->release_blocks_for(request);
+  finished_requests_.emplace_back(request);
+  num_pending_requests_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ContinuousScheduler::flush_responses() {
+  // stream deltas before finishing their requests, which are handled in
+  // order by the response handler
+  for (Sequence* seq : pending_stream_sequences_) {
+    response_handler_->on_sequence_stream(seq);
+  }
+  pending_stream_sequences_.clear();
+  for (auto& request : finished_requests_) {
+    response_handler_->on_request_finish(std::move(request));
+  }
+  finished_requests_.clear();
 }
 
 bool ContinuousScheduler::allocate_blocks_for(Sequence* sequence,
@@ -331,6 +361,20 @@ bool ContinuousScheduler::allocate_blocks_for(Sequence* sequence,
   // the actual allocated tokens is the difference between the total
   // number of tokens and the number of tokens already processed
   *actual_tokens = num_tokens - num_kv_cache_tokens;
+
+  // reserve slots for tokens of multiple decoding steps, falling back to a
+  // single step if no enough blocks
+  const bool is_decoding =
+      num_kv_cache_tokens >= num_prompt_tokens && *actual_tokens == 1;
+  if (options_.num_decoding_steps() > 1 &&
+      options_.num_speculative_tokens() == 0 && is_decoding) {
+    const size_t max_num_tokens = std::min<size_t>(
+        num_tokens + options_.num_decoding_steps() - 1, sequence->capacity());
+    if (block_manager_->allocate_blocks_for(sequence, max_num_tokens)) {
+      return true;
+    }
+  }
+
   // allocate blocks for the sequence
   return block_manager_->allocate_blocks_for(sequence, num_tokens);
 }
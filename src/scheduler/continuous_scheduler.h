@@ -3,8 +3,10 @@
 #include <absl/time/time.h>
 #include <folly/MPMCQueue.h>
 
+#include <atomic>
 #include <memory>
 #include <queue>
+#include <vector>
 
 #include "common/macros.h"
 #include "engine/batch.h"
@@ -29,6 +31,10 @@ class ContinuousScheduler final : public Scheduler {
 
     // the number of speculative tokens per step
     DEFINE_ARG(int32_t, num_speculative_tokens) = 0;
+
+    // the max number of decoding steps run back to back by the engine, which
+    // reserves kv cache slots for tokens of all steps when possible
+    DEFINE_ARG(int32_t, num_decoding_steps) = 1;
   };
 
   ContinuousScheduler(Engine* engine, const Options& options);
@@ -43,6 +49,18 @@ class ContinuousScheduler final : public Scheduler {
   // may get blocked if there are no requests to process
   void step(const absl::Duration& timeout) override;
 
+  // get the number of scheduled requests that are not finished yet.
+  // thread safe
+  size_t num_pending_requests() const {
+    return num_pending_requests_.load(std::memory_order_relaxed);
+  }
+
+  // get the number of free kv cache blocks after the last batch is built.
+  // thread safe
+  size_t num_free_blocks() const {
+    return num_free_blocks_.load(std::memory_order_relaxed);
+  }
+
  private:
   // get a batch of requests from the priority queue
   Batch build_sequence_batch();
@@ -51,12 +69,21 @@ class ContinuousScheduler final : public Scheduler {
   // * for prefill sequence, the allocated_tokens will be within
   // [1, num_prompt_tokens - num_tokens_in_kv_cache].
   // * for decode sequence, the actual_tokens usually would be 1 or K for
-  // speculative decoding.
+  // speculative decoding. blocks for multiple decoding steps are allocated
+  // if available.
   // returns false if no blocks can be allocated.
   bool allocate_blocks_for(Sequence* sequence,
                            size_t token_budget,
                            size_t* actual_tokens);
 
+  // release blocks of the finished request, and respond to it with the next
+  // flush of responses
+  void finish_request(Request* request);
+
+  // stream deltas of sequences in the last step and finish requests finished
+  // after it, overlapped with the next step on the engine
+  void flush_responses();
+
   const Options options_;
 
   // the engine to run the batch
@@ -68,6 +95,11 @@ class ContinuousScheduler final : public Scheduler {
   // tokenizer
   std::unique_ptr<Tokenizer> tokenizer_;
 
+  // tokenizer to decode the output text for stop strings in the scheduler
+  // thread, separated from the one used by the response handler since some
+  // tokenizers are not thread safe.
+  std::unique_ptr<Tokenizer> stop_tokenizer_;
+
   // a thread safe queue of requests, bounded by kRequestQueueSize
   // the schedule owns the requests and manages their lifetimes.
   folly::MPMCQueue<Request*> request_queue_;
@@ -88,7 +120,15 @@ class ContinuousScheduler final : public Scheduler {
 
   std::unique_ptr<ResponseHandler> response_handler_;
 
-  bool enable_prefix_cache_ = false;
+  // streaming sequences of the last step, whose deltas are not streamed yet
+  std::vector<Sequence*> pending_stream_sequences_;
+
+  // finished requests to respond to after the pending deltas
+  std::vector<std::unique_ptr<Request>> finished_requests_;
+
+  // load of the scheduler, updated in the scheduler thread
+  std::atomic<size_t> num_pending_requests_{0};
+  std::atomic<size_t> num_free_blocks_{0};
 };
 
 }  // namespace llm
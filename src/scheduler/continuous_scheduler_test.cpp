@@ -0,0 +1,184 @@
+#include "continuous_scheduler.h"
+
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <folly/futures/Future.h>
+#include <gtest/gtest.h>
+#include <torch/torch.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "engine/batch.h"
+#include "engine/engine.h"
+#include "memory/block_manager.h"
+#include "request/request.h"
+#include "request/sequence.h"
+
+namespace llm {
+namespace {
+
+constexpr int32_t kBlockSize = 4;
+constexpr int32_t kTokenId = 7;
+constexpr size_t kMaxTokens = 3;
+
+// a tokenizer decoding each token to one char
+class FakeTokenizer : public Tokenizer {
+ public:
+  bool encode(const std::string_view& /*text*/,
+              std::vector<int32_t>* /*ids*/) const override {
+    return false;
+  }
+
+  std::string decode(const Slice<int32_t>& tokens,
+                     bool /*skip_special_tokens*/) const override {
+    return std::string(tokens.size(), 'a');
+  }
+
+  size_t vocab_size() const override { return 0; }
+
+  std::unique_ptr<Tokenizer> clone() const override {
+    return std::make_unique<FakeTokenizer>();
+  }
+};
+
+// an engine on cpu that generates kTokenId for all sequences once the step
+// completes. the step of the engine waits for deltas of all earlier steps to
+// reach the client, which only happens if they are streamed while the step is
+// in flight.
+class FakeEngine : public Engine {
+ public:
+  explicit FakeEngine(const std::atomic<size_t>* num_deltas)
+      : num_deltas_(num_deltas),
+        block_manager_(BlockManager::Options()
+                           .num_blocks(64)
+                           .block_size(kBlockSize)
+                           .enable_prefix_cache(false)) {}
+
+  ModelOutput execute_model(Batch& batch) override {
+    return execute_model_async(batch).get();
+  }
+
+  folly::SemiFuture<ModelOutput> execute_model_async(Batch& batch) override {
+    const size_t step = num_steps_++;
+    std::vector<size_t> num_tokens;
+    for (int64_t i = 0; i < batch.size(); ++i) {
+      num_tokens.push_back(batch[i]->num_tokens());
+    }
+    return folly::makeSemiFuture().deferValue(
+        [this, &batch, step, num_tokens = std::move(num_tokens)](
+            folly::Unit) {
+          // host work between the launch and the completion should not
+          // touch sequences of the batch
+          for (int64_t i = 0; i < batch.size(); ++i) {
+            if (batch[i]->num_tokens() != num_tokens[i]) {
+              ++num_updated_in_flight_;
+            }
+          }
+          const auto deadline = absl::Now() + absl::Seconds(5);
+          while (num_deltas_->load() < step && absl::Now() < deadline) {
+            absl::SleepFor(absl::Milliseconds(1));
+          }
+          if (num_deltas_->load() < step) {
+            ++num_late_steps_;
+          }
+
+          const auto input =
+              batch.prepare_model_input(/*num_decoding_tokens=*/1,
+                                        /*min_decoding_bach_size=*/0);
+          const auto& sample_idxes = input.sampling_params.sample_idxes;
+          const int64_t num_seqs =
+              sample_idxes.defined() ? sample_idxes.numel() : 0;
+          ModelOutput output;
+          if (num_seqs > 0) {
+            output.sample_output.next_tokens =
+                torch::full({num_seqs}, kTokenId, torch::kLong);
+            batch.process_sample_output(output.sample_output);
+          }
+          return output;
+        });
+  }
+
+  std::unique_ptr<Tokenizer> tokenizer() const override {
+    return std::make_unique<FakeTokenizer>();
+  }
+
+  BlockManager* block_manager() const override { return &block_manager_; }
+
+  const ModelArgs& model_args() const override { return model_args_; }
+
+  const TokenizerArgs& tokenizer_args() const override {
+    return tokenizer_args_;
+  }
+
+  size_t num_steps() const { return num_steps_; }
+
+  size_t num_late_steps() const { return num_late_steps_; }
+
+  size_t num_updated_in_flight() const { return num_updated_in_flight_; }
+
+ private:
+  const std::atomic<size_t>* num_deltas_;
+  mutable BlockManager block_manager_;
+  ModelArgs model_args_;
+  TokenizerArgs tokenizer_args_;
+
+  size_t num_steps_ = 0;
+  size_t num_late_steps_ = 0;
+  size_t num_updated_in_flight_ = 0;
+};
+
+}  // namespace
+
+TEST(ContinuousSchedulerTest, StreamWhileStepInFlight) {
+  std::atomic<size_t> num_deltas{0};
+  std::atomic<size_t> num_deltas_at_finish{0};
+  std::atomic<bool> finished{false};
+  std::atomic<bool> last_delta_finished{false};
+
+  FakeEngine engine(&num_deltas);
+  ContinuousScheduler scheduler(&engine, ContinuousScheduler::Options());
+
+  auto request = std::make_unique<Request>(/*id=*/"",
+                                           /*prompt=*/"",
+                                           std::vector<int32_t>{1, 2, 3},
+                                           /*seq_capacity=*/64,
+                                           /*n=*/1,
+                                           /*best_of=*/1);
+  request->echo = false;
+  request->stream = true;
+  request->stopping_criteria.max_tokens = kMaxTokens;
+  request->on_stream_delta = [&](size_t /*index*/,
+                                 const SequenceDeltaOutput& output) {
+    num_deltas.fetch_add(1);
+    last_delta_finished.store(output.finish_reason != FinishReason::NONE);
+    return true;
+  };
+  request->on_stream_finish = [&](const Status& /*status*/) {
+    num_deltas_at_finish.store(num_deltas.load());
+    finished.store(true);
+    return true;
+  };
+  request->add_sequence();
+  EXPECT_TRUE(scheduler.schedule(request));
+
+  // the deferred step completes in this thread, after the scheduler streams
+  // deltas of the last step to the client
+  const auto deadline = absl::Now() + absl::Seconds(10);
+  while (!finished.load() && absl::Now() < deadline) {
+    scheduler.step(absl::Milliseconds(10));
+  }
+  EXPECT_TRUE(finished.load());
+  EXPECT_EQ(engine.num_steps(), kMaxTokens);
+  EXPECT_EQ(engine.num_late_steps(), 0);
+  EXPECT_EQ(engine.num_updated_in_flight(), 0);
+
+  // all deltas are streamed before the request is finished
+  EXPECT_EQ(num_deltas_at_finish.load(), kMaxTokens);
+  EXPECT_TRUE(last_delta_finished.load());
+  EXPECT_EQ(scheduler.num_pending_requests(), 0);
+}
+
+}  // namespace llm
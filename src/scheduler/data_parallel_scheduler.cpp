@@ -0,0 +1,188 @@
+#include "data_parallel_scheduler.h"
+
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/cpu_affinity.h"
+#include "common/metrics.h"
+#include "common/slice.h"
+#include "engine/engine.h"
+#include "request/request.h"
+
+namespace llm {
+
+// aggregate metrics of all replicas
+DEFINE_GAUGE(data_parallel_num_pending_requests,
+             "Number of pending requests of all replicas");
+DEFINE_GAUGE(data_parallel_num_free_blocks,
+             "Number of free kv cache blocks of all replicas");
+DEFINE_COUNTER(data_parallel_prefix_affinity_total,
+               "Total number of requests routed by prefix affinity");
+
+namespace {
+
+// timeout for each step of replica schedulers, to check the stop flag
+constexpr absl::Duration kReplicaStepTimeout = absl::Milliseconds(100);
+
+// FNV-1a offset basis, the hash of an empty prefix
+constexpr uint64_t kEmptyPrefixHash = 14695981039346656037ULL;
+
+// FNV-1a hash of the tokens chained to the hash of the preceding prefix
+uint64_t hash_tokens(uint64_t prefix_hash, const Slice<int32_t>& tokens) {
+  uint64_t hash = prefix_hash;
+  for (const int32_t token : tokens) {
+    hash ^= static_cast<uint32_t>(token);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+}  // namespace
+
+DataParallelScheduler::DataParallelScheduler(
+    const std::vector<Engine*>& engines,
+    const Options& options)
+    : options_(options) {
+  CHECK(!engines.empty()) << "At least one replica is required";
+  block_size_ = engines[0]->block_manager()->options().block_size();
+  CHECK_GT(block_size_, 0);
+
+  schedulers_.reserve(engines.size());
+  {
+    // response threads created with the replicas run on io cpus
+    ScopedThreadAffinity io_affinity(options_.io_cpus());
+    for (Engine* engine : engines) {
+      CHECK_EQ(engine->block_manager()->options().block_size(), block_size_)
+          << "All replicas should have the same block size";
+      schedulers_.push_back(std::make_unique<ContinuousScheduler>(
+          engine, options_.scheduler_options()));
+    }
+  }
+
+  // threads stepping replicas run the engines, which never inherit io cpus
+  threads_.reserve(schedulers_.size());
+  for (auto& scheduler : schedulers_) {
+    threads_.emplace_back(
+        [this, scheduler = scheduler.get()]() { replica_loop(scheduler); });
+  }
+}
+
+DataParallelScheduler::~DataParallelScheduler() {
+  stop_.store(true, std::memory_order_relaxed);
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+bool DataParallelScheduler::schedule(std::unique_ptr<Request>& request) {
+  CHECK(request != nullptr);
+  const size_t replica = route(*request);
+  return schedulers_[replica]->schedule(request);
+}
+
+size_t DataParallelScheduler::route(const Request& request) {
+  // the least loaded replica, with fewest pending requests then most free
+  // blocks
+  size_t least_loaded = 0;
+  for (size_t i = 1; i < schedulers_.size(); ++i) {
+    const auto& candidate = *schedulers_[i];
+    const auto& current = *schedulers_[least_loaded];
+    const size_t num_pending = candidate.num_pending_requests();
+    const size_t min_num_pending = current.num_pending_requests();
+    if (num_pending < min_num_pending ||
+        (num_pending == min_num_pending &&
+         candidate.num_free_blocks() > current.num_free_blocks())) {
+      least_loaded = i;
+    }
+  }
+
+  // only prefixes of whole blocks are shared in the prefix cache, hash the
+  // prefix up to the end of each block like the prefix cache matches blocks
+  const size_t max_prefix_tokens = std::min<size_t>(
+      request.prompt_tokens.size(), options_.prefix_affinity_tokens());
+  const size_t num_blocks = max_prefix_tokens / block_size_;
+  if (num_blocks == 0) {
+    return least_loaded;
+  }
+  const Slice<int32_t> tokens(request.prompt_tokens);
+  std::vector<uint64_t> block_hashes;
+  block_hashes.reserve(num_blocks);
+  uint64_t hash = kEmptyPrefixHash;
+  for (size_t i = 0; i < num_blocks; ++i) {
+    const size_t start = i * block_size_;
+    hash = hash_tokens(hash, tokens.slice(start, start + block_size_));
+    block_hashes.push_back(hash);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // the replica holding the longest known prefix
+  size_t replica = least_loaded;
+  for (auto it = block_hashes.rbegin(); it != block_hashes.rend(); ++it) {
+    auto found = prefix_replicas_.find(*it);
+    if (found == prefix_replicas_.end()) {
+      continue;
+    }
+    const size_t max_num_pending =
+        schedulers_[least_loaded]->num_pending_requests() +
+        options_.max_load_imbalance();
+    if (schedulers_[found->second]->num_pending_requests() <=
+        max_num_pending) {
+      data_parallel_prefix_affinity_total.Increment();
+      replica = found->second;
+    }
+    // otherwise move the prefix to the least loaded replica
+    break;
+  }
+
+  // remember blocks of the prefix on the replica, evicting the oldest ones if
+  // full
+  for (const uint64_t block_hash : block_hashes) {
+    auto it = prefix_replicas_.find(block_hash);
+    if (it != prefix_replicas_.end()) {
+      it->second = replica;
+      continue;
+    }
+    if (prefix_blocks_.size() >=
+            static_cast<size_t>(options_.max_prefix_blocks()) &&
+        !prefix_blocks_.empty()) {
+      prefix_replicas_.erase(prefix_blocks_.front());
+      prefix_blocks_.pop_front();
+    }
+    prefix_replicas_.emplace(block_hash, replica);
+    prefix_blocks_.push_back(block_hash);
+  }
+  return replica;
+}
+
+void DataParallelScheduler::step(const absl::Duration& timeout) {
+  size_t num_pending_requests = 0;
+  size_t num_free_blocks = 0;
+  for (const auto& scheduler : schedulers_) {
+    num_pending_requests += scheduler->num_pending_requests();
+    num_free_blocks += scheduler->num_free_blocks();
+  }
+  data_parallel_num_pending_requests.Set(
+      static_cast<double>(num_pending_requests));
+  data_parallel_num_free_blocks.Set(static_cast<double>(num_free_blocks));
+
+  absl::SleepFor(timeout);
+}
+
+void DataParallelScheduler::replica_loop(ContinuousScheduler* scheduler) {
+  if (!options_.scheduler_cpus().empty()) {
+    set_thread_affinity(options_.scheduler_cpus());
+  }
+  while (!stop_.load(std::memory_order_relaxed)) {
+    scheduler->step(kReplicaStepTimeout);
+  }
+}
+
+}  // namespace llm
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/time/time.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/macros.h"
+#include "continuous_scheduler.h"
+#include "request/request.h"
+#include "scheduler.h"
+
+namespace llm {
+class Engine;
+
+// A scheduler that routes requests to independent replicas of the model in
+// one process, each with its own engine and continuous scheduler stepped in
+// its own thread. Requests are routed to the replica holding the longest known
+// prefix of whole blocks of the prompt to reuse its prefix cache, unless the
+// replica is much busier than others, and the rest go to the least loaded
+// replica by pending requests and free kv cache blocks.
+class DataParallelScheduler final : public Scheduler {
+ public:
+  struct Options {
+    // options of the scheduler of each replica
+    DEFINE_ARG(ContinuousScheduler::Options, scheduler_options);
+
+    // max number of leading prompt tokens, rounded down to whole blocks, to
+    // route requests with the same prefix to the same replica. 0 to disable.
+    DEFINE_ARG(int32_t, prefix_affinity_tokens) = 256;
+
+    // a replica with the same prefix is skipped if it has more pending
+    // requests than the least loaded replica by this number
+    DEFINE_ARG(int32_t, max_load_imbalance) = 4;
+
+    // max number of prefix blocks remembered for routing
+    DEFINE_ARG(int32_t, max_prefix_blocks) = 65536;
+
+    // cpus to pin the threads stepping replicas to, empty to not pin
+    DEFINE_ARG(std::vector<int32_t>, scheduler_cpus);
+
+    // cpus to pin the response threads of replicas to, empty to not pin
+    DEFINE_ARG(std::vector<int32_t>, io_cpus);
+  };
+
+  // engines are not owned and should outlive the scheduler
+  DataParallelScheduler(const std::vector<Engine*>& engines,
+                        const Options& options);
+
+  ~DataParallelScheduler() override;
+
+  // route the request to a replica, thread safe and non-blocking
+  // may return false if the queue of the replica is full
+  bool schedule(std::unique_ptr<Request>& request) override;
+
+  // update the aggregate metrics of replicas and wait for the timeout, while
+  // replicas step forward in their own threads
+  void step(const absl::Duration& timeout) override;
+
+  size_t num_replicas() const { return schedulers_.size(); }
+
+  // get the scheduler of the i-th replica
+  const ContinuousScheduler& replica(size_t i) const { return *schedulers_[i]; }
+
+ private:
+  // pick a replica for the request and remember its prefix
+  size_t route(const Request& request);
+
+  // step the scheduler of the replica until stopped
+  void replica_loop(ContinuousScheduler* scheduler);
+
+  const Options options_;
+
+  // number of slots per kv cache block, the same for all replicas
+  int32_t block_size_ = 0;
+
+  // schedulers of replicas
+  std::vector<std::unique_ptr<ContinuousScheduler>> schedulers_;
+
+  // threads stepping schedulers of replicas
+  std::vector<std::thread> threads_;
+
+  std::atomic<bool> stop_{false};
+
+  // replica of recently routed prefixes, keyed by chained hash of prefix
+  // tokens up to the end of each block, evicted in insertion order
+  std::mutex mutex_;
+  absl::flat_hash_map<uint64_t, size_t> prefix_replicas_;
+  std::deque<uint64_t> prefix_blocks_;
+};
+
+}  // namespace llm
@@ -0,0 +1,210 @@
+#include "data_parallel_scheduler.h"
+
+#include <absl/synchronization/notification.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <gtest/gtest.h>
+#include <torch/torch.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "engine/batch.h"
+#include "engine/engine.h"
+#include "memory/block_manager.h"
+#include "request/request.h"
+
+namespace llm {
+namespace {
+
+constexpr int32_t kBlockSize = 4;
+constexpr int32_t kTokenId = 7;
+
+class FakeTokenizer : public Tokenizer {
+ public:
+  bool encode(const std::string_view& /*text*/,
+              std::vector<int32_t>* /*ids*/) const override {
+    return false;
+  }
+
+  std::string decode(const Slice<int32_t>& /*tokens*/,
+                     bool /*skip_special_tokens*/) const override {
+    return "";
+  }
+
+  size_t vocab_size() const override { return 0; }
+
+  std::unique_ptr<Tokenizer> clone() const override {
+    return std::make_unique<FakeTokenizer>();
+  }
+};
+
+// an engine on cpu that generates kTokenId for all sequences, blocked until
+// the gate is opened
+class FakeEngine : public Engine {
+ public:
+  explicit FakeEngine(absl::Notification* gate)
+      : gate_(gate),
+        block_manager_(BlockManager::Options()
+                           .num_blocks(64)
+                           .block_size(kBlockSize)
+                           .enable_prefix_cache(true)) {}
+
+  ModelOutput execute_model(Batch& batch) override {
+    gate_->WaitForNotification();
+    const auto input =
+        batch.prepare_model_input(/*num_decoding_tokens=*/1,
+                                  /*min_decoding_bach_size=*/0);
+    const auto& sample_idxes = input.sampling_params.sample_idxes;
+    const int64_t num_seqs = sample_idxes.defined() ? sample_idxes.numel() : 0;
+    ModelOutput output;
+    if (num_seqs > 0) {
+      output.sample_output.next_tokens =
+          torch::full({num_seqs}, kTokenId, torch::kLong);
+      batch.process_sample_output(output.sample_output);
+    }
+    return output;
+  }
+
+  std::unique_ptr<Tokenizer> tokenizer() const override {
+    return std::make_unique<FakeTokenizer>();
+  }
+
+  BlockManager* block_manager() const override { return &block_manager_; }
+
+  const ModelArgs& model_args() const override { return model_args_; }
+
+  const TokenizerArgs& tokenizer_args() const override {
+    return tokenizer_args_;
+  }
+
+ private:
+  absl::Notification* gate_;
+  mutable BlockManager block_manager_;
+  ModelArgs model_args_;
+  TokenizerArgs tokenizer_args_;
+};
+
+std::unique_ptr<Request> create_request(const std::vector<int32_t>& tokens,
+                                        std::atomic<int32_t>* num_finished) {
+  auto request = std::make_unique<Request>(
+      /*id=*/"", /*prompt=*/"", tokens, /*seq_capacity=*/64, 1, 1);
+  request->stopping_criteria.max_tokens = 2;
+  request->on_finish = [num_finished](const std::vector<SequenceOutput>&,
+                                      const Status&,
+                                      const Statistics&) {
+    num_finished->fetch_add(1);
+    return true;
+  };
+  request->add_sequence();
+  return request;
+}
+
+}  // namespace
+
+TEST(DataParallelSchedulerTest, RouteByPrefixAndLoad) {
+  absl::Notification gate;
+  FakeEngine engine0(&gate);
+  FakeEngine engine1(&gate);
+
+  DataParallelScheduler::Options options;
+  options.max_load_imbalance(1);
+  DataParallelScheduler scheduler({&engine0, &engine1}, options);
+  EXPECT_EQ(scheduler.num_replicas(), 2);
+
+  auto num_pending = [&scheduler]() {
+    return std::vector<size_t>{scheduler.replica(0).num_pending_requests(),
+                               scheduler.replica(1).num_pending_requests()};
+  };
+
+  // requests stay pending until the gate is opened
+  std::atomic<int32_t> num_finished{0};
+  const std::vector<int32_t> prefix_a = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+  const std::vector<int32_t> prefix_b = {11, 12, 13, 14, 15, 16, 17, 18};
+  auto request = create_request(prefix_a, &num_finished);
+  EXPECT_TRUE(scheduler.schedule(request));
+  EXPECT_EQ(num_pending(), std::vector<size_t>({1, 0}));
+
+  // a new prefix goes to the least loaded replica
+  request = create_request(prefix_b, &num_finished);
+  EXPECT_TRUE(scheduler.schedule(request));
+  EXPECT_EQ(num_pending(), std::vector<size_t>({1, 1}));
+
+  // the same prefix of whole blocks goes to the same replica
+  request = create_request({1, 2, 3, 4, 5, 6, 7, 8, 20}, &num_finished);
+  EXPECT_TRUE(scheduler.schedule(request));
+  EXPECT_EQ(num_pending(), std::vector<size_t>({2, 1}));
+
+  request = create_request(prefix_a, &num_finished);
+  EXPECT_TRUE(scheduler.schedule(request));
+  EXPECT_EQ(num_pending(), std::vector<size_t>({3, 1}));
+
+  // until the replica is too busy
+  request = create_request(prefix_a, &num_finished);
+  EXPECT_TRUE(scheduler.schedule(request));
+  EXPECT_EQ(num_pending(), std::vector<size_t>({3, 2}));
+
+  // prompts shorter than a block go to the least loaded replica
+  request = create_request({1, 2}, &num_finished);
+  EXPECT_TRUE(scheduler.schedule(request));
+  EXPECT_EQ(num_pending(), std::vector<size_t>({3, 3}));
+
+  // replicas run requests in their own threads
+  gate.Notify();
+  const auto deadline = absl::Now() + absl::Seconds(10);
+  while (num_finished.load() < 6 && absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+  EXPECT_EQ(num_finished.load(), 6);
+  EXPECT_EQ(num_pending(), std::vector<size_t>({0, 0}));
+}
+
+TEST(DataParallelSchedulerTest, RouteToLongestKnownPrefix) {
+  absl::Notification gate;
+  FakeEngine engine0(&gate);
+  FakeEngine engine1(&gate);
+
+  DataParallelScheduler::Options options;
+  DataParallelScheduler scheduler({&engine0, &engine1}, options);
+
+  auto num_pending = [&scheduler]() {
+    return std::vector<size_t>{scheduler.replica(0).num_pending_requests(),
+                               scheduler.replica(1).num_pending_requests()};
+  };
+
+  std::atomic<int32_t> num_finished{0};
+  auto request = create_request({1, 2, 3, 4}, &num_finished);
+  EXPECT_TRUE(scheduler.schedule(request));
+  EXPECT_EQ(num_pending(), std::vector<size_t>({1, 0}));
+
+  // a prompt extending a known prefix goes to the replica holding it
+  request = create_request({1, 2, 3, 4, 5, 6, 7, 8}, &num_finished);
+  EXPECT_TRUE(scheduler.schedule(request));
+  EXPECT_EQ(num_pending(), std::vector<size_t>({2, 0}));
+
+  request = create_request({9, 10, 11, 12}, &num_finished);
+  EXPECT_TRUE(scheduler.schedule(request));
+  EXPECT_EQ(num_pending(), std::vector<size_t>({2, 1}));
+
+  // a longer prompt goes to the replica holding its longest known prefix
+  request = create_request({1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12},
+                           &num_finished);
+  EXPECT_TRUE(scheduler.schedule(request));
+  EXPECT_EQ(num_pending(), std::vector<size_t>({3, 1}));
+
+  // blocks are matched as a chain from the start of the prompt
+  request = create_request({5, 6, 7, 8, 9, 10, 11, 12}, &num_finished);
+  EXPECT_TRUE(scheduler.schedule(request));
+  EXPECT_EQ(num_pending(), std::vector<size_t>({3, 2}));
+
+  gate.Notify();
+  const auto deadline = absl::Now() + absl::Seconds(10);
+  while (num_finished.load() < 5 && absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+  EXPECT_EQ(num_finished.load(), 5);
+}
+
+}  // namespace llm
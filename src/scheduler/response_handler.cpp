@@ -2,10 +2,13 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
+#include <string>
+#include <vector>
 
-#include "memory/block_manager.h"
+#include "request/incremental_decoder.h"
 #include "request/request.h"
 #include "request/sequence.h"
 
@@ -15,13 +18,10 @@ DEFINE_int32(streaming_token_buffer_size,
              1,
              "number of tokens to buffer before streaming to client");
 
-ResponseHandler::ResponseHandler(BlockManager* block_manager,
-                                 Tokenizer* tokenizer)
-    : block_manager_(block_manager), tokenizer_(tokenizer) {}
+ResponseHandler::ResponseHandler(Tokenizer* tokenizer)
+    : tokenizer_(tokenizer) {}
 
 void ResponseHandler::on_request_finish(std::unique_ptr<Request> request) {
-  // release all blocks for the finished request
-  block_manager_->release_blocks_for(request.get());
   // schedule the response handling
   response_threadpool_.schedule([tokenizer = tokenizer_,
                                  request = std::move(request)]() {
@@ -38,12 +38,61 @@ void ResponseHandler::on_request_finish(std::unique_ptr<Request> request) {
       stats.num_total_tokens =
           stats.num_prompt_tokens + stats.num_generated_tokens;
 
-      std::vector<SequenceOutput> seq_results;
-      seq_results.reserve(request->sequences.size());
+      // return the best hypotheses for beam search
+      if (request->beam_group != nullptr) {
+        const auto hypotheses =
+            request->beam_group->best_hypotheses(request->n);
+        if (!hypotheses.empty()) {
+          std::vector<SequenceOutput> seq_results;
+          seq_results.reserve(hypotheses.size());
+          for (const auto& hypothesis : hypotheses) {
+            IncrementalDecoder decoder(request->prompt,
+                                       request->num_prompt_tokens(),
+                                       request->echo,
+                                       request->skip_special_tokens);
+            auto output = decoder.decode(hypothesis.token_ids, *tokenizer);
+            // truncate the output at the first stop string
+            if (const auto& stop_strings =
+                    request->stopping_criteria.stop_strings;
+                stop_strings != nullptr) {
+              const size_t start = request->echo ? request->prompt.size() : 0;
+              const size_t pos = stop_strings->find(output, start);
+              if (pos != std::string::npos) {
+                output.resize(pos);
+              }
+            }
+            seq_results.push_back(
+                {std::move(output), hypothesis.finish_reason});
+          }
+          request->on_finish(seq_results, Status(), stats);
+          return;
+        }
+      }
+
+      std::vector<Sequence*> seqs;
+      seqs.reserve(request->sequences.size());
       for (Sequence& seq : request->sequences) {
+        seqs.push_back(&seq);
+      }
+      // only return the best n sequences ranked by cumulative logprob
+      if (request->n < seqs.size()) {
+        std::partial_sort(seqs.begin(),
+                          seqs.begin() + request->n,
+                          seqs.end(),
+                          [](const Sequence* a, const Sequence* b) {
+                            return a->cumulative_logprob() >
+                                   b->cumulative_logprob();
+                          });
+        seqs.resize(request->n);
+      }
+
+      std::vector<SequenceOutput> seq_results;
+      seq_results.reserve(seqs.size());
+      for (Sequence* seq : seqs) {
         // generate the final output
-        const auto output = seq.decode_delta_text(seq.token_ids(), *tokenizer);
-        seq_results.push_back({output, seq.finish_reason()});
+        const auto output =
+            seq->decode_delta_text(seq->token_ids(), *tokenizer);
+        seq_results.push_back({output, seq->finish_reason()});
       }
       request->on_finish(seq_results, Status(), stats);
     }
@@ -51,6 +100,21 @@ void ResponseHandler::on_request_finish(std::unique_ptr<Request> request) {
 }
 
 void ResponseHandler::on_sequence_stream(Sequence* seq) {
+  if (seq->has_stop_strings()) {
+    // the output text has been decoded when checking stop strings, take the
+    // delta text in current thread and stream it in the response thread.
+    const bool is_finished = seq->is_finished();
+    const auto finish_reason = seq->finish_reason();
+    auto delta = seq->decode_delta_text(seq->token_ids(), *tokenizer_);
+    if (!delta.empty() || is_finished) {
+      response_threadpool_.schedule(
+          [seq, delta = std::move(delta), finish_reason]() mutable {
+            seq->stream_delta({std::move(delta), finish_reason});
+          });
+    }
+    return;
+  }
+
   // check if the sequence has enough tokens to output
   const auto token_ids = seq->token_ids();
   const size_t output_offset = seq->output_offset();
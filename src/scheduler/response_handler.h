@@ -5,15 +5,15 @@
 
 namespace llm {
 
-class BlockManager;
 class Request;
 class Sequence;
 class Tokenizer;
 class ResponseHandler final {
  public:
-  ResponseHandler(BlockManager* block_manager, Tokenizer* tokenizer);
+  explicit ResponseHandler(Tokenizer* tokenizer);
 
-  // take over the ownership of the request
+  // take over the ownership of the request, whose blocks should be released
+  // by the scheduler
   virtual void on_request_finish(std::unique_ptr<Request> request);
 
   virtual void on_sequence_stream(Sequence* seq);
@@ -22,7 +22,6 @@ class ResponseHandler final {
   // the threadpool to handle responses
   ThreadPool response_threadpool_;
 
-  BlockManager* block_manager_;
   Tokenizer* tokenizer_;
 };
 
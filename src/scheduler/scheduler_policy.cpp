@@ -56,6 +56,7 @@ std::vector<Sequence*> FCFSSchedulerPolicy::build_batch() {
   std::vector<Request*> ready_queue;
   for (Request* request : running_queue_) {
     if (request->is_finished()) {
+      block_manager_->release_blocks_for(request);
       response_handler_->on_request_finish(std::unique_ptr<Request>(request));
       continue;
     }
@@ -109,6 +110,7 @@ std::vector<Sequence*> FCFSSchedulerPolicy::build_batch() {
     blocking_queue_.pop_back();
 
     // TODO: optimize the logic to only release blocks for sequences one by one
+    block_manager_->release_blocks_for(request);
     response_handler_->on_request_finish(std::unique_ptr<Request>(request));
   }
   return running_batch;
@@ -2,6 +2,9 @@
 
 #include <absl/strings/str_split.h>
 
+#include <algorithm>
+#include <thread>
+
 #include "engine/llm_engine.h"
 #include "request/sequence.h"
 
@@ -12,7 +15,10 @@ LLM::LLM(const std::string& model_path,
          const llm::StoppingCriteria& sc,
          int64_t max_seq_len,
          const std::string& device_str)
-    : sampling_param_(sp), stopping_criteria_(sc), max_seq_len_(max_seq_len) {
+    : sampling_param_(sp),
+      stopping_criteria_(sc),
+      max_seq_len_(max_seq_len),
+      tokenizer_threadpool_(std::max(std::thread::hardware_concurrency(), 1u)) {
   auto devices = parse_devices(device_str);
   LLMEngine::Options options;
   options.devices(devices);
@@ -23,13 +29,17 @@ LLM::LLM(const std::string& model_path,
 }
 
 void LLM::generate(const std::vector<std::string>& batched_prompt) {
+  // encode prompts in parallel
+  std::vector<std::vector<int32_t>> batched_prompt_tokens;
+  tokenizer_->encode_batch(
+      batched_prompt, &batched_prompt_tokens, &tokenizer_threadpool_);
+
   std::vector<llm::Sequence*> sequences;
   sequences.reserve(batched_prompt.size());
 
   for (size_t i = 0; i < batched_prompt.size(); ++i) {
     // create sequences
-    std::vector<int> prompt_tokens;
-    tokenizer_->encode(batched_prompt[i], &prompt_tokens);
+    const auto& prompt_tokens = batched_prompt_tokens[i];
 
     Sequence::Options options;
     options.sampling_param = sampling_param_;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "common/threadpool.h"
 #include "engine/llm_engine.h"
 #include "request/stopping_criteria.h"
 #include "sampling/parameters.h"
@@ -26,6 +27,9 @@ class LLM {
   StoppingCriteria stopping_criteria_;
   std::unique_ptr<Tokenizer> tokenizer_;
   int64_t max_seq_len_;
+
+  // threadpool to encode prompts in parallel
+  ThreadPool tokenizer_threadpool_;
 };
 
 }  // namespace llm
@@ -3,19 +3,25 @@
 #include <glog/logging.h>
 #include <torch/torch.h>
 
+#include <algorithm>
 #include <csignal>
 #include <filesystem>
+#include <iterator>
 #include <memory>
 #include <nlohmann/json.hpp>
+#include <vector>
 
+#include "common/cpu_affinity.h"
 #include "common/metrics.h"
 #include "engine/engine_factory.h"
+#include "grammar/grammar_compiler.h"
 #include "grpc_server.h"
 #include "handlers/chat_handler.h"
 #include "handlers/completion_handler.h"
 #include "handlers/models_handler.h"
 #include "http_server.h"
 #include "scheduler/continuous_scheduler.h"
+#include "scheduler/data_parallel_scheduler.h"
 using namespace llm;
 
 DEFINE_string(model_id, "", "hf model name.");
@@ -43,6 +49,31 @@ DEFINE_int32(max_seqs_per_batch, 128, "max number of sequences per batch");
 
 DEFINE_int32(num_speculative_tokens, 0, "number of speculative tokens");
 
+DECLARE_int32(num_decoding_steps);
+
+DEFINE_int32(num_replicas,
+             1,
+             "number of independent replicas of the model for data "
+             "parallelism, with devices and worker cpus split between them");
+DEFINE_int32(prefix_affinity_tokens,
+             256,
+             "max number of leading prompt tokens matched block by block to "
+             "route requests to the replica with the longest known prefix, 0 "
+             "to route by load only");
+
+DEFINE_int32(num_tokenizer_threads, 4, "number of threads to tokenize prompts");
+
+DEFINE_string(scheduler_cpus,
+              "",
+              "cpus to pin the scheduler thread to, e.g. 0-1. empty to not "
+              "pin");
+DEFINE_string(io_cpus,
+              "",
+              "cpus to pin grpc, http, tokenizer and response threads to, "
+              "e.g. 2-3. empty to not pin");
+
+DECLARE_string(worker_cpus);
+
 // NOLINTNEXTLINE
 static std::atomic<uint32_t> signal_received{0};
 void shutdown_handler(int signal) {
@@ -54,11 +85,40 @@ void shutdown_handler(int signal) {
   LOG(WARNING) << "Received signal " << signal << ", stopping server...";
 }
 
+// warn if cpus of worker, scheduler and io threads overlap
+void check_disjoint_cpus(const std::vector<int32_t>& scheduler_cpus,
+                         const std::vector<int32_t>& io_cpus) {
+  const auto worker_cpus = parse_cpu_list(FLAGS_worker_cpus);
+  const std::vector<std::pair<const char*, const std::vector<int32_t>*>> sets =
+      {{"worker", &worker_cpus},
+       {"scheduler", &scheduler_cpus},
+       {"io", &io_cpus}};
+  for (size_t i = 0; i < sets.size(); ++i) {
+    for (size_t j = i + 1; j < sets.size(); ++j) {
+      std::vector<int32_t> overlap;
+      std::set_intersection(sets[i].second->begin(),
+                            sets[i].second->end(),
+                            sets[j].second->begin(),
+                            sets[j].second->end(),
+                            std::back_inserter(overlap));
+      if (!overlap.empty()) {
+        LOG(WARNING) << overlap.size() << " cpus are shared by "
+                     << sets[i].first << " and " << sets[j].first
+                     << " threads, which compete for the same cores.";
+      }
+    }
+  }
+}
+
 int main(int argc, char** argv) {
   // glog and glfag will be initialized in folly::init
   folly::Init init(&argc, &argv);
   google::InstallFailureSignalHandler();
 
+  const auto scheduler_cpus = parse_cpu_list(FLAGS_scheduler_cpus);
+  const auto io_cpus = parse_cpu_list(FLAGS_io_cpus);
+  check_disjoint_cpus(scheduler_cpus, io_cpus);
+
   // check if model path exists
   if (!std::filesystem::exists(FLAGS_model_path)) {
     LOG(FATAL) << "Model path " << FLAGS_model_path << " does not exist.";
@@ -100,47 +160,89 @@ int main(int argc, char** argv) {
         return transport.send_status(503);
       });
 
-  // create engine
-  auto engine = EngineFactory::create(FLAGS_model_path,
-                                      FLAGS_device,
-                                      FLAGS_draft_model_path,
-                                      FLAGS_draft_device);
-
-  // create scheduler and grpc handlers
+  // create scheduler and engines, with one engine per replica for data
+  // parallelism
   ContinuousScheduler::Options scheduler_options;
   scheduler_options.max_tokens_per_batch(FLAGS_max_tokens_per_batch)
       .max_seqs_per_batch(FLAGS_max_seqs_per_batch)
-      .num_speculative_tokens(FLAGS_num_speculative_tokens);
-  auto scheduler =
-      std::make_unique<ContinuousScheduler>(engine.get(), scheduler_options);
-  auto completion_handler =
-      std::make_unique<CompletionHandler>(scheduler.get(), engine.get());
-  auto chat_handler =
-      std::make_unique<ChatHandler>(scheduler.get(), engine.get());
-  auto models_handler = std::make_unique<ModelsHandler>(FLAGS_model_id);
-
-  // start grpc server
-  GrpcServer grpc_server(std::move(completion_handler),
-                         std::move(chat_handler),
-                         std::move(models_handler));
-  GrpcServer::Options options;
-  options.address = "0.0.0.0";
-  options.port = FLAGS_grpc_port;
-
-  if (!grpc_server.start(options)) {
-    LOG(ERROR) << "failed to start grpc server on port " << FLAGS_grpc_port;
-    return -1;
+      .num_speculative_tokens(FLAGS_num_speculative_tokens)
+      .num_decoding_steps(FLAGS_num_decoding_steps);
+  std::vector<std::unique_ptr<Engine>> engines;
+  std::unique_ptr<Scheduler> scheduler;
+  if (FLAGS_num_replicas > 1) {
+    CHECK(FLAGS_draft_model_path.empty())
+        << "Speculative decoding is not supported with multiple replicas.";
+    engines = EngineFactory::create_replicas(
+        FLAGS_model_path, FLAGS_device, FLAGS_num_replicas);
+    std::vector<Engine*> replicas;
+    for (const auto& engine : engines) {
+      replicas.push_back(engine.get());
+    }
+    DataParallelScheduler::Options options;
+    options.scheduler_options(scheduler_options)
+        .prefix_affinity_tokens(FLAGS_prefix_affinity_tokens)
+        .scheduler_cpus(scheduler_cpus)
+        .io_cpus(io_cpus);
+    scheduler = std::make_unique<DataParallelScheduler>(replicas, options);
+  } else {
+    engines.push_back(EngineFactory::create(FLAGS_model_path,
+                                            FLAGS_device,
+                                            FLAGS_draft_model_path,
+                                            FLAGS_draft_device));
+    // the response threads of the scheduler run on io cpus
+    ScopedThreadAffinity io_affinity(io_cpus);
+    scheduler = std::make_unique<ContinuousScheduler>(engines[0].get(),
+                                                      scheduler_options);
   }
 
-  if (!http_server.start(FLAGS_http_port, /*num_threads=*/2)) {
-    LOG(ERROR) << "Failed to start http server on port " << FLAGS_http_port;
-    return -1;
+  // only tokenizer, response and server threads run on io cpus. workers and
+  // their intra-op threads, created with the engines or lazily by the main
+  // thread, keep the affinity of the main thread.
+  const auto main_cpus = get_thread_affinity();
+  // the grammar compiler is shared by handlers, and outlives the grpc server
+  std::unique_ptr<GrammarCompiler> grammar_compiler;
+  std::unique_ptr<GrpcServer> grpc_server;
+  {
+    ScopedThreadAffinity io_affinity(io_cpus);
+    // create grpc handlers, with the first engine for tokenizers and model
+    // args shared by all replicas
+    Engine* engine = engines[0].get();
+    grammar_compiler = std::make_unique<GrammarCompiler>(engine->tokenizer());
+    auto completion_handler = std::make_unique<CompletionHandler>(
+        scheduler.get(), engine, grammar_compiler.get());
+    auto chat_handler = std::make_unique<ChatHandler>(
+        scheduler.get(), engine, grammar_compiler.get());
+    auto models_handler = std::make_unique<ModelsHandler>(FLAGS_model_id);
+
+    // start grpc server
+    grpc_server = std::make_unique<GrpcServer>(std::move(completion_handler),
+                                               std::move(chat_handler),
+                                               std::move(models_handler));
+    GrpcServer::Options options;
+    options.address = "0.0.0.0";
+    options.port = FLAGS_grpc_port;
+    if (!grpc_server->start(options)) {
+      LOG(ERROR) << "failed to start grpc server on port " << FLAGS_grpc_port;
+      return -1;
+    }
+
+    if (!http_server.start(FLAGS_http_port, /*num_threads=*/2)) {
+      LOG(ERROR) << "Failed to start http server on port " << FLAGS_http_port;
+      return -1;
+    }
   }
+  CHECK(get_thread_affinity() == main_cpus)
+      << "The main thread should not inherit the io cpus";
 
   // install graceful shutdown handler
   (void)signal(SIGINT, shutdown_handler);
   (void)signal(SIGTERM, shutdown_handler);
 
+  // the main thread runs the scheduler, or updates metrics of replicas
+  if (!scheduler_cpus.empty()) {
+    set_thread_affinity(scheduler_cpus);
+  }
+
   const auto timeout = absl::Milliseconds(500);
   while (signal_received.load(std::memory_order_relaxed) == 0) {
     // move scheduler forward
@@ -148,7 +250,7 @@ int main(int argc, char** argv) {
   }
 
   // stop grpc server and http server
-  grpc_server.stop();
+  grpc_server->stop();
   http_server.stop();
 
   return 0;
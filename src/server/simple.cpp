@@ -140,16 +140,21 @@ int main(int argc, char* argv[]) {
 
     // generate tokens until the end of sentence token is generated
     while (sequence.num_generated_tokens() < FLAGS_max_seq_len) {
-      // run inference
+      // run inference without blocking
       Batch batch(&sequence);
-      engine->execute_model(batch);
+      auto output = engine->execute_model_async(batch);
+
+      // decode and print the delta of the last step while the step is running
+      std::cout << sequence.decode_delta_text(sequence.token_ids(), *tokenizer)
+                << std::flush;
+      std::move(output).get();
 
       // check if sequence is finished
       if (sequence.is_finished()) {
         break;
       }
-
-      // decode the output and print delta
+    }
+    if (!sequence.is_finished()) {
       std::cout << sequence.decode_delta_text(sequence.token_ids(), *tokenizer)
                 << std::flush;
     }
@@ -135,8 +135,10 @@ void SpeculativeEngine::validate(Batch& batch,
     return;
   }
 
-  const auto bonus_token_ids =
-      target_output.sample_output.next_tokens.view({-1, 1});
+  // sampled tokens are copied to the host, move them back to the logits
+  const auto bonus_token_ids = target_output.sample_output.next_tokens
+                                   .view({-1, 1})
+                                   .to(target_output.logits.device());
   const int64_t batch_size = bonus_token_ids.size(/*dim=*/0);
   const int64_t vocab_size = target_output.logits.size(/*dim=*/-1);
   const int64_t num_speculative_tokens =
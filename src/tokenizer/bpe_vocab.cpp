@@ -0,0 +1,398 @@
+#include "bpe_vocab.h"
+
+#include <absl/container/flat_hash_set.h>
+#include <absl/strings/escaping.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_split.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace llm {
+
+namespace {
+
+constexpr char kMagic[8] = {'B', 'P', 'E', 'V', 'O', 'C', 'A', 'B'};
+
+constexpr uint32_t kVersion = 1;
+
+// max displacement seed to try for a hash bucket
+constexpr uint32_t kMaxSeed = 1u << 24;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_ranks;
+  uint32_t num_tokens;
+  uint32_t num_buckets;
+  uint32_t num_slots;
+  uint32_t reserved;
+  uint64_t num_bytes;
+};
+static_assert(sizeof(Header) == 40, "unexpected header size");
+
+// byte offsets of the sections in the image
+struct Layout {
+  size_t offsets = 0;
+  size_t seeds = 0;
+  size_t slots = 0;
+  size_t bytes = 0;
+  size_t size = 0;
+};
+
+inline size_t align8(size_t size) { return (size + 7) & ~size_t{7}; }
+
+Layout get_layout(const Header& header) {
+  Layout layout;
+  layout.offsets = align8(sizeof(Header));
+  layout.seeds = align8(layout.offsets +
+                        (size_t{header.num_ranks} + 1) * sizeof(uint32_t));
+  layout.slots =
+      align8(layout.seeds + size_t{header.num_buckets} * sizeof(uint32_t));
+  layout.bytes =
+      align8(layout.slots + size_t{header.num_slots} * sizeof(int32_t));
+  layout.size = align8(layout.bytes + header.num_bytes);
+  return layout;
+}
+
+// fnv-1a hash of the bytes, which is stable across processes
+inline uint64_t hash_bytes(const std::string_view& bytes) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char c : bytes) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// the finalizer of splitmix64 to spread the bits of the hash
+inline uint64_t mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// map the high 32 bits of the hash into [0, n) without division
+inline uint32_t reduce(uint64_t hash, uint32_t n) {
+  return static_cast<uint32_t>(((hash >> 32) * n) >> 32);
+}
+
+inline uint32_t get_bucket(uint64_t hash, uint32_t num_buckets) {
+  return reduce(mix(hash), num_buckets);
+}
+
+inline uint32_t get_slot(uint64_t hash, uint32_t seed, uint32_t num_slots) {
+  return reduce(mix(hash + (seed + 1) * 0x9e3779b97f4a7c15ULL), num_slots);
+}
+
+}  // namespace
+
+BpeVocab::BpeVocab(
+    const std::vector<std::pair<std::string, int32_t>>& tokens) {
+  // the token of each rank, the first one wins for duplicates
+  std::vector<const std::string*> rank_to_token;
+  absl::flat_hash_set<std::string_view> seen_tokens;
+  for (const auto& [token, rank] : tokens) {
+    if (token.empty() || rank < 0) {
+      LOG(WARNING) << "Invalid token: " << token << ", rank: " << rank;
+      continue;
+    }
+    if (static_cast<size_t>(rank) >= rank_to_token.size()) {
+      rank_to_token.resize(rank + 1, nullptr);
+    }
+    if (rank_to_token[rank] != nullptr) {
+      LOG(WARNING) << "Duplicate rank: " << rank;
+      continue;
+    }
+    if (!seen_tokens.insert(token).second) {
+      LOG(WARNING) << "Duplicate token: " << token;
+      continue;
+    }
+    rank_to_token[rank] = &token;
+  }
+
+  Header header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.num_ranks = static_cast<uint32_t>(rank_to_token.size());
+  header.num_tokens = static_cast<uint32_t>(seen_tokens.size());
+  header.num_buckets = std::max<uint32_t>(header.num_tokens / 4, 1);
+  header.num_slots =
+      std::max<uint32_t>(header.num_tokens + header.num_tokens / 4, 1);
+  header.reserved = 0;
+  header.num_bytes = 0;
+  for (const auto* token : rank_to_token) {
+    if (token != nullptr) {
+      header.num_bytes += token->size();
+    }
+  }
+  CHECK_LE(header.num_bytes, UINT32_MAX) << "Too many bytes in tokens";
+
+  // hash and displace: place the buckets from the largest, find a seed for
+  // each bucket that maps all its tokens into free slots.
+  std::vector<uint64_t> hashes(header.num_ranks, 0);
+  // ranks of bucket i in bucket_ranks[bucket_starts[i], bucket_starts[i + 1])
+  std::vector<uint32_t> bucket_starts(header.num_buckets + 1, 0);
+  for (size_t rank = 0; rank < rank_to_token.size(); ++rank) {
+    if (rank_to_token[rank] != nullptr) {
+      hashes[rank] = hash_bytes(*rank_to_token[rank]);
+      ++bucket_starts[get_bucket(hashes[rank], header.num_buckets) + 1];
+    }
+  }
+  for (uint32_t i = 0; i < header.num_buckets; ++i) {
+    bucket_starts[i + 1] += bucket_starts[i];
+  }
+  std::vector<int32_t> bucket_ranks(header.num_tokens);
+  std::vector<uint32_t> bucket_ends(bucket_starts.begin(),
+                                    bucket_starts.end() - 1);
+  for (size_t rank = 0; rank < rank_to_token.size(); ++rank) {
+    if (rank_to_token[rank] != nullptr) {
+      const uint32_t bucket = get_bucket(hashes[rank], header.num_buckets);
+      bucket_ranks[bucket_ends[bucket]++] = static_cast<int32_t>(rank);
+    }
+  }
+
+  auto bucket_size = [&bucket_starts](uint32_t bucket) {
+    return bucket_starts[bucket + 1] - bucket_starts[bucket];
+  };
+  std::vector<uint32_t> order(header.num_buckets);
+  for (uint32_t i = 0; i < header.num_buckets; ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return bucket_size(a) > bucket_size(b);
+  });
+
+  std::vector<uint32_t> seeds(header.num_buckets, 0);
+  std::vector<int32_t> slots(header.num_slots, -1);
+  std::vector<uint32_t> bucket_slots;
+  for (const uint32_t bucket : order) {
+    const uint32_t size = bucket_size(bucket);
+    if (size == 0) {
+      // the rest of buckets are empty as well
+      break;
+    }
+    const int32_t* ranks = bucket_ranks.data() + bucket_starts[bucket];
+    for (uint32_t seed = 0;; ++seed) {
+      CHECK_LT(seed, kMaxSeed) << "Failed to build the perfect hash";
+      bucket_slots.clear();
+      for (uint32_t i = 0; i < size; ++i) {
+        const uint32_t slot =
+            get_slot(hashes[ranks[i]], seed, header.num_slots);
+        if (slots[slot] != -1 ||
+            std::find(bucket_slots.begin(), bucket_slots.end(), slot) !=
+                bucket_slots.end()) {
+          break;
+        }
+        bucket_slots.push_back(slot);
+      }
+      if (bucket_slots.size() == size) {
+        for (uint32_t i = 0; i < size; ++i) {
+          slots[bucket_slots[i]] = ranks[i];
+        }
+        seeds[bucket] = seed;
+        break;
+      }
+    }
+  }
+
+  // write the sections into the image
+  const Layout layout = get_layout(header);
+  buffer_.assign(layout.size, '\0');
+  char* data = buffer_.data();
+  std::memcpy(data, &header, sizeof(header));
+  auto* offsets = reinterpret_cast<uint32_t*>(data + layout.offsets);
+  char* bytes = data + layout.bytes;
+  uint32_t offset = 0;
+  for (size_t rank = 0; rank < rank_to_token.size(); ++rank) {
+    offsets[rank] = offset;
+    if (rank_to_token[rank] != nullptr) {
+      const auto& token = *rank_to_token[rank];
+      std::memcpy(bytes + offset, token.data(), token.size());
+      offset += static_cast<uint32_t>(token.size());
+    }
+  }
+  offsets[rank_to_token.size()] = offset;
+  std::memcpy(
+      data + layout.seeds, seeds.data(), seeds.size() * sizeof(seeds[0]));
+  std::memcpy(
+      data + layout.slots, slots.data(), slots.size() * sizeof(slots[0]));
+  CHECK(init(buffer_.data(), buffer_.size()));
+}
+
+BpeVocab::~BpeVocab() {
+  if (mapped_data_ != nullptr) {
+    ::munmap(mapped_data_, mapped_size_);
+  }
+}
+
+bool BpeVocab::init(const char* data, size_t size) {
+  if (size < sizeof(Header)) {
+    return false;
+  }
+  Header header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion) {
+    return false;
+  }
+  if (header.num_buckets == 0 || header.num_slots == 0) {
+    return false;
+  }
+  const Layout layout = get_layout(header);
+  if (layout.size != size) {
+    return false;
+  }
+
+  const auto* offsets =
+      reinterpret_cast<const uint32_t*>(data + layout.offsets);
+  const auto* slots = reinterpret_cast<const int32_t*>(data + layout.slots);
+  // reject corrupted offsets and slots, which are read without bound checks
+  for (size_t i = 0; i < header.num_ranks; ++i) {
+    if (offsets[i] > offsets[i + 1]) {
+      return false;
+    }
+  }
+  if (offsets[0] != 0 || offsets[header.num_ranks] != header.num_bytes) {
+    return false;
+  }
+  for (size_t i = 0; i < header.num_slots; ++i) {
+    if (slots[i] < -1 || slots[i] >= static_cast<int64_t>(header.num_ranks)) {
+      return false;
+    }
+  }
+
+  data_ = data;
+  size_ = size;
+  offsets_ = offsets;
+  seeds_ = reinterpret_cast<const uint32_t*>(data + layout.seeds);
+  slots_ = slots;
+  bytes_ = data + layout.bytes;
+  num_ranks_ = header.num_ranks;
+  num_tokens_ = header.num_tokens;
+  num_buckets_ = header.num_buckets;
+  num_slots_ = header.num_slots;
+  return true;
+}
+
+std::unique_ptr<BpeVocab> BpeVocab::from_file(const std::string& path) {
+  if (is_binary_file(path)) {
+    return load_binary(path);
+  }
+  return load_tiktoken(path);
+}
+
+std::unique_ptr<BpeVocab> BpeVocab::load_binary(const std::string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Failed to open vocab file: " << path;
+    return nullptr;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+    LOG(ERROR) << "Failed to stat vocab file: " << path;
+    ::close(fd);
+    return nullptr;
+  }
+  const auto size = static_cast<size_t>(st.st_size);
+  void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "Failed to map vocab file: " << path;
+    return nullptr;
+  }
+
+  // the constructor is private
+  std::unique_ptr<BpeVocab> vocab(new BpeVocab());
+  vocab->mapped_data_ = data;
+  vocab->mapped_size_ = size;
+  if (!vocab->init(static_cast<const char*>(data), size)) {
+    LOG(ERROR) << "Invalid vocab file: " << path;
+    return nullptr;
+  }
+  return vocab;
+}
+
+std::unique_ptr<BpeVocab> BpeVocab::load_tiktoken(const std::string& path) {
+  // read token + rank from vocab file
+  std::ifstream fs(path);
+  if (!fs) {
+    LOG(ERROR) << "Failed to open vocab file: " << path;
+    return nullptr;
+  }
+
+  std::vector<std::pair<std::string, int32_t>> tokens;
+  std::string line;
+  while (std::getline(fs, line)) {
+    if (line.empty()) {
+      // skip empty line
+      continue;
+    }
+    // split line by space
+    const std::vector<std::string> parts = absl::StrSplit(line, ' ');
+    if (parts.size() != 2) {
+      LOG(WARNING) << "Failed to parse line: " << line;
+      continue;
+    }
+    // parse token and rank
+    std::string token;
+    if (!absl::Base64Unescape(parts[0], &token)) {
+      LOG(WARNING) << "Failed to parse token: " << parts[0];
+      continue;
+    }
+    int32_t rank = 0;
+    if (!absl::SimpleAtoi(parts[1], &rank)) {
+      LOG(WARNING) << "Failed to parse rank: " << parts[1];
+      continue;
+    }
+    tokens.emplace_back(std::move(token), rank);
+  }
+  return std::make_unique<BpeVocab>(tokens);
+}
+
+bool BpeVocab::is_binary_file(const std::string& path) {
+  std::ifstream fs(path, std::ios::binary);
+  char magic[sizeof(kMagic)];
+  if (!fs.read(magic, sizeof(magic))) {
+    return false;
+  }
+  return std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+bool BpeVocab::save(const std::string& path) const {
+  std::ofstream fs(path, std::ios::binary | std::ios::trunc);
+  if (!fs) {
+    LOG(ERROR) << "Failed to open file: " << path;
+    return false;
+  }
+  fs.write(data_, static_cast<std::streamsize>(size_));
+  return static_cast<bool>(fs);
+}
+
+int32_t BpeVocab::find(const std::string_view& token) const {
+  const uint64_t hash = hash_bytes(token);
+  const uint32_t seed = seeds_[get_bucket(hash, num_buckets_)];
+  const int32_t rank = slots_[get_slot(hash, seed, num_slots_)];
+  // the slot may hold another token for tokens not in the vocab
+  if (rank < 0 || this->token(rank) != token) {
+    return -1;
+  }
+  return rank;
+}
+
+}  // namespace llm
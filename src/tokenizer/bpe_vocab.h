@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace llm {
+
+// A compiled vocab of byte pair encoding, which maps the bytes of tokens to
+// their ranks. The bytes of tokens are packed in rank order and indexed by a
+// perfect hash, so that the whole vocab is a flat binary image. The image can
+// be saved to a file, which is mapped into memory and used in place without
+// any parsing when loading. immutable and thread safe.
+//
+// layout of the image, with each section aligned to 8 bytes:
+//  header
+//  offsets: uint32_t[num_ranks + 1], bytes of rank i in [offsets[i],
+//           offsets[i + 1]), empty for unused ranks.
+//  seeds: uint32_t[num_buckets], the displacement seed of each hash bucket
+//  slots: int32_t[num_slots], the rank of each slot, -1 for empty slots
+//  bytes: char[num_bytes]
+// integers are stored in the native byte order.
+class BpeVocab final {
+ public:
+  // build the vocab from (token, rank) pairs. tokens with duplicate bytes or
+  // ranks are skipped with a warning.
+  explicit BpeVocab(
+      const std::vector<std::pair<std::string, int32_t>>& tokens);
+
+  ~BpeVocab();
+
+  // disable copy/move constructor and assignment
+  BpeVocab(const BpeVocab&) = delete;
+  BpeVocab& operator=(const BpeVocab&) = delete;
+  BpeVocab(BpeVocab&&) = delete;
+  BpeVocab& operator=(BpeVocab&&) = delete;
+
+  // load the vocab from a compiled binary file or a tiktoken file with a
+  // base64 encoded token and its rank per line. returns nullptr on failure.
+  static std::unique_ptr<BpeVocab> from_file(const std::string& path);
+
+  // map the compiled binary file into memory, returns nullptr on failure.
+  static std::unique_ptr<BpeVocab> load_binary(const std::string& path);
+
+  // parse the tiktoken file, returns nullptr on failure.
+  static std::unique_ptr<BpeVocab> load_tiktoken(const std::string& path);
+
+  // check if the file is a compiled binary file
+  static bool is_binary_file(const std::string& path);
+
+  // save the compiled binary file
+  bool save(const std::string& path) const;
+
+  // get the rank of the token, -1 if not found
+  int32_t find(const std::string_view& token) const;
+
+  // get the bytes of the token with the rank, empty if the rank is unused
+  std::string_view token(int32_t rank) const {
+    return {bytes_ + offsets_[rank], offsets_[rank + 1] - offsets_[rank]};
+  }
+
+  // number of ranks, which is the max rank + 1
+  size_t num_ranks() const { return num_ranks_; }
+
+  // number of tokens
+  size_t num_tokens() const { return num_tokens_; }
+
+ private:
+  BpeVocab() = default;
+
+  // set up the sections from the image, returns false if the image is invalid
+  bool init(const char* data, size_t size);
+
+  // the image owned by the vocab, or mapped from a file
+  std::string buffer_;
+  void* mapped_data_ = nullptr;
+  size_t mapped_size_ = 0;
+
+  // sections of the image
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  const uint32_t* offsets_ = nullptr;
+  const uint32_t* seeds_ = nullptr;
+  const int32_t* slots_ = nullptr;
+  const char* bytes_ = nullptr;
+
+  size_t num_ranks_ = 0;
+  size_t num_tokens_ = 0;
+  uint32_t num_buckets_ = 0;
+  uint32_t num_slots_ = 0;
+};
+
+}  // namespace llm
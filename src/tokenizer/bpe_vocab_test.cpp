@@ -0,0 +1,108 @@
+#include "bpe_vocab.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llm {
+
+TEST(BpeVocabTest, Basic) {
+  // ranks 3 and 5 are unused
+  const std::vector<std::pair<std::string, int32_t>> tokens = {
+      {"a", 0}, {"b", 1}, {"ab", 2}, {std::string("\0c", 2), 4}, {"abc", 6}};
+  BpeVocab vocab(tokens);
+  EXPECT_EQ(vocab.num_ranks(), 7);
+  EXPECT_EQ(vocab.num_tokens(), 5);
+
+  for (const auto& [token, rank] : tokens) {
+    EXPECT_EQ(vocab.find(token), rank);
+    EXPECT_EQ(vocab.token(rank), token);
+  }
+  EXPECT_EQ(vocab.token(3), "");
+  EXPECT_EQ(vocab.token(5), "");
+
+  EXPECT_EQ(vocab.find(""), -1);
+  EXPECT_EQ(vocab.find("c"), -1);
+  EXPECT_EQ(vocab.find("abcd"), -1);
+  EXPECT_EQ(vocab.find(std::string("\0", 1)), -1);
+}
+
+TEST(BpeVocabTest, Duplicates) {
+  // the first one wins for duplicate tokens and ranks
+  BpeVocab vocab({{"a", 0}, {"b", 0}, {"a", 1}, {"c", 2}});
+  EXPECT_EQ(vocab.num_tokens(), 2);
+  EXPECT_EQ(vocab.find("a"), 0);
+  EXPECT_EQ(vocab.find("b"), -1);
+  EXPECT_EQ(vocab.find("c"), 2);
+  EXPECT_EQ(vocab.token(1), "");
+}
+
+TEST(BpeVocabTest, Empty) {
+  const std::vector<std::pair<std::string, int32_t>> tokens;
+  BpeVocab vocab(tokens);
+  EXPECT_EQ(vocab.num_ranks(), 0);
+  EXPECT_EQ(vocab.num_tokens(), 0);
+  EXPECT_EQ(vocab.find("a"), -1);
+}
+
+TEST(BpeVocabTest, SaveAndLoad) {
+  // all single bytes and some pairs
+  std::vector<std::pair<std::string, int32_t>> tokens;
+  for (int32_t i = 0; i < 256; ++i) {
+    tokens.emplace_back(std::string(1, static_cast<char>(i)), i);
+  }
+  for (int32_t i = 0; i < 4096; ++i) {
+    tokens.emplace_back(std::string(1, static_cast<char>(i / 64 + 'A')) +
+                            std::string(1, static_cast<char>(i % 64 + 'A')),
+                        256 + i);
+  }
+  BpeVocab vocab(tokens);
+
+  const auto path =
+      std::filesystem::temp_directory_path() / "bpe_vocab_test.bin";
+  ASSERT_TRUE(vocab.save(path.string()));
+  EXPECT_TRUE(BpeVocab::is_binary_file(path.string()));
+
+  const auto loaded = BpeVocab::from_file(path.string());
+  ASSERT_NE(loaded, nullptr);
+  EXPECT_EQ(loaded->num_ranks(), vocab.num_ranks());
+  EXPECT_EQ(loaded->num_tokens(), vocab.num_tokens());
+  for (const auto& [token, rank] : tokens) {
+    EXPECT_EQ(loaded->find(token), rank);
+    EXPECT_EQ(loaded->token(rank), token);
+  }
+  EXPECT_EQ(loaded->find("not a token"), -1);
+  std::filesystem::remove(path);
+}
+
+TEST(BpeVocabTest, InvalidFile) {
+  BpeVocab vocab({{"a", 0}, {"b", 1}, {"ab", 2}});
+  const auto path =
+      std::filesystem::temp_directory_path() / "bpe_vocab_test_invalid.bin";
+  ASSERT_TRUE(vocab.save(path.string()));
+
+  // truncated file
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+  EXPECT_TRUE(BpeVocab::is_binary_file(path.string()));
+  EXPECT_EQ(BpeVocab::load_binary(path.string()), nullptr);
+
+  // missing file
+  std::filesystem::remove(path);
+  EXPECT_FALSE(BpeVocab::is_binary_file(path.string()));
+  EXPECT_EQ(BpeVocab::load_binary(path.string()), nullptr);
+}
+
+TEST(BpeVocabTest, LoadTiktoken) {
+  const auto vocab = BpeVocab::from_file("data/test.tiktoken");
+  ASSERT_NE(vocab, nullptr);
+  EXPECT_EQ(vocab->num_tokens(), 300);
+  EXPECT_EQ(vocab->find("H"), 39);
+  EXPECT_EQ(vocab->token(39), "H");
+}
+
+}  // namespace llm
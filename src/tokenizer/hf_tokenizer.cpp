@@ -2,10 +2,25 @@
 
 #include <glog/logging.h>
 
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include "huggingface/tokenizers.h"
 
 namespace llm {
 
+namespace {
+
+// max number of special tokens added to the ids of a text
+constexpr size_t kMaxSpecialTokens = 8;
+
+// initial guess of the number of bytes per token when decoding
+constexpr size_t kBytesPerToken = 8;
+
+}  // namespace
+
 std::unique_ptr<HFTokenizer> HFTokenizer::from_file(
     const std::string& tokenizer_file_path) {
   TokenizerHandle handle = tokenizer_from_file(tokenizer_file_path.c_str());
@@ -21,35 +36,110 @@ HFTokenizer::HFTokenizer(const std::string& tokenizer_file_path,
 }
 
 std::unique_ptr<Tokenizer> HFTokenizer::clone() const {
-  return from_file(tokenizer_file_path_);
+  TokenizerHandle handle = tokenizer_clone(handle_);
+  CHECK(handle != nullptr) << "Failed to clone tokenizer from file: "
+                           << tokenizer_file_path_;
+  return std::make_unique<HFTokenizer>(tokenizer_file_path_, handle);
 }
 
 HFTokenizer::~HFTokenizer() { tokenizer_free(handle_); }
 
 bool HFTokenizer::encode(const std::string_view& text,
                          std::vector<int32_t>* ids) const {
-  tokenizer_encode(
-      handle_, text.data(), text.size(), /*add_special_tokens=*/true);
-  const uint32_t* data = nullptr;
-  size_t len = 0;
-  tokenizer_get_encode_ids(handle_, &data, &len);
-  ids->reserve(len);
-  for (size_t i = 0; i < len; ++i) {
-    ids->push_back(static_cast<int32_t>(data[i]));
+  return encode_texts({text}, {ids});
+}
+
+bool HFTokenizer::encode_batch(const std::vector<std::string>& texts,
+                               std::vector<std::vector<int32_t>>* ids,
+                               ThreadPool* threadpool) const {
+  if (threadpool != nullptr) {
+    // the handle can be used by multiple threads concurrently
+    return Tokenizer::encode_batch(texts, ids, threadpool);
+  }
+  ids->clear();
+  ids->resize(texts.size());
+  std::vector<std::string_view> views(texts.begin(), texts.end());
+  std::vector<std::vector<int32_t>*> outputs(texts.size());
+  for (size_t i = 0; i < texts.size(); ++i) {
+    outputs[i] = &(*ids)[i];
   }
-  return true;
+  return encode_texts(views, outputs);
+}
+
+bool HFTokenizer::encode_texts(
+    const std::vector<std::string_view>& texts,
+    const std::vector<std::vector<int32_t>*>& ids) const {
+  const size_t num_texts = texts.size();
+  std::vector<const char*> data(num_texts);
+  std::vector<size_t> lens(num_texts);
+  std::vector<size_t> offsets(num_texts);
+  std::vector<uint32_t*> out_ids(num_texts);
+  std::vector<size_t> capacities(num_texts);
+  std::vector<size_t> out_lens(num_texts);
+  for (size_t i = 0; i < num_texts; ++i) {
+    data[i] = texts[i].data();
+    lens[i] = texts[i].size();
+    offsets[i] = ids[i]->size();
+    // byte level tokenizers produce at most one id per byte, plus a few
+    // special tokens. larger outputs are encoded again with the exact size.
+    capacities[i] = texts[i].size() + kMaxSpecialTokens;
+    ids[i]->resize(offsets[i] + capacities[i]);
+    out_ids[i] = reinterpret_cast<uint32_t*>(ids[i]->data() + offsets[i]);
+  }
+
+  bool ok = tokenizer_encode_batch(handle_,
+                                   data.data(),
+                                   lens.data(),
+                                   num_texts,
+                                   /*add_special_tokens=*/true,
+                                   out_ids.data(),
+                                   capacities.data(),
+                                   out_lens.data());
+  for (size_t i = 0; ok && i < num_texts; ++i) {
+    if (out_lens[i] > capacities[i]) {
+      const size_t capacity = out_lens[i];
+      ids[i]->resize(offsets[i] + capacity);
+      uint32_t* out = reinterpret_cast<uint32_t*>(ids[i]->data() + offsets[i]);
+      ok = tokenizer_encode_batch(handle_,
+                                  &data[i],
+                                  &lens[i],
+                                  /*num_texts=*/1,
+                                  /*add_special_tokens=*/true,
+                                  &out,
+                                  &capacity,
+                                  &out_lens[i]);
+    }
+  }
+  for (size_t i = 0; i < num_texts; ++i) {
+    ids[i]->resize(offsets[i] + (ok ? out_lens[i] : 0));
+  }
+  return ok;
 }
 
 std::string HFTokenizer::decode(const Slice<int32_t>& ids,
                                 bool skip_special_tokens) const {
-  tokenizer_decode(handle_,
-                   reinterpret_cast<const uint32_t*>(ids.data()),
-                   ids.size(),
-                   skip_special_tokens);
-  const char* data = nullptr;
-  size_t len = 0;
-  tokenizer_get_decode_str(handle_, &data, &len);
-  return {data, len};
+  // most tokens are short, longer texts are decoded again with the exact size
+  std::string text(ids.size() * kBytesPerToken, '\0');
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    size_t len = 0;
+    if (!tokenizer_decode_into(handle_,
+                               reinterpret_cast<const uint32_t*>(ids.data()),
+                               ids.size(),
+                               skip_special_tokens,
+                               text.data(),
+                               text.size(),
+                               &len)) {
+      LOG(ERROR) << "Failed to decode tokens with tokenizer: "
+                 << tokenizer_file_path_;
+      return {};
+    }
+    const bool fits = len <= text.size();
+    text.resize(len);
+    if (fits) {
+      break;
+    }
+  }
+  return text;
 }
 
 size_t HFTokenizer::vocab_size() const {
@@ -1,12 +1,19 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include "tokenizer.h"
 #include "huggingface/tokenizers.h"
 
 namespace llm {
 
 // a tokenizer that uses hf/tokenizers
-// not thread-safe, can't be used in multiple threads.
+// thread safe, ids and text are written directly into the output buffers
+// without keeping any state in the handle. clones share the tokenizer model.
 class HFTokenizer : public Tokenizer {
  public:
   HFTokenizer(const std::string& tokenizer_file_path, TokenizerHandle handle);
@@ -16,16 +23,27 @@ class HFTokenizer : public Tokenizer {
   bool encode(const std::string_view& text,
               std::vector<int32_t>* ids) const override;
 
+  // encode all texts with a single call into the tokenizer library if the
+  // threadpool is nullptr, otherwise encode them in parallel.
+  bool encode_batch(const std::vector<std::string>& texts,
+                    std::vector<std::vector<int32_t>>* ids,
+                    ThreadPool* threadpool) const override;
+
   std::string decode(const Slice<int32_t>& ids,
                      bool skip_special_tokens) const override;
 
   size_t vocab_size() const override;
 
+  // clones share the tokenizer model with this tokenizer
   std::unique_ptr<Tokenizer> clone() const override;
 
   static std::unique_ptr<HFTokenizer> from_file(const std::string& path);
 
  private:
+  // encode the texts and append the ids of each text to its output
+  bool encode_texts(const std::vector<std::string_view>& texts,
+                    const std::vector<std::vector<int32_t>*>& ids) const;
+
   std::string tokenizer_file_path_;
 
   TokenizerHandle handle_ = nullptr;
@@ -0,0 +1,85 @@
+#include "piece_table.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/slice.h"
+
+namespace llm {
+
+PieceTable::PieceTable(const std::vector<Piece>& pieces) {
+  int32_t max_id = -1;
+  for (const auto& piece : pieces) {
+    CHECK_GE(piece.id, 0) << "Invalid id: " << piece.id;
+    max_id = std::max(max_id, piece.id);
+  }
+  const size_t num_ids = max_id + 1;
+
+  // the last piece for each id
+  std::vector<const Piece*> id_to_piece(num_ids, nullptr);
+  for (const auto& piece : pieces) {
+    id_to_piece[piece.id] = &piece;
+  }
+
+  size_t num_bytes = 0;
+  for (const auto* piece : id_to_piece) {
+    if (piece != nullptr) {
+      num_bytes += piece->bytes.size();
+    }
+  }
+  CHECK_LE(num_bytes, std::numeric_limits<uint32_t>::max())
+      << "Too many bytes in pieces";
+
+  bytes_.reserve(num_bytes);
+  offsets_.reserve(num_ids + 1);
+  used_.resize((num_ids + 63) / 64, 0);
+  special_.resize((num_ids + 63) / 64, 0);
+  offsets_.push_back(0);
+  for (size_t id = 0; id < num_ids; ++id) {
+    const auto* piece = id_to_piece[id];
+    if (piece != nullptr) {
+      bytes_.append(piece->bytes);
+      used_[id / 64] |= uint64_t{1} << (id % 64);
+      if (piece->special) {
+        special_[id / 64] |= uint64_t{1} << (id % 64);
+      }
+    }
+    offsets_.push_back(static_cast<uint32_t>(bytes_.size()));
+  }
+}
+
+size_t PieceTable::num_bytes(const Slice<int32_t>& ids) const {
+  size_t num_bytes = 0;
+  for (const int32_t id : ids) {
+    if (contains(id)) {
+      num_bytes += offsets_[id + 1] - offsets_[id];
+    }
+  }
+  return num_bytes;
+}
+
+void PieceTable::decode(const Slice<int32_t>& ids,
+                        bool skip_special_tokens,
+                        std::string* text) const {
+  // reserve the upper bound of the text size to append without reallocation
+  text->reserve(text->size() + num_bytes(ids));
+
+  for (const int32_t id : ids) {
+    if (!contains(id)) {
+      LOG(ERROR) << "Failed to find token for id: " << id;
+      continue;
+    }
+    if (skip_special_tokens && is_special(id)) {
+      continue;
+    }
+    text->append(bytes_.data() + offsets_[id], offsets_[id + 1] - offsets_[id]);
+  }
+}
+
+}  // namespace llm
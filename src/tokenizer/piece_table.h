@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/slice.h"
+
+namespace llm {
+
+// A flat table of the bytes of each token for decoding. Since token ids are
+// dense, the bytes of all tokens are packed into one arena indexed by the
+// offsets of the tokens, and special tokens are marked in a bitset, so that
+// decoding a sequence is a single reserve-and-append loop without hashing.
+// immutable after construction and thread safe.
+class PieceTable final {
+ public:
+  struct Piece {
+    int32_t id = 0;
+    std::string_view bytes;
+    bool special = false;
+  };
+
+  PieceTable() = default;
+
+  // build the table from the pieces in any order, ids without pieces are
+  // unused. the last piece wins if there are duplicate ids.
+  explicit PieceTable(const std::vector<Piece>& pieces);
+
+  // number of ids in the table, which is the max id + 1
+  size_t size() const { return offsets_.empty() ? 0 : offsets_.size() - 1; }
+
+  bool empty() const { return size() == 0; }
+
+  // check if the id has a piece
+  bool contains(int32_t id) const {
+    return id >= 0 && static_cast<size_t>(id) < size() && test(used_, id);
+  }
+
+  // check if the id is a special token, the id must be in the table
+  bool is_special(int32_t id) const { return test(special_, id); }
+
+  // get the bytes of the token, the id must be in the table
+  std::string_view piece(int32_t id) const {
+    return {bytes_.data() + offsets_[id], offsets_[id + 1] - offsets_[id]};
+  }
+
+  // total bytes of the tokens in the table, an upper bound of the text size
+  size_t num_bytes(const Slice<int32_t>& ids) const;
+
+  // append the bytes of the tokens to the text, ids not in the table are
+  // logged and skipped.
+  void decode(const Slice<int32_t>& ids,
+              bool skip_special_tokens,
+              std::string* text) const;
+
+ private:
+  static bool test(const std::vector<uint64_t>& bits, int32_t id) {
+    return (bits[id / 64] >> (id % 64)) & 1;
+  }
+
+  // bytes of all pieces, concatenated in id order
+  std::string bytes_;
+
+  // the bytes of token i are in [offsets_[i], offsets_[i + 1])
+  std::vector<uint32_t> offsets_;
+
+  // bitsets of the ids with pieces and the special tokens
+  std::vector<uint64_t> used_;
+  std::vector<uint64_t> special_;
+};
+
+}  // namespace llm
@@ -0,0 +1,66 @@
+#include "piece_table.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace llm {
+
+TEST(PieceTableTest, Basic) {
+  // ids are added in any order, id 3 is unused
+  const PieceTable table({
+      {/*id=*/2, "c", /*special=*/false},
+      {/*id=*/0, "a", /*special=*/false},
+      {/*id=*/4, "<s>", /*special=*/true},
+      {/*id=*/1, "", /*special=*/false},
+  });
+  EXPECT_EQ(table.size(), 5);
+  EXPECT_TRUE(table.contains(0));
+  EXPECT_TRUE(table.contains(1));
+  EXPECT_FALSE(table.contains(3));
+  EXPECT_FALSE(table.contains(5));
+  EXPECT_FALSE(table.contains(-1));
+  EXPECT_FALSE(table.is_special(2));
+  EXPECT_TRUE(table.is_special(4));
+  EXPECT_EQ(table.piece(0), "a");
+  EXPECT_EQ(table.piece(1), "");
+  EXPECT_EQ(table.piece(4), "<s>");
+
+  const std::vector<int32_t> ids = {4, 0, 1, 3, 2, 5, 4};
+  EXPECT_EQ(table.num_bytes(ids), 8);
+  {
+    std::string text = "x";
+    table.decode(ids, /*skip_special_tokens=*/false, &text);
+    EXPECT_EQ(text, "x<s>ac<s>");
+  }
+  {
+    std::string text;
+    table.decode(ids, /*skip_special_tokens=*/true, &text);
+    EXPECT_EQ(text, "ac");
+  }
+}
+
+TEST(PieceTableTest, DuplicateIds) {
+  // the last piece wins
+  const PieceTable table({
+      {/*id=*/0, "a", /*special=*/false},
+      {/*id=*/1, "b", /*special=*/false},
+      {/*id=*/1, "<s>", /*special=*/true},
+  });
+  EXPECT_EQ(table.size(), 2);
+  EXPECT_TRUE(table.is_special(1));
+  EXPECT_EQ(table.piece(1), "<s>");
+}
+
+TEST(PieceTableTest, Empty) {
+  const PieceTable table;
+  EXPECT_TRUE(table.empty());
+  EXPECT_FALSE(table.contains(0));
+  std::string text;
+  table.decode(
+      std::vector<int32_t>{0, 1}, /*skip_special_tokens=*/false, &text);
+  EXPECT_EQ(text, "");
+}
+
+}  // namespace llm
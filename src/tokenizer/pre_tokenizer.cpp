@@ -0,0 +1,347 @@
+#include "pre_tokenizer.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "unicode_tables.h"
+
+namespace llm {
+
+namespace {
+
+// the cl100k_base pattern with look-aheads rewritten for RE2, with numbers
+// split into single digits (qwen) or up to 3 digits (cl100k_base, llama3).
+struct KnownPattern {
+  const char* pattern;
+  size_t max_digits;
+};
+// clang-format off
+constexpr KnownPattern kKnownPatterns[] = {
+    {R"((?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+[^\S]|\s+)",
+     1},
+    {R"((?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}{1,3}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+[^\S]|\s+)",
+     3},
+};
+// clang-format on
+
+// classes of characters in the pattern, \s is [\t\n\f\r ] in RE2.
+enum CharClass : uint8_t {
+  // invalid utf-8 byte, not matched by the pattern
+  kInvalid = 0,
+  // \p{L}
+  kLetter = 1,
+  // \p{N}
+  kNumber = 2,
+  // \s
+  kSpace = 3,
+  // [^\s\p{L}\p{N}]
+  kOther = 4,
+};
+
+constexpr std::array<CharClass, 128> make_ascii_classes() {
+  std::array<CharClass, 128> classes{};
+  for (int c = 0; c < 128; ++c) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+      classes[c] = kLetter;
+    } else if (c >= '0' && c <= '9') {
+      classes[c] = kNumber;
+    } else if (c == '\t' || c == '\n' || c == '\f' || c == '\r' || c == ' ') {
+      classes[c] = kSpace;
+    } else {
+      classes[c] = kOther;
+    }
+  }
+  return classes;
+}
+constexpr std::array<CharClass, 128> kAsciiClasses = make_ascii_classes();
+
+template <size_t N>
+bool in_ranges(const UnicodeRange (&ranges)[N], uint32_t cp) {
+  // find the first range with last >= cp
+  const auto* it = std::lower_bound(
+      std::begin(ranges),
+      std::end(ranges),
+      cp,
+      [](const UnicodeRange& range, uint32_t cp) { return range.last < cp; });
+  return it != std::end(ranges) && it->first <= cp;
+}
+
+CharClass classify_slow(uint32_t cp) {
+  if (in_ranges(kLetterRanges, cp)) {
+    return kLetter;
+  }
+  if (in_ranges(kNumberRanges, cp)) {
+    return kNumber;
+  }
+  // \s only matches ascii whitespaces
+  return kOther;
+}
+
+// classes of code points in the basic multilingual plane
+const std::array<CharClass, 0x10000>& bmp_classes() {
+  static const auto* classes = [] {
+    auto* classes = new std::array<CharClass, 0x10000>();
+    for (uint32_t cp = 0; cp < classes->size(); ++cp) {
+      (*classes)[cp] = cp < 0x80 ? kAsciiClasses[cp] : classify_slow(cp);
+    }
+    return classes;
+  }();
+  return *classes;
+}
+
+inline CharClass classify(uint32_t cp) {
+  return cp < 0x10000 ? bmp_classes()[cp] : classify_slow(cp);
+}
+
+struct Char {
+  CharClass cls;
+  // number of bytes of the character
+  uint32_t len;
+};
+
+// decode the character at pos, which is valid if it is well formed as RE2
+// does, where surrogates are accepted but overlong encodings and code points
+// above U+10FFFF are not.
+inline Char decode(const std::string_view& text, size_t pos) {
+  const auto* s = reinterpret_cast<const uint8_t*>(text.data()) + pos;
+  const size_t n = text.size() - pos;
+  const uint8_t b0 = s[0];
+  if (b0 < 0x80) {
+    return {kAsciiClasses[b0], 1};
+  }
+  auto is_continuation = [s, n](size_t i) {
+    return i < n && (s[i] & 0xC0) == 0x80;
+  };
+  if (b0 < 0xC2) {
+    return {kInvalid, 1};
+  }
+  if (b0 < 0xE0) {
+    if (!is_continuation(1)) {
+      return {kInvalid, 1};
+    }
+    return {classify(((b0 & 0x1F) << 6) | (s[1] & 0x3F)), 2};
+  }
+  if (b0 < 0xF0) {
+    if (!is_continuation(1) || !is_continuation(2) ||
+        (b0 == 0xE0 && s[1] < 0xA0)) {
+      return {kInvalid, 1};
+    }
+    return {classify(((b0 & 0x0F) << 12) | ((s[1] & 0x3F) << 6) |
+                     (s[2] & 0x3F)),
+            3};
+  }
+  if (b0 < 0xF5) {
+    if (!is_continuation(1) || !is_continuation(2) || !is_continuation(3) ||
+        (b0 == 0xF0 && s[1] < 0x90) || (b0 == 0xF4 && s[1] >= 0x90)) {
+      return {kInvalid, 1};
+    }
+    return {classify(((b0 & 0x07) << 18) | ((s[1] & 0x3F) << 12) |
+                     ((s[2] & 0x3F) << 6) | (s[3] & 0x3F)),
+            4};
+  }
+  return {kInvalid, 1};
+}
+
+inline bool is_newline(char c) { return c == '\r' || c == '\n'; }
+
+inline bool is_ascii_letter(char c) {
+  const auto lower = static_cast<uint8_t>(c) | 0x20;
+  return lower >= 'a' && lower <= 'z';
+}
+
+// get the number of leading ascii letters in the 16 bytes
+inline size_t count_ascii_letters16(const char* data) {
+#if defined(__SSE2__)
+  const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+  // map [a-z] to [-128, -103] with wrapping, then compare as signed bytes
+  const __m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+  const __m128i shifted = _mm_add_epi8(lower, _mm_set1_epi8(128 - 'a'));
+  const __m128i letters =
+      _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(-128 + 26)));
+  const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(letters));
+  return mask == 0xFFFF ? 16 : __builtin_ctz(~mask);
+#elif defined(__ARM_NEON)
+  const uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(data));
+  const uint8x16_t lower = vorrq_u8(bytes, vdupq_n_u8(0x20));
+  const uint8x16_t letters =
+      vcltq_u8(vsubq_u8(lower, vdupq_n_u8('a')), vdupq_n_u8(26));
+  if (vminvq_u8(letters) == 0xFF) {
+    return 16;
+  }
+#endif
+  size_t count = 0;
+  while (count < 16 && is_ascii_letter(data[count])) {
+    ++count;
+  }
+  return count;
+}
+
+// get the end of the run of letters starting at pos
+size_t letters_end(const std::string_view& text, size_t pos) {
+  while (pos < text.size()) {
+    // scan ascii letters 16 bytes at a time
+    while (pos + 16 <= text.size()) {
+      const size_t count = count_ascii_letters16(text.data() + pos);
+      pos += count;
+      if (count < 16) {
+        break;
+      }
+    }
+    // non-ascii letters and the tail
+    if (pos >= text.size()) {
+      break;
+    }
+    const Char c = decode(text, pos);
+    if (c.cls != kLetter) {
+      break;
+    }
+    pos += c.len;
+  }
+  return pos;
+}
+
+// get the length of the contraction after an apostrophe at pos, 0 if none,
+// for (?i:'s|'t|'re|'ve|'m|'ll|'d). 's' is case folded with U+017F as well.
+size_t contraction_len(const std::string_view& text, size_t pos) {
+  if (pos >= text.size()) {
+    return 0;
+  }
+  auto lower_at = [&text](size_t i) -> char {
+    if (i >= text.size()) {
+      return '\0';
+    }
+    const char c = text[i];
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+  };
+  switch (lower_at(pos)) {
+    case 's':
+    case 't':
+    case 'm':
+    case 'd':
+      return 1;
+    case 'r':
+    case 'v':
+      return lower_at(pos + 1) == 'e' ? 2 : 0;
+    case 'l':
+      return lower_at(pos + 1) == 'l' ? 2 : 0;
+    case '\xC5':
+      // U+017F, latin small letter long s
+      return lower_at(pos + 1) == '\xBF' ? 2 : 0;
+    default:
+      return 0;
+  }
+}
+
+}  // namespace
+
+std::unique_ptr<PreTokenizer> PreTokenizer::create(const std::string& pattern) {
+  for (const auto& known : kKnownPatterns) {
+    if (pattern == known.pattern) {
+      // the constructor is private
+      return std::unique_ptr<PreTokenizer>(new PreTokenizer(known.max_digits));
+    }
+  }
+  return nullptr;
+}
+
+bool PreTokenizer::next(std::string_view* input,
+                        std::string_view* piece) const {
+  const std::string_view text = *input;
+  // skip invalid bytes, which are not matched by the pattern
+  size_t pos = 0;
+  while (pos < text.size() && decode(text, pos).cls == kInvalid) {
+    ++pos;
+  }
+  if (pos == text.size()) {
+    return false;
+  }
+  const size_t end = match(text, pos);
+  *piece = text.substr(pos, end - pos);
+  input->remove_prefix(end);
+  return true;
+}
+
+size_t PreTokenizer::match(const std::string_view& text, size_t pos) const {
+  // the alternatives of the pattern are tried in order, the first one that
+  // matches wins, which is how RE2 matches alternations.
+  const Char c0 = decode(text, pos);
+  const size_t next = pos + c0.len;
+
+  // (?i:'s|'t|'re|'ve|'m|'ll|'d)
+  if (text[pos] == '\'') {
+    const size_t len = contraction_len(text, next);
+    if (len > 0) {
+      return next + len;
+    }
+  }
+
+  // [^\r\n\p{L}\p{N}]?\p{L}+
+  if (c0.cls == kLetter) {
+    return letters_end(text, pos);
+  }
+  if (c0.cls != kNumber && !is_newline(text[pos]) && next < text.size() &&
+      decode(text, next).cls == kLetter) {
+    return letters_end(text, next);
+  }
+
+  // \p{N}{1,max_digits}
+  if (c0.cls == kNumber) {
+    size_t end = next;
+    for (size_t i = 1; i < max_digits_ && end < text.size(); ++i) {
+      const Char c = decode(text, end);
+      if (c.cls != kNumber) {
+        break;
+      }
+      end += c.len;
+    }
+    return end;
+  }
+
+  //  ?[^\s\p{L}\p{N}]+[\r\n]*
+  size_t end = pos;
+  if (text[pos] == ' ' && next < text.size() &&
+      decode(text, next).cls == kOther) {
+    end = next;
+  }
+  if (end > pos || c0.cls == kOther) {
+    while (end < text.size()) {
+      const Char c = decode(text, end);
+      if (c.cls != kOther) {
+        break;
+      }
+      end += c.len;
+    }
+    while (end < text.size() && is_newline(text[end])) {
+      ++end;
+    }
+    return end;
+  }
+
+  // \s*[\r\n]+ ends at the last newline of the run of whitespaces, otherwise
+  // \s+[^\S]|\s+ matches the whole run.
+  size_t last_newline = std::string_view::npos;
+  end = pos;
+  while (end < text.size() &&
+         static_cast<uint8_t>(text[end]) < 0x80 &&
+         kAsciiClasses[static_cast<uint8_t>(text[end])] == kSpace) {
+    if (is_newline(text[end])) {
+      last_newline = end;
+    }
+    ++end;
+  }
+  return last_newline != std::string_view::npos ? last_newline + 1 : end;
+}
+
+}  // namespace llm
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace llm {
+
+// A hand-written pre-tokenizer for the known tiktoken patterns, which splits
+// text into the same pieces as the regex does with RE2, but without the regex
+// engine. Characters are classified by ascii tables and unicode tables, and
+// runs of ascii letters are scanned with SIMD where available. Same as RE2,
+// invalid utf-8 bytes are not matched by the pattern and are skipped.
+// immutable and thread safe.
+class PreTokenizer final {
+ public:
+  // create a pre-tokenizer for the pattern, returns nullptr if the pattern is
+  // not known, for which the regex should be used instead.
+  static std::unique_ptr<PreTokenizer> create(const std::string& pattern);
+
+  // find the next piece in the input and consume the input up to the end of
+  // the piece, same as re2::RE2::FindAndConsume with the pattern. returns
+  // false if there are no more pieces.
+  bool next(std::string_view* input, std::string_view* piece) const;
+
+ private:
+  // max number of digits in a number piece, e.g. \p{N}{1,3}
+  explicit PreTokenizer(size_t max_digits) : max_digits_(max_digits) {}
+
+  // get the end of the piece starting at pos
+  size_t match(const std::string_view& text, size_t pos) const;
+
+  size_t max_digits_ = 1;
+};
+
+}  // namespace llm
@@ -0,0 +1,117 @@
+#include "pre_tokenizer.h"
+
+#include <gtest/gtest.h>
+#include <re2/re2.h>
+
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace llm {
+
+namespace {
+
+// clang-format off
+const std::string kPattern =
+    R"((?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+[^\S]|\s+)";
+const std::string kPattern3Digits =
+    R"((?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}{1,3}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+[^\S]|\s+)";
+// clang-format on
+
+std::vector<std::string> split(const PreTokenizer& pre_tokenizer,
+                               const std::string& text) {
+  std::vector<std::string> pieces;
+  std::string_view input = text;
+  std::string_view piece;
+  while (pre_tokenizer.next(&input, &piece)) {
+    pieces.emplace_back(piece);
+  }
+  return pieces;
+}
+
+std::vector<std::string> split(const re2::RE2& regex,
+                               const std::string& text) {
+  std::vector<std::string> pieces;
+  std::string_view input = text;
+  std::string_view piece;
+  while (re2::RE2::FindAndConsume(&input, regex, &piece)) {
+    pieces.emplace_back(piece);
+  }
+  return pieces;
+}
+
+// random text of characters of all classes, including invalid utf-8 bytes
+std::string random_text(std::mt19937* gen) {
+  static const std::vector<std::string> kChars = {
+      "a", "Z", "s", "S", "t", "r", "e", "v", "m", "l", "d", "k", "K",
+      "0", "7", "'", "\"", ",", ".", "-", "(", "<", "|", " ", " ", " ",
+      "\t", "\n", "\r", "\f", "\v", "\x01", "\x7F",
+      // letters: é, ſ, ж, 中, 日, 𝐀, Kelvin sign
+      "\xC3\xA9", "\xC5\xBF", "\xD0\xB6", "\xE4\xB8\xAD", "\xE6\x97\xA5",
+      "\xF0\x9D\x90\x80", "\xE2\x84\xAA",
+      // numbers: arabic-indic digit, roman numeral, one half, 𝟘
+      "\xD9\xA1", "\xE2\x85\xAB", "\xC2\xBD", "\xF0\x9D\x9F\x98",
+      // others: nbsp, line separator, em dash, emoji, combining acute
+      "\xC2\xA0", "\xE2\x80\xA8", "\xE2\x80\x94", "\xF0\x9F\x98\x80",
+      "\xCC\x81",
+      // invalid: continuation, truncated, overlong, surrogate, > U+10FFFF
+      "\x80", "\xFF", "\xE4\xB8", "\xC0\xAF", "\xED\xA0\x80",
+      "\xF4\x90\x80\x80",
+  };
+  std::uniform_int_distribution<size_t> len_dist(0, 32);
+  std::uniform_int_distribution<size_t> char_dist(0, kChars.size() - 1);
+  std::string text;
+  const size_t len = len_dist(*gen);
+  for (size_t i = 0; i < len; ++i) {
+    text += kChars[char_dist(*gen)];
+  }
+  return text;
+}
+
+}  // namespace
+
+TEST(PreTokenizerTest, UnknownPattern) {
+  EXPECT_EQ(PreTokenizer::create(R"(\s+|\S+)"), nullptr);
+  EXPECT_NE(PreTokenizer::create(kPattern), nullptr);
+  EXPECT_NE(PreTokenizer::create(kPattern3Digits), nullptr);
+}
+
+TEST(PreTokenizerTest, Split) {
+  const auto pre_tokenizer = PreTokenizer::create(kPattern);
+  ASSERT_NE(pre_tokenizer, nullptr);
+  EXPECT_EQ(split(*pre_tokenizer, "Hello, world!"),
+            std::vector<std::string>({"Hello", ",", " world", "!"}));
+  EXPECT_EQ(split(*pre_tokenizer, "I'm 2024 \n\n  ok"),
+            std::vector<std::string>(
+                {"I", "'m", " ", "2", "0", "2", "4", " \n\n", "  ", "ok"}));
+  EXPECT_TRUE(split(*pre_tokenizer, "").empty());
+
+  const auto pre_tokenizer3 = PreTokenizer::create(kPattern3Digits);
+  ASSERT_NE(pre_tokenizer3, nullptr);
+  EXPECT_EQ(split(*pre_tokenizer3, "12345"),
+            std::vector<std::string>({"123", "45"}));
+}
+
+TEST(PreTokenizerTest, MatchRegex) {
+  std::mt19937 gen(42);
+  for (const auto& pattern : {kPattern, kPattern3Digits}) {
+    const auto pre_tokenizer = PreTokenizer::create(pattern);
+    ASSERT_NE(pre_tokenizer, nullptr);
+    const re2::RE2 regex("(" + pattern + ")");
+    for (int i = 0; i < 10000; ++i) {
+      const std::string text = random_text(&gen);
+      EXPECT_EQ(split(*pre_tokenizer, text), split(regex, text))
+          << "text: " << text;
+    }
+
+    // long runs of letters, scanned 16 bytes at a time
+    const std::string text =
+        "Pneumonoultramicroscopicsilicovolcanoconiosis is a word, "
+        "internationalization\xC3\xA9tudesabcdefghijklmnopqrstuvwxyz0 "
+        "abcdefghijklmnop";
+    EXPECT_EQ(split(*pre_tokenizer, text), split(regex, text));
+  }
+}
+
+}  // namespace llm
@@ -0,0 +1,197 @@
+#include "prefix_token_cache.h"
+
+#include <absl/hash/hash.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace llm {
+
+namespace {
+// number of prompts to verify before trusting the boundaries
+constexpr size_t kNumVerifications = 16;
+}  // namespace
+
+PrefixTokenCache::PrefixTokenCache(size_t max_entries, bool verify)
+    : num_verifications_(verify ? std::numeric_limits<size_t>::max()
+                                : kNumVerifications),
+      max_entries_(max_entries) {}
+
+bool PrefixTokenCache::encode(const Tokenizer& tokenizer,
+                              const std::string_view& text,
+                              const std::vector<size_t>& boundaries,
+                              std::vector<int32_t>* ids) {
+  if (!enabled() || boundaries.empty()) {
+    return tokenizer.encode(text, ids);
+  }
+
+  // hashes of the prefixes, chained over the segments
+  std::vector<uint64_t> hashes(boundaries.size());
+  uint64_t hash = 0;
+  size_t start = 0;
+  for (size_t i = 0; i < boundaries.size(); ++i) {
+    CHECK(boundaries[i] >= start && boundaries[i] <= text.size())
+        << "Invalid boundary: " << boundaries[i];
+    const auto segment = text.substr(start, boundaries[i] - start);
+    hash = absl::Hash<std::pair<uint64_t, std::string_view>>{}(
+        std::make_pair(hash, segment));
+    hashes[i] = hash;
+    start = boundaries[i];
+  }
+
+  // ids added by the tokenizer to any text, e.g. the bos token, which are
+  // stripped from the ids of segments.
+  std::vector<int32_t> prefix_ids;
+  if (!tokenizer.encode("", &prefix_ids)) {
+    return false;
+  }
+
+  Entry cached;
+  const int64_t hit = lookup(text, boundaries, hashes, &cached);
+
+  const absl::Time start_time = absl::Now();
+  auto prompt_ids = std::make_shared<std::vector<int32_t>>();
+  if (hit >= 0) {
+    prompt_ids->assign(cached.ids->begin(),
+                       cached.ids->begin() + cached.num_ids);
+    start = cached.num_bytes;
+  } else {
+    *prompt_ids = prefix_ids;
+    start = 0;
+  }
+  auto encode_segment = [&](size_t end) {
+    std::vector<int32_t> segment_ids;
+    if (!tokenizer.encode(text.substr(start, end - start), &segment_ids)) {
+      return false;
+    }
+    const bool has_prefix =
+        segment_ids.size() >= prefix_ids.size() &&
+        std::equal(prefix_ids.begin(), prefix_ids.end(), segment_ids.begin());
+    const size_t skip = has_prefix ? prefix_ids.size() : 0;
+    prompt_ids->insert(
+        prompt_ids->end(), segment_ids.begin() + skip, segment_ids.end());
+    start = end;
+    return true;
+  };
+  // number of ids of the prefix ending at each boundary
+  std::vector<size_t> num_ids(boundaries.size(), 0);
+  for (size_t i = hit + 1; i < boundaries.size(); ++i) {
+    if (!encode_segment(boundaries[i])) {
+      return false;
+    }
+    num_ids[i] = prompt_ids->size();
+  }
+  if (!encode_segment(text.size())) {
+    return false;
+  }
+  const double seconds = absl::ToDoubleSeconds(absl::Now() - start_time);
+
+  bool verify = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (num_verified_ < num_verifications_) {
+      verify = true;
+      ++num_verified_;
+    }
+  }
+  if (verify) {
+    std::vector<int32_t> full_ids;
+    if (!tokenizer.encode(text, &full_ids)) {
+      return false;
+    }
+    if (full_ids != *prompt_ids) {
+      LOG(WARNING) << "Found unstable prompt boundaries, disable the prefix "
+                      "token cache";
+      enabled_.store(false, std::memory_order_relaxed);
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++stats_.num_mismatches;
+      lru_list_.clear();
+      index_.clear();
+      ids->insert(ids->end(), full_ids.begin(), full_ids.end());
+      return true;
+    }
+  }
+
+  const size_t num_cached_bytes = hit >= 0 ? cached.num_bytes : 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (hit >= 0) {
+      ++stats_.num_hits;
+    } else {
+      ++stats_.num_misses;
+    }
+    stats_.num_cached_bytes += num_cached_bytes;
+    stats_.num_encoded_bytes += text.size() - num_cached_bytes;
+    stats_.encode_seconds += seconds;
+  }
+
+  // add the prefixes after the cached one, sharing the text and ids
+  const auto shared_text = std::make_shared<const std::string>(text);
+  for (size_t i = hit + 1; i < boundaries.size(); ++i) {
+    insert({hashes[i], shared_text, prompt_ids, boundaries[i], num_ids[i]});
+  }
+  ids->insert(ids->end(), prompt_ids->begin(), prompt_ids->end());
+  return true;
+}
+
+int64_t PrefixTokenCache::lookup(const std::string_view& text,
+                                 const std::vector<size_t>& boundaries,
+                                 const std::vector<uint64_t>& hashes,
+                                 Entry* entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto i = static_cast<int64_t>(boundaries.size()) - 1; i >= 0; --i) {
+    auto it = index_.find(hashes[i]);
+    if (it == index_.end()) {
+      continue;
+    }
+    // compare the bytes in case of hash collisions
+    const Entry& candidate = *it->second;
+    if (candidate.num_bytes != boundaries[i] ||
+        text.substr(0, candidate.num_bytes) !=
+            std::string_view(*candidate.text).substr(0, candidate.num_bytes)) {
+      continue;
+    }
+    // move the entry to the front of the lru list
+    lru_list_.splice(lru_list_.begin(), lru_list_, it->second);
+    *entry = candidate;
+    return i;
+  }
+  return -1;
+}
+
+void PrefixTokenCache::insert(Entry entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (max_entries_ == 0 || index_.contains(entry.hash)) {
+    // added by another prompt
+    return;
+  }
+  lru_list_.push_front(std::move(entry));
+  index_.emplace(lru_list_.front().hash, lru_list_.begin());
+  // evict the least recently used entry
+  if (lru_list_.size() > max_entries_) {
+    index_.erase(lru_list_.back().hash);
+    lru_list_.pop_back();
+  }
+}
+
+size_t PrefixTokenCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return lru_list_.size();
+}
+
+PrefixTokenCache::Stats PrefixTokenCache::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+}  // namespace llm
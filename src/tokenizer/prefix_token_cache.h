@@ -0,0 +1,120 @@
+#pragma once
+
+#include <absl/container/flat_hash_map.h>
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "tokenizer.h"
+
+namespace llm {
+
+// A cache of the token ids of rendered prompt prefixes, such as the shared
+// system prompt and the history of a multi-turn chat, so that only the new
+// suffix of a prompt is encoded.
+//
+// The prompt is encoded segment by segment, split at the given boundaries,
+// e.g. the end of each message, and the ids of the longest cached prefix are
+// reused. It equals encoding the whole prompt only if no token crosses the
+// boundaries, which holds when boundaries are next to special tokens. The
+// first prompts are verified against encoding the whole prompt, or all of
+// them in verify mode, and the cache is disabled once a boundary is found
+// unstable. thread safe.
+class PrefixTokenCache final {
+ public:
+  struct Stats {
+    // number of prompts with and without a cached prefix
+    uint64_t num_hits = 0;
+    uint64_t num_misses = 0;
+
+    // bytes of prompts reused from the cache and encoded by the tokenizer
+    uint64_t num_cached_bytes = 0;
+    uint64_t num_encoded_bytes = 0;
+
+    // time spent in encoding the uncached bytes
+    double encode_seconds = 0;
+
+    // number of prompts with unstable boundaries found by verification
+    uint64_t num_mismatches = 0;
+
+    double hit_rate() const {
+      const uint64_t total = num_hits + num_misses;
+      return total == 0 ? 0 : static_cast<double>(num_hits) / total;
+    }
+
+    // estimated time to encode the cached bytes
+    double saved_seconds() const {
+      return num_encoded_bytes == 0
+                 ? 0
+                 : encode_seconds * num_cached_bytes / num_encoded_bytes;
+    }
+  };
+
+  // cache up to max_entries prefixes, verify all prompts if verify is true
+  PrefixTokenCache(size_t max_entries, bool verify);
+
+  // encode the text with the tokenizer, reusing the ids of the longest cached
+  // prefix that ends at one of the boundaries, which are sorted offsets into
+  // the text. the prefixes ending at the boundaries are added into the cache.
+  bool encode(const Tokenizer& tokenizer,
+              const std::string_view& text,
+              const std::vector<size_t>& boundaries,
+              std::vector<int32_t>* ids);
+
+  // disabled when unstable boundaries are found
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  size_t size() const;
+
+  Stats stats() const;
+
+ private:
+  struct Entry {
+    // hash of the prefix
+    uint64_t hash = 0;
+
+    // the prompt text and its ids shared by the prefixes of the same prompt
+    std::shared_ptr<const std::string> text;
+    std::shared_ptr<const std::vector<int32_t>> ids;
+
+    // the prefix is text[0, num_bytes) with ids[0, num_ids)
+    size_t num_bytes = 0;
+    size_t num_ids = 0;
+  };
+
+  // find the longest cached prefix, returns the index of its boundary, or -1
+  int64_t lookup(const std::string_view& text,
+                 const std::vector<size_t>& boundaries,
+                 const std::vector<uint64_t>& hashes,
+                 Entry* entry);
+
+  void insert(Entry entry);
+
+  // the number of prompts to verify before trusting the boundaries
+  const size_t num_verifications_;
+
+  const size_t max_entries_;
+
+  std::atomic<bool> enabled_{true};
+
+  // mutex to protect the lru list, the index, the stats and verifications
+  mutable std::mutex mutex_;
+
+  // cached entries with the most recently used at the front
+  std::list<Entry> lru_list_;
+
+  // hash of the prefix to the cache entry
+  absl::flat_hash_map<uint64_t, std::list<Entry>::iterator> index_;
+
+  size_t num_verified_ = 0;
+
+  Stats stats_;
+};
+
+}  // namespace llm
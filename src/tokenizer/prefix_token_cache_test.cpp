@@ -0,0 +1,135 @@
+#include "prefix_token_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "tiktoken_tokenizer.h"
+#include "tokenizer_args.h"
+
+namespace llm {
+
+namespace {
+
+std::unique_ptr<Tokenizer> create_tokenizer() {
+  TokenizerArgs args;
+  args.vocab_file() = "test.tiktoken";
+  args.special_tokens() = {{"<|im_start|>", 300}, {"<|im_end|>", 301}};
+  return std::make_unique<TiktokenTokenizer>("data", args);
+}
+
+// render the messages in chatml format, and return the end of each message
+std::string render(const std::vector<std::string>& messages,
+                   std::vector<size_t>* boundaries) {
+  std::string prompt;
+  for (size_t i = 0; i < messages.size(); ++i) {
+    prompt += i % 2 == 0 ? "<|im_start|>user\n" : "<|im_start|>assistant\n";
+    prompt += messages[i];
+    boundaries->push_back(prompt.size());
+    prompt += "<|im_end|>\n";
+  }
+  prompt += "<|im_start|>assistant\n";
+  return prompt;
+}
+
+}  // namespace
+
+TEST(PrefixTokenCacheTest, MultiTurn) {
+  const auto tokenizer = create_tokenizer();
+  PrefixTokenCache cache(/*max_entries=*/1024, /*verify=*/true);
+
+  std::vector<std::string> messages;
+  for (int turn = 0; turn < 8; ++turn) {
+    messages.push_back("Hello, world! " + std::to_string(turn));
+    messages.push_back("你好，世界！" + std::to_string(turn));
+
+    std::vector<size_t> boundaries;
+    const std::string prompt = render(messages, &boundaries);
+    std::vector<int32_t> ids;
+    ASSERT_TRUE(cache.encode(*tokenizer, prompt, boundaries, &ids));
+
+    std::vector<int32_t> desired_ids;
+    ASSERT_TRUE(tokenizer->encode(prompt, &desired_ids));
+    EXPECT_EQ(ids, desired_ids);
+  }
+  EXPECT_TRUE(cache.enabled());
+  EXPECT_EQ(cache.size(), 16);
+
+  // all turns but the first reuse the history
+  const auto stats = cache.stats();
+  EXPECT_EQ(stats.num_hits, 7);
+  EXPECT_EQ(stats.num_misses, 1);
+  EXPECT_EQ(stats.num_mismatches, 0);
+  EXPECT_GT(stats.num_cached_bytes, stats.num_encoded_bytes);
+  EXPECT_GT(stats.hit_rate(), 0.8);
+}
+
+TEST(PrefixTokenCacheTest, SharedPrefix) {
+  const auto tokenizer = create_tokenizer();
+  PrefixTokenCache cache(/*max_entries=*/1024, /*verify=*/false);
+
+  // prompts with the same first message
+  for (int i = 0; i < 4; ++i) {
+    std::vector<size_t> boundaries;
+    const std::string prompt =
+        render({"You are a helpful assistant.", std::to_string(i)},
+               &boundaries);
+    std::vector<int32_t> ids;
+    ASSERT_TRUE(cache.encode(*tokenizer, prompt, boundaries, &ids));
+    std::vector<int32_t> desired_ids;
+    ASSERT_TRUE(tokenizer->encode(prompt, &desired_ids));
+    EXPECT_EQ(ids, desired_ids);
+  }
+  const auto stats = cache.stats();
+  EXPECT_EQ(stats.num_hits, 3);
+  EXPECT_EQ(stats.num_misses, 1);
+}
+
+TEST(PrefixTokenCacheTest, UnstableBoundaries) {
+  const auto tokenizer = create_tokenizer();
+  PrefixTokenCache cache(/*max_entries=*/1024, /*verify=*/false);
+
+  // the boundary splits the token "or"
+  const std::string prompt = "Hello, world!";
+  std::vector<int32_t> ids;
+  ASSERT_TRUE(cache.encode(*tokenizer, prompt, {9}, &ids));
+  std::vector<int32_t> desired_ids;
+  ASSERT_TRUE(tokenizer->encode(prompt, &desired_ids));
+  EXPECT_EQ(ids, desired_ids);
+
+  // the cache is disabled
+  EXPECT_FALSE(cache.enabled());
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(cache.stats().num_mismatches, 1);
+
+  ids.clear();
+  ASSERT_TRUE(cache.encode(*tokenizer, prompt, {9}, &ids));
+  EXPECT_EQ(ids, desired_ids);
+}
+
+TEST(PrefixTokenCacheTest, Eviction) {
+  const auto tokenizer = create_tokenizer();
+  PrefixTokenCache cache(/*max_entries=*/2, /*verify=*/false);
+
+  for (int i = 0; i < 4; ++i) {
+    std::vector<size_t> boundaries;
+    const std::string prompt = render({std::to_string(i)}, &boundaries);
+    std::vector<int32_t> ids;
+    ASSERT_TRUE(cache.encode(*tokenizer, prompt, boundaries, &ids));
+  }
+  EXPECT_EQ(cache.size(), 2);
+
+  // the first prompt is evicted, the last one is cached
+  for (const int i : {0, 3}) {
+    std::vector<size_t> boundaries;
+    const std::string prompt = render({std::to_string(i)}, &boundaries);
+    std::vector<int32_t> ids;
+    ASSERT_TRUE(cache.encode(*tokenizer, prompt, boundaries, &ids));
+  }
+  const auto stats = cache.stats();
+  EXPECT_EQ(stats.num_hits, 1);
+  EXPECT_EQ(stats.num_misses, 5);
+}
+
+}  // namespace llm
@@ -1,12 +1,22 @@
 #include "sentencepiece_tokenizer.h"
 
+#include <absl/strings/match.h>
+#include <absl/strings/numbers.h>
 #include <absl/strings/str_cat.h>
 #include <absl/strings/str_join.h>
+#include <absl/strings/str_replace.h>
 #include <glog/logging.h>
 #include <re2/re2.h>
 
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include "sentencepiece.pb.h"
 #include "sentencepiece/sentencepiece_processor.h"
+#include "sentencepiece_model.pb.h"
+#include "utf8.h"
 
 #define RETURN_FALSE_IF_ERROR(expr)  \
   do {                               \
@@ -22,13 +32,44 @@
 
 namespace llm {
 
+namespace {
+// the whitespace symbol used by sentencepiece: U+2581
+constexpr char kSpaceSymbol[] = "\xe2\x96\x81";
+
+// default surface of unknown tokens: " U+2047 "
+constexpr char kDefaultUnknownSymbol[] = " \xE2\x81\x87 ";
+
+// append the bytes of consecutive byte pieces as utf-8 characters, each
+// invalid byte is replaced with U+FFFD, same as sentencepiece.
+void append_bytes(const std::string_view& bytes, std::string* text) {
+  const size_t consumed = append_utf8(bytes, text);
+  // the partial character at the end is invalid as well
+  for (size_t i = consumed; i < bytes.size(); ++i) {
+    text->append(kReplacementChar);
+  }
+}
+}  // namespace
+
 SentencePieceTokenizer::SentencePieceTokenizer(const std::string_view& dir_path,
                                                const TokenizerArgs& args)
-    : dir_path_(dir_path), args_(args) {
+    : SentencePieceTokenizer(load(dir_path, args)) {}
+
+SentencePieceTokenizer::SentencePieceTokenizer(
+    std::shared_ptr<const Vocab> vocab)
+    : vocab_(std::move(vocab)) {
+  CHECK(vocab_ != nullptr);
+}
+
+std::shared_ptr<const SentencePieceTokenizer::Vocab>
+SentencePieceTokenizer::load(const std::string_view& dir_path,
+                             const TokenizerArgs& args) {
+  auto vocab = std::make_shared<Vocab>();
+  vocab->args = args;
+
   const std::string vocab_file_path =
       dir_path.empty() ? args.vocab_file()
-                       : absl::StrCat(dir_path_, "/", args.vocab_file());
-  const auto status = sp_processor_.Load(vocab_file_path);
+                       : absl::StrCat(dir_path, "/", args.vocab_file());
+  const auto status = vocab->sp_processor.Load(vocab_file_path);
   if (!status.ok()) {
     LOG(FATAL) << "Failed to load SentencePiece model from " << vocab_file_path
                << ": " << status.ToString() << ", error " << status.ToString();
@@ -36,40 +77,44 @@ SentencePieceTokenizer::SentencePieceTokenizer(const std::string_view& dir_path,
 
   // add special tokens and construct special token regex
   if (!args.special_tokens().empty()) {
-    const auto vocab_size = sp_processor_.GetPieceSize();
-    load_special_tokens(args.special_tokens());
+    load_special_tokens(args.special_tokens(), vocab.get());
   }
 
+  // precompute decoded pieces for incremental decoding
+  load_pieces(vocab.get());
+
   // construct prefix tokens
   if (!args.prefix_tokens().empty()) {
     for (const auto& token : args.prefix_tokens()) {
       if (token.empty()) {
         continue;
       }
-      const auto token_id = token_to_id(token);
+      const auto token_id = token_to_id(*vocab, token);
       if (token_id.has_value()) {
-        prefix_token_ids_.push_back(token_id.value());
+        vocab->prefix_token_ids.push_back(token_id.value());
         LOG(INFO) << "Prefix token: " << token << ", id: " << token_id.value();
       } else {
         LOG(ERROR) << "Failed to find prefix token: " << token;
       }
     }
   }
+  return vocab;
 }
 
 void SentencePieceTokenizer::load_special_tokens(
-    const std::vector<SpecialToken>& special_tokens) {
+    const std::vector<SpecialToken>& special_tokens,
+    Vocab* vocab) {
   // for each special token, add to encoder and decoder
   for (const auto& [token, id] : special_tokens) {
     if (token.empty()) {
       continue;
     }
 
-    if (!special_token_encoder_.try_emplace(token, id).second) {
+    if (!vocab->special_token_encoder.try_emplace(token, id).second) {
       LOG(WARNING) << "Duplicate special token: " << token << ", id: " << id;
     }
 
-    if (!special_token_decoder_.try_emplace(id, token).second) {
+    if (!vocab->special_token_decoder.try_emplace(id, token).second) {
       LOG(WARNING) << "Duplicate special token: " << token << ", id: " << id;
     }
   }
@@ -89,10 +134,72 @@ void SentencePieceTokenizer::load_special_tokens(
     const auto special_token_regex_str = absl::StrJoin(escaped_tokens, "|");
     // surround with () to match special tokens
     const auto regex_str = absl::StrCat("(", special_token_regex_str, ")");
-    special_token_regex_ = std::make_unique<re2::RE2>(regex_str);
+    vocab->special_token_regex = std::make_unique<re2::RE2>(regex_str);
   }
 }
 
+void SentencePieceTokenizer::load_pieces(Vocab* vocab) {
+  const auto& sp_processor = vocab->sp_processor;
+  const auto& model_proto = sp_processor.model_proto();
+  // the denormalizer rewrites the whole text, can't decode tokens one by one
+  if (!model_proto.denormalizer_spec().precompiled_charsmap().empty()) {
+    LOG(WARNING) << "Incremental decoding is disabled for the denormalizer";
+    return;
+  }
+  // same rules as SentencePieceProcessor::Decode
+  const std::string unk_surface = model_proto.trainer_spec().has_unk_surface()
+                                      ? model_proto.trainer_spec().unk_surface()
+                                      : kDefaultUnknownSymbol;
+  vocab->remove_extra_whitespaces =
+      model_proto.normalizer_spec().remove_extra_whitespaces();
+  const bool remove_bos_ws =
+      model_proto.normalizer_spec().add_dummy_prefix() ||
+      vocab->remove_extra_whitespaces;
+
+  const int num_pieces = sp_processor.GetPieceSize();
+  std::vector<std::string> decoded(num_pieces);
+  vocab->has_bos_ws.resize(num_pieces, false);
+  vocab->is_byte.resize(num_pieces, false);
+  for (int id = 0; id < num_pieces; ++id) {
+    const std::string& piece = sp_processor.IdToPiece(id);
+    if (sp_processor.IsControl(id)) {
+      // invisible symbols, such as <s> and </s>
+      continue;
+    }
+    if (sp_processor.IsUnknown(id)) {
+      decoded[id] = unk_surface;
+      continue;
+    }
+    if (sp_processor.IsByte(id)) {
+      // byte pieces in the format of <0xXX>
+      uint32_t byte = 0;
+      CHECK(piece.size() == 6 && absl::SimpleHexAtoi(piece.substr(3, 2), &byte))
+          << "Invalid byte piece: " << piece;
+      decoded[id] = std::string(1, static_cast<char>(byte));
+      vocab->is_byte[id] = true;
+      continue;
+    }
+    vocab->has_bos_ws[id] =
+        remove_bos_ws && absl::StartsWith(piece, kSpaceSymbol);
+    decoded[id] = absl::StrReplaceAll(piece, {{kSpaceSymbol, " "}});
+  }
+
+  std::vector<PieceTable::Piece> pieces;
+  pieces.reserve(num_pieces + vocab->special_token_encoder.size());
+  for (int id = 0; id < num_pieces; ++id) {
+    pieces.push_back({id, decoded[id], /*special=*/false});
+  }
+  // special tokens take precedence over pieces with the same id
+  for (const auto& [token, id] : vocab->special_token_encoder) {
+    pieces.push_back({id, token, /*special=*/true});
+    if (id < num_pieces) {
+      vocab->is_byte[id] = false;
+      vocab->has_bos_ws[id] = false;
+    }
+  }
+  vocab->pieces = PieceTable(pieces);
+}
+
 bool SentencePieceTokenizer::encode_internal(const std::string_view& text,
                                              std::vector<int32_t>* ids) const {
   if (text.empty()) {
@@ -101,7 +208,7 @@ bool SentencePieceTokenizer::encode_internal(const std::string_view& text,
   }
 
   sentencepiece::SentencePieceText spt;
-  RETURN_FALSE_IF_ERROR(sp_processor_.Encode(text, &spt));
+  RETURN_FALSE_IF_ERROR(vocab_->sp_processor.Encode(text, &spt));
   for (const auto& sp : spt.pieces()) {
     ids->emplace_back(sp.id());
   }
@@ -111,12 +218,12 @@ bool SentencePieceTokenizer::encode_internal(const std::string_view& text,
 bool SentencePieceTokenizer::encode(const std::string_view& text,
                                     std::vector<int32_t>* ids) const {
   // prepend prefix tokens if exists
-  if (!prefix_token_ids_.empty()) {
-    ids->insert(
-        ids->begin(), prefix_token_ids_.begin(), prefix_token_ids_.end());
+  const auto& prefix_token_ids = vocab_->prefix_token_ids;
+  if (!prefix_token_ids.empty()) {
+    ids->insert(ids->begin(), prefix_token_ids.begin(), prefix_token_ids.end());
   }
 
-  if (special_token_regex_ == nullptr) {
+  if (vocab_->special_token_regex == nullptr) {
     return encode_internal(text, ids);
   }
 
@@ -124,7 +231,8 @@ bool SentencePieceTokenizer::encode(const std::string_view& text,
   std::string_view special;
   while (true) {
     const auto* start = input.begin();
-    if (!re2::RE2::FindAndConsume(&input, *special_token_regex_, &special)) {
+    if (!re2::RE2::FindAndConsume(
+            &input, *vocab_->special_token_regex, &special)) {
       // no more special tokens
       break;
     }
@@ -137,8 +245,8 @@ bool SentencePieceTokenizer::encode(const std::string_view& text,
     }
 
     // add special token id if exists
-    const auto sit = special_token_encoder_.find(special);
-    if (sit != special_token_encoder_.end()) {
+    const auto sit = vocab_->special_token_encoder.find(special);
+    if (sit != vocab_->special_token_encoder.end()) {
       // find one special token
       ids->push_back(sit->second);
     }
@@ -151,7 +259,7 @@ bool SentencePieceTokenizer::encode(const std::string_view& text,
 void SentencePieceTokenizer::decode_internal(const Slice<int32_t>& ids,
                                              size_t start,
                                              size_t end,
-                                             std::stringstream* ss) const {
+                                             std::string* text) const {
   if (start >= end) {
     // no text to decode
     return;
@@ -159,7 +267,7 @@ void SentencePieceTokenizer::decode_internal(const Slice<int32_t>& ids,
 
   sentencepiece::SentencePieceText spt;
   std::vector<std::string> pieces;
-  const int num_pieces = sp_processor_.GetPieceSize();
+  const int num_pieces = vocab_->sp_processor.GetPieceSize();
   pieces.reserve(end - start);
   for (size_t i = start; i < end; ++i) {
     const auto id = ids[i];
@@ -167,48 +275,122 @@ void SentencePieceTokenizer::decode_internal(const Slice<int32_t>& ids,
       LOG(ERROR) << "Invalid id: " << id;
       continue;
     }
-    pieces.emplace_back(sp_processor_.IdToPiece(id));
+    pieces.emplace_back(vocab_->sp_processor.IdToPiece(id));
   }
-  RETURN_IF_ERROR(sp_processor_.Decode(pieces, &spt));
-  (*ss) << spt.text();
+  RETURN_IF_ERROR(vocab_->sp_processor.Decode(pieces, &spt));
+  text->append(spt.text());
 }
 
-std::string SentencePieceTokenizer::decode(const Slice<int32_t>& ids,
-                                           bool skip_special_tokens) const {
-  std::stringstream ss;
+std::string SentencePieceTokenizer::decode_with_processor(
+    const Slice<int32_t>& ids,
+    bool skip_special_tokens) const {
+  std::string text;
   size_t start = 0;
   for (size_t i = 0; i < ids.size(); ++i) {
     // identify special token
-    const auto sit = special_token_decoder_.find(ids[i]);
-    if (sit == special_token_decoder_.end()) {
+    const auto sit = vocab_->special_token_decoder.find(ids[i]);
+    if (sit == vocab_->special_token_decoder.end()) {
       continue;
     }
     // decode text before special token if exists
-    decode_internal(ids, start, i, &ss);
+    decode_internal(ids, start, i, &text);
 
     if (!skip_special_tokens) {
       // output special token
-      ss << sit->second;
+      text.append(sit->second);
     }
     start = i + 1;
   }
 
   // decode remaining text if exists
-  decode_internal(ids, start, ids.size(), &ss);
-  return ss.str();
+  decode_internal(ids, start, ids.size(), &text);
+  return text;
+}
+
+std::string SentencePieceTokenizer::decode(const Slice<int32_t>& ids,
+                                           bool skip_special_tokens) const {
+  const auto& table = vocab_->pieces;
+  if (table.empty()) {
+    return decode_with_processor(ids, skip_special_tokens);
+  }
+
+  std::string text;
+  text.reserve(table.num_bytes(ids));
+  // consecutive byte pieces waiting to be converted into utf-8 characters
+  std::string bytes;
+  bool is_first = true;
+  for (const int32_t id : ids) {
+    if (!table.contains(id)) {
+      LOG(ERROR) << "Invalid id: " << id;
+      continue;
+    }
+    if (static_cast<size_t>(id) < vocab_->is_byte.size() &&
+        vocab_->is_byte[id]) {
+      bytes.append(table.piece(id));
+      is_first = false;
+      continue;
+    }
+    if (!bytes.empty()) {
+      append_bytes(bytes, &text);
+      bytes.clear();
+    }
+    decode_token(id, skip_special_tokens, &is_first, &text);
+  }
+  append_bytes(bytes, &text);
+  return text;
+}
+
+bool SentencePieceTokenizer::decode_token(int32_t id,
+                                          bool skip_special_tokens,
+                                          bool* is_first,
+                                          std::string* text) const {
+  const auto& table = vocab_->pieces;
+  if (table.empty()) {
+    // incremental decoding is not supported
+    return false;
+  }
+
+  if (!table.contains(id)) {
+    LOG(ERROR) << "Invalid id: " << id;
+    return true;
+  }
+  const auto piece = table.piece(id);
+  if (table.is_special(id)) {
+    if (!skip_special_tokens) {
+      text->append(piece);
+    }
+    // text after special tokens is decoded separately in decode()
+    *is_first = true;
+    return true;
+  }
+  if (piece.empty()) {
+    // invisible control symbols
+    return true;
+  }
+  if (*is_first && vocab_->has_bos_ws[id]) {
+    // remove the leading whitespace added by add_dummy_prefix, only once
+    // unless all leading whitespaces are removed.
+    text->append(piece.substr(1));
+    *is_first = vocab_->remove_extra_whitespaces && piece.size() == 1;
+    return true;
+  }
+  text->append(piece);
+  *is_first = false;
+  return true;
 }
 
 std::optional<int32_t> SentencePieceTokenizer::token_to_id(
-    const std::string_view& token) const {
+    const Vocab& vocab,
+    const std::string_view& token) {
   // encode special token
-  const auto sit = special_token_encoder_.find(token);
-  if (sit != special_token_encoder_.end()) {
+  const auto sit = vocab.special_token_encoder.find(token);
+  if (sit != vocab.special_token_encoder.end()) {
     return sit->second;
   }
 
   // encode token
-  const auto token_id = sp_processor_.PieceToId(token);
-  if (sp_processor_.IsUnknown(token_id)) {
+  const auto token_id = vocab.sp_processor.PieceToId(token);
+  if (vocab.sp_processor.IsUnknown(token_id)) {
     LOG(ERROR) << "Failed to find token for token: " << token;
     return std::nullopt;
   }
@@ -217,11 +399,14 @@ std::optional<int32_t> SentencePieceTokenizer::token_to_id(
 
 size_t SentencePieceTokenizer::vocab_size() const {
   // vocab size = sentencepiece vocab size + special tokens
-  return sp_processor_.GetPieceSize() + args_.special_tokens().size();
+  return vocab_->sp_processor.GetPieceSize() +
+         vocab_->args.special_tokens().size();
 }
 
 std::unique_ptr<Tokenizer> SentencePieceTokenizer::clone() const {
-  return std::make_unique<SentencePieceTokenizer>(dir_path_, args_);
+  // the constructor is private
+  return std::unique_ptr<SentencePieceTokenizer>(
+      new SentencePieceTokenizer(vocab_));
 }
 
 }  // namespace llm
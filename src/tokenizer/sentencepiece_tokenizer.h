@@ -3,7 +3,12 @@
 #include <re2/re2.h>
 
 #include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 
+#include "piece_table.h"
 #include "sentencepiece/sentencepiece_processor.h"
 #include "tokenizer.h"
 #include "tokenizer_args.h"
@@ -22,39 +27,79 @@ class SentencePieceTokenizer : public Tokenizer {
   std::string decode(const Slice<int32_t>& ids,
                      bool skip_special_tokens) const override;
 
+  bool decode_token(int32_t id,
+                    bool skip_special_tokens,
+                    bool* is_first,
+                    std::string* text) const override;
+
   size_t vocab_size() const override;
 
+  // clones share the vocab with this tokenizer
   std::unique_ptr<Tokenizer> clone() const override;
 
  private:
-  void load_special_tokens(const std::vector<SpecialToken>& special_tokens);
+  // the model, special tokens and decoded pieces loaded from files, which are
+  // immutable and shared by all clones of the tokenizer.
+  struct Vocab {
+    TokenizerArgs args;
 
-  bool encode_internal(const std::string_view& text,
-                       std::vector<int32_t>* ids) const;
-  void decode_internal(const Slice<int32_t>& ids,
-                       size_t start,
-                       size_t end,
-                       std::stringstream* ss) const;
+    sentencepiece::SentencePieceProcessor sp_processor;
+
+    // special tokens to ids
+    absl::flat_hash_map<std::string, int32_t> special_token_encoder;
+
+    // special token ids to tokens
+    absl::flat_hash_map<int32_t, std::string> special_token_decoder;
+
+    // special token regex (optional)
+    std::unique_ptr<re2::RE2> special_token_regex;
+
+    // token ids to add to the beginning of the input sequence
+    std::vector<int32_t> prefix_token_ids;
 
-  std::optional<int32_t> token_to_id(const std::string_view& token) const;
+    // decoded bytes of each piece and special token, with the whitespace
+    // symbol replaced and byte pieces converted into bytes. empty if the
+    // pieces can't be decoded one by one.
+    PieceTable pieces;
 
-  std::string dir_path_;
+    // whether the piece starts with a whitespace that is removed at the
+    // beginning of the text, which is added by add_dummy_prefix when encoding.
+    std::vector<bool> has_bos_ws;
 
-  TokenizerArgs args_;
+    // whether the piece is a byte piece, consecutive byte pieces are
+    // converted into utf-8 characters together.
+    std::vector<bool> is_byte;
 
-  sentencepiece::SentencePieceProcessor sp_processor_;
+    // whether all leading whitespaces are removed when decoding
+    bool remove_extra_whitespaces = false;
+  };
 
-  // special tokens to ids
-  absl::flat_hash_map<std::string, int32_t> special_token_encoder_;
+  explicit SentencePieceTokenizer(std::shared_ptr<const Vocab> vocab);
 
-  // special token ids to tokens
-  absl::flat_hash_map<int32_t, std::string> special_token_decoder_;
+  static std::shared_ptr<const Vocab> load(const std::string_view& dir_path,
+                                           const TokenizerArgs& args);
+
+  static void load_special_tokens(
+      const std::vector<SpecialToken>& special_tokens,
+      Vocab* vocab);
+
+  static void load_pieces(Vocab* vocab);
+
+  static std::optional<int32_t> token_to_id(const Vocab& vocab,
+                                            const std::string_view& token);
+
+  bool encode_internal(const std::string_view& text,
+                       std::vector<int32_t>* ids) const;
+  void decode_internal(const Slice<int32_t>& ids,
+                       size_t start,
+                       size_t end,
+                       std::string* text) const;
 
-  // special token regex (optional)
-  std::unique_ptr<re2::RE2> special_token_regex_;
+  // decode with sentencepiece, used when the pieces are not available
+  std::string decode_with_processor(const Slice<int32_t>& ids,
+                                    bool skip_special_tokens) const;
 
-  // token ids to add to the beginning of the input sequence
-  std::vector<int32_t> prefix_token_ids_;
+  std::shared_ptr<const Vocab> vocab_;
 };
 
 }  // namespace llm
@@ -106,4 +106,78 @@ TEST(SentencePieceTokenizerTest, SpecialTokenTest) {
     EXPECT_EQ(text, " Hello world  Hello ");
   }
 }
+
+TEST(SentencePieceTokenizerTest, DecodeTokenTest) {
+  std::vector<SpecialToken> special_tokens = {
+      SpecialToken("<|system|>", 32000),
+      SpecialToken("<|user|>", 32001),
+  };
+  TokenizerArgs args;
+  args.vocab_file() = "tokenizer.model";
+  args.special_tokens() = special_tokens;
+  args.prefix_tokens() = {"<s>"};
+  SentencePieceTokenizer tokenizer("data", args);
+
+  const std::vector<std::string> test_texts = {
+      "Hello, world!",
+      "  leading spaces",
+      "你好，世界！",
+      "<|system|> Hello world <|user|> Hello",
+  };
+  for (const auto& test_text : test_texts) {
+    std::vector<int> ids;
+    ASSERT_TRUE(tokenizer.encode(test_text, &ids));
+    for (const bool skip_special_tokens : {false, true}) {
+      // decoding tokens one by one should be the same as decoding all
+      std::string text;
+      bool is_first = true;
+      for (const int id : ids) {
+        ASSERT_TRUE(
+            tokenizer.decode_token(id, skip_special_tokens, &is_first, &text));
+      }
+      EXPECT_EQ(text, tokenizer.decode(ids, skip_special_tokens));
+    }
+  }
+}
+
+TEST(SentencePieceTokenizerTest, DecodeBytePiecesTest) {
+  TokenizerArgs args;
+  args.vocab_file() = "tokenizer.model";
+  SentencePieceTokenizer tokenizer("data", args);
+
+  // <0xE4> <0xB8> <0xAD>: "中"
+  EXPECT_EQ(tokenizer.decode(std::vector<int>{231, 187, 176},
+                             /*skip_special_tokens=*/false),
+            "中");
+  // ▁the <0xE4> <0xB8> <0xAD> </s>
+  EXPECT_EQ(tokenizer.decode(std::vector<int>{278, 231, 187, 176, 2},
+                             /*skip_special_tokens=*/false),
+            "the中");
+  // each byte of partial characters is replaced with U+FFFD
+  EXPECT_EQ(tokenizer.decode(std::vector<int>{231, 187, 278},
+                             /*skip_special_tokens=*/false),
+            "\xEF\xBF\xBD\xEF\xBF\xBD the");
+  // control symbols split the bytes
+  EXPECT_EQ(tokenizer.decode(std::vector<int>{231, 1, 187, 176},
+                             /*skip_special_tokens=*/false),
+            "\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD");
+}
+
+TEST(SentencePieceTokenizerTest, CloneTest) {
+  TokenizerArgs args;
+  args.vocab_file() = "tokenizer.model";
+  args.prefix_tokens() = {"<s>"};
+  SentencePieceTokenizer tokenizer("data", args);
+  const auto clone = tokenizer.clone();
+  EXPECT_EQ(clone->vocab_size(), tokenizer.vocab_size());
+
+  const std::string test_text = "Hello, world! 你好，世界！";
+  std::vector<int> ids;
+  ASSERT_TRUE(tokenizer.encode(test_text, &ids));
+  std::vector<int> clone_ids;
+  ASSERT_TRUE(clone->encode(test_text, &clone_ids));
+  EXPECT_EQ(clone_ids, ids);
+  EXPECT_EQ(clone->decode(clone_ids, /*skip_special_tokens=*/false), test_text);
+}
+
 }  // namespace llm
@@ -0,0 +1,142 @@
+#include "special_token_matcher.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace llm {
+
+SpecialTokenMatcher::SpecialTokenMatcher(
+    const std::vector<std::string>& tokens) {
+  // build the trie of tokens
+  nodes_.emplace_back();
+  bool same_first_byte = true;
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    const auto& token = tokens[i];
+    if (token.empty()) {
+      continue;
+    }
+    const auto first_byte = static_cast<uint8_t>(token[0]);
+    if (first_byte_ < 0) {
+      first_byte_ = first_byte;
+    } else if (first_byte_ != first_byte) {
+      same_first_byte = false;
+    }
+
+    int32_t state = 0;
+    for (const char c : token) {
+      const auto byte = static_cast<uint8_t>(c);
+      int32_t next = child(state, byte);
+      if (next < 0) {
+        next = static_cast<int32_t>(nodes_.size());
+        nodes_.emplace_back();
+        nodes_[next].depth = nodes_[state].depth + 1;
+        auto& children = nodes_[state].children;
+        children.insert(
+            std::upper_bound(children.begin(),
+                             children.end(),
+                             std::make_pair(byte, int32_t{-1})),
+            {byte, next});
+      }
+      state = next;
+    }
+    // keep the first one for duplicate tokens
+    if (nodes_[state].index < 0) {
+      nodes_[state].index = static_cast<int32_t>(i);
+    }
+  }
+  if (!same_first_byte) {
+    first_byte_ = -1;
+  }
+
+  // the root transitions are dense, missing bytes loop back to the root
+  root_next_.fill(0);
+  for (const auto& [byte, next] : nodes_[0].children) {
+    root_next_[byte] = next;
+  }
+
+  // compute fail and output links in bfs order so that the fail node of a
+  // node is always processed before the node itself.
+  std::queue<int32_t> queue;
+  for (const auto& [byte, next] : nodes_[0].children) {
+    queue.push(next);
+  }
+  while (!queue.empty()) {
+    const int32_t state = queue.front();
+    queue.pop();
+    for (const auto& [byte, next] : nodes_[state].children) {
+      const int32_t fail = next_state(nodes_[state].fail, byte);
+      nodes_[next].fail = fail;
+      nodes_[next].output =
+          nodes_[fail].index >= 0 ? fail : nodes_[fail].output;
+      queue.push(next);
+    }
+  }
+}
+
+int32_t SpecialTokenMatcher::child(int32_t state, uint8_t byte) const {
+  for (const auto& [child_byte, next] : nodes_[state].children) {
+    if (child_byte == byte) {
+      return next;
+    }
+  }
+  return -1;
+}
+
+int32_t SpecialTokenMatcher::next_state(int32_t state, uint8_t byte) const {
+  DCHECK(state >= 0 && static_cast<size_t>(state) < nodes_.size());
+  while (state != 0) {
+    const int32_t next = child(state, byte);
+    if (next >= 0) {
+      return next;
+    }
+    state = nodes_[state].fail;
+  }
+  return root_next_[byte];
+}
+
+size_t SpecialTokenMatcher::find(const std::string_view& text,
+                                 size_t* len) const {
+  size_t best_start = std::string_view::npos;
+  int32_t best_index = -1;
+  int32_t state = 0;
+  for (size_t pos = 0; pos < text.size(); ++pos) {
+    // the state is the longest prefix of tokens ending here, stop once it
+    // starts after the best match found so far.
+    if (best_start != std::string_view::npos &&
+        pos - nodes_[state].depth > best_start) {
+      break;
+    }
+    if (state == 0 && first_byte_ >= 0) {
+      // skip to the next byte that may start a token
+      const void* found =
+          std::memchr(text.data() + pos, first_byte_, text.size() - pos);
+      if (found == nullptr) {
+        break;
+      }
+      pos = static_cast<const char*>(found) - text.data();
+    }
+
+    state = next_state(state, static_cast<uint8_t>(text[pos]));
+    // check all tokens ending here, from the longest to the shortest
+    int32_t node = nodes_[state].index >= 0 ? state : nodes_[state].output;
+    for (; node >= 0; node = nodes_[node].output) {
+      const size_t start = pos + 1 - nodes_[node].depth;
+      if (start < best_start ||
+          (start == best_start && nodes_[node].index < best_index)) {
+        best_start = start;
+        best_index = nodes_[node].index;
+        *len = nodes_[node].depth;
+      }
+    }
+  }
+  return best_start;
+}
+
+}  // namespace llm
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace llm {
+
+// An Aho-Corasick automaton to find special tokens in text in a single pass.
+// It finds the same token as the regex alternation of the escaped tokens does
+// with RE2: the match starting leftmost, and the first token in the list
+// among the tokens starting at the same position. Bytes that can't start a
+// token are skipped with memchr when all tokens start with the same byte.
+// immutable and thread safe.
+class SpecialTokenMatcher final {
+ public:
+  // empty tokens are ignored
+  explicit SpecialTokenMatcher(const std::vector<std::string>& tokens);
+
+  // find the first special token in the text, returns the start position of
+  // the token and sets its length, or npos if not found.
+  size_t find(const std::string_view& text, size_t* len) const;
+
+ private:
+  struct Node {
+    // transitions to children, sorted by byte
+    std::vector<std::pair<uint8_t, int32_t>> children;
+
+    // the node of the longest proper suffix that is also in the automaton
+    int32_t fail = 0;
+
+    // the nearest node on the fail chain, excluding itself, that is a token
+    int32_t output = -1;
+
+    // the length of the prefix represented by the node
+    uint32_t depth = 0;
+
+    // the index of the first token in the list ending at the node, -1 if none
+    int32_t index = -1;
+  };
+
+  // get the child of the node with the byte, -1 if not found
+  int32_t child(int32_t state, uint8_t byte) const;
+
+  // get the state after the byte
+  int32_t next_state(int32_t state, uint8_t byte) const;
+
+  std::vector<Node> nodes_;
+
+  // dense transitions of the root, to stop following fail links at the root
+  std::array<int32_t, 256> root_next_{};
+
+  // the first byte of all tokens if they share the same one, otherwise -1
+  int32_t first_byte_ = -1;
+};
+
+}  // namespace llm
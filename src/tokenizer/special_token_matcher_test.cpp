@@ -0,0 +1,89 @@
+#include "special_token_matcher.h"
+
+#include <absl/strings/str_join.h>
+#include <gtest/gtest.h>
+#include <re2/re2.h>
+
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace llm {
+
+namespace {
+
+// find the special token with the regex of escaped tokens
+size_t find_with_regex(const std::vector<std::string>& tokens,
+                       const std::string_view& text,
+                       size_t* len) {
+  std::vector<std::string> escaped_tokens;
+  for (const auto& token : tokens) {
+    escaped_tokens.push_back(re2::RE2::QuoteMeta(token));
+  }
+  const re2::RE2 regex("(" + absl::StrJoin(escaped_tokens, "|") + ")");
+  std::string_view input = text;
+  std::string_view match;
+  if (!re2::RE2::FindAndConsume(&input, regex, &match)) {
+    return std::string_view::npos;
+  }
+  *len = match.size();
+  return match.data() - text.data();
+}
+
+}  // namespace
+
+TEST(SpecialTokenMatcherTest, Find) {
+  SpecialTokenMatcher matcher({"<|im_start|>", "<|im_end|>", ""});
+  size_t len = 0;
+  EXPECT_EQ(matcher.find("hello <|im_start|>user", &len), 6);
+  EXPECT_EQ(len, 12);
+  EXPECT_EQ(matcher.find("<|im_end|><|im_start|>", &len), 0);
+  EXPECT_EQ(len, 10);
+  EXPECT_EQ(matcher.find("<|im_star|>", &len), std::string_view::npos);
+  EXPECT_EQ(matcher.find("", &len), std::string_view::npos);
+}
+
+TEST(SpecialTokenMatcherTest, OverlappingTokens) {
+  // the leftmost match wins, then the first token in the list
+  SpecialTokenMatcher matcher({"ab", "abcd", "bc", "c"});
+  size_t len = 0;
+  EXPECT_EQ(matcher.find("xabcd", &len), 1);
+  EXPECT_EQ(len, 2);
+  EXPECT_EQ(matcher.find("xbcd", &len), 1);
+  EXPECT_EQ(len, 2);
+  EXPECT_EQ(matcher.find("xacd", &len), 2);
+  EXPECT_EQ(len, 1);
+}
+
+TEST(SpecialTokenMatcherTest, MatchRegex) {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<size_t> len_dist(1, 4);
+  std::uniform_int_distribution<int> char_dist('a', 'd');
+  auto random_string = [&](size_t len) {
+    std::string s;
+    for (size_t i = 0; i < len; ++i) {
+      s.push_back(static_cast<char>(char_dist(gen)));
+    }
+    return s;
+  };
+  for (int i = 0; i < 1000; ++i) {
+    std::vector<std::string> tokens;
+    const size_t num_tokens = len_dist(gen);
+    for (size_t j = 0; j < num_tokens; ++j) {
+      tokens.push_back(random_string(len_dist(gen)));
+    }
+    SpecialTokenMatcher matcher(tokens);
+    const std::string text = random_string(16);
+    size_t len = 0;
+    size_t desired_len = 0;
+    const size_t start = matcher.find(text, &len);
+    const size_t desired_start = find_with_regex(tokens, text, &desired_len);
+    EXPECT_EQ(start, desired_start) << text;
+    if (start != std::string_view::npos) {
+      EXPECT_EQ(len, desired_len) << text;
+    }
+  }
+}
+
+}  // namespace llm
@@ -0,0 +1,42 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <iostream>
+#include <string>
+
+#include "bpe_vocab.h"
+
+// convert a tiktoken vocab file into a compiled binary file, which is mapped
+// into memory without parsing when loading the tokenizer.
+// usage: tiktoken_converter --input=cl100k_base.tiktoken
+//                           --output=cl100k_base.tiktoken.bin
+
+DEFINE_string(input, "", "path to the tiktoken vocab file.");
+
+DEFINE_string(output, "", "path to the compiled binary vocab file.");
+
+int main(int argc, char* argv[]) {
+  // initialize glog and gflags
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (FLAGS_input.empty() || FLAGS_output.empty()) {
+    std::cerr << "Usage: " << argv[0]
+              << " --input=<tiktoken file> --output=<binary file>"
+              << std::endl;
+    return 1;
+  }
+
+  const auto vocab = llm::BpeVocab::from_file(FLAGS_input);
+  if (vocab == nullptr) {
+    LOG(ERROR) << "Failed to load vocab file: " << FLAGS_input;
+    return 1;
+  }
+  if (!vocab->save(FLAGS_output)) {
+    LOG(ERROR) << "Failed to save vocab file: " << FLAGS_output;
+    return 1;
+  }
+  LOG(INFO) << "Converted " << vocab->num_tokens() << " tokens to "
+            << FLAGS_output;
+  return 0;
+}
@@ -1,38 +1,67 @@
 #include "tiktoken_tokenizer.h"
 
-#include <absl/strings/escaping.h>
-#include <absl/strings/numbers.h>
+#include <absl/container/flat_hash_set.h>
 #include <absl/strings/str_cat.h>
-#include <absl/strings/str_join.h>
-#include <absl/strings/str_split.h>
 #include <glog/logging.h>
 #include <re2/re2.h>
 
-#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <queue>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace llm {
 
+namespace {
+// max number of pieces in the cache of byte pair encoding results
+constexpr size_t kMaxCachedPieces = 8192;
+
+// max length of pieces to cache
+constexpr size_t kMaxCachedPieceLen = 64;
+}  // namespace
+
 TiktokenTokenizer::TiktokenTokenizer(const std::string_view& dir_path,
                                      const TokenizerArgs& args)
-    : dir_path_(dir_path), args_(args) {
+    : TiktokenTokenizer(load(dir_path, args)) {}
+
+TiktokenTokenizer::TiktokenTokenizer(std::shared_ptr<const Vocab> vocab)
+    : vocab_(std::move(vocab)) {
+  CHECK(vocab_ != nullptr);
+}
+
+std::shared_ptr<const TiktokenTokenizer::Vocab> TiktokenTokenizer::load(
+    const std::string_view& dir_path,
+    const TokenizerArgs& args) {
+  auto vocab = std::make_shared<Vocab>();
+  vocab->args = args;
+
   // load vocab from file
   const std::string vocab_file_path =
       dir_path.empty() ? args.vocab_file()
-                       : absl::StrCat(dir_path_, "/", args.vocab_file());
-  load_vocab(vocab_file_path);
+                       : absl::StrCat(dir_path, "/", args.vocab_file());
+  load_vocab(vocab_file_path, vocab.get());
 
   // add special tokens and construct special token regex
   if (!args.special_tokens().empty()) {
-    const auto vocab_size = encoder_.size();
-    load_special_tokens(args.special_tokens());
+    load_special_tokens(args.special_tokens(), vocab.get());
   }
 
-  // construct regex
+  // pack the bytes of tokens into a table for decoding
+  load_pieces(vocab.get());
+
+  // construct regex, and the pre-tokenizer if the pattern is known
   if (!args.pattern().empty()) {
     const auto regex_str = absl::StrCat("(", args.pattern(), ")");
-    regex_ = std::make_unique<re2::RE2>(regex_str);
+    vocab->regex = std::make_unique<re2::RE2>(regex_str);
+    vocab->pre_tokenizer = PreTokenizer::create(args.pattern());
+    if (vocab->pre_tokenizer == nullptr) {
+      LOG(INFO) << "Using regex for pre-tokenization of unknown pattern";
+    }
   }
 
   // construct prefix tokens
@@ -41,91 +70,76 @@ TiktokenTokenizer::TiktokenTokenizer(const std::string_view& dir_path,
       if (token.empty()) {
         continue;
       }
-      const auto token_id = token_to_id(token);
+      const auto token_id = token_to_id(*vocab, token);
       if (token_id.has_value()) {
-        prefix_token_ids_.push_back(token_id.value());
+        vocab->prefix_token_ids.push_back(token_id.value());
         LOG(INFO) << "Prefix token: " << token << ", id: " << token_id.value();
       } else {
         LOG(ERROR) << "Failed to find prefix token: " << token;
       }
     }
   }
+  return vocab;
 }
 
 void TiktokenTokenizer::load_special_tokens(
-    const std::vector<SpecialToken>& special_tokens) {
-  // for each special token, add to encoder and decoder
+    const std::vector<SpecialToken>& special_tokens,
+    Vocab* vocab) {
+  // for each special token, add to encoder
+  absl::flat_hash_set<int32_t> ids;
   for (const auto& [token, id] : special_tokens) {
     if (token.empty()) {
       continue;
     }
 
-    if (!special_token_encoder_.try_emplace(token, id).second) {
+    if (!vocab->special_token_encoder.try_emplace(token, id).second) {
       LOG(WARNING) << "Duplicate special token: " << token << ", id: " << id;
     }
 
-    if (!special_token_decoder_.try_emplace(id, token).second) {
+    if (!ids.insert(id).second) {
       LOG(WARNING) << "Duplicate special token: " << token << ", id: " << id;
     }
   }
 
-  // build special token regex
-  std::vector<std::string> escaped_tokens;
-  escaped_tokens.reserve(special_tokens.size());
+  // build the matcher to find special tokens in a single pass
+  std::vector<std::string> tokens;
+  tokens.reserve(special_tokens.size());
   for (const auto& [token, id] : special_tokens) {
-    if (token.empty()) {
-      continue;
+    if (!token.empty()) {
+      tokens.push_back(token);
     }
-    // escape each token
-    const auto escaped_token = re2::RE2::QuoteMeta(token);
-    escaped_tokens.push_back(escaped_token);
   }
-  if (!escaped_tokens.empty()) {
-    const auto special_token_regex_str = absl::StrJoin(escaped_tokens, "|");
-    // surround with () to match special tokens
-    const auto regex_str = absl::StrCat("(", special_token_regex_str, ")");
-    special_token_regex_ = std::make_unique<re2::RE2>(regex_str);
+  if (!tokens.empty()) {
+    vocab->special_token_matcher =
+        std::make_unique<SpecialTokenMatcher>(tokens);
   }
 }
 
-void TiktokenTokenizer::load_vocab(const std::string& vocab_file_path) {
-  // read token + rank from vocab file
-  std::ifstream fs(vocab_file_path);
-  if (!fs) {
-    LOG(FATAL) << "Failed to open vocab file: " << vocab_file_path;
+void TiktokenTokenizer::load_vocab(const std::string& vocab_file_path,
+                                   Vocab* vocab) {
+  // load from a compiled binary file or a tiktoken file with token + rank
+  vocab->encoder = BpeVocab::from_file(vocab_file_path);
+  if (vocab->encoder == nullptr) {
+    LOG(FATAL) << "Failed to load vocab file: " << vocab_file_path;
   }
+}
 
-  std::string line;
-  while (std::getline(fs, line)) {
-    if (line.empty()) {
-      // skip empty line
-      continue;
-    }
-    // split line by space
-    const std::vector<std::string> parts = absl::StrSplit(line, ' ');
-    if (parts.size() != 2) {
-      LOG(WARNING) << "Failed to parse line: " << line;
-      continue;
-    }
-    // parse token and rank
-    std::string token;
-    if (!absl::Base64Unescape(parts[0], &token)) {
-      LOG(WARNING) << "Failed to parse token: " << parts[0];
-      continue;
-    }
-    int32_t rank = 0;
-    if (!absl::SimpleAtoi(parts[1], &rank)) {
-      LOG(WARNING) << "Failed to parse rank: " << parts[1];
-      continue;
-    }
-
-    if (!encoder_.try_emplace(token, rank).second) {
-      LOG(WARNING) << "Duplicate token: " << token;
-    }
-    if (!decoder_.try_emplace(rank, token).second) {
-      LOG(WARNING) << "Duplicate rank: " << rank;
+void TiktokenTokenizer::load_pieces(Vocab* vocab) {
+  std::vector<PieceTable::Piece> pieces;
+  const auto& encoder = *vocab->encoder;
+  pieces.reserve(encoder.num_tokens() + vocab->special_token_encoder.size());
+  for (size_t rank = 0; rank < encoder.num_ranks(); ++rank) {
+    const auto token = encoder.token(static_cast<int32_t>(rank));
+    if (!token.empty()) {
+      pieces.push_back(
+          {static_cast<int32_t>(rank), token, /*special=*/false});
     }
   }
+  // special tokens take precedence over tokens with the same id
+  for (const auto& [token, id] : vocab->special_token_encoder) {
+    pieces.push_back({id, token, /*special=*/true});
+  }
+  vocab->pieces = PieceTable(pieces);
 }
 
 void TiktokenTokenizer::byte_pair_encode(const std::string_view& piece,
@@ -135,132 +149,191 @@ void TiktokenTokenizer::byte_pair_encode(const std::string_view& piece,
     return;
   }
 
-  // This is a vector of (start, rank) pairs.
-  // The rank is of the byte pair startig at position start.
-  // The rank of the last item in the vector is not a valid value.
-  std::vector<std::pair<int32_t, int32_t>> parts;
-  parts.reserve(piece.size() + 1);
+  // The parts are kept as a linked list of their start positions, where
+  // next[i] is the start of the part after the one starting at i, and
+  // ranks[i] is the rank of the byte pair (part i, part next[i]).
+  // The end of the piece is a sentinel part.
+  const auto n = static_cast<int32_t>(piece.size());
   const int32_t kMaxRank = std::numeric_limits<int32_t>::max();
-  for (int32_t i = 0; i <= piece.size(); ++i) {
-    parts.emplace_back(i, kMaxRank);
+  std::vector<int32_t> prev(n + 1);
+  std::vector<int32_t> next(n + 1);
+  std::vector<int32_t> ranks(n + 1, kMaxRank);
+  for (int32_t i = 0; i <= n; ++i) {
+    prev[i] = i - 1;
+    next[i] = i + 1;
   }
 
-  auto get_rank = [&piece, &parts, this](
-                      int32_t start, int32_t skip) -> std::optional<int32_t> {
-    if (start + skip + 2 < parts.size()) {
-      auto s = parts[start].first;
-      auto e = parts[start + skip + 2].first;
-      const auto key = piece.substr(s, e - s);
-      auto it = encoder_.find(key);
-      if (it != encoder_.end()) {
-        return it->second;
-      }
+  auto get_rank = [&piece, &next, n, this](int32_t start) -> int32_t {
+    const int32_t mid = next[start];
+    if (mid >= n) {
+      return kMaxRank;
+    }
+    const int32_t end = next[mid];
+    const int32_t rank =
+        vocab_->encoder->find(piece.substr(start, end - start));
+    if (rank < 0) {
+      return kMaxRank;
     }
-    return std::nullopt;
+    // kMaxRank is a sentinel value and cannot be a valid rank.
+    CHECK(rank != kMaxRank) << "Invalid rank";
+    return rank;
   };
 
-  // We look up the ranks once in the beginning and iteratively update
-  // them during each merge, which reduces the number of rank lookups.
-  for (int32_t i = 0; i < parts.size() - 2; ++i) {
-    const auto rank = get_rank(i, 0);
-    if (rank.has_value()) {
-      // kMaxRank is a sentinel value and cannot be a valid rank.
-      CHECK(rank.value() != kMaxRank) << "Invalid rank";
-      parts[i].second = rank.value();
+  // a min heap of (rank, start) for the byte pairs to merge, the leftmost
+  // pair with the lowest rank is merged first. entries are not removed when
+  // the pair is merged away or changed, and are skipped when popped instead.
+  using Candidate = std::pair<int32_t, int32_t>;
+  std::priority_queue<Candidate, std::vector<Candidate>, std::greater<>> heap;
+  for (int32_t i = 0; i + 1 < n; ++i) {
+    ranks[i] = get_rank(i);
+    if (ranks[i] != kMaxRank) {
+      heap.emplace(ranks[i], i);
     }
   }
 
-  while (parts.size() > 1) {
-    // find i with min rank. kMaxRank is a sentinel value.
-    int32_t min_rank = kMaxRank;
-    int32_t min_i = 0;
-    for (int32_t i = 0; i < parts.size() - 1; ++i) {
-      const auto rank = parts[i].second;
-      if (rank < min_rank) {
-        min_rank = rank;
-        min_i = i;
-      }
+  while (!heap.empty()) {
+    const auto [rank, start] = heap.top();
+    heap.pop();
+    // skip stale entries
+    if (ranks[start] != rank) {
+      continue;
     }
 
-    if (min_rank == kMaxRank) {
-      // No more merges possible.
-      break;
-    }
+    // merge the part after start into the part at start
+    const int32_t removed = next[start];
+    next[start] = next[removed];
+    prev[next[removed]] = start;
+    ranks[removed] = kMaxRank;
 
-    // remove parts[min_i + 1].
-    parts[min_i].second = get_rank(min_i, 1).value_or(kMaxRank);
-    if (min_i > 0) {
-      parts[min_i - 1].second = get_rank(min_i - 1, 1).value_or(kMaxRank);
+    // update the ranks of the pairs around the merged part
+    ranks[start] = get_rank(start);
+    if (ranks[start] != kMaxRank) {
+      heap.emplace(ranks[start], start);
+    }
+    const int32_t before = prev[start];
+    if (before >= 0) {
+      ranks[before] = get_rank(before);
+      if (ranks[before] != kMaxRank) {
+        heap.emplace(ranks[before], before);
+      }
     }
-    parts.erase(parts.begin() + min_i + 1);
   }
 
-  for (int32_t i = 0; i < parts.size() - 1; ++i) {
-    const auto s = parts[i].first;
-    const auto e = parts[i + 1].first;
-    // get rank for each piece
-    const auto key = piece.substr(s, e - s);
-    auto it = encoder_.find(key);
-    if (it == encoder_.end()) {
+  for (int32_t i = 0; i < n; i = next[i]) {
+    // get rank for each part
+    const auto key = piece.substr(i, next[i] - i);
+    const int32_t rank = vocab_->encoder->find(key);
+    if (rank < 0) {
       LOG(ERROR) << "Failed to find key: " << key;
     } else {
-      ids->push_back(it->second);
+      ids->push_back(rank);
     }
   }
 }
 
-void TiktokenTokenizer::encode_internal(const std::string_view& text,
-                                        std::vector<int32_t>* ids) const {
-  if (regex_ == nullptr) {
-    byte_pair_encode(text, ids);
+bool TiktokenTokenizer::lookup_cache(const std::string_view& piece,
+                                     std::vector<int32_t>* ids) const {
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  auto it = cache_.find(piece);
+  if (it == cache_.end()) {
+    return false;
+  }
+  // move the entry to the front of the lru list
+  lru_list_.splice(lru_list_.begin(), lru_list_, it->second);
+  const auto& cached_ids = it->second->second;
+  ids->insert(ids->end(), cached_ids.begin(), cached_ids.end());
+  return true;
+}
+
+void TiktokenTokenizer::update_cache(const std::string_view& piece,
+                                     const Slice<int32_t>& ids) const {
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  if (cache_.contains(piece)) {
+    // added by another thread
     return;
   }
+  lru_list_.emplace_front(std::string(piece),
+                          std::vector<int32_t>(ids.begin(), ids.end()));
+  // key of the map points to the string owned by the list entry
+  cache_.emplace(lru_list_.front().first, lru_list_.begin());
+  // evict the least recently used entry
+  if (lru_list_.size() > kMaxCachedPieces) {
+    cache_.erase(lru_list_.back().first);
+    lru_list_.pop_back();
+  }
+}
 
+void TiktokenTokenizer::encode_piece(const std::string_view& piece,
+                                     std::vector<int32_t>* ids) const {
+  const int32_t rank = vocab_->encoder->find(piece);
+  if (rank >= 0) {
+    ids->push_back(rank);
+    return;
+  }
+  // long pieces are rarely repeated, don't pollute the cache with them
+  if (piece.size() > kMaxCachedPieceLen) {
+    byte_pair_encode(piece, ids);
+    return;
+  }
+  if (!lookup_cache(piece, ids)) {
+    const size_t start = ids->size();
+    byte_pair_encode(piece, ids);
+    update_cache(piece, Slice<int32_t>(*ids).slice(start));
+  }
+}
+
+void TiktokenTokenizer::encode_internal(const std::string_view& text,
+                                        std::vector<int32_t>* ids) const {
   std::string_view input = text;
   std::string_view piece;
-  while (re2::RE2::FindAndConsume(&input, *regex_, &piece)) {
-    auto it = encoder_.find(piece);
-    if (it != encoder_.end()) {
-      ids->push_back(it->second);
-      continue;
+  if (vocab_->pre_tokenizer != nullptr) {
+    while (vocab_->pre_tokenizer->next(&input, &piece)) {
+      encode_piece(piece, ids);
     }
-    byte_pair_encode(piece, ids);
+    return;
+  }
+
+  if (vocab_->regex == nullptr) {
+    byte_pair_encode(text, ids);
+    return;
+  }
+  while (re2::RE2::FindAndConsume(&input, *vocab_->regex, &piece)) {
+    encode_piece(piece, ids);
   }
 }
 
 bool TiktokenTokenizer::encode(const std::string_view& text,
                                std::vector<int32_t>* ids) const {
   // prepend prefix tokens if exists
-  if (!prefix_token_ids_.empty()) {
-    ids->insert(
-        ids->begin(), prefix_token_ids_.begin(), prefix_token_ids_.end());
+  const auto& prefix_token_ids = vocab_->prefix_token_ids;
+  if (!prefix_token_ids.empty()) {
+    ids->insert(ids->begin(), prefix_token_ids.begin(), prefix_token_ids.end());
   }
 
-  if (special_token_regex_ == nullptr) {
+  if (vocab_->special_token_matcher == nullptr) {
     encode_internal(text, ids);
     return true;
   }
 
   std::string_view input = text;
-  std::string_view special;
+  size_t len = 0;
   while (true) {
-    const auto* start = input.begin();
-    if (!re2::RE2::FindAndConsume(&input, *special_token_regex_, &special)) {
+    const size_t start = vocab_->special_token_matcher->find(input, &len);
+    if (start == std::string_view::npos) {
       // no more special tokens
       break;
     }
 
     // encode text before special token if exists
-    const std::string_view sub_input(start,
-                                     input.begin() - start - special.size());
-    encode_internal(sub_input, ids);
-
-    // add special token id if exists
-    const auto sit = special_token_encoder_.find(special);
-    if (sit != special_token_encoder_.end()) {
-      // find one special token
+    encode_internal(input.substr(0, start), ids);
+
+    // add special token id
+    const auto special = input.substr(start, len);
+    const auto sit = vocab_->special_token_encoder.find(special);
+    if (sit != vocab_->special_token_encoder.end()) {
       ids->push_back(sit->second);
     }
+    input.remove_prefix(start + len);
   }
 
   // encode remaining text if exists
@@ -270,49 +343,43 @@ bool TiktokenTokenizer::encode(const std::string_view& text,
 
 std::string TiktokenTokenizer::decode(const Slice<int32_t>& ids,
                                       bool skip_special_tokens) const {
-  std::stringstream ss;
-  for (const auto& id : ids) {
-    // encode special token
-    const auto sit = special_token_decoder_.find(id);
-    if (sit != special_token_decoder_.end()) {
-      if (!skip_special_tokens) {
-        ss << sit->second;
-      }
-      continue;
-    }
+  std::string text;
+  vocab_->pieces.decode(ids, skip_special_tokens, &text);
+  return text;
+}
 
-    // encode token
-    const auto it = decoder_.find(id);
-    if (it != decoder_.end()) {
-      ss << it->second;
-      continue;
-    }
-    LOG(ERROR) << "Failed to find token for id: " << id;
-  }
-  return ss.str();
+bool TiktokenTokenizer::decode_token(int32_t id,
+                                     bool skip_special_tokens,
+                                     bool* /*is_first*/,
+                                     std::string* text) const {
+  // tokens are decoded independently into bytes
+  vocab_->pieces.decode(Slice<int32_t>(&id, 1), skip_special_tokens, text);
+  return true;
 }
 
 size_t TiktokenTokenizer::vocab_size() const {
   // vocab size = encoder size + special tokens size
-  return encoder_.size() + args_.special_tokens().size();
+  return vocab_->encoder->num_tokens() + vocab_->args.special_tokens().size();
 }
 
 std::unique_ptr<Tokenizer> TiktokenTokenizer::clone() const {
-  return std::make_unique<TiktokenTokenizer>(dir_path_, args_);
+  // the constructor is private
+  return std::unique_ptr<TiktokenTokenizer>(new TiktokenTokenizer(vocab_));
 }
 
 std::optional<int32_t> TiktokenTokenizer::token_to_id(
-    const std::string_view& token) const {
+    const Vocab& vocab,
+    const std::string_view& token) {
   // encode special token
-  const auto sit = special_token_encoder_.find(token);
-  if (sit != special_token_encoder_.end()) {
+  const auto sit = vocab.special_token_encoder.find(token);
+  if (sit != vocab.special_token_encoder.end()) {
     return sit->second;
   }
 
   // encode token
-  const auto it = encoder_.find(token);
-  if (it != encoder_.end()) {
-    return it->second;
+  const int32_t rank = vocab.encoder->find(token);
+  if (rank >= 0) {
+    return rank;
   }
   return std::nullopt;
 }
@@ -3,8 +3,19 @@
 #include <absl/container/flat_hash_map.h>
 #include <re2/re2.h>
 
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "bpe_vocab.h"
+#include "piece_table.h"
+#include "pre_tokenizer.h"
+#include "special_token_matcher.h"
 #include "tokenizer.h"
 #include "tokenizer_args.h"
 
@@ -23,48 +34,93 @@ class TiktokenTokenizer : public Tokenizer {
   std::string decode(const Slice<int32_t>& ids,
                      bool skip_special_tokens) const override;
 
+  bool decode_token(int32_t id,
+                    bool skip_special_tokens,
+                    bool* is_first,
+                    std::string* text) const override;
+
   size_t vocab_size() const override;
 
+  // clones share the vocab with this tokenizer
   std::unique_ptr<Tokenizer> clone() const override;
 
  private:
-  void load_special_tokens(const std::vector<SpecialToken>& special_tokens);
+  // the vocab, special tokens and regexes loaded from files, which are
+  // immutable and shared by all clones of the tokenizer.
+  struct Vocab {
+    TokenizerArgs args;
 
-  void load_vocab(const std::string& vocab_file_path);
+    // token to ids, loaded from a tiktoken file or mapped from a compiled
+    // binary file
+    std::unique_ptr<BpeVocab> encoder;
 
-  void encode_internal(const std::string_view& text,
-                       std::vector<int32_t>* ids) const;
+    // a regex pattern to tokenize text
+    // N.B. RE2 doesn't support look-around assertions.
+    // https://github.com/google/re2/wiki/Syntax
+    std::unique_ptr<re2::RE2> regex;
 
-  void byte_pair_encode(const std::string_view& piece,
-                        std::vector<int32_t>* ids) const;
+    // a hand-written pre-tokenizer for the known patterns, used instead of
+    // the regex if exists.
+    std::unique_ptr<PreTokenizer> pre_tokenizer;
+
+    // special tokens to ids
+    absl::flat_hash_map<std::string, int32_t> special_token_encoder;
+
+    // matcher to find special tokens (optional)
+    std::unique_ptr<SpecialTokenMatcher> special_token_matcher;
+
+    // token ids to add to the beginning of the input sequence
+    std::vector<int32_t> prefix_token_ids;
+
+    // bytes of tokens and special tokens indexed by id for decoding
+    PieceTable pieces;
+  };
 
-  std::optional<int32_t> token_to_id(const std::string_view& token) const;
+  explicit TiktokenTokenizer(std::shared_ptr<const Vocab> vocab);
 
-  std::string dir_path_;
+  static std::shared_ptr<const Vocab> load(const std::string_view& dir_path,
+                                           const TokenizerArgs& args);
 
-  TokenizerArgs args_;
+  static void load_special_tokens(
+      const std::vector<SpecialToken>& special_tokens,
+      Vocab* vocab);
 
-  // token to ids
-  absl::flat_hash_map<std::string, int32_t> encoder_;
-  // id to token
-  absl::flat_hash_map<int32_t, std::string> decoder_;
+  static void load_vocab(const std::string& vocab_file_path, Vocab* vocab);
+
+  static void load_pieces(Vocab* vocab);
+
+  static std::optional<int32_t> token_to_id(const Vocab& vocab,
+                                            const std::string_view& token);
+
+  void encode_internal(const std::string_view& text,
+                       std::vector<int32_t>* ids) const;
+
+  // encode a piece from the pre-tokenization
+  void encode_piece(const std::string_view& piece,
+                    std::vector<int32_t>* ids) const;
+
+  // encode the piece with byte pair merges in O(n log n)
+  void byte_pair_encode(const std::string_view& piece,
+                        std::vector<int32_t>* ids) const;
 
-  // a regex pattern to tokenize text
-  // N.B. RE2 doesn't support look-around assertions.
-  // https://github.com/google/re2/wiki/Syntax
-  std::unique_ptr<re2::RE2> regex_;
+  // append the cached ids of the piece, returns false if not cached
+  bool lookup_cache(const std::string_view& piece,
+                    std::vector<int32_t>* ids) const;
 
-  // special tokens to ids
-  absl::flat_hash_map<std::string, int32_t> special_token_encoder_;
+  void update_cache(const std::string_view& piece,
+                    const Slice<int32_t>& ids) const;
 
-  // special token ids to tokens
-  absl::flat_hash_map<int32_t, std::string> special_token_decoder_;
+  std::shared_ptr<const Vocab> vocab_;
 
-  // special token regex (optional)
-  std::unique_ptr<re2::RE2> special_token_regex_;
+  // mutex to protect the lru cache of encoded pieces
+  mutable std::mutex cache_mutex_;
 
-  // token ids to add to the beginning of the input sequence
-  std::vector<int32_t> prefix_token_ids_;
+  // cached (piece, ids) with the most recently used at the front
+  using CacheEntry = std::pair<std::string, std::vector<int32_t>>;
+  mutable std::list<CacheEntry> lru_list_;
+  // piece to the cache entry, keyed by the piece owned by the entry
+  mutable absl::flat_hash_map<std::string_view, std::list<CacheEntry>::iterator>
+      cache_;
 };
 
 }  // namespace llm
@@ -1,7 +1,12 @@
 #include "tiktoken_tokenizer.h"
 
+#include <absl/strings/str_join.h>
 #include <gtest/gtest.h>
 
+#include <filesystem>
+
+#include "common/threadpool.h"
+#include "tokenizer/bpe_vocab.h"
 #include "tokenizer/tokenizer_args.h"
 
 namespace llm {
@@ -79,6 +84,41 @@ TEST(TiktokenTokenizerTest, PatternTest) {
   }
 }
 
+TEST(TiktokenTokenizerTest, RepeatedAndLongPieceTest) {
+  const std::string pattern =
+      R"((?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+[^\S]|\s+)";
+  TokenizerArgs args;
+  args.vocab_file() = "test.tiktoken";
+  args.pattern() = pattern;
+  TiktokenTokenizer tokenizer("data", args);
+
+  // repeated pieces are encoded from the cache
+  std::string test_text;
+  std::vector<int> desired_ids;
+  for (int i = 0; i < 10; ++i) {
+    test_text += "Hello, world!";
+    desired_ids.insert(desired_ids.end(),
+                       {39, 68, 75, 75, 78, 11, 289, 269, 75, 67, 0});
+  }
+  std::vector<int> ids;
+  ASSERT_TRUE(tokenizer.encode(test_text, &ids));
+  EXPECT_EQ(ids, desired_ids);
+
+  // long pieces of letters and whitespaces
+  const std::vector<std::string> long_texts = {
+      std::string(10000, ' '),
+      absl::StrJoin(std::vector<std::string>(2000, "string"), ""),
+      absl::StrJoin(std::vector<std::string>(2000, "world"), ""),
+  };
+  for (const auto& long_text : long_texts) {
+    std::vector<int> long_ids;
+    ASSERT_TRUE(tokenizer.encode(long_text, &long_ids));
+    EXPECT_LT(long_ids.size(), long_text.size());
+    EXPECT_EQ(tokenizer.decode(long_ids, /*skip_special_tokens=*/false),
+              long_text);
+  }
+}
+
 TEST(TiktokenTokenizerTest, SpecialTokenTest) {
   std::vector<SpecialToken> special_tokens = {{"[gMASK]", 300},
                                               {"[sMASK]", 301},
@@ -134,4 +174,104 @@ TEST(TiktokenTokenizerTest, SpecialTokenTest) {
   }
 }
 
+TEST(TiktokenTokenizerTest, DecodeTokenTest) {
+  std::vector<SpecialToken> special_tokens = {{"<|system|>", 300},
+                                              {"<|user|>", 301}};
+  TokenizerArgs args;
+  args.vocab_file() = "test.tiktoken";
+  args.special_tokens() = special_tokens;
+  TiktokenTokenizer tokenizer("data", args);
+
+  const std::vector<std::string> test_texts = {
+      "Hello, world!",
+      "你好，世界！",
+      "<|system|> Hello world <|user|> Hello",
+  };
+  for (const auto& test_text : test_texts) {
+    std::vector<int> ids;
+    ASSERT_TRUE(tokenizer.encode(test_text, &ids));
+    for (const bool skip_special_tokens : {false, true}) {
+      // decoding tokens one by one should be the same as decoding all
+      std::string text;
+      bool is_first = true;
+      for (const int id : ids) {
+        ASSERT_TRUE(
+            tokenizer.decode_token(id, skip_special_tokens, &is_first, &text));
+      }
+      EXPECT_EQ(text, tokenizer.decode(ids, skip_special_tokens));
+    }
+  }
+}
+
+TEST(TiktokenTokenizerTest, CloneTest) {
+  TokenizerArgs args;
+  args.vocab_file() = "test.tiktoken";
+  TiktokenTokenizer tokenizer("data", args);
+  const auto clone = tokenizer.clone();
+  EXPECT_EQ(clone->vocab_size(), tokenizer.vocab_size());
+
+  const std::string test_text = "Hello, world! 你好，世界！";
+  std::vector<int> ids;
+  ASSERT_TRUE(tokenizer.encode(test_text, &ids));
+  std::vector<int> clone_ids;
+  ASSERT_TRUE(clone->encode(test_text, &clone_ids));
+  EXPECT_EQ(clone_ids, ids);
+  EXPECT_EQ(clone->decode(clone_ids, /*skip_special_tokens=*/false), test_text);
+}
+
+TEST(TiktokenTokenizerTest, BatchTest) {
+  TokenizerArgs args;
+  args.vocab_file() = "test.tiktoken";
+  TiktokenTokenizer tokenizer("data", args);
+
+  std::vector<std::string> texts;
+  for (int i = 0; i < 100; ++i) {
+    texts.push_back("Hello, world! " + std::to_string(i) + " 你好，世界！");
+  }
+  std::vector<std::vector<int32_t>> desired_ids(texts.size());
+  for (size_t i = 0; i < texts.size(); ++i) {
+    ASSERT_TRUE(tokenizer.encode(texts[i], &desired_ids[i]));
+  }
+
+  ThreadPool threadpool(4);
+  for (auto* pool : {static_cast<ThreadPool*>(nullptr), &threadpool}) {
+    std::vector<std::vector<int32_t>> ids;
+    ASSERT_TRUE(tokenizer.encode_batch(texts, &ids, pool));
+    EXPECT_EQ(ids, desired_ids);
+    const auto decoded_texts =
+        tokenizer.decode_batch(ids, /*skip_special_tokens=*/false, pool);
+    EXPECT_EQ(decoded_texts, texts);
+  }
+}
+
+TEST(TiktokenTokenizerTest, BinaryVocabTest) {
+  TokenizerArgs args;
+  args.vocab_file() = "test.tiktoken";
+  args.special_tokens() = {{"<|im_start|>", 300}, {"<|im_end|>", 301}};
+  TiktokenTokenizer tokenizer("data", args);
+
+  // convert the vocab into a compiled binary file
+  const auto path =
+      std::filesystem::temp_directory_path() / "test.tiktoken.bin";
+  const auto vocab = BpeVocab::from_file("data/test.tiktoken");
+  ASSERT_NE(vocab, nullptr);
+  ASSERT_TRUE(vocab->save(path.string()));
+
+  TokenizerArgs binary_args = args;
+  binary_args.vocab_file() = path.string();
+  TiktokenTokenizer binary_tokenizer("", binary_args);
+  EXPECT_EQ(binary_tokenizer.vocab_size(), tokenizer.vocab_size());
+
+  const std::string test_text =
+      "<|im_start|>Hello, world! 你好，世界！<|im_end|>";
+  std::vector<int> ids;
+  ASSERT_TRUE(tokenizer.encode(test_text, &ids));
+  std::vector<int> binary_ids;
+  ASSERT_TRUE(binary_tokenizer.encode(test_text, &binary_ids));
+  EXPECT_EQ(binary_ids, ids);
+  EXPECT_EQ(binary_tokenizer.decode(binary_ids, /*skip_special_tokens=*/false),
+            test_text);
+  std::filesystem::remove(path);
+}
+
 }  // namespace llm
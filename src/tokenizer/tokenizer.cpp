@@ -0,0 +1,51 @@
+#include "tokenizer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/threadpool.h"
+
+namespace llm {
+
+bool Tokenizer::encode_batch(const std::vector<std::string>& texts,
+                             std::vector<std::vector<int32_t>>* ids,
+                             ThreadPool* threadpool) const {
+  ids->clear();
+  ids->resize(texts.size());
+  std::atomic<bool> ok{true};
+  auto encode_text = [&](size_t i) {
+    if (!encode(texts[i], &(*ids)[i])) {
+      ok = false;
+    }
+  };
+  if (threadpool == nullptr) {
+    for (size_t i = 0; i < texts.size(); ++i) {
+      encode_text(i);
+    }
+  } else {
+    threadpool->parallel_for(texts.size(), encode_text);
+  }
+  return ok;
+}
+
+std::vector<std::string> Tokenizer::decode_batch(
+    const std::vector<std::vector<int32_t>>& ids,
+    bool skip_special_tokens,
+    ThreadPool* threadpool) const {
+  std::vector<std::string> texts(ids.size());
+  auto decode_ids = [&](size_t i) {
+    texts[i] = decode(ids[i], skip_special_tokens);
+  };
+  if (threadpool == nullptr) {
+    for (size_t i = 0; i < ids.size(); ++i) {
+      decode_ids(i);
+    }
+  } else {
+    threadpool->parallel_for(ids.size(), decode_ids);
+  }
+  return texts;
+}
+
+}  // namespace llm
@@ -9,6 +9,8 @@
 
 namespace llm {
 
+class ThreadPool;
+
 // Fundamentally, Large Language Models (LLM) are designed to generate text
 // based on given prompts. To process text effectively, LLM models typically
 // work with sequences of integers as inputs and produce sequences of integers
@@ -32,6 +34,32 @@ class Tokenizer {
   virtual std::string decode(const Slice<int32_t>& tokens,
                              bool skip_special_tokens) const = 0;
 
+  // decode the token incrementally by appending its bytes to the text, which
+  // may end with a partial utf-8 character. is_first should be initialized to
+  // true at the beginning of the text, where the leading space is removed by
+  // some tokenizers, and is updated by the tokenizer for the next token.
+  // returns false if the tokenizer can't decode tokens one by one, then
+  // decode() over a window of tokens should be used instead.
+  virtual bool decode_token(int32_t /*id*/,
+                            bool /*skip_special_tokens*/,
+                            bool* /*is_first*/,
+                            std::string* /*text*/) const {
+    return false;
+  }
+
+  // encode the texts in parallel on the threadpool, or one by one if the
+  // threadpool is nullptr. returns false if any text fails to encode.
+  virtual bool encode_batch(const std::vector<std::string>& texts,
+                            std::vector<std::vector<int32_t>>* ids,
+                            ThreadPool* threadpool) const;
+
+  // decode the sequences of tokens in parallel on the threadpool, or one by
+  // one if the threadpool is nullptr.
+  virtual std::vector<std::string> decode_batch(
+      const std::vector<std::vector<int32_t>>& ids,
+      bool skip_special_tokens,
+      ThreadPool* threadpool) const;
+
   virtual size_t vocab_size() const = 0;
 
   virtual std::unique_ptr<Tokenizer> clone() const = 0;
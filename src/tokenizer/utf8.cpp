@@ -0,0 +1,92 @@
+#include "utf8.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace llm {
+
+namespace {
+
+// get the length of the utf-8 character from the leading byte, 0 if invalid
+inline size_t utf8_char_len(uint8_t byte) {
+  if (byte < 0x80) {
+    return 1;
+  }
+  if (byte >= 0xC2 && byte <= 0xDF) {
+    return 2;
+  }
+  if (byte >= 0xE0 && byte <= 0xEF) {
+    return 3;
+  }
+  if (byte >= 0xF0 && byte <= 0xF4) {
+    return 4;
+  }
+  return 0;
+}
+
+// check if the byte at index i of the character with the leading byte is
+// valid, which rejects overlong encodings, surrogates and code points above
+// U+10FFFF.
+inline bool is_valid_continuation(uint8_t lead, size_t i, uint8_t byte) {
+  if (i == 1) {
+    switch (lead) {
+      case 0xE0:
+        return byte >= 0xA0 && byte <= 0xBF;
+      case 0xED:
+        return byte >= 0x80 && byte <= 0x9F;
+      case 0xF0:
+        return byte >= 0x90 && byte <= 0xBF;
+      case 0xF4:
+        return byte >= 0x80 && byte <= 0x8F;
+      default:
+        break;
+    }
+  }
+  return (byte & 0xC0) == 0x80;
+}
+
+}  // namespace
+
+size_t append_utf8(const std::string_view& bytes, std::string* text) {
+  size_t pos = 0;
+  size_t start = 0;
+  while (pos < bytes.size()) {
+    const auto lead = static_cast<uint8_t>(bytes[pos]);
+    // fast path for ascii
+    if (lead < 0x80) {
+      ++pos;
+      continue;
+    }
+
+    const size_t len = utf8_char_len(lead);
+    size_t valid_len = 0;
+    if (len > 0) {
+      valid_len = 1;
+      while (valid_len < len && pos + valid_len < bytes.size()) {
+        const auto byte = static_cast<uint8_t>(bytes[pos + valid_len]);
+        if (!is_valid_continuation(lead, valid_len, byte)) {
+          break;
+        }
+        ++valid_len;
+      }
+      if (valid_len == len) {
+        pos += len;
+        continue;
+      }
+      if (pos + valid_len == bytes.size()) {
+        // a partial character at the end
+        break;
+      }
+    }
+    // replace the invalid byte, same as sentencepiece
+    text->append(bytes.data() + start, pos - start);
+    text->append(kReplacementChar);
+    start = ++pos;
+  }
+  text->append(bytes.data() + start, pos - start);
+  return pos;
+}
+
+}  // namespace llm
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace llm {
+
+// utf-8 encoding of U+FFFD, the replacement character for invalid bytes
+inline constexpr char kReplacementChar[] = "\xEF\xBF\xBD";
+
+// append the complete utf-8 characters in the bytes to the text, each invalid
+// byte is replaced with U+FFFD, same as sentencepiece. returns the number of
+// bytes consumed, the rest is a partial character waiting for more bytes.
+size_t append_utf8(const std::string_view& bytes, std::string* text);
+
+}  // namespace llm